@@ -100,11 +100,29 @@ const char*   lmconfig_lmdb_range_str[] = {
 const char*   lmconfig_report_format_str[] = {
                         "column",
                         "csv",
+                        "json",
                         NULL
                       };
 
 #endif
 
+const char*   lmconfig_journal_mode_str[] = {
+                        "default",
+                        "delete",
+                        "truncate",
+                        "persist",
+                        "wal",
+                        NULL
+                      };
+
+const char*   lmconfig_synchronous_str[] = {
+                        "default",
+                        "off",
+                        "normal",
+                        "full",
+                        NULL
+                      };
+
 //
 
 typedef struct _lmconfig_private {
@@ -123,11 +141,14 @@ __lmconfig_alloc(void)
   if ( new_config ) {
     memset(new_config, 0, sizeof(lmconfig_private));
     new_config->public.base_config_path = lmdb_default_conf_file;
+    new_config->public.db_options.busy_timeout = 5000; /* 5 seconds */
 #ifdef LMDB_APPLICATION_CLI
 # ifndef LMDB_DISABLE_RRDTOOL
     new_config->public.should_update_rrds = true;
     new_config->public.rrd_repodir = lmdb_rrd_repodir;
+    new_config->public.rrd_flush_interval = 60; /* 1 minute */
 # endif
+    new_config->public.poll_interval = 5 * 60; /* 5 minutes */
 #endif
 #ifdef LMDB_APPLICATION_NAGIOS_CHECK
     new_config->public.nagios_default_warn = nagios_threshold_make(nagios_threshold_type_fraction, 0.95);
@@ -142,6 +163,13 @@ __lmconfig_alloc(void)
 #endif
 #ifdef LMDB_APPLICATION_LS
     new_config->public.match_id = lmfeature_no_id;
+#endif
+#ifdef LMDB_APPLICATION_RRD_REBUILD
+    new_config->public.rrd_repodir = lmdb_rrd_repodir;
+    new_config->public.rebuild_feature_id = lmfeature_no_id;
+#endif
+#ifdef LMDB_APPLICATION_TSDB
+    new_config->public.export_feature_id = lmfeature_no_id;
 #endif
     new_config->pool = mempool_alloc();
     if ( ! new_config->pool ) {
@@ -159,6 +187,9 @@ __lmconfig_dealloc(
   lmconfig_private    *the_config
 )
 {
+#ifdef LMDB_APPLICATION_CLI
+  if ( the_config->public.lmstat_sources ) free((void*)the_config->public.lmstat_sources);
+#endif
 #ifdef LMDB_APPLICATION_NAGIOS_CHECK
   if ( the_config->public.nagios_rules ) nagios_rules_release(the_config->public.nagios_rules);
 #endif
@@ -257,6 +288,268 @@ __lmconfig_fixup_path(
 
 //
 
+#if defined(LMDB_APPLICATION_CLI) || defined(LMDB_APPLICATION_LOGTAIL)
+
+bool
+__lmconfig_parse_bool(
+  const char    *word,
+  bool          *value
+)
+{
+  if ( !strcasecmp(word, "true") || !strcasecmp(word, "yes") || !strcasecmp(word, "t") || !strcasecmp(word, "y") ) {
+    *value = true;
+    return true;
+  }
+  if ( !strcasecmp(word, "false") || !strcasecmp(word, "no") || !strcasecmp(word, "f") || !strcasecmp(word, "n") ) {
+    *value = false;
+    return true;
+  }
+  return false;
+}
+
+#endif
+
+//
+
+bool
+__lmconfig_parse_interval(
+  const char    *word,
+  int           *interval
+)
+{
+  char          *endp;
+  long          value = strtol(word, &endp, 10);
+  
+  if ( (endp > word) && (value > 0) ) {
+    while ( *endp && isspace(*endp) ) endp++;
+    switch ( *endp ) {
+      case 'd':
+      case 'D':
+        value *= 24;
+      case 'h':
+      case 'H':
+        value *= 60;
+      case 'm':
+      case 'M':
+        value *= 60;
+      case 's':
+      case 'S':
+      case '\0':
+        if ( value <= INT_MAX ) {
+          *interval = value;
+          return true;
+        }
+        break;
+    }
+  }
+  return false;
+}
+
+//
+
+bool
+__lmconfig_parse_msec_interval(
+  const char    *word,
+  int           *interval
+)
+{
+  char          *endp;
+  long          value = strtol(word, &endp, 10);
+  
+  if ( (endp > word) && (value >= 0) ) {
+    while ( *endp && isspace(*endp) ) endp++;
+    if ( ! strcasecmp(endp, "m") ) {
+      value *= 60 * 1000;
+    }
+    else if ( ! strcasecmp(endp, "s") ) {
+      value *= 1000;
+    }
+    else if ( *endp && strcasecmp(endp, "ms") ) {
+      return false;
+    }
+    if ( value <= INT_MAX ) {
+      *interval = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+//
+
+bool
+__lmconfig_parse_size(
+  const char    *word,
+  long long     *size
+)
+{
+  char          *endp;
+  long long     value = strtoll(word, &endp, 10);
+  
+  if ( (endp > word) && (value >= 0) ) {
+    while ( *endp && isspace(*endp) ) endp++;
+    switch ( *endp ) {
+      case 'g':
+      case 'G':
+        value *= 1024;
+      case 'm':
+      case 'M':
+        value *= 1024;
+      case 'k':
+      case 'K':
+        value *= 1024;
+        endp++;
+        if ( (*endp == 'b') || (*endp == 'B') ) endp++;
+        if ( *endp ) break;
+      case '\0':
+        *size = value;
+        return true;
+    }
+  }
+  return false;
+}
+
+//
+
+bool
+__lmconfig_parse_keyword(
+  const char    *word,
+  const char    **keywords,
+  int           *value
+)
+{
+  int           i = 0;
+  
+  while ( keywords[i] ) {
+    if ( ! strcasecmp(word, keywords[i]) ) {
+      *value = i;
+      return true;
+    }
+    i++;
+  }
+  return false;
+}
+
+//
+
+#ifdef LMDB_APPLICATION_CLI
+
+bool
+__lmconfig_lmstat_source_is_equal(
+  const lmstat_source   *s1,
+  const lmstat_source   *s2
+)
+{
+  if ( s1->kind != s2->kind ) return false;
+  switch ( s1->kind ) {
+    case lmstat_interface_kind_static_output:
+      return ( strcmp(s1->interface.static_output, s2->interface.static_output) == 0 );
+    case lmstat_interface_kind_command:
+      return ( strcmp(s1->interface.command, s2->interface.command) == 0 );
+    case lmstat_interface_kind_exec: {
+      char * const  *a1 = s1->interface.exec, * const *a2 = s2->interface.exec;
+      
+      while ( *a1 && *a2 && (strcmp(*a1, *a2) == 0) ) a1++, a2++;
+      return ( ! *a1 && ! *a2 );
+    }
+    default:
+      break;
+  }
+  return true;
+}
+
+//
+
+/*
+ * Parse a source description of the form
+ *
+ *     static-output <path>
+ *     command <command string>
+ *     cmd-and-args <path> {<arg> ..}
+ *
+ * and append it to the list of lmstat sources.  Since the command line is
+ * processed more than once, a source identical to one already in the list
+ * is silently ignored.
+ */
+bool
+__lmconfig_add_lmstat_source(
+  lmconfig_private  *the_config,
+  const char        *line
+)
+{
+  const char        *word;
+  lmstat_source     new_source, *sources;
+  
+  memset(&new_source, 0, sizeof(new_source));
+  if ( str_next_word(&line, the_config->pool, &word) != str_next_word_ok ) {
+    lmlog(lmlog_level_error, "no kind provided for lmstat source");
+    return false;
+  }
+  if ( ! strcasecmp(word, "static-output") ) {
+    if ( str_next_word(&line, the_config->pool, &word) != str_next_word_ok ) {
+      lmlog(lmlog_level_error, "no path provided for static-output lmstat source");
+      return false;
+    }
+    new_source.kind = lmstat_interface_kind_static_output;
+    new_source.interface.static_output = __lmconfig_fixup_path(the_config->pool, word);
+  }
+  else if ( ! strcasecmp(word, "command") ) {
+    if ( str_next_word(&line, the_config->pool, &word) != str_next_word_ok ) {
+      lmlog(lmlog_level_error, "no command string provided for command lmstat source");
+      return false;
+    }
+    new_source.kind = lmstat_interface_kind_command;
+    new_source.interface.command = word;
+  }
+  else if ( ! strcasecmp(word, "cmd-and-args") ) {
+    const char      *savepoint = line;
+    unsigned int    argc = 0;
+    const char*     *argv;
+    
+    while ( str_next_word(&line, NULL, NULL) == str_next_word_ok ) argc++;
+    if ( argc == 0 ) {
+      lmlog(lmlog_level_error, "no command provided for cmd-and-args lmstat source");
+      return false;
+    }
+    argv = mempool_alloc_bytes(the_config->pool, sizeof(const char*) * (argc + 1));
+    if ( ! argv ) {
+      lmlog(lmlog_level_error, "unable to allocate array for lmstat command and args");
+      return false;
+    }
+    new_source.kind = lmstat_interface_kind_exec;
+    new_source.interface.exec = (char * const *)argv;
+    line = savepoint;
+    while ( argc-- ) {
+      if ( str_next_word(&line, the_config->pool, argv++) != str_next_word_ok ) return false;
+    }
+    *argv = NULL;
+  }
+  else {
+    lmlogf(lmlog_level_error, "unknown lmstat source kind: %s", word);
+    return false;
+  }
+  if ( ! new_source.interface.static_output ) return false;
+  
+  sources = the_config->public.lmstat_sources;
+  while ( sources && (sources < the_config->public.lmstat_sources + the_config->public.lmstat_source_count) ) {
+    if ( __lmconfig_lmstat_source_is_equal(sources, &new_source) ) return true;
+    sources++;
+  }
+  sources = realloc(the_config->public.lmstat_sources, sizeof(lmstat_source) * (the_config->public.lmstat_source_count + 1));
+  
+  if ( ! sources ) {
+    lmlog(lmlog_level_error, "unable to allocate space for lmstat source");
+    return false;
+  }
+  sources[the_config->public.lmstat_source_count++] = new_source;
+  the_config->public.lmstat_sources = sources;
+  return true;
+}
+
+#endif
+
+//
+
 lmconfig*
 lmconfig_update_with_file(
   lmconfig      *the_config,
@@ -275,7 +568,8 @@ lmconfig_update_with_file(
     while ( ok && fscanln_get_line(scanner, &line, NULL) ) {
       const char      *param_start, *param_end;
       const char      *word;
-      int             equals;
+      int             equals, keyword;
+      long long       size;
 
       param_start = param_end = NULL;
       equals = 0;
@@ -326,6 +620,126 @@ lmconfig_update_with_file(
           }
         }
 
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "database-journal-mode") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_keyword(word, lmconfig_journal_mode_str, &keyword) ) {
+                lmlogf(lmlog_level_error, "invalid value for database-journal-mode parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              } else {
+                THE_CONFIG->public.db_options.journal_mode = keyword;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for database-journal-mode parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "database-synchronous") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_keyword(word, lmconfig_synchronous_str, &keyword) ) {
+                lmlogf(lmlog_level_error, "invalid value for database-synchronous parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              } else {
+                THE_CONFIG->public.db_options.synchronous = keyword;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for database-synchronous parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "database-cache-size") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_size(word, &size) || (size / 1024 > INT_MAX) ) {
+                lmlogf(lmlog_level_error, "invalid value for database-cache-size parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              } else {
+                THE_CONFIG->public.db_options.cache_size = size / 1024;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for database-cache-size parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "database-mmap-size") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_size(word, &THE_CONFIG->public.db_options.mmap_size) ) {
+                lmlogf(lmlog_level_error, "invalid value for database-mmap-size parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for database-mmap-size parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "database-busy-timeout") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_msec_interval(word, &THE_CONFIG->public.db_options.busy_timeout) ) {
+                lmlogf(lmlog_level_error, "invalid value for database-busy-timeout parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for database-busy-timeout parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "database-checkpoint-interval") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_interval(word, &THE_CONFIG->public.db_options.checkpoint_interval) ) {
+                lmlogf(lmlog_level_error, "invalid value for database-checkpoint-interval parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for database-checkpoint-interval parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
 #ifdef LMDB_APPLICATION_CLI
         else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "license-file") ) {
           switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
@@ -427,6 +841,13 @@ lmconfig_update_with_file(
           }
         }
 
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "lmstat-source") ) {
+          if ( ! __lmconfig_add_lmstat_source(THE_CONFIG, line) ) {
+            lmlogf(lmlog_level_error, "invalid lmstat-source parameter at line %lu\n", fscanln_get_line_number(scanner));
+            ok = false;
+          }
+        }
+
         else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "include") ) {
           size_t      include_path_len = strlen(line);
 
@@ -451,7 +872,66 @@ lmconfig_update_with_file(
           }
         }
 
-# ifndef LMDB_DISABLE_RRDTOOL
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "daemon") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_bool(word, &THE_CONFIG->public.should_run_as_daemon) ) {
+                lmlogf(lmlog_level_error, "invalid value for daemon parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for daemon parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "poll-interval") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_interval(word, &THE_CONFIG->public.poll_interval) ) {
+                lmlogf(lmlog_level_error, "invalid value for poll-interval parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for poll-interval parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "track-checkouts") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_bool(word, &THE_CONFIG->public.should_track_checkouts) ) {
+                lmlogf(lmlog_level_error, "invalid value for track-checkouts parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for track-checkouts parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
+#endif
+
+#if ( defined(LMDB_APPLICATION_CLI) || defined(LMDB_APPLICATION_RRD_REBUILD) ) && ! defined(LMDB_DISABLE_RRDTOOL)
         else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "rrd-repodir") ) {
           switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
             case str_next_word_ok:
@@ -467,7 +947,9 @@ lmconfig_update_with_file(
               break;
           }
         }
-        
+#endif
+
+#if defined(LMDB_APPLICATION_CLI) && ! defined(LMDB_DISABLE_RRDTOOL)
         else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "rrd-updates") ) {
           switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
             case str_next_word_ok:
@@ -492,7 +974,80 @@ lmconfig_update_with_file(
               break;
           }
         }
-# endif
+        
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "rrd-flush-interval") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_interval(word, &THE_CONFIG->public.rrd_flush_interval) ) {
+                lmlogf(lmlog_level_error, "invalid value for rrd-flush-interval parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for rrd-flush-interval parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+#endif
+
+#if defined(LMDB_APPLICATION_CLI) || defined(LMDB_APPLICATION_TSDB)
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "tsdb-path") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              THE_CONFIG->public.tsdb_path = __lmconfig_fixup_path(THE_CONFIG->pool, word);
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for tsdb-path parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+#endif
+
+#ifdef LMDB_APPLICATION_LOGTAIL
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "debug-log") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              THE_CONFIG->public.debug_log_path = __lmconfig_fixup_path(THE_CONFIG->pool, word);
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for debug-log parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
+
+        else if ( __lmconfig_param_cmp(param_start, param_end - param_start, "follow-log") ) {
+          switch ( str_next_word(&line, THE_CONFIG->pool, &word) ) {
+            case str_next_word_ok:
+              if ( ! __lmconfig_parse_bool(word, &THE_CONFIG->public.should_follow) ) {
+                lmlogf(lmlog_level_error, "invalid value for follow-log parameter at line %lu: %s\n", fscanln_get_line_number(scanner), word);
+                ok = false;
+              }
+              break;
+            case str_next_word_none:
+              lmlogf(lmlog_level_error, "no value provided for follow-log parameter at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+            case str_next_word_error:
+              fprintf(stderr, "at line %lu\n", fscanln_get_line_number(scanner));
+              ok = false;
+              break;
+          }
+        }
 #endif
 
 #ifdef LMDB_APPLICATION_NAGIOS_CHECK
@@ -651,6 +1206,13 @@ struct option lmdb_cli_options[] = {
     { "rrd-repodir",            required_argument,      NULL, 'R' },
     { "no-rrd-updates",         no_argument,            NULL, 'u' },
     { "rrd-updates",            no_argument,            NULL, 'U' },
+    { "lmstat-source",          required_argument,      NULL, 'S' },
+    { "daemon",                 no_argument,            NULL, 'D' },
+    { "poll-interval",          required_argument,      NULL, 'p' },
+    { "track-checkouts",        no_argument,            NULL, 'k' },
+    { "compact-counts",         no_argument,            NULL, 'K' },
+    { "rebuild-rollups",        no_argument,            NULL, 'B' },
+    { "tsdb",                   required_argument,      NULL, 'T' },
 #endif
 #ifdef LMDB_APPLICATION_NAGIOS_CHECK
     { "nagios-rules",           required_argument,      NULL, 'r' },
@@ -673,19 +1235,36 @@ struct option lmdb_cli_options[] = {
     { "hide-percentage",        no_argument,            NULL, 'P' },
     { "hide-expire-ts",         no_argument,            NULL, 'E' },
     { "hide-check-ts",          no_argument,            NULL, 'T' },
+    { "tsdb",                   required_argument,      NULL, 0x83 },
 #endif
 #ifdef LMDB_APPLICATION_LS
     { "name-only",              no_argument,            NULL, 'n' },
+    { "json",                   no_argument,            NULL, 'j' },
     { "match-id",               required_argument,      NULL, 'i' },
     { "match-feature",          required_argument,      NULL, 0x80 },
     { "match-vendor",           required_argument,      NULL, 0x81 },
     { "match-version",          required_argument,      NULL, 0x82 },
+#endif
+#ifdef LMDB_APPLICATION_LOGTAIL
+    { "debug-log",              required_argument,      NULL, 'l' },
+    { "follow",                 no_argument,            NULL, 'f' },
+#endif
+#ifdef LMDB_APPLICATION_RRD_REBUILD
+    { "rrd-repodir",            required_argument,      NULL, 'R' },
+    { "match-id",               required_argument,      NULL, 'i' },
+    { "threads",                required_argument,      NULL, 'j' },
+#endif
+#ifdef LMDB_APPLICATION_TSDB
+    { "tsdb",                   required_argument,      NULL, 'T' },
+    { "list",                   no_argument,            NULL, 'l' },
+    { "export-rrd",             required_argument,      NULL, 'x' },
+    { "import",                 no_argument,            NULL, 'I' },
 #endif
     { NULL,                     0,                      NULL, 0 }
   };
 
 #ifdef LMDB_APPLICATION_CLI
-const char *lmdb_cli_option_flags = "hvqtC:d:c:O:e:R:uU";
+const char *lmdb_cli_option_flags = "hvqtC:d:c:O:e:R:uUS:Dp:kKBT:";
 #endif
 
 #ifdef LMDB_APPLICATION_NAGIOS_CHECK
@@ -693,11 +1272,23 @@ const char *lmdb_cli_option_flags = "hvqtC:d:r:w:c:m:";
 #endif
 
 #ifdef LMDB_APPLICATION_REPORT
-const char *lmdb_cli_option_flags = "hvqtC:d:a:r:f:s:e:HFUPET\x80:\x81:\x82:";
+const char *lmdb_cli_option_flags = "hvqtC:d:a:r:f:s:e:HFUPET\x80:\x81:\x82:\x83:";
 #endif
 
 #ifdef LMDB_APPLICATION_LS
-const char *lmdb_cli_option_flags = "hvqtC:d:ni:\x80:\x81:\x82:";
+const char *lmdb_cli_option_flags = "hvqtC:d:nji:\x80:\x81:\x82:";
+#endif
+
+#ifdef LMDB_APPLICATION_LOGTAIL
+const char *lmdb_cli_option_flags = "hvqtC:d:l:f";
+#endif
+
+#ifdef LMDB_APPLICATION_RRD_REBUILD
+const char *lmdb_cli_option_flags = "hvqtC:d:R:i:j:";
+#endif
+
+#ifdef LMDB_APPLICATION_TSDB
+const char *lmdb_cli_option_flags = "hvqtC:d:T:lx:I";
 #endif
 
 void
@@ -737,6 +1328,27 @@ lmconfig_usage(
       "  --lmstat-cmd/-e <command string>       if provided, the given command will be invoked to\n"
       "                                         produce an extended lmstat listing that can be scanned\n"
       "                                         for license usage\n"
+      "  --lmstat-source/-S <source>            add a source of lmstat output; may be used multiple times\n"
+      "                                         and all sources are polled concurrently:\n\n"
+      "                                           <source> = static-output <path>\n"
+      "                                                      command <command string>\n"
+      "                                                      cmd-and-args <path> {<arg> ..}\n\n"
+      "  --daemon/-D                            keep running, polling lmstat at a fixed interval instead\n"
+      "                                         of exiting after a single check\n"
+      "  --poll-interval/-p <time>              time between polls when running with --daemon\n\n"
+      "                                           <time> = <integer>{s|m|h|d}\n\n"
+      "                                         where the unit is optional and defaults to seconds\n"
+      "  --track-checkouts/-k                   record each user's checkouts (from the per-user lines in\n"
+      "                                         the lmstat output) as sessions with start and end times\n"
+      "  --compact-counts/-K                    convert the database's per-poll count rows to runs of\n"
+      "                                         unchanged counts (one row per change) and store only the\n"
+      "                                         changes from then on; new databases always do so\n"
+      "  --rebuild-rollups/-B                   recompute the hourly, daily, and monthly rollups of the\n"
+      "                                         database's counts (from which aggregated reports are\n"
+      "                                         produced) in the local time zone; new databases always\n"
+      "                                         maintain them\n"
+      "  --tsdb/-T <path>                       also add the counts to the time-series store at <path>,\n"
+      "                                         creating it if necessary\n"
 #endif
 #ifdef LMDB_APPLICATION_NAGIOS_CHECK
       "  --max-data-age/-m <time>               if the count data is older than this many seconds, it\n"
@@ -780,7 +1392,8 @@ lmconfig_usage(
       "\n"
       "                                           <range> = none, last_check, hour, day, week, month, year\n"
       "\n"
-      "  --report-format/-f <format>            format for the output:  <format> = column, csv\n"
+      "  --report-format/-f <format>            format for the output:  <format> = column, csv, json\n"
+      "                                         (json writes one object per line and ignores --no-headers)\n"
       "  --start-at/-s <date-time>              only include count checks that happened at or after the given\n"
       "                                         timestamp; <date-time> = 'YYYY-mm-dd{ HH:MM{:SS{±zzzz}}}'\n"
       "  --end-at/-e <date-time>                only include count checks that happened at or before the given\n"
@@ -803,9 +1416,14 @@ lmconfig_usage(
       "  --hide-percentage/-P                   exclude the usage percents from the output report\n"
       "  --hide-expire-ts/-E                    exclude the expiration timestamps from the output report\n"
       "  --hide-check-ts/-T                     exclude the check timestamps from the output report\n"
+      "  --tsdb <path>                          report from the consolidated counts in the time-series\n"
+      "                                         store at <path> rather than the database's counts; the\n"
+      "                                         database still provides the features\n"
 #endif
 #ifdef LMDB_APPLICATION_LS
       "  --name-only/-n                         suppress the display of vendor and version\n"
+      "  --json/-j                              display each feature as a JSON object on a line of\n"
+      "                                         its own\n"
       "  --match-id/-i <#>                      show the feature with the given numerical id\n"
       "  --match-feature <pattern>              only show features with the given identity; the <pattern>\n"
       "                                         can be:\n"
@@ -819,6 +1437,31 @@ lmconfig_usage(
       "                                         the <pattern> works the same as for --match-feature\n"
       "  --match-version <pattern>              only show features with the given version;  the\n"
       "                                         <pattern> works the same as for --match-feature\n"
+#endif
+#ifdef LMDB_APPLICATION_LOGTAIL
+      "  --debug-log/-l <path>                  the license server debug log to ingest; OUT and IN lines\n"
+      "                                         update the in-use counts and DENIED and UNSUPPORTED lines\n"
+      "                                         are recorded as denials.  The position reached is saved in\n"
+      "                                         the database, so each run resumes where the last stopped\n"
+      "  --follow/-f                            keep running after reaching the end of the log, ingesting\n"
+      "                                         lines as they are written\n"
+#endif
+#ifdef LMDB_APPLICATION_RRD_REBUILD
+      "  --rrd-repodir/-R <path>                the directory containing the RRD files to rebuild\n"
+      "  --match-id/-i <#>                      rebuild only the RRD file of the feature with the given\n"
+      "                                         numerical id\n"
+      "  --threads/-j <#>                       number of threads rebuilding RRD files (default: one per\n"
+      "                                         online CPU)\n"
+#endif
+#ifdef LMDB_APPLICATION_TSDB
+      "  --tsdb/-T <path>                       the time-series store to work with\n"
+      "  --list/-l                              list the id and last update time of each feature in the\n"
+      "                                         store\n"
+      "  --export-rrd/-x <#>                    write the consolidated counts of the feature with the\n"
+      "                                         given numerical id as an rrdtool XML dump (which\n"
+      "                                         'rrdtool restore' turns into an RRD file)\n"
+      "  --import/-I                            add the database's counts to the store; counts at or\n"
+      "                                         before a feature's last update are skipped\n"
 #endif
       "\n"
       "  By default, a configuration file at\n\n"
@@ -832,6 +1475,10 @@ lmconfig_usage(
       "  feature.  The rrd files are named according to the feature id and can be found in:\n\n"
       "     %s\n\n"
 # endif
+#endif
+#ifdef LMDB_APPLICATION_RRD_REBUILD
+      "  The rrd files are named according to the feature id; by default they are rebuilt in:\n\n"
+      "     %s\n\n"
 #endif
       ,
       lmdb_version_str,
@@ -995,6 +1642,52 @@ lmconfig_update_with_options(
         break;
       }
 # endif
+
+      case 'S': {
+        if ( optarg && *optarg ) {
+          if ( ! __lmconfig_add_lmstat_source(THE_CONFIG, optarg) ) {
+            lmlogf(lmlog_level_error, "invalid lmstat source: %s\n", optarg);
+            __lmconfig_dealloc(THE_CONFIG);
+            return NULL;
+          }
+        } else {
+          lmlog(lmlog_level_error, "no value provided to --lmstat-source/-S option\n");
+          __lmconfig_dealloc(THE_CONFIG);
+          return NULL;
+        }
+        break;
+      }
+
+      case 'D':
+        THE_CONFIG->public.should_run_as_daemon = true;
+        break;
+
+      case 'p': {
+        if ( optarg && *optarg ) {
+          if ( ! __lmconfig_parse_interval(optarg, &THE_CONFIG->public.poll_interval) ) {
+            lmlogf(lmlog_level_error, "invalid poll interval: %s\n", optarg);
+            __lmconfig_dealloc(THE_CONFIG);
+            return NULL;
+          }
+        } else {
+          lmlog(lmlog_level_error, "no value provided to --poll-interval/-p option\n");
+          __lmconfig_dealloc(THE_CONFIG);
+          return NULL;
+        }
+        break;
+      }
+
+      case 'k':
+        THE_CONFIG->public.should_track_checkouts = true;
+        break;
+
+      case 'K':
+        THE_CONFIG->public.should_compact_counts = true;
+        break;
+
+      case 'B':
+        THE_CONFIG->public.should_rebuild_rollups = true;
+        break;
 #endif
 #ifdef LMDB_APPLICATION_NAGIOS_CHECK
 
@@ -1282,6 +1975,10 @@ lmconfig_update_with_options(
         THE_CONFIG->public.name_only = true;
         break;
       
+      case 'j':
+        THE_CONFIG->public.as_json = true;
+        break;
+      
       case 'i': {
         if ( optarg && *optarg ) {
           char      *endp;
@@ -1335,6 +2032,149 @@ lmconfig_update_with_options(
         break;
       }
 
+#endif
+
+#ifdef LMDB_APPLICATION_LOGTAIL
+
+      case 'l': {
+        if ( optarg && *optarg ) {
+          THE_CONFIG->public.debug_log_path = __lmconfig_fixup_path(THE_CONFIG->pool, optarg);
+        } else {
+          lmlog(lmlog_level_error, "no value provided to --debug-log option\n");
+          __lmconfig_dealloc(THE_CONFIG);
+          return NULL;
+        }
+        break;
+      }
+      
+      case 'f':
+        THE_CONFIG->public.should_follow = true;
+        break;
+
+#endif
+
+#ifdef LMDB_APPLICATION_RRD_REBUILD
+
+      case 'R': {
+        if ( optarg && *optarg ) {
+          const char    *path = __lmconfig_fixup_path(THE_CONFIG->pool, optarg);
+
+          if ( path == optarg ) path = mempool_strdup(THE_CONFIG->pool, optarg);
+          if ( path ) {
+            THE_CONFIG->public.rrd_repodir = path;
+          } else {
+            lmlog(lmlog_level_error, "unable to allocate space for RRD repository directory\n");
+            __lmconfig_dealloc(THE_CONFIG);
+            return NULL;
+          }
+        } else {
+          lmlog(lmlog_level_error, "no directory path provided to --rrd-repodir/-R option\n");
+          __lmconfig_dealloc(THE_CONFIG);
+          return NULL;
+        }
+        break;
+      }
+
+      case 'i': {
+        if ( optarg && *optarg ) {
+          char      *endp;
+          long      value = strtol(optarg, &endp, 10);
+          
+          if ( (value > 0) && (value < INT_MAX) && (endp > optarg) ) {
+            THE_CONFIG->public.rebuild_feature_id = value;
+          } else {
+            lmlogf(lmlog_level_error, "invalid argument to --match-id:  %s\n", optarg);
+            __lmconfig_dealloc(THE_CONFIG);
+            return NULL;
+          }
+        } else {
+          lmlog(lmlog_level_error, "no value provided to --match-id option\n");
+          __lmconfig_dealloc(THE_CONFIG);
+          return NULL;
+        }
+        break;
+      }
+
+      case 'j': {
+        if ( optarg && *optarg ) {
+          char      *endp;
+          long      value = strtol(optarg, &endp, 10);
+          
+          if ( (value > 0) && (value <= 1024) && (endp > optarg) && (*endp == '\0') ) {
+            THE_CONFIG->public.rebuild_thread_count = value;
+          } else {
+            lmlogf(lmlog_level_error, "invalid argument to --threads:  %s\n", optarg);
+            __lmconfig_dealloc(THE_CONFIG);
+            return NULL;
+          }
+        } else {
+          lmlog(lmlog_level_error, "no value provided to --threads option\n");
+          __lmconfig_dealloc(THE_CONFIG);
+          return NULL;
+        }
+        break;
+      }
+
+#endif
+
+#if defined(LMDB_APPLICATION_CLI) || defined(LMDB_APPLICATION_REPORT) || defined(LMDB_APPLICATION_TSDB)
+
+# ifdef LMDB_APPLICATION_REPORT
+      case 0x83: {
+# else
+      case 'T': {
+# endif
+        if ( optarg && *optarg ) {
+          const char    *path = __lmconfig_fixup_path(THE_CONFIG->pool, optarg);
+
+          if ( path == optarg ) path = mempool_strdup(THE_CONFIG->pool, optarg);
+          if ( path ) {
+            THE_CONFIG->public.tsdb_path = path;
+          } else {
+            lmlog(lmlog_level_error, "unable to allocate space for time-series store path\n");
+            __lmconfig_dealloc(THE_CONFIG);
+            return NULL;
+          }
+        } else {
+          lmlog(lmlog_level_error, "no file path provided to --tsdb option\n");
+          __lmconfig_dealloc(THE_CONFIG);
+          return NULL;
+        }
+        break;
+      }
+
+#endif
+
+#ifdef LMDB_APPLICATION_TSDB
+
+      case 'l':
+        THE_CONFIG->public.should_list_features = true;
+        break;
+
+      case 'x': {
+        if ( optarg && *optarg ) {
+          char      *endp;
+          long      value = strtol(optarg, &endp, 10);
+          
+          if ( (value > 0) && (value < INT_MAX) && (endp > optarg) && (*endp == '\0') ) {
+            THE_CONFIG->public.export_feature_id = value;
+          } else {
+            lmlogf(lmlog_level_error, "invalid argument to --export-rrd:  %s\n", optarg);
+            __lmconfig_dealloc(THE_CONFIG);
+            return NULL;
+          }
+        } else {
+          lmlog(lmlog_level_error, "no value provided to --export-rrd option\n");
+          __lmconfig_dealloc(THE_CONFIG);
+          return NULL;
+        }
+        break;
+      }
+
+      case 'I':
+        THE_CONFIG->public.should_import_counts = true;
+        break;
+
 #endif
 
     }
@@ -21,11 +21,10 @@
 #endif
 
 /*
- * The report utility uses report parameters:
+ * All utilities use the database connection options; the report utility
+ * also uses report parameters:
  */
-#ifdef LMDB_APPLICATION_REPORT
-# include "lmdb.h"
-#endif
+#include "lmdb.h"
 
 #ifndef LMDB_DISABLE_RRDTOOL
 extern const char   *lmdb_rrd_repodir;
@@ -88,6 +87,21 @@ typedef enum {
   lmstat_interface_kind_command,
   lmstat_interface_kind_exec
 } lmstat_interface_kind;
+
+/*!
+	@typedef lmstat_source
+	A single source of lmstat output:  the kind of interface and the
+	file path, command string, or command-and-arguments array that goes
+	with it (see the lmstat_interface field of lmconfig).
+*/
+typedef struct {
+  lmstat_interface_kind   kind;
+  union {
+    const char    *static_output;
+    const char    *command;
+    char * const  *exec;
+  } interface;
+} lmstat_source;
 #endif
 
 #ifdef LMDB_APPLICATION_REPORT
@@ -98,6 +112,7 @@ typedef enum {
 typedef enum {
   report_format_column = 0,
   report_format_csv,
+  report_format_json,
   //
   report_format_max
 } report_format;
@@ -137,6 +152,12 @@ typedef unsigned int field_selection;
 		license_db_path
 			Filesystem path of the SQLite database file containing
 			the feature definitions and counts to be used
+    
+    db_options
+      Tuning applied to the database connection when it is opened
+      (journaling mode, synchronous level, cache and mmap sizes, busy
+      timeout, checkpoint interval); the busy timeout defaults to 5
+      seconds and everything else to SQLite's defaults
 		
 	lmdb_cli options
 	================
@@ -168,9 +189,39 @@ typedef unsigned int field_selection;
 					executable path) that will be forked and executed using
 					execve() to generate lmstat output to scan
       
+    lmstat_source_count, lmstat_sources
+      Additional lmstat sources (e.g. one per license server); every
+      source -- including the one described by lmstat_interface, if
+      set -- is polled concurrently and the counts from all of them
+      are combined
+      
     rrd_repodir
       Directory that contains RRD files for the features; only
       present if the library is compiled with RRD support enabled
+
+    rrd_flush_interval
+      number of seconds between applications of the RRD journal to the
+      RRD files when running as a daemon; defaults to 60.  A single check
+      applies the journal as it exits.  Only present if the library is
+      compiled with RRD support enabled
+    
+    should_run_as_daemon
+      if true, the program does not exit after a single check but keeps
+      the database open and polls lmstat every poll_interval seconds
+      until it receives SIGTERM or SIGINT
+    
+    poll_interval
+      number of seconds between the start of successive polls when
+      running as a daemon; defaults to 300
+    
+    should_track_checkouts
+      if true, the per-user checkout lines in the lmstat output are
+      parsed and each checkout is recorded in the database as a
+      session with a start and end time
+    
+    tsdb_path
+      path of a time-series store to which committed counts are also
+      added; defaults to NULL (none)
 		
 	lmdb_nagios_check options
 	=========================
@@ -212,7 +263,9 @@ typedef unsigned int field_selection;
       the report; default is all fields except the feature_id
     
     report_format
-      output format for the report; defaults to report_format_column
+      output format for the report; defaults to report_format_column.  The
+      report_format_json format writes one JSON object per row
+      (newline-delimited JSON)
       
     checked_time
       an array of two Unix timestamps, (start, end), that limit the starting
@@ -227,6 +280,10 @@ typedef unsigned int field_selection;
       
     match_version
       pattern string used to limit which versions are chosen for the report
+    
+    tsdb_path
+      path of a time-series store from which the report's counts are read
+      instead of the database; defaults to NULL (none)
   
   ls
   ==
@@ -234,6 +291,9 @@ typedef unsigned int field_selection;
     name_only
       only display the name of the feature, not the vendor and version
       
+    as_json
+      display each feature as a JSON object on a line of its own
+      
     match_id
       a specific feature id to find
       
@@ -245,13 +305,54 @@ typedef unsigned int field_selection;
       
     match_version
       pattern string used to limit which versions are shown
+  
+  lmdb_logtail
+  ============
+  
+    debug_log_path
+      path to the license server debug log to ingest
+      
+    should_follow
+      if true, the program does not exit when it reaches the end of the
+      log but waits for more lines to be written (following the log across
+      rotation) until it receives SIGTERM or SIGINT
+  
+  lmdb_rrd_rebuild
+  ================
+  
+    rrd_repodir
+      directory that contains the RRD files to rebuild
+    
+    rebuild_feature_id
+      a specific feature id whose RRD file is rebuilt; defaults to
+      lmfeature_no_id (every feature)
+    
+    rebuild_thread_count
+      number of threads rebuilding RRD files; defaults to 0 (one per
+      online CPU)
+  
+  lmdb_tsdb
+  =========
+  
+    tsdb_path
+      path of the time-series store to work with
+    
+    should_list_features
+      if true, the features in the store are listed
+    
+    export_feature_id
+      a specific feature id whose consolidated counts are written as an
+      rrdtool XML dump; defaults to lmfeature_no_id (none)
+    
+    should_import_counts
+      if true, the database's counts are added to the store
       
 */
 typedef struct _lmconfig {
 	// options common to all programs:
   const char              *base_config_path;
   const char              *license_db_path;
-
+  lmdb_options            db_options;
   
 #ifdef LMDB_APPLICATION_CLI
   // options specific to lmdb_cli:
@@ -262,10 +363,19 @@ typedef struct _lmconfig {
     const char    *command;
     char * const  *exec;
   } lmstat_interface;
+  unsigned int            lmstat_source_count;
+  lmstat_source           *lmstat_sources;
 # ifndef LMDB_DISABLE_RRDTOOL
   bool                    should_update_rrds;
   const char              *rrd_repodir;
+  int                     rrd_flush_interval;
 # endif
+  bool                    should_run_as_daemon;
+  int                     poll_interval;
+  bool                    should_track_checkouts;
+  bool                    should_compact_counts;
+  bool                    should_rebuild_rollups;
+  const char              *tsdb_path;
 #endif
 
 #ifdef LMDB_APPLICATION_NAGIOS_CHECK
@@ -286,17 +396,40 @@ typedef struct _lmconfig {
   const char                    *match_feature;
   const char                    *match_vendor;
   const char                    *match_version;
+  const char                    *tsdb_path;
 #endif
 
 #ifdef LMDB_APPLICATION_LS
 	// options specific to lmdb_ls:
   bool                          name_only;
+  bool                          as_json;
   int                           match_id;
   const char                    *match_feature;
   const char                    *match_vendor;
   const char                    *match_version;
 #endif
 
+#ifdef LMDB_APPLICATION_LOGTAIL
+	// options specific to lmdb_logtail:
+  const char                    *debug_log_path;
+  bool                          should_follow;
+#endif
+
+#ifdef LMDB_APPLICATION_RRD_REBUILD
+	// options specific to lmdb_rrd_rebuild:
+  const char                    *rrd_repodir;
+  int                           rebuild_feature_id;
+  int                           rebuild_thread_count;
+#endif
+
+#ifdef LMDB_APPLICATION_TSDB
+	// options specific to lmdb_tsdb:
+  const char                    *tsdb_path;
+  bool                          should_list_features;
+  int                           export_feature_id;
+  bool                          should_import_counts;
+#endif
+
 } lmconfig;
 
 /*!
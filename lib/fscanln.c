@@ -10,6 +10,9 @@
 #include "mempool.h"
 #include "lmlog.h"
 
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 
 //
@@ -19,7 +22,8 @@ enum {
   fscanln_flags_should_use_pclose_on_dealloc = 1 << 1,
   fscanln_flags_should_use_waitpid_on_dealloc = 1 << 2,
   fscanln_flags_is_regex_present = 1 << 3,
-  fscanln_flags_is_regex_enabled = 1 << 4
+  fscanln_flags_is_regex_enabled = 1 << 4,
+  fscanln_flags_is_following = 1 << 5
 };
 
 typedef struct _fscanln {
@@ -39,18 +43,46 @@ typedef struct _fscanln {
   const char*     *sub_match_strings;
   mempool_ref     string_pool;
   
-  bool            is_internal_buffer;
+  int             fd_src;
+  bool            is_eof;
+  
+  /*
+   * Offset of the first byte read from fd_src and the total number of
+   * bytes read since, so the offset of the next line can be reported:
+   */
+  off_t           base_offset;
+  off_t           bytes_read;
+  
+  /*
+   * Regular files are mapped into memory and lines are returned as
+   * pointers into the mapping; map_offset is the start of the next line.
+   */
+  const char      *map_base;
+  size_t          map_length;
+  size_t          map_offset;
+  
+  /*
+   * Otherwise, data is read from fd_src in blocks.  The unconsumed bytes
+   * are buffer[data_start, data_end); lines are returned in-place with a
+   * NUL written after them.  If that NUL overwrote the first byte of the
+   * next line, the byte is held in saved_char until the next fill.  The
+   * buffer is also where continued lines from a mapping are joined.
+   */
   char            *buffer;
-  size_t          buffer_length;
   size_t          buffer_capacity;
+  size_t          data_start, data_end;
+  int             saved_char;
+  
+  /*
+   * The current line; it is only NUL-terminated if is_line_terminated.
+   */
+  const char      *line;
+  size_t          line_length;
+  bool            is_line_terminated;
 } fscanln;
 
-#ifndef FSCANLN_INTERNAL_BUFFER_CAPACITY
-#define FSCANLN_INTERNAL_BUFFER_CAPACITY  (4096 - sizeof(fscanln))
-#endif
-
-#ifndef FSCANLN_INTERNAL_BUFFER_DELTA
-#define FSCANLN_INTERNAL_BUFFER_DELTA     4096
+#ifndef FSCANLN_BUFFER_CAPACITY
+#define FSCANLN_BUFFER_CAPACITY           65536
 #endif
 
 //
@@ -58,7 +90,7 @@ typedef struct _fscanln {
 fscanln*
 __fscanln_alloc(void)
 {
-  fscanln       *new_obj = malloc(sizeof(fscanln) + FSCANLN_INTERNAL_BUFFER_CAPACITY);
+  fscanln       *new_obj = malloc(sizeof(fscanln));
   
   if ( new_obj ) {
     new_obj->ref_count            = 1;
@@ -73,10 +105,28 @@ __fscanln_alloc(void)
     new_obj->sub_match_strings    = NULL;
     new_obj->string_pool          = mempool_alloc();
     
-    new_obj->is_internal_buffer   = true;
-    new_obj->buffer               = (char*)((void*)new_obj + sizeof(fscanln));
-    new_obj->buffer_length        = 0;
-    new_obj->buffer_capacity      = FSCANLN_INTERNAL_BUFFER_CAPACITY;
+    new_obj->fd_src               = -1;
+    new_obj->is_eof               = false;
+    new_obj->base_offset          = new_obj->bytes_read = 0;
+    
+    new_obj->buffer               = malloc(FSCANLN_BUFFER_CAPACITY);
+    new_obj->buffer_capacity      = FSCANLN_BUFFER_CAPACITY;
+    new_obj->data_start           = new_obj->data_end = 0;
+    new_obj->saved_char           = -1;
+    
+    new_obj->map_base             = NULL;
+    new_obj->map_length           = new_obj->map_offset = 0;
+    
+    new_obj->line                 = NULL;
+    new_obj->line_length          = 0;
+    new_obj->is_line_terminated   = false;
+    
+    if ( ! new_obj->buffer || ! new_obj->string_pool ) {
+      if ( new_obj->buffer ) free((void*)new_obj->buffer);
+      if ( new_obj->string_pool ) mempool_dealloc(new_obj->string_pool);
+      free((void*)new_obj);
+      new_obj = NULL;
+    }
   }
   return new_obj;
 }
@@ -117,7 +167,8 @@ __fscanln_dealloc(
 )
 {
   if ( f ) {
-    if ( f->buffer && ! f->is_internal_buffer ) free((void*)f->buffer);
+    if ( f->buffer ) free((void*)f->buffer);
+    if ( f->map_base ) munmap((void*)f->map_base, f->map_length);
     if ( __fscanln_get_flags(f, fscanln_flags_is_regex_present) ) regfree(&f->line_regex);
     if ( f->sub_matches ) free((void*)f->sub_matches);
     if ( f->sub_match_strings ) free((void*)f->sub_match_strings);
@@ -158,7 +209,7 @@ __fscanln_clear_sub_matches(
   }
   if ( f->string_pool ) mempool_reset(f->string_pool);
   if ( f->sub_match_strings ) {
-    int         i = 0;
+    size_t      i = 0;
     
     while ( i < f->sub_match_max ) f->sub_match_strings[i++] = NULL;
   }
@@ -184,7 +235,7 @@ __fscanln_set_regex(
   rc = regcomp(&f->line_regex, regex, regex_flags);
   if ( rc != 0 ) return false;
   
-  if ( sub_match_max > f->sub_match_max ) {
+  if ( (sub_match_max > 0) && ((size_t)sub_match_max > f->sub_match_max) ) {
     void        *p = realloc(f->sub_matches, sub_match_max * sizeof(regmatch_t));
     void        *s = realloc(f->sub_match_strings, sub_match_max * sizeof(const char*));
     
@@ -214,89 +265,263 @@ __fscanln_grow(
   fscanln     *f
 )
 {
-  bool          ok = false;
+  /* Double the capacity so that very long lines cost amortized O(1) per byte: */
+  size_t        l = 2 * f->buffer_capacity;
+  char          *p = realloc(f->buffer, l);
+  
+  if ( ! p ) {
+    lmlogf(lmlog_level_warn, "fscanln: failure to grow scanner buffer (errno = %d)", errno);
+    return false;
+  }
+  f->buffer = p;
+  f->buffer_capacity = l;
+  return true;
+}
+
+//
+
+bool
+__fscanln_read(
+  fscanln     *f
+)
+{
+  ssize_t       n;
   
-  if ( f->is_internal_buffer ) {
-    /* Allocate externally: */
-    size_t      l = 2 * FSCANLN_INTERNAL_BUFFER_DELTA;
-    char        *p = malloc(l);
+  /* Always leave room for the NUL terminator: */
+  if ( f->data_end + 1 >= f->buffer_capacity ) {
+    if ( ! __fscanln_grow(f) ) return false;
+  }
+  do {
+    n = read(f->fd_src, f->buffer + f->data_end, f->buffer_capacity - 1 - f->data_end);
+  } while ( (n < 0) && (errno == EINTR) );
+  if ( n < 0 ) {
+    lmlogf(lmlog_level_warn, "fscanln: read failed (errno = %d)", errno);
+    f->is_eof = true;
+  } else if ( n == 0 ) {
+    f->is_eof = true;
+  } else {
+    f->data_end += n;
+    f->bytes_read += n;
+  }
+  return true;
+}
+
+//
+
+bool
+__fscanln_fill(
+  fscanln     *f
+)
+{
+  size_t        out, scan;
+  bool          is_following = __fscanln_get_flags(f, fscanln_flags_is_following);
+  
+  /* Put back the byte the previous line's NUL terminator displaced: */
+  if ( f->saved_char >= 0 ) {
+    f->buffer[f->data_start] = (char)f->saved_char;
+    f->saved_char = -1;
+  }
+  
+  /* A following scanner tries the descriptor again for appended data: */
+  if ( is_following ) f->is_eof = false;
+  if ( f->is_eof && (f->data_start == f->data_end) ) return false;
+  
+  f->line_number += f->line_number_inc;
+  f->line_number_inc = 1;
+  
+  /*
+   * buffer[data_start, out) is the line so far; buffer[scan, data_end)
+   * has not yet been examined.  The two only differ once a continuation
+   * has been joined, after which bytes are shifted down to close the gap.
+   */
+  out = scan = f->data_start;
+  while ( 1 ) {
+    char        *nl = ( scan < f->data_end ) ? memchr(f->buffer + scan, '\n', f->data_end - scan) : NULL;
     
-    if ( p ) {
-      memcpy(p, f->buffer, f->buffer_length);
-      f->buffer = p;
-      f->is_internal_buffer = false;
-      f->buffer_capacity = l;
-      ok = true;
-    } else {
-      lmlogf(lmlog_level_warn, "fscanln: failure to externally-allocate scanner buffer (errno = %d)", errno);
+    if ( nl ) {
+      size_t    seg_len = (nl - f->buffer) + 1 - scan;
+      
+      if ( out != scan ) memmove(f->buffer + out, f->buffer + scan, seg_len);
+      out += seg_len;
+      scan += seg_len;
+      if ( ! is_following && (out - f->data_start >= 2) && (f->buffer[out - 2] == '\\') ) {
+        // Drop the backslash and the newline, keep adding
+        // next line from the file:
+        f->buffer[out - 2] = ' ';
+        out--;
+        f->line_number_inc++;
+        continue;
+      }
+      break;
     }
-  } else {
-    /* Reallocate: */
-    size_t      l = f->buffer_capacity + FSCANLN_INTERNAL_BUFFER_DELTA;
-    char        *p = realloc(f->buffer, l);
     
-    if ( p ) {
-      f->buffer = p;
-      f->buffer_capacity = l;
-      ok = true;
-    } else {
-      lmlogf(lmlog_level_warn, "fscanln: failure to grow scanner buffer (errno = %d)", errno);
+    /* No newline in what's buffered:  the rest belongs to this line. */
+    if ( out != scan ) memmove(f->buffer + out, f->buffer + scan, f->data_end - scan);
+    out += f->data_end - scan;
+    scan = f->data_end = out;
+    if ( f->is_eof ) {
+      //
+      // When following, an unterminated line is still being written:  leave
+      // it buffered and report no line until its newline arrives:
+      //
+      if ( is_following ) {
+        f->line_number--;
+        return false;
+      }
+      break;
     }
+    
+    /* Slide the partial line to the front of the buffer and read more: */
+    if ( f->data_start > 0 ) {
+      memmove(f->buffer, f->buffer + f->data_start, out - f->data_start);
+      out -= f->data_start;
+      scan = f->data_end = out;
+      f->data_start = 0;
+    }
+    if ( ! __fscanln_read(f) ) return false;
   }
-  return ok;
+  if ( out == f->data_start ) return false;
+  
+  f->line = f->buffer + f->data_start;
+  f->line_length = out - f->data_start;
+  f->is_line_terminated = true;
+  if ( (out == scan) && (out < f->data_end) ) f->saved_char = (unsigned char)f->buffer[out];
+  f->buffer[out] = '\0';
+  f->data_start = scan;
+  return true;
 }
 
 //
 
 bool
-__fscanln_append_char(
+__fscanln_reserve(
   fscanln     *f,
-  char          c
+  size_t        length
 )
 {
-  if ( f->buffer_length == f->buffer_capacity ) {
+  while ( length > f->buffer_capacity ) {
     if ( ! __fscanln_grow(f) ) return false;
   }
-  f->buffer[f->buffer_length++] = c;
   return true;
 }
 
 //
 
 bool
-__fscanln_fill(
+__fscanln_fill_mapped(
   fscanln     *f
 )
 {
-  int           prev_c = -1;
-  bool          exit_loop = false;
+  const char    *base = f->map_base;
+  size_t        start = f->map_offset, end;
+  const char    *nl;
   
-  if ( feof(f->fptr_src) ) return false;
+  if ( start >= f->map_length ) return false;
   
   f->line_number += f->line_number_inc;
   f->line_number_inc = 1;
-  f->buffer_length = 0;
   
-  while ( ! exit_loop && ! feof(f->fptr_src) ) {
-    int         c = fgetc(f->fptr_src);
+  nl = memchr(base + start, '\n', f->map_length - start);
+  end = nl ? (size_t)(nl - base) + 1 : f->map_length;
+  if ( ! nl || (end - start < 2) || (base[end - 2] != '\\') ) {
+    /* The common case:  the line is returned straight from the mapping. */
+    f->line = base + start;
+    f->line_length = end - start;
+    f->is_line_terminated = false;
+    f->map_offset = end;
+    return true;
+  }
+  
+  /* A continued line must be joined in the buffer: */
+  f->line_length = 0;
+  while ( 1 ) {
+    size_t      seg_len = end - start;
     
-    if ( c == EOF ) break;
+    if ( ! __fscanln_reserve(f, f->line_length + seg_len + 1) ) return false;
+    memcpy(f->buffer + f->line_length, base + start, seg_len);
+    f->line_length += seg_len;
+    start = end;
+    if ( ! nl || (f->line_length < 2) || (f->buffer[f->line_length - 2] != '\\') ) break;
     
-    else if ( c == '\n' ) {
-      if ( prev_c != '\\' ) {
-        exit_loop = true;
-      } else {
-        // Drop the backslash and the newline, keep adding
-        // next line from the file:
-        f->line_number_inc++;
-        f->buffer_length--;
-        c = ' ';
-      }
+    // Drop the backslash and the newline, keep adding
+    // next line from the file:
+    f->buffer[f->line_length - 2] = ' ';
+    f->line_length--;
+    f->line_number_inc++;
+    if ( start >= f->map_length ) break;
+    nl = memchr(base + start, '\n', f->map_length - start);
+    end = nl ? (size_t)(nl - base) + 1 : f->map_length;
+  }
+  f->buffer[f->line_length] = '\0';
+  f->line = f->buffer;
+  f->is_line_terminated = true;
+  f->map_offset = start;
+  return true;
+}
+
+//
+
+bool
+__fscanln_next_line(
+  fscanln     *f
+)
+{
+  return f->map_base ? __fscanln_fill_mapped(f) : __fscanln_fill(f);
+}
+
+//
+
+bool
+__fscanln_terminate_line(
+  fscanln     *f
+)
+{
+  if ( ! f->is_line_terminated ) {
+    if ( ! __fscanln_reserve(f, f->line_length + 1) ) return false;
+    memcpy(f->buffer, f->line, f->line_length);
+    f->buffer[f->line_length] = '\0';
+    f->line = f->buffer;
+    f->is_line_terminated = true;
+  }
+  return true;
+}
+
+//
+
+bool
+__fscanln_line_matches_regex(
+  fscanln     *f
+)
+{
+#ifdef REG_STARTEND
+  regmatch_t    whole_line;
+  regmatch_t    *matches = f->sub_match_max ? f->sub_matches : &whole_line;
+  
+  /* The line need not be NUL-terminated: */
+  matches[0].rm_so = 0;
+  matches[0].rm_eo = f->line_length;
+  return ( regexec(&f->line_regex, f->line, f->sub_match_max ? f->sub_match_max : 1, matches, REG_STARTEND) == 0 );
+#else
+  if ( ! __fscanln_terminate_line(f) ) return false;
+  return ( regexec(&f->line_regex, f->line, f->sub_match_max, f->sub_matches, 0) == 0 );
+#endif
+}
+
+//
+
+bool
+__fscanln_next_matching_line(
+  fscanln     *f
+)
+{
+  if ( __fscanln_get_flags(f, fscanln_flags_is_regex_present | fscanln_flags_is_regex_enabled) ) {
+    __fscanln_clear_sub_matches(f);
+    while ( __fscanln_next_line(f) ) {
+      if ( __fscanln_line_matches_regex(f) ) return true;
     }
-    prev_c = c;
-    if ( ! __fscanln_append_char(f, c) ) return false;
+    return false;
   }
-  return __fscanln_append_char(f, '\0');
+  return __fscanln_next_line(f);
 }
 
 //
@@ -314,7 +539,21 @@ fscanln_create(
   fscanln   *new_scanner = __fscanln_alloc(); 
   
   if ( new_scanner ) {
+    off_t     offset = ftello(fptr);
+    
     new_scanner->fptr_src = fptr;
+    new_scanner->fd_src = fileno(fptr);
+    
+    //
+    // The stream may have buffered data beyond what its caller consumed;
+    // moving the descriptor back to the stream's position ensures those
+    // bytes get scanned.  A stream that cannot seek must be unread:
+    //
+    if ( (offset >= 0) && (lseek(new_scanner->fd_src, offset, SEEK_SET) == offset) ) {
+      new_scanner->base_offset = offset;
+    } else {
+      new_scanner->base_offset = 0;
+    }
     if ( should_close_on_dealloc ) __fscanln_set_flags(new_scanner, fscanln_flags_should_close_on_dealloc, true);
   } else {
     lmlog(lmlog_level_warn, "fscanln:  unable to allocate a new scanner");
@@ -336,6 +575,28 @@ fscanln_create_with_file(
     new_scanner = fscanln_create(fptr, true);
     if ( ! new_scanner ) {
       fclose(fptr);
+    } else {
+      struct stat finfo;
+      
+      //
+      // Regular files are mapped rather than read; anything else (or a
+      // failed mapping) falls back to reading the descriptor.  Scanning
+      // starts at the stream's position, not at the start of the mapping:
+      //
+      if ( (fstat(fileno(fptr), &finfo) == 0) && S_ISREG(finfo.st_mode) && (finfo.st_size > 0) && ((uintmax_t)finfo.st_size <= SIZE_MAX) && (new_scanner->base_offset <= finfo.st_size) ) {
+        void    *map_base = mmap(NULL, (size_t)finfo.st_size, PROT_READ, MAP_PRIVATE, fileno(fptr), 0);
+        
+        if ( map_base != MAP_FAILED ) {
+          fscanln *F = (fscanln*)new_scanner;
+          
+          madvise(map_base, (size_t)finfo.st_size, MADV_SEQUENTIAL);
+          F->map_base = (const char*)map_base;
+          F->map_length = (size_t)finfo.st_size;
+          F->map_offset = (size_t)F->base_offset;
+        } else {
+          lmlogf(lmlog_level_debug, "fscanln:  mmap(%s) failed, will read instead: %s", path, strerror(errno));
+        }
+      }
     }
   } else {
     lmlogf(lmlog_level_warn, "fscanln:  fopen(%s) failed: %s", path, strerror(errno));
@@ -526,27 +787,61 @@ fscanln_get_line(
 {
   fscanln       *F = (fscanln*)f;
   
-  if ( __fscanln_get_flags(F, fscanln_flags_is_regex_present | fscanln_flags_is_regex_enabled) ) {
-    __fscanln_clear_sub_matches((fscanln*)f);
-    while ( __fscanln_fill((fscanln*)f) ) {
-      if ( regexec(&f->line_regex, f->buffer, f->sub_match_max, f->sub_matches, 0) == 0 ) {
-				if ( out_line_ptr ) *out_line_ptr = (const char*)f->buffer;
-				if ( out_line_len ) *out_line_len = f->buffer_length;
-				return true;
-      }
-    }
-  } else {
-    if ( __fscanln_fill((fscanln*)f) ) {
-      if ( out_line_ptr ) *out_line_ptr = (const char*)f->buffer;
-      if ( out_line_len ) *out_line_len = f->buffer_length;
-      return true;
-    }
+  if ( __fscanln_next_matching_line(F) && __fscanln_terminate_line(F) ) {
+    if ( out_line_ptr ) *out_line_ptr = f->line;
+    if ( out_line_len ) *out_line_len = f->line_length;
+    return true;
+  }
+  return false;
+}
+
+//
+
+bool
+fscanln_get_line_span(
+  fscanln_ref   f,
+  const char    **out_line_ptr,
+  size_t        *out_line_len
+)
+{
+  fscanln       *F = (fscanln*)f;
+  
+  if ( __fscanln_next_matching_line(F) ) {
+    if ( out_line_ptr ) *out_line_ptr = f->line;
+    if ( out_line_len ) *out_line_len = f->line_length;
+    return true;
   }
   return false;
 }
 
 //
 
+bool
+fscanln_set_is_following(
+  fscanln_ref   f,
+  bool          is_following
+)
+{
+  fscanln       *F = (fscanln*)f;
+  
+  if ( f->map_base ) return false;
+  __fscanln_set_flags(F, fscanln_flags_is_following, is_following);
+  return true;
+}
+
+//
+
+off_t
+fscanln_get_offset(
+  fscanln_ref   f
+)
+{
+  if ( f->map_base ) return (off_t)f->map_offset;
+  return f->base_offset + f->bytes_read - (off_t)(f->data_end - f->data_start);
+}
+
+//
+
 const char*
 fscanln_get_sub_match_string(
   fscanln_ref   f,
@@ -556,13 +851,13 @@ fscanln_get_sub_match_string(
   fscanln       *F = (fscanln*)f;
   
   if ( __fscanln_get_flags(F, fscanln_flags_is_regex_present | fscanln_flags_is_regex_enabled) ) {
-    if ( sub_match_idx < f->sub_match_max ) {
+    if ( (sub_match_idx >= 0) && ((size_t)sub_match_idx < f->sub_match_max) ) {
       if ( ! f->sub_match_strings[sub_match_idx] ) {
         size_t  match_len = f->sub_matches[sub_match_idx].rm_eo - f->sub_matches[sub_match_idx].rm_so;
         char    *s = mempool_alloc_bytes(f->string_pool, match_len + 1);
         
         if ( s ) {
-          memcpy(s, f->buffer + f->sub_matches[sub_match_idx].rm_so, match_len);
+          memcpy(s, f->line + f->sub_matches[sub_match_idx].rm_so, match_len);
           s[match_len] = '\0';
           f->sub_match_strings[sub_match_idx] = s;
           return s;
@@ -27,6 +27,12 @@ typedef const struct _fscanln * fscanln_ref;
 	the should_close_on_dealloc argument requests that the file scanner should close
 	the file when it is destroyed.
 	
+	The scanner reads the stream's underlying file descriptor directly in large
+	blocks, starting at the stream's current position:  if the stream can seek, any
+	data it has buffered but not yet returned is scanned as well.  A stream that
+	cannot seek (e.g. a pipe) must not have been read from.  Nothing else should read
+	from the stream while the scanner is in use.
+	
 	Returns NULL in case of any error.
 */
 fscanln_ref fscanln_create(FILE *fptr, bool should_close_on_dealloc);
@@ -34,6 +40,10 @@ fscanln_ref fscanln_create(FILE *fptr, bool should_close_on_dealloc);
 	@function fscanln_create_with_file
 	Create a new file scanner by opening the given path for reading.  If the path cannot
 	be opened, NULL is returned.
+	
+	A regular file is mapped into memory (with sequential access advised) and lines are
+	returned directly from the mapping, so the file should not be truncated while the
+	scanner is in use; data appended after the scanner was created is not seen.
 */
 fscanln_ref fscanln_create_with_file(const char *path);
 /*!
@@ -101,11 +111,44 @@ unsigned long fscanln_get_line_number(fscanln_ref f);
 	
 	If out_line_ptr is not NULL, the pointer to which it points is set to a pointer
 	to a buffer containing the line read.  The line is NUL-terminated and includes the
-	terminating newline character.  The buffer is owned by the file scanner object and
-	should not be modified and will be invalidated the next time the
+	terminating newline character (if one was present).  The buffer is owned by the file
+	scanner object and should not be modified and will be invalidated the next time the
 	fscanln_get_line() function is called.
+	
+	If out_line_len is not NULL, the size_t to which it points is set to the length
+	of the line (as strlen() would report it).
 */
 bool fscanln_get_line(fscanln_ref f, const char **out_line_ptr, size_t *out_line_len);
+/*!
+	@function fscanln_get_line_span
+	Identical to fscanln_get_line() except that the line is NOT NUL-terminated:  the
+	line is the out_line_len characters at the pointer returned in out_line_ptr.  For a
+	mapped file this avoids copying the line out of the mapping.  As with
+	fscanln_get_line(), the pointer is invalidated by the next call to either function.
+*/
+bool fscanln_get_line_span(fscanln_ref f, const char **out_line_ptr, size_t *out_line_len);
+/*!
+	@function fscanln_set_is_following
+	Put the file scanner in (or take it out of) following mode, for tailing a file
+	that is still being written.  In following mode a final line that lacks its
+	newline is not returned:  it stays buffered and fscanln_get_line() returns false
+	until the rest of the line has been appended, and each call after reaching the
+	end of the file reads the descriptor again for new data.  Line-continuation is
+	not performed in following mode.
+	
+	Returns false (and changes nothing) for a scanner on a mapped file; use
+	fscanln_create() on an opened file to follow it.
+*/
+bool fscanln_set_is_following(fscanln_ref f, bool is_following);
+/*!
+	@function fscanln_get_offset
+	Returns the byte offset in the underlying file of the start of the next line
+	that will be returned; after the last line of a file it is the file's length.
+	For a scanner created with fscanln_create() the offset is relative to the
+	start of the file if the descriptor was seekable (its position at creation is
+	taken as the starting offset) and to the start of the stream otherwise.
+*/
+off_t fscanln_get_offset(fscanln_ref f);
 /*!
 	@function fscanln_get_sub_match_string
 	If a regular expression filter is set and enabled, then after a successful call to
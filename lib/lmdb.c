@@ -7,37 +7,61 @@
  */
 
 #include "lmdb.h"
+#include "lmtsdb.h"
 #include "lmlog.h"
 #include "util_fns.h"
+#include "mempool.h"
 
 #include <sqlite3.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <regex.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdint.h>
+#include <math.h>
 
 //
 
 #ifndef LMDB_DISABLE_RRDTOOL
 
 #include <rrd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
 
 static const char		*__db_get_all_feature_counts_query =
 		"SELECT issued, in_use, checked_timestamp FROM counts"
 		"  WHERE feature_id = ?"
 		"  ORDER BY checked_timestamp ASC";
 
+static const char		*__db_get_all_feature_run_counts_query =
+		"SELECT issued, in_use, checked_timestamp FROM expanded_counts"
+		"  WHERE feature_id = ?"
+		"  ORDER BY checked_timestamp ASC";
+
 typedef char			rrd_point_str_type[64];  /* %lld:%d   => max length should be 43 (with NUL), so 64 is very safe */
 
+static const char		*__lmdb_rrd_definition[] = {
+		"DS:in_use:GAUGE:600:0:U",   /* in-use license count */
+		"DS:issued:GAUGE:600:0:U",   /* issued seats count */
+		"RRA:AVERAGE:0.5:1:5184",    /* 18 days @ 5 minutes*/
+		"RRA:AVERAGE:0.5:12:1440",   /* 60 days @ 1 hour*/
+		"RRA:AVERAGE:0.5:144:1800",  /* 180 days @ 12 hours */
+		"RRA:AVERAGE:0.5:288:1080",  /* 1080 days @ 24 hours */
+		"RRA:AVERAGE:0.5:2016:730"   /* 14 years @ 7 days */
+	};
+static const int		__lmdb_rrd_definition_count = sizeof(__lmdb_rrd_definition) / sizeof(const char*);
+
 bool
 __lmdb_rrd_create(
 	const char		*rrd_path,
 	int						feature_id,
-	const char		*feature_string,
 	sqlite3_stmt	*counts_query
 )
 {
 	const char*   argv[12];
-	int						query_rc, rc, argc, points;
+	int						query_rc, rc, points;
 	int						issued, in_use;
   time_t        count_ts;
 	
@@ -63,19 +87,11 @@ __lmdb_rrd_create(
 		count_ts = time(NULL);
 	}
 	
-	argc = 0;
-	argv[argc++] = "DS:in_use:GAUGE:600:0:U";   /* in-use license count */
-	argv[argc++] = "DS:issued:GAUGE:600:0:U";   /* issued seats count */
-	argv[argc++] = "RRA:AVERAGE:0.5:1:5184";    /* 18 days @ 5 minutes*/
-	argv[argc++] = "RRA:AVERAGE:0.5:12:1440";   /* 60 days @ 1 hour*/
-	argv[argc++] = "RRA:AVERAGE:0.5:144:1800";  /* 180 days @ 12 hours */
-	argv[argc++] = "RRA:AVERAGE:0.5:288:1080";  /* 1080 days @ 24 hours */
-	argv[argc++] = "RRA:AVERAGE:0.5:2016:730";  /* 14 years @ 7 days */
-	
 	rrd_clear_error();
-	rc = rrd_create_r(rrd_path, 300, count_ts, argc, argv);
+	// Updates must be later than the start time, so start just before the first count:
+	rc = rrd_create_r(rrd_path, 300, count_ts - 1, __lmdb_rrd_definition_count, __lmdb_rrd_definition);
 	if ( rc ) {
-		lmlogf(lmlog_level_error, "failed to create rrd file for feature '%s' (id=%d): %s", feature_string, feature_id, rrd_get_error());
+		lmlogf(lmlog_level_error, "failed to create rrd file for feature id=%d: %s", feature_id, rrd_get_error());
 		return false;
 	}
 	if ( counts_query && (query_rc == SQLITE_ROW) ) {
@@ -133,814 +149,5146 @@ __lmdb_rrd_update(
 	return false;
 }
 
-#endif /* LMDB_DISABLE_RRDTOOL */
-	
-//
-
-void
-__lmdb_sqlite_regexp_fn(
-  sqlite3_context     *context,
-  int                 argc,
-  sqlite3_value       **argv
-)
-{
-  bool                is_match = false;
-  
-  if ( argc == 2 ) {
-    char              *regex = (char*)sqlite3_value_text(argv[0]);
-    char              *string = (char*)sqlite3_value_text(argv[1]);
-    
-    if ( regex && string ) {
-      regex_t         comp_regex;
-      
-      if ( regcomp(&comp_regex, regex, REG_EXTENDED) == 0 ) {
-        if ( regexec(&comp_regex, string, 0, NULL, 0) == 0 ) {
-          is_match = true;
-        }
-        regfree(&comp_regex);
-      }
-    }
-  }
-  sqlite3_result_int(context, is_match);
-}
-
 //
 
-static const char   *__db_schema =
-    "CREATE TABLE features (\n"
-    "  feature_id            INTEGER PRIMARY KEY NOT NULL,\n"
-    "  feature_string        TEXT,\n"
-    "  vendor                TEXT,\n"
-    "  version               TEXT\n"
-    ");\n"
-    "CREATE UNIQUE INDEX unique_features_idx\n"
-    "  ON features(vendor, version, feature_string);\n"
-    "CREATE TABLE counts (\n"
-    "  feature_id            INTEGER NOT NULL REFERENCES features(feature_id)\n"
-    "                        ON DELETE CASCADE,\n"
-    "  issued                INTEGER NOT NULL DEFAULT 0,\n"
-    "  in_use                INTEGER NOT NULL DEFAULT 0,\n"
-    "  expiration_timestamp  BIGINT,\n"
-    "  checked_timestamp     BIGINT NOT NULL\n"
-    ");\n"
-    "\n"
-    ;
-
-static const char   *__db_get_features_query =
-    "SELECT feature_id, feature_string, vendor, version FROM features ORDER BY feature_string, vendor, version";
+/*
+ * RRD updates are not made while counts are committed.  Each committed
+ * count is appended as a line
+ *
+ *   <feature id> <timestamp> <in use> <issued>
+ *
+ * to a journal file in the RRD repository, written with a single append
+ * once the enclosing transaction has committed.  A flush renames the
+ * journal aside (new counts go to a fresh journal), sorts its points by
+ * feature and time, and applies each feature's points with as few
+ * rrd_update_r() calls as possible.  Flushes are made by a background
+ * thread every flush interval (if one is set), by lmdb_rrd_flush(), and
+ * when the database is released.
+ *
+ * The journal is flock()'ed while it is appended to; a writer that finds
+ * it has locked a journal that was renamed aside in the meantime reopens
+ * the path.  A separate lock file serializes flushes, even across
+ * processes sharing the repository.
+ */
+#ifndef LMDB_RRD_JOURNAL_NAME
+#define LMDB_RRD_JOURNAL_NAME       "lmdb-rrd.journal"
+#endif
 
-static const char   *__db_get_feature_by_name_query =
-    "SELECT feature_id, feature_string, vendor, version FROM features WHERE feature_string = ?1 AND vendor = ?2 AND version = ?3";
+#ifndef LMDB_RRD_POINTS_PER_UPDATE
+#define LMDB_RRD_POINTS_PER_UPDATE  64
+#endif
 
-static const char   *__db_get_feature_by_id_query =
-    "SELECT feature_id, feature_string, vendor, version FROM features WHERE feature_id = ?1";
+typedef struct {
+  int               feature_id;
+  unsigned int      seq;
+  long long         count_ts;
+  int               in_use, issued;
+} lmdb_rrd_point;
 
-static const char   *__db_add_feature_query =
-    "INSERT INTO features (feature_string, vendor, version) VALUES (?1, ?2, ?3)";
+typedef struct {
+  char              *rrd_repodir;
+  char              *journal_path;
+  char              *flushing_path;
+  char              *lock_path;
+  char              *db_path;
+  sqlite3           *db_handle;
+  //
+  // Points committed in the current transaction:
+  //
+  char              *pending;
+  size_t            pending_len, pending_capacity;
+  //
+  // Background flushes:
+  //
+  bool              has_flusher;
+  pthread_t         thread;
+  pthread_mutex_t   lock;
+  pthread_cond_t    wakeup;
+  bool              should_exit;
+  int               interval;
+} lmdb_rrd_journal;
 
-static const char   *__db_add_feature_count_query =
-    "INSERT INTO counts (feature_id, in_use, issued, expiration_timestamp, checked_timestamp) VALUES"
-    "  (?1, ?2, ?3, ?4, ?5)";
+lmdb_count_storage __lmdb_read_count_storage(sqlite3 *db_handle);
 
-#define DB_QUERY_BASE_NOAGGR \
-    "SELECT f.feature_id, f.vendor, f.version, f.feature_string, c.in_use, c.issued, c.checked_timestamp AS start_timestamp, c.expiration_timestamp AS expiration_timestamp" \
-    "  FROM counts AS c" \
-    "  INNER JOIN features AS f ON (f.feature_id = c.feature_id)"
+//
 
-#define DB_QUERY_BASE_AGGR \
-    "SELECT f.feature_id, f.vendor, f.version, f.feature_string, MIN(c.in_use) AS in_use_min, MAX(c.in_use) AS in_use_max, AVG(c.in_use) AS in_use_avg, MIN(c.issued) AS issued_min, MAX(c.issued) AS issued_max, AVG(c.issued) AS issued_avg, MIN(c.checked_timestamp) AS start_timestamp, MAX(c.checked_timestamp) AS end_timestamp, MAX(c.expiration_timestamp) AS expiration_timestamp" \
-    "  FROM counts AS c" \
-    "  INNER JOIN features AS f ON (f.feature_id = c.feature_id)"
+bool
+__lmdb_rrd_file_for_feature_id(
+  const char        *rrd_repodir,
+  int               feature_id,
+  char              *s,
+  size_t            s_size
+)
+{
+  int               c = snprintf(s, s_size, "%s/%d.rrd", rrd_repodir, feature_id);
+  
+  return ( c < s_size ) ? true : false;
+}
 
-#define DB_QUERY_ORDER_BY \
-    "  ORDER BY start_timestamp ASC, f.vendor, f.version, f.feature_string"
-    
-static const char   *__db_get_last_check_timestamp_query =
-    "SELECT MAX(checked_timestamp) FROM counts";
-    
 //
 
-typedef struct _lmdb {
-  unsigned int      ref_count;
-  sqlite3           *db_handle;
-  char              *db_path;
-#ifndef LMDB_DISABLE_RRDTOOL
-  char              *rrd_repodir;
-#endif
-  bool              is_read_only;
-  lmfeatureset_ref  features;
-} lmdb;
+int
+__lmdb_rrd_point_cmp(
+  const void        *p1,
+  const void        *p2
+)
+{
+  const lmdb_rrd_point  *P1 = (const lmdb_rrd_point*)p1;
+  const lmdb_rrd_point  *P2 = (const lmdb_rrd_point*)p2;
+  
+  if ( P1->feature_id != P2->feature_id ) return ( P1->feature_id < P2->feature_id ) ? -1 : 1;
+  if ( P1->count_ts != P2->count_ts ) return ( P1->count_ts < P2->count_ts ) ? -1 : 1;
+  return ( P1->seq < P2->seq ) ? -1 : (( P1->seq > P2->seq ) ? 1 : 0);
+}
 
 //
 
-lmdb*
-__lmdb_alloc(
+lmdb_rrd_journal*
+__lmdb_rrd_journal_alloc(
+  const char        *rrd_repodir,
   const char        *db_path
 )
 {
-  size_t            db_path_len = 1 + (db_path ? strlen(db_path) : 0);
-  lmdb              *new_db = malloc(sizeof(lmdb) + db_path_len);
-
-  if ( new_db ) {
-    new_db->ref_count = 1;
-    new_db->db_handle = NULL;
-    new_db->db_path = (void*)new_db + sizeof(lmdb);
-    if ( db_path ) {
-      strcpy(new_db->db_path, db_path);
-    } else {
-      new_db->db_path[0] = '\0';
+  lmdb_rrd_journal  *new_journal = malloc(sizeof(lmdb_rrd_journal));
+  
+  if ( new_journal ) {
+    memset(new_journal, 0, sizeof(lmdb_rrd_journal));
+    new_journal->rrd_repodir = strdup(rrd_repodir);
+    new_journal->journal_path = (char*)strcatf("%s/" LMDB_RRD_JOURNAL_NAME, rrd_repodir);
+    new_journal->flushing_path = (char*)strcatf("%s/" LMDB_RRD_JOURNAL_NAME ".flushing", rrd_repodir);
+    new_journal->lock_path = (char*)strcatf("%s/" LMDB_RRD_JOURNAL_NAME ".lock", rrd_repodir);
+    new_journal->db_path = strdup(db_path);
+    if ( ! new_journal->rrd_repodir || ! new_journal->journal_path || ! new_journal->flushing_path || ! new_journal->lock_path || ! new_journal->db_path ) {
+      if ( new_journal->rrd_repodir ) free((void*)new_journal->rrd_repodir);
+      if ( new_journal->journal_path ) free((void*)new_journal->journal_path);
+      if ( new_journal->flushing_path ) free((void*)new_journal->flushing_path);
+      if ( new_journal->lock_path ) free((void*)new_journal->lock_path);
+      if ( new_journal->db_path ) free((void*)new_journal->db_path);
+      free((void*)new_journal);
+      return NULL;
     }
-#ifndef LMDB_DISABLE_RRDTOOL
-    new_db->rrd_repodir = NULL;
-#endif
-    new_db->features = lmfeatureset_create();
+    pthread_mutex_init(&new_journal->lock, NULL);
+    pthread_cond_init(&new_journal->wakeup, NULL);
   }
-  return new_db;
+  return new_journal;
 }
 
 //
 
-void
-__lmdb_dealloc(
-  lmdb      *the_db
+bool
+__lmdb_rrd_journal_add_point(
+  lmdb_rrd_journal  *the_journal,
+  int               feature_id,
+  time_t            count_ts,
+  int               in_use,
+  int               issued
 )
 {
-#ifndef LMDB_DISABLE_RRDTOOL
-  if ( the_db->rrd_repodir ) free((void*)the_db->rrd_repodir);
-#endif
-  if ( the_db->db_handle ) sqlite3_close(the_db->db_handle);
-  if ( the_db->features ) lmfeatureset_release(the_db->features);
-  free((void*)the_db);
+  char              line[64];
+  int               line_len = snprintf(line, sizeof(line), "%d %lld %d %d\n", feature_id, (long long int)count_ts, in_use, issued);
+  
+  if ( line_len < 0 || line_len >= sizeof(line) ) return false;
+  if ( the_journal->pending_len + line_len > the_journal->pending_capacity ) {
+    size_t          new_capacity = the_journal->pending_capacity ? 2 * the_journal->pending_capacity : 4096;
+    char            *new_pending;
+    
+    while ( the_journal->pending_len + line_len > new_capacity ) new_capacity *= 2;
+    if ( ! (new_pending = realloc(the_journal->pending, new_capacity)) ) return false;
+    the_journal->pending = new_pending;
+    the_journal->pending_capacity = new_capacity;
+  }
+  memcpy(the_journal->pending + the_journal->pending_len, line, line_len);
+  the_journal->pending_len += line_len;
+  return true;
 }
 
 //
 
 bool
-__lmdb_commit_feature_count(
-  lmdb_ref      the_db,
-  lmfeature_ref the_feature,
-  time_t        check_timestamp
+__lmdb_rrd_journal_write_pending(
+  lmdb_rrd_journal  *the_journal,
+  bool              should_write
 )
 {
-	//
-	// All SQLite result codes are positive, so we use
-	// -1 to indicate failue prior to sqlite3_step()
-	// and -2 to mean that there was no 
-	int           rc = -1;
-
-  if ( lmfeature_is_modified(the_feature) ) {
-    sqlite3_stmt  *stmt = NULL;
-    sqlite3_int64 db_ts;
-    time_t        raw_ts;
-    
-    if ( sqlite3_prepare_v2(the_db->db_handle, __db_add_feature_count_query, -1, &stmt, NULL) != SQLITE_OK ) goto exit_on_error;
-    if ( sqlite3_bind_int(stmt, 1, lmfeature_get_feature_id(the_feature)) != SQLITE_OK ) goto exit_on_error;
-    if ( sqlite3_bind_int(stmt, 2, lmfeature_get_in_use(the_feature)) != SQLITE_OK ) goto exit_on_error;
-    if ( sqlite3_bind_int(stmt, 3, lmfeature_get_issued(the_feature)) != SQLITE_OK ) goto exit_on_error;
+  bool              rc = true;
+  
+  if ( should_write && the_journal->pending_len ) {
+    int             fd;
     
-    raw_ts = lmfeature_get_expiration_date(the_feature);
-    if ( raw_ts != lmfeature_no_expiration ) {
-      db_ts = (sqlite3_int64)raw_ts;
-      if ( sqlite3_bind_int64(stmt, 4, db_ts) != SQLITE_OK ) goto exit_on_error;
-    } else {
-      if ( sqlite3_bind_null(stmt, 4) != SQLITE_OK ) goto exit_on_error;
+    rc = false;
+    while ( (fd = open(the_journal->journal_path, O_WRONLY | O_APPEND | O_CREAT, 0644)) >= 0 ) {
+      struct stat   fd_info, path_info;
+      
+      if ( (flock(fd, LOCK_EX) == 0) && (fstat(fd, &fd_info) == 0) ) {
+        if ( (stat(the_journal->journal_path, &path_info) == 0) && (fd_info.st_dev == path_info.st_dev) && (fd_info.st_ino == path_info.st_ino) ) {
+          const char  *p = the_journal->pending;
+          size_t      p_len = the_journal->pending_len;
+          
+          while ( p_len ) {
+            ssize_t   n = write(fd, p, p_len);
+            
+            if ( n < 0 ) {
+              if ( errno == EINTR ) continue;
+              break;
+            }
+            p += n;
+            p_len -= n;
+          }
+          rc = ( p_len == 0 );
+          close(fd);
+          break;
+        }
+        // Renamed aside by a flush, try again:
+        close(fd);
+        continue;
+      }
+      close(fd);
+      break;
     }
-    
-    db_ts = (sqlite3_int64)check_timestamp;
-    if ( sqlite3_bind_int64(stmt, 5, db_ts) != SQLITE_OK ) goto exit_on_error;
-    
-    rc = sqlite3_step(stmt);
-    if ( rc == SQLITE_DONE ) {
-      rc = 0;
+    if ( rc ) {
+      LMDEBUG("appended %lu bytes to RRD journal %s", (unsigned long)the_journal->pending_len, the_journal->journal_path);
+    } else {
+      lmlogf(lmlog_level_error, "failed to append to RRD journal %s: %s", the_journal->journal_path, strerror(errno));
     }
+  }
+  the_journal->pending_len = 0;
+  return rc;
+}
 
-exit_on_error:
-    if ( stmt ) sqlite3_finalize(stmt);
+//
+
+void
+__lmdb_rrd_journal_apply_points(
+  lmdb_rrd_journal  *the_journal,
+  lmdb_rrd_point    *points,
+  unsigned int      point_count
+)
+{
+  rrd_point_str_type  point_strs[LMDB_RRD_POINTS_PER_UPDATE];
+  const char          *argv[LMDB_RRD_POINTS_PER_UPDATE];
+  char                rrd_path[PATH_MAX];
+  unsigned int        i = 0, file_count = 0, update_count = 0;
+  
+  qsort(points, point_count, sizeof(lmdb_rrd_point), __lmdb_rrd_point_cmp);
+  while ( i < point_count ) {
+    int               feature_id = points[i].feature_id;
+    unsigned int      j = i;
     
-#ifndef LMDB_DISABLE_RRDTOOL
-		if ( the_db->rrd_repodir ) {
-			const char			*rrd_path	= strcatf("%s/%d.rrd", the_db->rrd_repodir, lmfeature_get_feature_id(the_feature));
-			
-			if ( rrd_path ) {
-				bool						was_added = false;
-			
-				if ( ! file_exists(rrd_path) ) {
-					//
-					// We need to create the rrd file and fill-it with any old data:
-					//
-					if ( sqlite3_prepare_v2(the_db->db_handle, __db_get_all_feature_counts_query, -1, &stmt, NULL) == SQLITE_OK ) {
-						if ( sqlite3_bind_int(stmt, 1, lmfeature_get_feature_id(the_feature)) == SQLITE_OK ) {
-							__lmdb_rrd_create(rrd_path, lmfeature_get_feature_id(the_feature), lmfeature_get_feature_string(the_feature), stmt);
-							was_added = true;
-						} else {
-							__lmdb_rrd_create(rrd_path, lmfeature_get_feature_id(the_feature), lmfeature_get_feature_string(the_feature), NULL);
-						}
-						sqlite3_finalize(stmt);
-					} else {
-						__lmdb_rrd_create(rrd_path, lmfeature_get_feature_id(the_feature), lmfeature_get_feature_string(the_feature), NULL);
-					}
-				}
-				if ( ! was_added && file_exists(rrd_path) ) {
-					__lmdb_rrd_update(rrd_path, check_timestamp, lmfeature_get_in_use(the_feature), lmfeature_get_issued(the_feature));
-				}
-				free((void*)rrd_path);
-			}
-		}
-#endif
+    while ( (j < point_count) && (points[j].feature_id == feature_id) ) j++;
+    file_count++;
     
-  	return rc ? false : true;
+    if ( __lmdb_rrd_file_for_feature_id(the_journal->rrd_repodir, feature_id, rrd_path, sizeof(rrd_path)) ) {
+      bool            should_update = true;
+      
+      if ( ! file_exists(rrd_path) ) {
+        //
+        // We need to create the rrd file and fill-it with any old data; the
+        // points in the journal were committed before they were journaled,
+        // so they are included:
+        //
+        sqlite3_stmt  *stmt = NULL;
+        
+        if ( ! the_journal->db_handle ) {
+          if ( sqlite3_open_v2(the_journal->db_path, &the_journal->db_handle, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK ) {
+            sqlite3_busy_timeout(the_journal->db_handle, 5000);
+          } else {
+            lmlogf(lmlog_level_warn, "failed to open database '%s' to fill RRD files", the_journal->db_path);
+            sqlite3_close(the_journal->db_handle);
+            the_journal->db_handle = NULL;
+          }
+        }
+        if ( the_journal->db_handle ) {
+          const char  *query = (__lmdb_read_count_storage(the_journal->db_handle) == lmdb_count_storage_runs) ? __db_get_all_feature_run_counts_query : __db_get_all_feature_counts_query;
+          
+          if ( (sqlite3_prepare_v2(the_journal->db_handle, query, -1, &stmt, NULL) != SQLITE_OK) || (sqlite3_bind_int(stmt, 1, feature_id) != SQLITE_OK) ) {
+            sqlite3_finalize(stmt);
+            stmt = NULL;
+          }
+        }
+        __lmdb_rrd_create(rrd_path, feature_id, stmt);
+        if ( stmt ) {
+          sqlite3_finalize(stmt);
+          should_update = false;
+        }
+      }
+      if ( should_update && file_exists(rrd_path) ) {
+        unsigned int  k = i;
+        time_t        last_ts;
+        
+        //
+        // Points the file already has (e.g. from a rebuild, or a flush that
+        // did not finish) would be rejected along with the rest of their
+        // batch, so skip them:
+        //
+        rrd_clear_error();
+        if ( (last_ts = rrd_last_r(rrd_path)) != -1 ) {
+          while ( (k < j) && (points[k].count_ts <= last_ts) ) k++;
+        }
+        while ( k < j ) {
+          int         argc = 0;
+          
+          while ( (k < j) && (argc < LMDB_RRD_POINTS_PER_UPDATE) ) {
+            snprintf(point_strs[argc], sizeof(rrd_point_str_type), "%lld:%d:%d", points[k].count_ts, points[k].in_use, points[k].issued);
+            argv[argc] = &point_strs[argc][0];
+            argc++;
+            k++;
+          }
+          rrd_clear_error();
+          if ( rrd_update_r(rrd_path, NULL, argc, argv) != 0 ) {
+            lmlogf(lmlog_level_warn, "failed to update rrd file %s: %s", rrd_path, rrd_get_error());
+          }
+          update_count++;
+        }
+      }
+    }
+    i = j;
   }
-  return true;
+  LMDEBUG("applied %u RRD point(s) to %u file(s) with %u update(s)", point_count, file_count, update_count);
 }
 
 //
 
-#ifndef LMDB_DISABLE_RRDTOOL
-
 bool
-__lmdb_rrd_file_for_feature_id(
-  const char        *rrd_repodir,
-  int               feature_id,
-  char              *s,
-  size_t            s_size
+__lmdb_rrd_journal_apply_file(
+  lmdb_rrd_journal  *the_journal,
+  const char        *path
 )
 {
-  int               c = snprintf(s, s_size, "%s/%d.rrd", rrd_repodir, feature_id);
+  FILE              *fptr = fopen(path, "r");
+  lmdb_rrd_point    *points = NULL;
+  unsigned int      point_count = 0, point_capacity = 0;
+  lmdb_rrd_point    point;
+  char              line[128];
   
-  return ( c < s_size ) ? true : false;
+  if ( ! fptr ) return ( errno == ENOENT );
+  
+  // Wait for any writer that opened the file before it was renamed aside:
+  flock(fileno(fptr), LOCK_EX);
+  
+  memset(&point, 0, sizeof(point));
+  while ( fgets(line, sizeof(line), fptr) ) {
+    if ( sscanf(line, "%d %lld %d %d", &point.feature_id, &point.count_ts, &point.in_use, &point.issued) != 4 ) continue;
+    if ( point_count == point_capacity ) {
+      unsigned int    new_capacity = point_capacity ? 2 * point_capacity : 1024;
+      lmdb_rrd_point  *new_points = realloc(points, new_capacity * sizeof(lmdb_rrd_point));
+      
+      if ( ! new_points ) {
+        lmlogf(lmlog_level_error, "unable to allocate RRD journal points for %s", path);
+        if ( points ) free((void*)points);
+        fclose(fptr);
+        return false;
+      }
+      points = new_points;
+      point_capacity = new_capacity;
+    }
+    point.seq = point_count;
+    points[point_count++] = point;
+  }
+  fclose(fptr);
+  if ( point_count ) {
+    __lmdb_rrd_journal_apply_points(the_journal, points, point_count);
+  }
+  if ( points ) free((void*)points);
+  unlink(path);
+  return true;
 }
 
-#endif
-
 //
 
-const char*
-lmdb_get_schema(void)
+bool
+__lmdb_rrd_journal_flush(
+  lmdb_rrd_journal  *the_journal
+)
 {
-  return __db_schema;
+  int               lock_fd = open(the_journal->lock_path, O_RDWR | O_CREAT, 0644);
+  bool              rc = false;
+  
+  if ( lock_fd < 0 ) {
+    lmlogf(lmlog_level_error, "failed to open RRD journal lock %s: %s", the_journal->lock_path, strerror(errno));
+    return false;
+  }
+  if ( flock(lock_fd, LOCK_EX) == 0 ) {
+    //
+    // A journal left by a flush that did not finish goes first:
+    //
+    rc = __lmdb_rrd_journal_apply_file(the_journal, the_journal->flushing_path);
+    if ( rc ) {
+      if ( rename(the_journal->journal_path, the_journal->flushing_path) == 0 ) {
+        rc = __lmdb_rrd_journal_apply_file(the_journal, the_journal->flushing_path);
+      } else if ( errno != ENOENT ) {
+        lmlogf(lmlog_level_error, "failed to rename RRD journal %s: %s", the_journal->journal_path, strerror(errno));
+        rc = false;
+      }
+    }
+  }
+  close(lock_fd);
+  return rc;
 }
 
 //
 
-lmdb_ref
-__lmdb_create(
-  const char        *db_path,
-  bool              is_read_only
+void*
+__lmdb_rrd_journal_thread(
+  void              *context
 )
 {
-
-  struct stat       finfo;
-  sqlite3           *db_handle;
-  bool              is_new = true;
-  int               rc, sqlite_flags = 0;
+  lmdb_rrd_journal  *the_journal = (lmdb_rrd_journal*)context;
   
-#ifndef LMDB_IGNORE_SQLITE_VERSION
-  static bool       is_inited = false;
-  if ( ! is_inited ) {
-    /* Ensure we're using an SQLite library at least as new as the one
-     * with which we were compiled:
-     */
-    LMASSERT( sqlite3_libversion_number() >= SQLITE_VERSION_NUMBER );
-    is_inited = true;
+  pthread_mutex_lock(&the_journal->lock);
+  while ( ! the_journal->should_exit ) {
+    struct timespec deadline;
+    int             rc = 0;
+    
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += the_journal->interval;
+    while ( ! the_journal->should_exit && (rc != ETIMEDOUT) ) {
+      rc = pthread_cond_timedwait(&the_journal->wakeup, &the_journal->lock, &deadline);
+    }
+    if ( ! the_journal->should_exit ) {
+      pthread_mutex_unlock(&the_journal->lock);
+      __lmdb_rrd_journal_flush(the_journal);
+      pthread_mutex_lock(&the_journal->lock);
+    }
   }
-#endif
+  pthread_mutex_unlock(&the_journal->lock);
+  return NULL;
+}
 
-  if ( strcmp(db_path, ":memory:") && (stat(db_path, &finfo) == 0) ) {
-    if ( ! S_ISREG(finfo.st_mode) ) {
-      lmlogf(lmlog_level_error, "lmdb_create: %s is not a regular file", db_path);
-      return NULL;
+//
+
+bool
+__lmdb_rrd_journal_set_interval(
+  lmdb_rrd_journal  *the_journal,
+  int               interval
+)
+{
+  if ( the_journal->has_flusher ) {
+    pthread_mutex_lock(&the_journal->lock);
+    the_journal->should_exit = true;
+    pthread_cond_signal(&the_journal->wakeup);
+    pthread_mutex_unlock(&the_journal->lock);
+    pthread_join(the_journal->thread, NULL);
+    the_journal->has_flusher = false;
+    the_journal->should_exit = false;
+  }
+  the_journal->interval = interval;
+  if ( interval > 0 ) {
+    if ( pthread_create(&the_journal->thread, NULL, __lmdb_rrd_journal_thread, the_journal) != 0 ) {
+      lmlog(lmlog_level_warn, "failed to start RRD flush thread");
+      return false;
     }
-    is_new = false;
+    the_journal->has_flusher = true;
+    LMDEBUG("flushing RRD journal every %d seconds", interval);
   }
+  return true;
+}
+
+//
+
+/*
+ * Rebuilding RRD files:  a pool of threads, each with its own read-only
+ * connection to the database, takes feature ids from a shared list.  Each
+ * feature's counts are written to <id>.rrd.rebuild with large batches of
+ * points per rrd_update_r() call; then, holding the journal's flush lock,
+ * any counts committed in the meantime are appended and the file is renamed
+ * over <id>.rrd.  Points journaled but not yet flushed are skipped when they
+ * are applied to the new file, so nothing is lost or applied twice and the
+ * program collecting counts never waits on a rebuild.
+ */
+#ifndef LMDB_RRD_REBUILD_POINTS_PER_UPDATE
+#define LMDB_RRD_REBUILD_POINTS_PER_UPDATE  1024
+#endif
+
+typedef struct {
+  const char        *db_path;
+  const char        *rrd_repodir;
+  const char        *lock_path;
+  bool              use_runs;
+  int               *feature_ids;
+  unsigned int      feature_count;
+  pthread_mutex_t   lock;
+  unsigned int      next_feature;
+  unsigned int      rebuilt_count, failed_count;
+} lmdb_rrd_rebuild_context;
+
+//
+
+bool
+__lmdb_rrd_rebuild_append_rows(
+  const char        *rrd_path,
+  sqlite3_stmt      *stmt,
+  int               query_rc,
+  time_t            after_ts,
+  rrd_point_str_type  *point_strs,
+  const char        **argv,
+  time_t            *last_ts
+)
+{
+  int               argc = 0;
   
-  if ( is_new && is_read_only ) {
-    lmlog(lmlog_level_alert, "lmdb_create:  impossible to open a non-existent database read-only");
-    return NULL;
-  }
-  
-  sqlite_flags = is_read_only ? (SQLITE_OPEN_READONLY) : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
-  
-  if ( (rc = sqlite3_open_v2(db_path, &db_handle, sqlite_flags, NULL)) == SQLITE_OK ) {
-    LMDEBUG("successfully opened %sdatabase '%s'", is_read_only ? "read-only " : "", db_path);
+  while ( query_rc == SQLITE_ROW ) {
+    time_t          count_ts = (time_t)sqlite3_column_int64(stmt, 2);
     
-#ifdef SQLITE_DBCONFIG_ENABLE_FKEY
-    if ( (rc = sqlite3_db_config(db_handle, SQLITE_DBCONFIG_ENABLE_FKEY, 1, NULL)) == SQLITE_OK )
-#else
-    if ( (rc = sqlite3_exec(db_handle, "PRAGMA foreign_keys = ON", NULL, NULL, NULL)) == SQLITE_OK )
-#endif
-    {
-      size_t          db_path_len;
-      lmdb            *new_db;
-      
-      LMDEBUG("successfully enabled foreign key support on database");
-      if ( is_new ) {
-        if ( (rc = sqlite3_exec(db_handle, __db_schema, NULL, NULL, NULL)) != SQLITE_OK ) {
-          lmlogf(lmlog_level_error, "failed to initialize database schema: %s", sqlite3_errmsg(db_handle));
-          sqlite3_close(db_handle);
-          return NULL;
+    if ( count_ts > after_ts ) {
+      snprintf(point_strs[argc], sizeof(rrd_point_str_type), "%lld:%d:%d", (long long int)count_ts, sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 0));
+      argv[argc] = &point_strs[argc][0];
+      *last_ts = after_ts = count_ts;
+      if ( ++argc == LMDB_RRD_REBUILD_POINTS_PER_UPDATE ) {
+        rrd_clear_error();
+        if ( rrd_update_r(rrd_path, NULL, argc, argv) != 0 ) {
+          lmlogf(lmlog_level_error, "failed to update rrd file %s: %s", rrd_path, rrd_get_error());
+          return false;
         }
-        LMDEBUG("successfully initialized database schema");
-      }
-      new_db = __lmdb_alloc(db_path);
-      if ( new_db ) {
-        new_db->db_handle = db_handle;
-        new_db->is_read_only = is_read_only;
-        
-        // Register or regexp function:
-        sqlite3_create_function(
-            db_handle,
-            "REGEXP",
-            2,
-            SQLITE_UTF8,
-            NULL,
-            __lmdb_sqlite_regexp_fn,
-            NULL,
-            NULL
-          );
-        
-        return (lmdb_ref)new_db;
-      } else {
-        lmlog(lmlog_level_warn, "lmdb_create: failed to allocate new object");
+        argc = 0;
       }
-    } else {
-      lmlogf(lmlog_level_error, "lmdb_create: failed to enable foreign key support on database (rc = %d)", rc);
-      sqlite3_close(db_handle);
     }
-  } else {
-    lmlogf(lmlog_level_error, "lmdb_create: failed to open database '%s' (rc = %d)", rc);
+    query_rc = sqlite3_step(stmt);
   }
-  return NULL;
+  if ( query_rc != SQLITE_DONE ) {
+    lmlogf(lmlog_level_error, "failed data lookup query (SQLite3 error %d)", query_rc);
+    return false;
+  }
+  if ( argc > 0 ) {
+    rrd_clear_error();
+    if ( rrd_update_r(rrd_path, NULL, argc, argv) != 0 ) {
+      lmlogf(lmlog_level_error, "failed to update rrd file %s: %s", rrd_path, rrd_get_error());
+      return false;
+    }
+  }
+  return true;
 }
 
 //
 
-lmdb_ref
-lmdb_create(
-  const char        *db_path
+bool
+__lmdb_rrd_rebuild_feature(
+  lmdb_rrd_rebuild_context  *context,
+  sqlite3_stmt      *stmt,
+  int               feature_id,
+  rrd_point_str_type  *point_strs,
+  const char        **argv
 )
 {
-  return __lmdb_create(db_path, false);
+  char              rrd_path[PATH_MAX], tmp_path[PATH_MAX];
+  int               query_rc, lock_fd;
+  time_t            first_ts, last_ts;
+  bool              rc = false;
+  
+  if ( ! __lmdb_rrd_file_for_feature_id(context->rrd_repodir, feature_id, rrd_path, sizeof(rrd_path)) ||
+       (snprintf(tmp_path, sizeof(tmp_path), "%s.rebuild", rrd_path) >= sizeof(tmp_path))
+  ) {
+    lmlogf(lmlog_level_error, "rrd file path too long for feature id=%d", feature_id);
+    return false;
+  }
+  
+  if ( sqlite3_bind_int(stmt, 1, feature_id) != SQLITE_OK ) goto exit_on_error;
+  query_rc = sqlite3_step(stmt);
+  if ( query_rc == SQLITE_DONE ) {
+    LMDEBUG("no counts for feature id=%d, no rrd file written", feature_id);
+    sqlite3_reset(stmt);
+    return true;
+  }
+  if ( query_rc != SQLITE_ROW ) {
+    lmlogf(lmlog_level_error, "failed data lookup query (SQLite3 error %d)", query_rc);
+    goto exit_on_error;
+  }
+  
+  // Updates must be later than the start time, so start just before the first count:
+  first_ts = last_ts = (time_t)sqlite3_column_int64(stmt, 2) - 1;
+  unlink(tmp_path);
+  rrd_clear_error();
+  if ( rrd_create_r(tmp_path, 300, first_ts, __lmdb_rrd_definition_count, __lmdb_rrd_definition) != 0 ) {
+    lmlogf(lmlog_level_error, "failed to create rrd file for feature id=%d: %s", feature_id, rrd_get_error());
+    goto exit_on_error;
+  }
+  if ( ! __lmdb_rrd_rebuild_append_rows(tmp_path, stmt, query_rc, first_ts, point_strs, argv, &last_ts) ) goto exit_on_error;
+  sqlite3_reset(stmt);
+  
+  //
+  // No journal flush may happen between catching up and the rename:
+  //
+  if ( (lock_fd = open(context->lock_path, O_RDWR | O_CREAT, 0644)) < 0 ) {
+    lmlogf(lmlog_level_error, "failed to open RRD journal lock %s: %s", context->lock_path, strerror(errno));
+    goto exit_on_error;
+  }
+  if ( flock(lock_fd, LOCK_EX) == 0 ) {
+    if ( sqlite3_bind_int(stmt, 1, feature_id) == SQLITE_OK ) {
+      if ( __lmdb_rrd_rebuild_append_rows(tmp_path, stmt, sqlite3_step(stmt), last_ts, point_strs, argv, &last_ts) ) {
+        if ( rename(tmp_path, rrd_path) == 0 ) {
+          rc = true;
+        } else {
+          lmlogf(lmlog_level_error, "failed to rename %s to %s: %s", tmp_path, rrd_path, strerror(errno));
+        }
+      }
+    }
+  }
+  close(lock_fd);
+  
+exit_on_error:
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  if ( ! rc ) unlink(tmp_path);
+  return rc;
 }
 
 //
 
-lmdb_ref
-lmdb_create_read_only(
-  const char        *db_path
+void*
+__lmdb_rrd_rebuild_thread(
+  void              *context
 )
 {
-  return __lmdb_create(db_path, true);
+  lmdb_rrd_rebuild_context  *CONTEXT = (lmdb_rrd_rebuild_context*)context;
+  sqlite3                   *db_handle = NULL;
+  sqlite3_stmt              *stmt = NULL;
+  rrd_point_str_type        *point_strs = malloc(LMDB_RRD_REBUILD_POINTS_PER_UPDATE * (sizeof(rrd_point_str_type) + sizeof(const char*)));
+  const char                **argv = (const char**)(point_strs + LMDB_RRD_REBUILD_POINTS_PER_UPDATE);
+  const char                *query = CONTEXT->use_runs ? __db_get_all_feature_run_counts_query : __db_get_all_feature_counts_query;
+  unsigned int              rebuilt_count = 0, failed_count = 0;
+  
+  if ( ! point_strs ) {
+    lmlog(lmlog_level_error, "unable to allocate rrd update buffers");
+    goto exit_on_error;
+  }
+  if ( sqlite3_open_v2(CONTEXT->db_path, &db_handle, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK ) {
+    lmlogf(lmlog_level_error, "failed to open database '%s': %s", CONTEXT->db_path, sqlite3_errmsg(db_handle));
+    goto exit_on_error;
+  }
+  sqlite3_busy_timeout(db_handle, 5000);
+  if ( sqlite3_prepare_v2(db_handle, query, -1, &stmt, NULL) != SQLITE_OK ) {
+    lmlogf(lmlog_level_error, "failed while preparing query '%s': %s", query, sqlite3_errmsg(db_handle));
+    goto exit_on_error;
+  }
+  while ( 1 ) {
+    int             feature_id;
+    
+    pthread_mutex_lock(&CONTEXT->lock);
+    if ( CONTEXT->next_feature >= CONTEXT->feature_count ) {
+      pthread_mutex_unlock(&CONTEXT->lock);
+      break;
+    }
+    feature_id = CONTEXT->feature_ids[CONTEXT->next_feature++];
+    pthread_mutex_unlock(&CONTEXT->lock);
+    
+    if ( __lmdb_rrd_rebuild_feature(CONTEXT, stmt, feature_id, point_strs, argv) ) {
+      LMDEBUG("rebuilt rrd file for feature id=%d", feature_id);
+      rebuilt_count++;
+    } else {
+      failed_count++;
+    }
+  }
+
+exit_on_error:
+  if ( stmt ) sqlite3_finalize(stmt);
+  if ( db_handle ) sqlite3_close(db_handle);
+  if ( point_strs ) free((void*)point_strs);
+  
+  pthread_mutex_lock(&CONTEXT->lock);
+  CONTEXT->rebuilt_count += rebuilt_count;
+  CONTEXT->failed_count += failed_count;
+  pthread_mutex_unlock(&CONTEXT->lock);
+  return NULL;
 }
 
 //
 
-lmdb_ref
-lmdb_retain(
-  lmdb_ref          the_db
+void
+__lmdb_rrd_journal_dealloc(
+  lmdb_rrd_journal  *the_journal
 )
 {
-  the_db->ref_count++;
-  return the_db;
+  __lmdb_rrd_journal_set_interval(the_journal, 0);
+  __lmdb_rrd_journal_flush(the_journal);
+  
+  pthread_cond_destroy(&the_journal->wakeup);
+  pthread_mutex_destroy(&the_journal->lock);
+  if ( the_journal->db_handle ) sqlite3_close(the_journal->db_handle);
+  if ( the_journal->pending ) free((void*)the_journal->pending);
+  free((void*)the_journal->rrd_repodir);
+  free((void*)the_journal->journal_path);
+  free((void*)the_journal->flushing_path);
+  free((void*)the_journal->lock_path);
+  free((void*)the_journal->db_path);
+  free((void*)the_journal);
 }
 
+#endif /* LMDB_DISABLE_RRDTOOL */
+	
 //
 
-void
-lmdb_release(
-  lmdb_ref          the_db
-)
-{
-  if ( --the_db->ref_count == 0 ) __lmdb_dealloc(the_db);
-}
+/*
+ * Compiled REGEXP patterns are reference-counted:  each connection keeps a
+ * small LRU cache of them (so patterns that vary from row to row are not
+ * recompiled every time they recur) and a pattern that is constant for a
+ * statement is also held as the function's auxiliary data, which SQLite
+ * hands back on every row without a lookup.  A pattern that fails to
+ * compile is cached, too, and never matches.
+ */
+#ifndef LMDB_REGEX_CACHE_SIZE
+#define LMDB_REGEX_CACHE_SIZE   16
+#endif
+
+typedef struct {
+  unsigned int        ref_count;
+  unsigned int        hash;
+  unsigned long       last_used;
+  bool                is_valid;
+  regex_t             regex;
+  char                pattern[];
+} lmdb_regex;
+
+typedef struct {
+  unsigned int        count;
+  unsigned long       clock;
+  lmdb_regex          *entries[LMDB_REGEX_CACHE_SIZE];
+} lmdb_regex_cache;
 
 //
 
-const char*
-lmdb_get_path(
-  lmdb_ref          the_db
+lmdb_regex*
+__lmdb_regex_alloc(
+  const char          *pattern,
+  unsigned int        hash
 )
 {
-  return the_db->db_path;
+  size_t              pattern_len = strlen(pattern);
+  lmdb_regex          *new_regex = malloc(sizeof(lmdb_regex) + pattern_len + 1);
+  
+  if ( new_regex ) {
+    new_regex->ref_count = 1;
+    new_regex->hash = hash;
+    new_regex->last_used = 0;
+    memcpy(new_regex->pattern, pattern, pattern_len + 1);
+    new_regex->is_valid = ( regcomp(&new_regex->regex, pattern, REG_EXTENDED | REG_NOSUB) == 0 );
+  }
+  return new_regex;
 }
 
 //
 
-#ifndef LMDB_DISABLE_RRDTOOL
-
-const char*
-lmdb_get_rrd_repodir(
-  lmdb_ref          the_db
+void
+__lmdb_regex_release(
+  void                *a_regex
 )
 {
-  return the_db->rrd_repodir;
+  lmdb_regex          *the_regex = (lmdb_regex*)a_regex;
+  
+  if ( --the_regex->ref_count == 0 ) {
+    if ( the_regex->is_valid ) regfree(&the_regex->regex);
+    free(a_regex);
+  }
 }
 
 //
 
-bool
-lmdb_set_rrd_repodir(
-  lmdb_ref          the_db,
-  const char        *rrd_repodir
+void
+__lmdb_regex_cache_dealloc(
+  void                *a_cache
 )
 {
-  if ( the_db->rrd_repodir ) {
-    free((void*)the_db->rrd_repodir);
-    the_db->rrd_repodir = NULL;
-  }
-  if ( rrd_repodir ) {
-    if ( directory_exists(rrd_repodir) ) {
-      if ( access(rrd_repodir, R_OK | W_OK) == 0 ) {
-        the_db->rrd_repodir = strdup(rrd_repodir);
-        return true;
-      } else {
-        lmlogf(lmlog_level_warn, "no read+write permission on RRD repository directory: %s", rrd_repodir);
-      }
-    } else {
-      lmlogf(lmlog_level_warn, "RRD repository directory does not exist: %s", rrd_repodir);
-    }
-    return false;
-  }
-  return true;
+  lmdb_regex_cache    *cache = (lmdb_regex_cache*)a_cache;
+  
+  while ( cache->count ) __lmdb_regex_release(cache->entries[--cache->count]);
+  free(a_cache);
 }
 
-#endif
-
 //
 
-void
-lmdb_load_all_features(
-  lmdb_ref          the_db
+lmdb_regex*
+__lmdb_regex_cache_get(
+  lmdb_regex_cache    *cache,
+  const char          *pattern
 )
 {
-  sqlite3_stmt    *stmt = NULL;
-  int             rc;
-  int             tbl_feature_id;
-  const char      *tbl_feature_string, *tbl_vendor, *tbl_version;
-  lmfeature_ref   a_feature;
-  bool            done = false;
+  unsigned int        hash = 2166136261U, i = 0, lru = 0;
+  const char          *s = pattern;
+  lmdb_regex          *the_regex;
   
-  if ( sqlite3_prepare_v2(the_db->db_handle, __db_get_features_query, -1, &stmt, NULL) != SQLITE_OK ) {
-    lmlogf(lmlog_level_warn, "failed while preparing query '%s': %s", __db_get_features_query, sqlite3_errmsg(the_db->db_handle));
-    return;
-  }
-  while ( ! done ) {
-    rc = sqlite3_step(stmt);
-    switch ( rc ) {
-    
-      case SQLITE_ROW: {
-        /* Extant feature, wrap with an lmfeature: */
-        tbl_feature_id = sqlite3_column_int(stmt, 0);
-        
-         // Check the featureset first
-        a_feature = lmfeatureset_get_feature_by_id(the_db->features, tbl_feature_id);
-        if ( ! a_feature ) {
-          tbl_feature_string = (const char*)sqlite3_column_text(stmt, 1);
-          tbl_vendor = (const char*)sqlite3_column_text(stmt, 2);
-          tbl_version = (const char*)sqlite3_column_text(stmt, 3);
-          
-          a_feature = lmfeature_create(tbl_feature_id, tbl_feature_string, tbl_vendor, tbl_version);
-          if ( a_feature ) {
-            bool      ok = lmfeatureset_add_feature(the_db->features, a_feature);
-            lmfeature_release(a_feature);
-          }
-        }
-        break;
-      }
-      
-      case SQLITE_DONE:
-        done = true;
-        break;
-      
-      default:
-        lmlogf(lmlog_level_warn, "query failed (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
-        break;
-      
+  while ( *s ) hash = (hash ^ (unsigned char)*s++) * 16777619U;
+  while ( i < cache->count ) {
+    the_regex = cache->entries[i];
+    if ( (the_regex->hash == hash) && (strcmp(the_regex->pattern, pattern) == 0) ) {
+      the_regex->last_used = ++cache->clock;
+      return the_regex;
     }
+    if ( the_regex->last_used < cache->entries[lru]->last_used ) lru = i;
+    i++;
   }
-  sqlite3_finalize(stmt);
+  if ( ! (the_regex = __lmdb_regex_alloc(pattern, hash)) ) return NULL;
+  if ( cache->count < LMDB_REGEX_CACHE_SIZE ) {
+    cache->entries[cache->count++] = the_regex;
+  } else {
+    __lmdb_regex_release(cache->entries[lru]);
+    cache->entries[lru] = the_regex;
+  }
+  the_regex->last_used = ++cache->clock;
+  return the_regex;
 }
 
 //
 
-static const char   *__db_lookup_features_query =
-    "SELECT feature_id, f.feature_string, f.vendor, f.version FROM features AS f";
-static const char   *__db_lookup_features_orderby =
-    " ORDER BY f.vendor, f.version, f.feature_string";
-
-lmfeatureset_ref
-lmdb_lookup_features(
-  lmdb_ref            the_db,
-  lmdb_predicate_ref  predicate
+void
+__lmdb_sqlite_regexp_fn(
+  sqlite3_context     *context,
+  int                 argc,
+  sqlite3_value       **argv
 )
 {
-  lmfeatureset_ref    out_featureset = NULL;
-  const char          *predicate_str = predicate ? lmdb_predicate_get_string(predicate) : NULL;
-  const char          *query_str;
+  bool                is_match = false;
   
-  if ( predicate_str ) {
-    query_str = strcatm(__db_lookup_features_query, " WHERE ", predicate_str, __db_lookup_features_orderby, NULL);
-    free((void*)predicate_str);
-  } else {
-    query_str = strcatm(__db_lookup_features_query, __db_lookup_features_orderby, NULL);
-  }
-  if ( query_str ) {
-    sqlite3_stmt    *stmt;
+  if ( argc == 2 ) {
+    lmdb_regex        *the_regex = (lmdb_regex*)sqlite3_get_auxdata(context, 0);
+    char              *string = (char*)sqlite3_value_text(argv[1]);
+    bool              is_new_reference = false;
     
-    LMDEBUG("QUERY:  %s\n", query_str);
-    if ( sqlite3_prepare_v2(the_db->db_handle, query_str, -1, &stmt, NULL) == SQLITE_OK ) {
-      int           rc;
+    if ( ! the_regex ) {
+      lmdb_regex_cache  *cache = (lmdb_regex_cache*)sqlite3_user_data(context);
+      char              *regex = (char*)sqlite3_value_text(argv[0]);
       
-      out_featureset = lmfeatureset_create();
-      if ( out_featureset ) {
-        while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
-          lmfeature_ref   feature = lmfeature_create(
-                                            sqlite3_column_int(stmt, 0),
-                                            (const char*)sqlite3_column_text(stmt, 1),
-                                            (const char*)sqlite3_column_text(stmt, 2),
-                                            (const char*)sqlite3_column_text(stmt, 3)
-                                          );
-          if ( feature ) {
-            lmfeatureset_add_feature(out_featureset, feature);
-            lmfeature_release(feature);
-          }
+      if ( regex ) {
+        if ( cache ) {
+          if ( (the_regex = __lmdb_regex_cache_get(cache, regex)) ) the_regex->ref_count++;
+        } else {
+          the_regex = __lmdb_regex_alloc(regex, 0);
         }
+        is_new_reference = ( the_regex != NULL );
       }
-      sqlite3_finalize(stmt);
     }
-    free((void*)query_str);
+    if ( the_regex && the_regex->is_valid && string ) {
+      if ( regexec(&the_regex->regex, string, 0, NULL, 0) == 0 ) {
+        is_match = true;
+      }
+    }
+    //
+    // SQLite keeps the reference for the following rows while the pattern
+    // is constant (and may drop it before this call even returns):
+    //
+    if ( is_new_reference ) sqlite3_set_auxdata(context, 0, the_regex, __lmdb_regex_release);
   }
-  return out_featureset;
+  sqlite3_result_int(context, is_match);
 }
 
 //
 
-lmfeatureset_ref
-lmdb_get_features(
-  lmdb_ref          the_db
-)
-{
-  return the_db->features;
-}
-
+/*
+ * The checkouts table is only used when checkout tracking is enabled, so
+ * it is also created on demand in databases that predate it:
+ */
+#define DB_SCHEMA_CHECKOUTS \
+    "CREATE TABLE IF NOT EXISTS checkouts (\n" \
+    "  checkout_id           INTEGER PRIMARY KEY NOT NULL,\n" \
+    "  feature_id            INTEGER NOT NULL REFERENCES features(feature_id)\n" \
+    "                        ON DELETE CASCADE,\n" \
+    "  user                  TEXT NOT NULL,\n" \
+    "  host                  TEXT NOT NULL,\n" \
+    "  display               TEXT,\n" \
+    "  version               TEXT,\n" \
+    "  server_host           TEXT,\n" \
+    "  server_port           TEXT,\n" \
+    "  handle                TEXT,\n" \
+    "  license_count         INTEGER NOT NULL DEFAULT 1,\n" \
+    "  start_timestamp       BIGINT NOT NULL,\n" \
+    "  end_timestamp         BIGINT\n" \
+    ");\n" \
+    "CREATE INDEX IF NOT EXISTS checkouts_feature_idx\n" \
+    "  ON checkouts(feature_id, start_timestamp);\n" \
+    "CREATE INDEX IF NOT EXISTS checkouts_open_idx\n" \
+    "  ON checkouts(end_timestamp);\n"
+
+/*
+ * Likewise the tables used when ingesting license server debug logs:  the
+ * position reached in each log and the license requests that were denied.
+ */
+#define DB_SCHEMA_LOG_INGEST \
+    "CREATE TABLE IF NOT EXISTS log_checkpoints (\n" \
+    "  log_path              TEXT PRIMARY KEY NOT NULL,\n" \
+    "  device                BIGINT NOT NULL,\n" \
+    "  inode                 BIGINT NOT NULL,\n" \
+    "  offset                BIGINT NOT NULL,\n" \
+    "  event_timestamp       BIGINT,\n" \
+    "  updated_timestamp     BIGINT NOT NULL\n" \
+    ");\n" \
+    "CREATE TABLE IF NOT EXISTS denials (\n" \
+    "  feature_id            INTEGER NOT NULL REFERENCES features(feature_id)\n" \
+    "                        ON DELETE CASCADE,\n" \
+    "  user                  TEXT,\n" \
+    "  host                  TEXT,\n" \
+    "  reason                TEXT,\n" \
+    "  is_unsupported        INTEGER NOT NULL DEFAULT 0,\n" \
+    "  event_timestamp       BIGINT NOT NULL\n" \
+    ");\n" \
+    "CREATE INDEX IF NOT EXISTS denials_feature_idx\n" \
+    "  ON denials(feature_id, event_timestamp);\n"
+
+/*
+ * Named properties of the database (e.g. how it stores counts):
+ */
+#define DB_SCHEMA_PROPERTIES \
+    "CREATE TABLE IF NOT EXISTS properties (\n" \
+    "  name                  TEXT PRIMARY KEY NOT NULL,\n" \
+    "  value                 TEXT\n" \
+    ");\n"
+
+/*
+ * Change-only storage of counts:  every commit adds a single row to the
+ * checks table and a feature's counts are stored as a run covering the
+ * consecutive checks in which they did not change.  A run that is still
+ * open (last_check_id NULL) extends through the latest check.  The
+ * expanded_counts view presents the runs in the shape of the counts table.
+ */
+#define DB_SCHEMA_COUNT_RUNS \
+    DB_SCHEMA_PROPERTIES \
+    "CREATE TABLE IF NOT EXISTS checks (\n" \
+    "  check_id              INTEGER PRIMARY KEY NOT NULL,\n" \
+    "  checked_timestamp     BIGINT NOT NULL\n" \
+    ");\n" \
+    "CREATE INDEX IF NOT EXISTS checks_timestamp_idx\n" \
+    "  ON checks(checked_timestamp);\n" \
+    "CREATE TABLE IF NOT EXISTS count_runs (\n" \
+    "  run_id                INTEGER PRIMARY KEY NOT NULL,\n" \
+    "  feature_id            INTEGER NOT NULL REFERENCES features(feature_id)\n" \
+    "                        ON DELETE CASCADE,\n" \
+    "  issued                INTEGER NOT NULL DEFAULT 0,\n" \
+    "  in_use                INTEGER NOT NULL DEFAULT 0,\n" \
+    "  expiration_timestamp  BIGINT,\n" \
+    "  first_check_id        INTEGER NOT NULL,\n" \
+    "  last_check_id         INTEGER\n" \
+    ");\n" \
+    "CREATE INDEX IF NOT EXISTS count_runs_feature_idx\n" \
+    "  ON count_runs(feature_id, first_check_id);\n" \
+    "CREATE INDEX IF NOT EXISTS count_runs_last_check_idx\n" \
+    "  ON count_runs(last_check_id);\n" \
+    "CREATE VIEW IF NOT EXISTS expanded_counts AS\n" \
+    "  SELECT r.feature_id AS feature_id, r.issued AS issued, r.in_use AS in_use,\n" \
+    "         r.expiration_timestamp AS expiration_timestamp, k.checked_timestamp AS checked_timestamp\n" \
+    "    FROM count_runs AS r\n" \
+    "    INNER JOIN checks AS k ON (k.check_id >= r.first_check_id AND\n" \
+    "        k.check_id <= IFNULL(r.last_check_id, (SELECT MAX(check_id) FROM checks)));\n"
+
+/*
+ * Rollups of the counts:  per feature, the number of samples and the
+ * minimum, maximum and sum of the in-use and issued counts (plus the latest
+ * expiration and the first and last check times) over each hour (tier 1),
+ * day (tier 2) and month (tier 3) in local time.  A bucket is identified by
+ * its YYYYMMDDHH, YYYYMMDD or YYYYMM digits.
+ */
+#define DB_SCHEMA_COUNT_ROLLUPS \
+    "CREATE TABLE IF NOT EXISTS count_rollups (\n" \
+    "  tier                  INTEGER NOT NULL,\n" \
+    "  bucket                INTEGER NOT NULL,\n" \
+    "  feature_id            INTEGER NOT NULL REFERENCES features(feature_id)\n" \
+    "                        ON DELETE CASCADE,\n" \
+    "  sample_count          INTEGER NOT NULL,\n" \
+    "  in_use_min            INTEGER NOT NULL,\n" \
+    "  in_use_max            INTEGER NOT NULL,\n" \
+    "  in_use_sum            INTEGER NOT NULL,\n" \
+    "  issued_min            INTEGER NOT NULL,\n" \
+    "  issued_max            INTEGER NOT NULL,\n" \
+    "  issued_sum            INTEGER NOT NULL,\n" \
+    "  expiration_timestamp  BIGINT,\n" \
+    "  first_timestamp       BIGINT NOT NULL,\n" \
+    "  last_timestamp        BIGINT NOT NULL,\n" \
+    "  PRIMARY KEY (tier, bucket, feature_id)\n" \
+    ") WITHOUT ROWID;\n"
+
+/*
+ * Indexes on the counts table for the last-check, per-feature backfill and
+ * time-range queries; the per-feature index covers the backfill query.
+ */
+#define DB_SCHEMA_COUNTS_INDEXES \
+    "CREATE INDEX IF NOT EXISTS counts_timestamp_idx\n" \
+    "  ON counts(checked_timestamp);\n" \
+    "CREATE INDEX IF NOT EXISTS counts_feature_timestamp_idx\n" \
+    "  ON counts(feature_id, checked_timestamp, issued, in_use);\n"
+
+/*
+ * Schema migrations:  the database's version is kept in PRAGMA user_version
+ * and __db_migrations[n] upgrades a database at version n to version n + 1.
+ * Version 0 is the original schema.  New databases are created by __db_schema
+ * at DB_SCHEMA_VERSION directly.
+ */
+static const char   *__db_migrations[] = {
+    /* 0 => 1 */  DB_SCHEMA_COUNTS_INDEXES,
+    /* 1 => 2 */  DB_SCHEMA_PROPERTIES DB_SCHEMA_COUNT_ROLLUPS,
+    NULL
+  };
+
+#define DB_SCHEMA_VERSION ((int)(sizeof(__db_migrations) / sizeof(const char*)) - 1)
+
+static const char   *__db_schema =
+    "CREATE TABLE features (\n"
+    "  feature_id            INTEGER PRIMARY KEY NOT NULL,\n"
+    "  feature_string        TEXT,\n"
+    "  vendor                TEXT,\n"
+    "  version               TEXT\n"
+    ");\n"
+    "CREATE UNIQUE INDEX unique_features_idx\n"
+    "  ON features(vendor, version, feature_string);\n"
+    "CREATE TABLE counts (\n"
+    "  feature_id            INTEGER NOT NULL REFERENCES features(feature_id)\n"
+    "                        ON DELETE CASCADE,\n"
+    "  issued                INTEGER NOT NULL DEFAULT 0,\n"
+    "  in_use                INTEGER NOT NULL DEFAULT 0,\n"
+    "  expiration_timestamp  BIGINT,\n"
+    "  checked_timestamp     BIGINT NOT NULL\n"
+    ");\n"
+    DB_SCHEMA_COUNTS_INDEXES
+    DB_SCHEMA_CHECKOUTS
+    DB_SCHEMA_LOG_INGEST
+    DB_SCHEMA_COUNT_RUNS
+    DB_SCHEMA_COUNT_ROLLUPS
+    "INSERT INTO properties (name, value) VALUES ('count-storage', 'runs');\n"
+    "\n"
+    ;
+
+static const char   *__db_get_features_query =
+    "SELECT feature_id, feature_string, vendor, version FROM features ORDER BY feature_string, vendor, version";
+
+#define DB_QUERY_BASE_NOAGGR \
+    "SELECT f.feature_id, f.vendor, f.version, f.feature_string, c.in_use, c.issued, c.checked_timestamp AS start_timestamp, c.expiration_timestamp AS expiration_timestamp"
+
+#define DB_QUERY_BASE_AGGR \
+    "SELECT f.feature_id, f.vendor, f.version, f.feature_string, MIN(c.in_use) AS in_use_min, MAX(c.in_use) AS in_use_max, AVG(c.in_use) AS in_use_avg, MIN(c.issued) AS issued_min, MAX(c.issued) AS issued_max, AVG(c.issued) AS issued_avg, MIN(c.checked_timestamp) AS start_timestamp, MAX(c.checked_timestamp) AS end_timestamp, MAX(c.expiration_timestamp) AS expiration_timestamp"
+
+#define DB_QUERY_FROM_COUNTS \
+    "  FROM counts AS c" \
+    "  INNER JOIN features AS f ON (f.feature_id = c.feature_id)"
+
+#define DB_QUERY_FROM_EXPANDED_COUNTS \
+    "  FROM expanded_counts AS c" \
+    "  INNER JOIN features AS f ON (f.feature_id = c.feature_id)"
+
+#define DB_QUERY_ORDER_BY \
+    "  ORDER BY start_timestamp ASC, f.vendor, f.version, f.feature_string"
+    
+//
+
+/*
+ * Statements that are used repeatedly get prepared once per lmdb object
+ * and are reset (rather than finalized) after each use:
+ */
+typedef enum {
+  lmdb_stmt_get_feature_by_name = 0,
+  lmdb_stmt_get_feature_by_id,
+  lmdb_stmt_add_feature,
+  lmdb_stmt_add_feature_count,
+  lmdb_stmt_get_last_check_timestamp,
+  lmdb_stmt_get_open_checkouts,
+  lmdb_stmt_add_checkout,
+  lmdb_stmt_end_checkout,
+  lmdb_stmt_get_latest_feature_by_vendor,
+  lmdb_stmt_get_last_counts,
+  lmdb_stmt_get_log_checkpoint,
+  lmdb_stmt_set_log_checkpoint,
+  lmdb_stmt_add_denial,
+  lmdb_stmt_add_check,
+  lmdb_stmt_get_last_check_id,
+  lmdb_stmt_get_open_count_runs,
+  lmdb_stmt_add_count_run,
+  lmdb_stmt_end_count_run,
+  lmdb_stmt_get_last_run_check_timestamp,
+  lmdb_stmt_get_last_run_counts,
+  lmdb_stmt_add_count_rollup_sample,
+  lmdb_stmt_get_last_checked_timestamp,
+  lmdb_stmt_get_last_run_checked_timestamp,
+  lmdb_stmt_get_rollup_hour_keys,
+  lmdb_stmt_add_resolve_tuple,
+  lmdb_stmt_add_resolve_features,
+  lmdb_stmt_get_resolve_features,
+  //
+  lmdb_stmt_max
+} lmdb_stmt;
+
+static const char*  __db_stmt_queries[lmdb_stmt_max] = {
+      [lmdb_stmt_get_feature_by_name] = "SELECT feature_id, feature_string, vendor, version FROM features WHERE feature_string = ?1 AND vendor = ?2 AND version = ?3",
+      [lmdb_stmt_get_feature_by_id] = "SELECT feature_id, feature_string, vendor, version FROM features WHERE feature_id = ?1",
+      [lmdb_stmt_add_feature] = "INSERT INTO features (feature_string, vendor, version) VALUES (?1, ?2, ?3)",
+      [lmdb_stmt_add_feature_count] = "INSERT INTO counts (feature_id, in_use, issued, expiration_timestamp, checked_timestamp) VALUES (?1, ?2, ?3, ?4, ?5)",
+      [lmdb_stmt_get_last_check_timestamp] = "SELECT MAX(checked_timestamp) FROM counts",
+      [lmdb_stmt_get_open_checkouts] = "SELECT checkout_id, feature_id, user, host, display, version, server_host, server_port, handle, license_count, start_timestamp FROM checkouts WHERE end_timestamp IS NULL",
+      [lmdb_stmt_add_checkout] = "INSERT INTO checkouts (feature_id, user, host, display, version, server_host, server_port, handle, license_count, start_timestamp) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10)",
+      [lmdb_stmt_end_checkout] = "UPDATE checkouts SET end_timestamp = ?2 WHERE checkout_id = ?1",
+      [lmdb_stmt_get_latest_feature_by_vendor] = "SELECT feature_id, feature_string, vendor, version FROM features WHERE feature_string = ?1 AND vendor = ?2 ORDER BY feature_id DESC LIMIT 1",
+      [lmdb_stmt_get_last_counts] = "SELECT feature_id, in_use, issued, expiration_timestamp, MAX(checked_timestamp) FROM counts GROUP BY feature_id",
+      [lmdb_stmt_get_log_checkpoint] = "SELECT device, inode, offset, event_timestamp FROM log_checkpoints WHERE log_path = ?1",
+      [lmdb_stmt_set_log_checkpoint] = "INSERT OR REPLACE INTO log_checkpoints (log_path, device, inode, offset, event_timestamp, updated_timestamp) VALUES (?1, ?2, ?3, ?4, ?5, ?6)",
+      [lmdb_stmt_add_denial] = "INSERT INTO denials (feature_id, user, host, reason, is_unsupported, event_timestamp) VALUES (?1, ?2, ?3, ?4, ?5, ?6)",
+      [lmdb_stmt_add_check] = "INSERT INTO checks (checked_timestamp) VALUES (?1)",
+      [lmdb_stmt_get_last_check_id] = "SELECT MAX(check_id) FROM checks",
+      [lmdb_stmt_get_open_count_runs] = "SELECT run_id, feature_id, in_use, issued, expiration_timestamp FROM count_runs WHERE last_check_id IS NULL",
+      [lmdb_stmt_add_count_run] = "INSERT INTO count_runs (feature_id, in_use, issued, expiration_timestamp, first_check_id) VALUES (?1, ?2, ?3, ?4, ?5)",
+      [lmdb_stmt_end_count_run] = "UPDATE count_runs SET last_check_id = ?2 WHERE run_id = ?1",
+      [lmdb_stmt_get_last_run_check_timestamp] = "SELECT MAX(checked_timestamp) FROM checks",
+      [lmdb_stmt_get_last_run_counts] = "SELECT feature_id, in_use, issued, expiration_timestamp, MAX(first_check_id) FROM count_runs GROUP BY feature_id",
+      [lmdb_stmt_get_last_checked_timestamp] = "SELECT MAX(checked_timestamp) FROM counts",
+      [lmdb_stmt_get_last_run_checked_timestamp] = "SELECT MAX(checked_timestamp) FROM checks",
+      [lmdb_stmt_get_rollup_hour_keys] = "SELECT CAST(strftime('%Y%m%d%H', ?1, 'unixepoch', 'localtime') AS INTEGER), CAST(strftime('%Y%m%d%H', ?2, 'unixepoch', 'localtime') AS INTEGER)",
+      [lmdb_stmt_add_resolve_tuple] = "INSERT INTO temp.lmdb_resolve_tuples (feature_string, vendor, version) VALUES (?1, ?2, ?3)",
+      [lmdb_stmt_add_resolve_features] = "INSERT OR IGNORE INTO features (feature_string, vendor, version) SELECT feature_string, vendor, version FROM temp.lmdb_resolve_tuples",
+      [lmdb_stmt_get_resolve_features] = "SELECT f.feature_id, f.feature_string, f.vendor, f.version FROM temp.lmdb_resolve_tuples AS r"
+                                         "  INNER JOIN features AS f ON (f.vendor = r.vendor AND f.version = r.version AND f.feature_string = r.feature_string)",
+      [lmdb_stmt_add_count_rollup_sample] = "INSERT INTO count_rollups (tier, bucket, feature_id, sample_count, in_use_min, in_use_max, in_use_sum, issued_min, issued_max, issued_sum, expiration_timestamp, first_timestamp, last_timestamp)"
+                                            "  SELECT t.tier, h.bucket / t.divisor, ?1, 1, ?3, ?3, ?3, ?4, ?4, ?4, ?5, ?2, ?2"
+                                            "    FROM (SELECT CAST(strftime('%Y%m%d%H', ?2, 'unixepoch', 'localtime') AS INTEGER) AS bucket) AS h,"
+                                            "         (SELECT 1 AS tier, 1 AS divisor UNION ALL SELECT 2, 100 UNION ALL SELECT 3, 10000) AS t"
+                                            "    WHERE 1"
+                                            "  ON CONFLICT (tier, bucket, feature_id) DO UPDATE SET"
+                                            "    sample_count = sample_count + 1,"
+                                            "    in_use_min = MIN(in_use_min, excluded.in_use_min), in_use_max = MAX(in_use_max, excluded.in_use_max), in_use_sum = in_use_sum + excluded.in_use_sum,"
+                                            "    issued_min = MIN(issued_min, excluded.issued_min), issued_max = MAX(issued_max, excluded.issued_max), issued_sum = issued_sum + excluded.issued_sum,"
+                                            "    expiration_timestamp = MAX(IFNULL(expiration_timestamp, excluded.expiration_timestamp), IFNULL(excluded.expiration_timestamp, expiration_timestamp)),"
+                                            "    first_timestamp = MIN(first_timestamp, excluded.first_timestamp), last_timestamp = MAX(last_timestamp, excluded.last_timestamp)",
+    };
+
+//
+
+/*
+ * An open checkout session.  The key (feature id, start time, and the
+ * user/host/display/server/handle strings, each NUL-terminated) is stored
+ * inline after the struct, followed by the version string; the string
+ * pointers in checkout point into that storage.
+ */
+typedef struct _lmdb_checkout_session {
+  struct _lmdb_checkout_session *link;
+  unsigned int                  hash;
+  int                           feature_id;
+  sqlite3_int64                 checkout_id;      /* 0 => not yet in the database */
+  sqlite3_int64                 new_checkout_id;  /* written by an uncommitted transaction */
+  unsigned int                  last_seen;        /* poll generation */
+  bool                          is_ended;
+  bool                          is_end_written;   /* ...by an uncommitted transaction */
+  lmdb_checkout_t               checkout;
+  size_t                        key_len;
+  char                          key[];
+} lmdb_checkout_session;
+
+typedef struct {
+  unsigned int                  generation;
+  unsigned int                  count, capacity;
+  lmdb_checkout_session         **buckets;
+  char                          *scratch;
+  size_t                        scratch_capacity;
+} lmdb_checkout_sessions;
+
+//
+
+#ifndef LMDB_CHECKOUT_SESSIONS_MIN_CAPACITY
+#define LMDB_CHECKOUT_SESSIONS_MIN_CAPACITY   256
+#endif
+
+lmdb_checkout_sessions*
+__lmdb_checkout_sessions_alloc(void)
+{
+  lmdb_checkout_sessions  *new_sessions = malloc(sizeof(lmdb_checkout_sessions));
+  
+  if ( new_sessions ) {
+    memset(new_sessions, 0, sizeof(lmdb_checkout_sessions));
+    new_sessions->capacity = LMDB_CHECKOUT_SESSIONS_MIN_CAPACITY;
+    new_sessions->buckets = calloc(new_sessions->capacity, sizeof(lmdb_checkout_session*));
+    if ( ! new_sessions->buckets ) {
+      free((void*)new_sessions);
+      new_sessions = NULL;
+    }
+  }
+  return new_sessions;
+}
+
+//
+
+void
+__lmdb_checkout_sessions_dealloc(
+  lmdb_checkout_sessions  *sessions
+)
+{
+  unsigned int            i;
+  
+  for ( i = 0; i < sessions->capacity; i++ ) {
+    lmdb_checkout_session *session = sessions->buckets[i];
+    
+    while ( session ) {
+      lmdb_checkout_session *next = session->link;
+      
+      free((void*)session);
+      session = next;
+    }
+  }
+  if ( sessions->scratch ) free((void*)sessions->scratch);
+  free((void*)sessions->buckets);
+  free((void*)sessions);
+}
+
+//
+
+/*
+ * Build the session key for a checkout in the scratch buffer; returns the
+ * key length (or zero on error).  The version string is appended after the
+ * key, so the scratch buffer holds exactly what a new session will store.
+ */
+size_t
+__lmdb_checkout_sessions_make_key(
+  lmdb_checkout_sessions  *sessions,
+  int                     feature_id,
+  const lmdb_checkout_t   *the_checkout,
+  size_t                  *total_len
+)
+{
+  const char              *strings[6] = {
+                                the_checkout->user, the_checkout->host, the_checkout->display,
+                                the_checkout->server_host, the_checkout->server_port, the_checkout->handle
+                              };
+  size_t                  lengths[6];
+  size_t                  version_len = strlen(the_checkout->version ? the_checkout->version : "") + 1;
+  size_t                  key_len = sizeof(int) + sizeof(sqlite3_int64);
+  sqlite3_int64           start_ts = (sqlite3_int64)the_checkout->start_timestamp;
+  char                    *p;
+  int                     i;
+  
+  for ( i = 0; i < 6; i++ ) {
+    if ( ! strings[i] ) strings[i] = "";
+    lengths[i] = strlen(strings[i]) + 1;
+    key_len += lengths[i];
+  }
+  if ( key_len + version_len > sessions->scratch_capacity ) {
+    size_t                new_capacity = sessions->scratch_capacity ? sessions->scratch_capacity : 256;
+    
+    while ( new_capacity < key_len + version_len ) new_capacity *= 2;
+    if ( ! (p = realloc(sessions->scratch, new_capacity)) ) return 0;
+    sessions->scratch = p;
+    sessions->scratch_capacity = new_capacity;
+  }
+  p = sessions->scratch;
+  memcpy(p, &feature_id, sizeof(int)); p += sizeof(int);
+  memcpy(p, &start_ts, sizeof(start_ts)); p += sizeof(start_ts);
+  for ( i = 0; i < 6; i++ ) {
+    memcpy(p, strings[i], lengths[i]);
+    p += lengths[i];
+  }
+  memcpy(p, the_checkout->version ? the_checkout->version : "", version_len);
+  *total_len = key_len + version_len;
+  return key_len;
+}
+
+//
+
+unsigned int
+__lmdb_checkout_sessions_hash(
+  const char              *key,
+  size_t                  key_len
+)
+{
+  /* FNV-1a */
+  unsigned int            h = 2166136261u;
+  
+  while ( key_len-- ) {
+    h ^= (unsigned char)*key++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+//
+
+lmdb_checkout_session*
+__lmdb_checkout_sessions_lookup(
+  lmdb_checkout_sessions  *sessions,
+  unsigned int            hash,
+  const char              *key,
+  size_t                  key_len
+)
+{
+  lmdb_checkout_session   *session = sessions->buckets[hash & (sessions->capacity - 1)];
+  
+  while ( session ) {
+    if ( (session->hash == hash) && (session->key_len == key_len) && (memcmp(session->key, key, key_len) == 0) ) break;
+    session = session->link;
+  }
+  return session;
+}
+
+//
+
+void
+__lmdb_checkout_sessions_grow(
+  lmdb_checkout_sessions  *sessions
+)
+{
+  unsigned int            new_capacity = 2 * sessions->capacity, i;
+  lmdb_checkout_session   **new_buckets = calloc(new_capacity, sizeof(lmdb_checkout_session*));
+  
+  // Failing to grow just means longer chains:
+  if ( ! new_buckets ) return;
+  for ( i = 0; i < sessions->capacity; i++ ) {
+    lmdb_checkout_session *session = sessions->buckets[i];
+    
+    while ( session ) {
+      lmdb_checkout_session *next = session->link;
+      
+      session->link = new_buckets[session->hash & (new_capacity - 1)];
+      new_buckets[session->hash & (new_capacity - 1)] = session;
+      session = next;
+    }
+  }
+  free((void*)sessions->buckets);
+  sessions->buckets = new_buckets;
+  sessions->capacity = new_capacity;
+}
+
+//
+
+/*
+ * Add a session using the key (and version) currently in the scratch
+ * buffer.
+ */
+lmdb_checkout_session*
+__lmdb_checkout_sessions_insert(
+  lmdb_checkout_sessions  *sessions,
+  unsigned int            hash,
+  size_t                  key_len,
+  size_t                  total_len,
+  int                     feature_id,
+  const lmdb_checkout_t   *the_checkout
+)
+{
+  lmdb_checkout_session   *new_session = malloc(sizeof(lmdb_checkout_session) + total_len);
+  
+  if ( new_session ) {
+    const char            *p;
+    
+    memset(new_session, 0, sizeof(lmdb_checkout_session));
+    new_session->hash = hash;
+    new_session->feature_id = feature_id;
+    new_session->key_len = key_len;
+    memcpy(new_session->key, sessions->scratch, total_len);
+    
+    p = new_session->key + sizeof(int) + sizeof(sqlite3_int64);
+    new_session->checkout.user = p; p += strlen(p) + 1;
+    new_session->checkout.host = p; p += strlen(p) + 1;
+    new_session->checkout.display = p; p += strlen(p) + 1;
+    new_session->checkout.server_host = p; p += strlen(p) + 1;
+    new_session->checkout.server_port = p; p += strlen(p) + 1;
+    new_session->checkout.handle = p; p += strlen(p) + 1;
+    new_session->checkout.version = p;
+    new_session->checkout.start_timestamp = the_checkout->start_timestamp;
+    new_session->checkout.license_count = the_checkout->license_count;
+    
+    if ( 4 * (sessions->count + 1) > 3 * sessions->capacity ) __lmdb_checkout_sessions_grow(sessions);
+    new_session->link = sessions->buckets[hash & (sessions->capacity - 1)];
+    sessions->buckets[hash & (sessions->capacity - 1)] = new_session;
+    sessions->count++;
+  }
+  return new_session;
+}
+
+//
+
+/*
+ * The open count run of each feature (see DB_SCHEMA_COUNT_RUNS), indexed
+ * by feature id.  The table mirrors the database as of the check with id
+ * last_check_id; it is reloaded when another writer has added checks since
+ * then or when a transaction is rolled back.
+ */
+typedef struct {
+  sqlite3_int64                 run_id;           /* 0 => no open run */
+  int                           in_use, issued;
+  time_t                        expiration_date;
+  unsigned int                  last_seen;        /* commit generation */
+} lmdb_open_count_run;
+
+typedef struct {
+  bool                          is_loaded;
+  sqlite3_int64                 last_check_id;
+  sqlite3_int64                 check_id;         /* 0 => no check added by this commit */
+  unsigned int                  generation;
+  unsigned int                  capacity;
+  lmdb_open_count_run           *open_runs;
+} lmdb_count_runs;
+
+//
+
+#ifndef LMDB_COUNT_RUNS_MIN_CAPACITY
+#define LMDB_COUNT_RUNS_MIN_CAPACITY   64
+#endif
+
+lmdb_count_runs*
+__lmdb_count_runs_alloc(void)
+{
+  lmdb_count_runs   *runs = malloc(sizeof(lmdb_count_runs));
+  
+  if ( runs ) {
+    memset(runs, 0, sizeof(lmdb_count_runs));
+  }
+  return runs;
+}
+
+//
+
+void
+__lmdb_count_runs_dealloc(
+  lmdb_count_runs   *runs
+)
+{
+  if ( runs->open_runs ) free((void*)runs->open_runs);
+  free((void*)runs);
+}
+
+//
+
+lmdb_open_count_run*
+__lmdb_count_runs_lookup(
+  lmdb_count_runs   *runs,
+  int               feature_id
+)
+{
+  if ( feature_id < 0 ) return NULL;
+  if ( (unsigned int)feature_id >= runs->capacity ) {
+    unsigned int          new_capacity = runs->capacity ? runs->capacity : LMDB_COUNT_RUNS_MIN_CAPACITY;
+    lmdb_open_count_run   *new_open_runs;
+    
+    while ( new_capacity <= (unsigned int)feature_id ) new_capacity *= 2;
+    new_open_runs = realloc(runs->open_runs, new_capacity * sizeof(lmdb_open_count_run));
+    if ( ! new_open_runs ) return NULL;
+    memset(new_open_runs + runs->capacity, 0, (new_capacity - runs->capacity) * sizeof(lmdb_open_count_run));
+    runs->open_runs = new_open_runs;
+    runs->capacity = new_capacity;
+  }
+  return &runs->open_runs[feature_id];
+}
+
+//
+
+#define LMDB_BUSY_MAX_DELAY_MS 100
+
+/*
+ * Busy handler:  keep retrying until the timeout (in milliseconds, passed as
+ * the context) has elapsed, sleeping 1, 2, 4, ... ms between attempts up to
+ * a maximum of LMDB_BUSY_MAX_DELAY_MS.
+ */
+int
+__lmdb_busy_handler(
+  void              *context,
+  int               count
+)
+{
+  long              timeout = (long)(intptr_t)context;
+  long              elapsed, delay;
+  struct timespec   nap;
+  
+  if ( count < 7 ) {
+    delay = 1L << count;
+    elapsed = delay - 1;
+  } else {
+    delay = LMDB_BUSY_MAX_DELAY_MS;
+    elapsed = 127 + (long)(count - 7) * LMDB_BUSY_MAX_DELAY_MS;
+  }
+  if ( elapsed >= timeout ) return 0;
+  if ( delay > timeout - elapsed ) delay = timeout - elapsed;
+  nap.tv_sec = delay / 1000;
+  nap.tv_nsec = (delay % 1000) * 1000000L;
+  nanosleep(&nap, NULL);
+  return 1;
+}
+
+//
+
+typedef struct {
+  pthread_t         thread;
+  pthread_mutex_t   lock;
+  pthread_cond_t    wakeup;
+  bool              should_exit;
+  int               interval;
+  sqlite3           *db_handle;
+} lmdb_checkpointer;
+
+//
+
+void*
+__lmdb_checkpointer_thread(
+  void              *context
+)
+{
+  lmdb_checkpointer *the_checkpointer = (lmdb_checkpointer*)context;
+  
+  pthread_mutex_lock(&the_checkpointer->lock);
+  while ( ! the_checkpointer->should_exit ) {
+    struct timespec deadline;
+    int             rc = 0;
+    
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += the_checkpointer->interval;
+    while ( ! the_checkpointer->should_exit && (rc != ETIMEDOUT) ) {
+      rc = pthread_cond_timedwait(&the_checkpointer->wakeup, &the_checkpointer->lock, &deadline);
+    }
+    if ( ! the_checkpointer->should_exit ) {
+      int           log_frames = 0, checkpointed_frames = 0;
+      
+      //
+      // A passive checkpoint copies whatever it can without waiting on
+      // readers or the writer:
+      //
+      pthread_mutex_unlock(&the_checkpointer->lock);
+      rc = sqlite3_wal_checkpoint_v2(the_checkpointer->db_handle, NULL, SQLITE_CHECKPOINT_PASSIVE, &log_frames, &checkpointed_frames);
+      if ( rc == SQLITE_OK ) {
+        LMDEBUG("checkpointed %d of %d write-ahead log frames", checkpointed_frames, log_frames);
+      } else if ( rc != SQLITE_BUSY ) {
+        lmlogf(lmlog_level_warn, "failed to checkpoint write-ahead log: %s", sqlite3_errmsg(the_checkpointer->db_handle));
+      }
+      pthread_mutex_lock(&the_checkpointer->lock);
+    }
+  }
+  pthread_mutex_unlock(&the_checkpointer->lock);
+  return NULL;
+}
+
+//
+
+lmdb_checkpointer*
+__lmdb_checkpointer_alloc(
+  const char        *db_path,
+  int               interval
+)
+{
+  lmdb_checkpointer *new_checkpointer = malloc(sizeof(lmdb_checkpointer));
+  
+  if ( new_checkpointer ) {
+    new_checkpointer->should_exit = false;
+    new_checkpointer->interval = interval;
+    //
+    // The connection doesn't see the write-ahead log until it has read the
+    // database, so query the journaling mode right away:
+    //
+    if ( (sqlite3_open_v2(db_path, &new_checkpointer->db_handle, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) ||
+         (sqlite3_exec(new_checkpointer->db_handle, "PRAGMA journal_mode", NULL, NULL, NULL) != SQLITE_OK)
+    ) {
+      lmlogf(lmlog_level_warn, "failed to open checkpoint connection to database '%s'", db_path);
+      sqlite3_close(new_checkpointer->db_handle);
+      free((void*)new_checkpointer);
+      return NULL;
+    }
+    pthread_mutex_init(&new_checkpointer->lock, NULL);
+    pthread_cond_init(&new_checkpointer->wakeup, NULL);
+    if ( pthread_create(&new_checkpointer->thread, NULL, __lmdb_checkpointer_thread, new_checkpointer) != 0 ) {
+      lmlog(lmlog_level_warn, "failed to start checkpoint thread");
+      pthread_cond_destroy(&new_checkpointer->wakeup);
+      pthread_mutex_destroy(&new_checkpointer->lock);
+      sqlite3_close(new_checkpointer->db_handle);
+      free((void*)new_checkpointer);
+      return NULL;
+    }
+  }
+  return new_checkpointer;
+}
+
+//
+
+void
+__lmdb_checkpointer_dealloc(
+  lmdb_checkpointer *the_checkpointer
+)
+{
+  pthread_mutex_lock(&the_checkpointer->lock);
+  the_checkpointer->should_exit = true;
+  pthread_cond_signal(&the_checkpointer->wakeup);
+  pthread_mutex_unlock(&the_checkpointer->lock);
+  pthread_join(the_checkpointer->thread, NULL);
+  
+  pthread_cond_destroy(&the_checkpointer->wakeup);
+  pthread_mutex_destroy(&the_checkpointer->lock);
+  sqlite3_close(the_checkpointer->db_handle);
+  free((void*)the_checkpointer);
+}
+
+//
+
+/*
+ * Statements built at runtime (reports, feature lookups) are kept prepared
+ * in a small cache keyed by their SQL text.  Values are bound rather than
+ * written into the SQL, so the text only varies with the shape of the query
+ * and callers that repeat the same shapes never compile a statement twice.
+ * A statement is held exclusively from __lmdb_query_cache_get() until it is
+ * handed back to __lmdb_query_cache_put().
+ */
+#ifndef LMDB_QUERY_CACHE_SIZE
+#define LMDB_QUERY_CACHE_SIZE   32
+#endif
+
+typedef struct {
+  char              *query_str;
+  unsigned int      hash;
+  sqlite3_stmt      *stmt;
+  bool              is_in_use;
+  unsigned long     last_used;
+} lmdb_query_cache_entry;
+
+typedef struct {
+  unsigned int            count;
+  unsigned long           clock;
+  lmdb_query_cache_entry  entries[LMDB_QUERY_CACHE_SIZE];
+} lmdb_query_cache;
+
+//
+
+typedef struct _lmdb {
+  unsigned int      ref_count;
+  sqlite3           *db_handle;
+  char              *db_path;
+#ifndef LMDB_DISABLE_RRDTOOL
+  lmdb_rrd_journal  *rrd_journal;
+#endif
+  lmtsdb_ref        tsdb;
+  bool              is_read_only;
+  lmfeature_pool_ref  feature_pool;
+  lmfeatureset_ref  features;
+  sqlite3_stmt      *stmts[lmdb_stmt_max];
+  unsigned int      transaction_depth;
+  bool              is_rollback_only;
+  lmdb_checkout_sessions  *checkouts;
+  lmdb_count_storage      count_storage;
+  lmdb_count_runs         *count_runs;
+  lmdb_checkpointer       *checkpointer;
+  bool                    has_rollups;
+  lmdb_query_cache        query_cache;
+} lmdb;
+
+//
+
+lmdb*
+__lmdb_alloc(
+  const char        *db_path
+)
+{
+  size_t            db_path_len = 1 + (db_path ? strlen(db_path) : 0);
+  lmdb              *new_db = malloc(sizeof(lmdb) + db_path_len);
+
+  if ( new_db ) {
+    new_db->ref_count = 1;
+    new_db->db_handle = NULL;
+    new_db->db_path = (void*)new_db + sizeof(lmdb);
+    if ( db_path ) {
+      strcpy(new_db->db_path, db_path);
+    } else {
+      new_db->db_path[0] = '\0';
+    }
+#ifndef LMDB_DISABLE_RRDTOOL
+    new_db->rrd_journal = NULL;
+#endif
+    new_db->tsdb = NULL;
+    new_db->feature_pool = lmfeature_pool_create();
+    new_db->features = lmfeatureset_create();
+    memset(new_db->stmts, 0, sizeof(new_db->stmts));
+    new_db->transaction_depth = 0;
+    new_db->is_rollback_only = false;
+    new_db->checkouts = NULL;
+    new_db->count_storage = lmdb_count_storage_rows;
+    new_db->count_runs = NULL;
+    new_db->checkpointer = NULL;
+    new_db->has_rollups = false;
+    memset(&new_db->query_cache, 0, sizeof(new_db->query_cache));
+  }
+  return new_db;
+}
+
+
+//
+
+void
+__lmdb_dealloc(
+  lmdb      *the_db
+)
+{
+#ifndef LMDB_DISABLE_RRDTOOL
+  if ( the_db->rrd_journal ) __lmdb_rrd_journal_dealloc(the_db->rrd_journal);
+#endif
+  if ( the_db->tsdb ) lmtsdb_close(the_db->tsdb);
+  //
+  // The checkpoint connection goes first so that closing db_handle (the
+  // last connection) checkpoints and removes the write-ahead log:
+  //
+  if ( the_db->checkpointer ) __lmdb_checkpointer_dealloc(the_db->checkpointer);
+  if ( the_db->db_handle ) {
+    unsigned int  i = 0;
+    
+    while ( i < lmdb_stmt_max ) {
+      if ( the_db->stmts[i] ) sqlite3_finalize(the_db->stmts[i]);
+      i++;
+    }
+    i = 0;
+    while ( i < the_db->query_cache.count ) {
+      sqlite3_finalize(the_db->query_cache.entries[i].stmt);
+      free((void*)the_db->query_cache.entries[i].query_str);
+      i++;
+    }
+    sqlite3_close(the_db->db_handle);
+  }
+  if ( the_db->features ) lmfeatureset_release(the_db->features);
+  if ( the_db->feature_pool ) lmfeature_pool_release(the_db->feature_pool);
+  if ( the_db->checkouts ) __lmdb_checkout_sessions_dealloc(the_db->checkouts);
+  if ( the_db->count_runs ) __lmdb_count_runs_dealloc(the_db->count_runs);
+  free((void*)the_db);
+}
+
+//
+
+sqlite3_stmt*
+__lmdb_get_stmt(
+  lmdb_ref      the_db,
+  lmdb_stmt     which_stmt
+)
+{
+  if ( ! the_db->stmts[which_stmt] ) {
+    int         rc;
+    
+#if SQLITE_VERSION_NUMBER >= 3020000
+    rc = sqlite3_prepare_v3(the_db->db_handle, __db_stmt_queries[which_stmt], -1, SQLITE_PREPARE_PERSISTENT, &the_db->stmts[which_stmt], NULL);
+#else
+    rc = sqlite3_prepare_v2(the_db->db_handle, __db_stmt_queries[which_stmt], -1, &the_db->stmts[which_stmt], NULL);
+#endif
+    if ( rc != SQLITE_OK ) {
+      lmlogf(lmlog_level_warn, "failed while preparing query '%s': %s", __db_stmt_queries[which_stmt], sqlite3_errmsg(the_db->db_handle));
+      the_db->stmts[which_stmt] = NULL;
+    }
+  }
+  return the_db->stmts[which_stmt];
+}
+
+//
+
+void
+__lmdb_put_stmt(
+  sqlite3_stmt  *stmt
+)
+{
+  if ( stmt ) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+  }
+}
+
+//
+
+unsigned int
+__lmdb_query_cache_hash(
+  const char    *query_str
+)
+{
+  unsigned int  hash = 2166136261U;
+  
+  while ( *query_str ) hash = (hash ^ (unsigned char)*query_str++) * 16777619U;
+  return hash;
+}
+
+//
+
+sqlite3_stmt*
+__lmdb_query_cache_get(
+  lmdb_ref                the_db,
+  const char              *query_str
+)
+{
+  lmdb_query_cache        *cache = &the_db->query_cache;
+  lmdb_query_cache_entry  *entry = NULL;
+  unsigned int            hash = __lmdb_query_cache_hash(query_str), i = 0;
+  bool                    is_busy = false;
+  sqlite3_stmt            *stmt;
+  int                     rc;
+  
+  while ( i < cache->count ) {
+    entry = &cache->entries[i++];
+    if ( (entry->hash == hash) && (strcmp(entry->query_str, query_str) == 0) ) {
+      if ( ! entry->is_in_use ) {
+        entry->is_in_use = true;
+        entry->last_used = ++cache->clock;
+        LMDEBUG("reusing prepared query %p", entry->stmt);
+        return entry->stmt;
+      }
+      is_busy = true;
+      break;
+    }
+  }
+  
+  LMDEBUG("QUERY:  %s\n", query_str);
+#if SQLITE_VERSION_NUMBER >= 3020000
+  rc = sqlite3_prepare_v3(the_db->db_handle, query_str, -1, (is_busy ? 0 : SQLITE_PREPARE_PERSISTENT), &stmt, NULL);
+#else
+  rc = sqlite3_prepare_v2(the_db->db_handle, query_str, -1, &stmt, NULL);
+#endif
+  if ( rc != SQLITE_OK ) {
+    lmlogf(lmlog_level_warn, "failed while preparing query '%s': %s", query_str, sqlite3_errmsg(the_db->db_handle));
+    return NULL;
+  }
+  
+  //
+  // A query that is already being used by someone else gets a statement of
+  // its own (finalized when it is put back).  Otherwise, take a free slot or
+  // evict the least-recently used statement that isn't in use:
+  //
+  if ( is_busy ) return stmt;
+  entry = NULL;
+  if ( cache->count < LMDB_QUERY_CACHE_SIZE ) {
+    entry = &cache->entries[cache->count++];
+  } else {
+    i = 0;
+    while ( i < cache->count ) {
+      if ( ! cache->entries[i].is_in_use && (! entry || (cache->entries[i].last_used < entry->last_used)) ) entry = &cache->entries[i];
+      i++;
+    }
+    if ( ! entry ) return stmt;
+    sqlite3_finalize(entry->stmt);
+    free((void*)entry->query_str);
+  }
+  if ( ! (entry->query_str = strdup(query_str)) ) {
+    // Drop the slot:
+    *entry = cache->entries[--cache->count];
+    return stmt;
+  }
+  entry->hash = hash;
+  entry->stmt = stmt;
+  entry->is_in_use = true;
+  entry->last_used = ++cache->clock;
+  return stmt;
+}
+
+//
+
+void
+__lmdb_query_cache_put(
+  lmdb_ref                the_db,
+  sqlite3_stmt            *stmt
+)
+{
+  lmdb_query_cache        *cache = &the_db->query_cache;
+  unsigned int            i = 0;
+  
+  if ( ! stmt ) return;
+  while ( i < cache->count ) {
+    if ( cache->entries[i].stmt == stmt ) {
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+      cache->entries[i].is_in_use = false;
+      return;
+    }
+    i++;
+  }
+  sqlite3_finalize(stmt);
+}
+
+//
+
+/*
+ * The SQL for a predicate either refers to the value of each test through a
+ * named parameter -- :v1, :v2, ... numbered in the order the tests are
+ * encountered, starting after *bind_index -- which __lmdb_predicate_bind()
+ * then supplies, or (with a NULL bind_index) quotes the values in-line.
+ */
+bool __lmdb_predicate_append_sql(strbuf_ref sql, lmdb_predicate_ref the_predicate, unsigned int *bind_index);
+bool __lmdb_predicate_bind(lmdb_predicate_ref the_predicate, sqlite3_stmt *stmt, unsigned int *bind_index);
+
+//
+
+bool
+__lmdb_exec_simple(
+  lmdb_ref      the_db,
+  const char    *sql
+)
+{
+  char          *errmsg = NULL;
+  
+  if ( sqlite3_exec(the_db->db_handle, sql, NULL, NULL, &errmsg) != SQLITE_OK ) {
+    lmlogf(lmlog_level_warn, "failed to execute '%s': %s", sql, errmsg ? errmsg : sqlite3_errmsg(the_db->db_handle));
+    if ( errmsg ) sqlite3_free(errmsg);
+    return false;
+  }
+  return true;
+}
+
+//
+
+bool
+__lmdb_transaction_begin(
+  lmdb_ref      the_db
+)
+{
+  if ( the_db->transaction_depth == 0 ) {
+    if ( ! __lmdb_exec_simple(the_db, "BEGIN IMMEDIATE") ) return false;
+  }
+  the_db->transaction_depth++;
+  return true;
+}
+
+//
+
+void __lmdb_checkouts_finish_commit(lmdb_ref the_db, bool was_committed);
+
+bool
+__lmdb_transaction_end(
+  lmdb_ref      the_db,
+  bool          should_commit
+)
+{
+  bool          rc = true;
+  
+  if ( the_db->transaction_depth == 0 ) return false;
+  
+  //
+  // A nested transaction that is not committed dooms the one it is part
+  // of:  whatever the outermost one is asked to do, it rolls back.
+  //
+  if ( ! should_commit ) the_db->is_rollback_only = true;
+  if ( --the_db->transaction_depth > 0 ) return ! the_db->is_rollback_only;
+  
+  if ( ! the_db->is_rollback_only ) {
+    rc = __lmdb_exec_simple(the_db, "COMMIT");
+    if ( ! rc ) __lmdb_exec_simple(the_db, "ROLLBACK");
+  } else {
+    __lmdb_exec_simple(the_db, "ROLLBACK");
+    rc = false;
+  }
+  the_db->is_rollback_only = false;
+  
+  // The open count runs may no longer match the database:
+  if ( ! rc && the_db->count_runs ) the_db->count_runs->is_loaded = false;
+#ifndef LMDB_DISABLE_RRDTOOL
+  // Committed points go to the RRD journal:
+  if ( the_db->rrd_journal ) __lmdb_rrd_journal_write_pending(the_db->rrd_journal, rc);
+#endif
+  // ...and the time-series store keeps only what was committed:
+  if ( the_db->tsdb ) {
+    if ( rc ) {
+      lmtsdb_sync(the_db->tsdb);
+    } else {
+      lmtsdb_discard(the_db->tsdb);
+    }
+  }
+  // ...and what was written is final only now:
+  lmfeatureset_finish_staged(the_db->features, rc);
+  if ( the_db->checkouts ) __lmdb_checkouts_finish_commit(the_db, rc);
+  return rc;
+}
+
+//
+
+bool
+__lmdb_add_feature_count_row(
+  lmdb_ref      the_db,
+  lmfeature_ref the_feature,
+  time_t        check_timestamp
+)
+{
+	//
+	// All SQLite result codes are positive, so we use
+	// -1 to indicate failue prior to sqlite3_step()
+	// and -2 to mean that there was no 
+	int           rc = -1;
+  sqlite3_stmt  *stmt = __lmdb_get_stmt(the_db, lmdb_stmt_add_feature_count);
+  sqlite3_int64 db_ts;
+  time_t        raw_ts;
+  
+  if ( ! stmt ) goto exit_on_error;
+  if ( sqlite3_bind_int(stmt, 1, lmfeature_get_feature_id(the_feature)) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int(stmt, 2, lmfeature_get_in_use(the_feature)) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int(stmt, 3, lmfeature_get_issued(the_feature)) != SQLITE_OK ) goto exit_on_error;
+  
+  raw_ts = lmfeature_get_expiration_date(the_feature);
+  if ( raw_ts != lmfeature_no_expiration ) {
+    db_ts = (sqlite3_int64)raw_ts;
+    if ( sqlite3_bind_int64(stmt, 4, db_ts) != SQLITE_OK ) goto exit_on_error;
+  } else {
+    if ( sqlite3_bind_null(stmt, 4) != SQLITE_OK ) goto exit_on_error;
+  }
+  
+  db_ts = (sqlite3_int64)check_timestamp;
+  if ( sqlite3_bind_int64(stmt, 5, db_ts) != SQLITE_OK ) goto exit_on_error;
+  
+  rc = sqlite3_step(stmt);
+  if ( rc == SQLITE_DONE ) {
+    rc = 0;
+  }
+
+exit_on_error:
+  __lmdb_put_stmt(stmt);
+  return rc ? false : true;
+}
+
+//
+
+/*
+ * Fold a feature's counts into the hourly, daily and monthly rollups that
+ * contain check_timestamp.
+ */
+bool
+__lmdb_add_feature_count_rollups(
+  lmdb_ref      the_db,
+  lmfeature_ref the_feature,
+  time_t        check_timestamp
+)
+{
+  int           rc = -1;
+  sqlite3_stmt  *stmt = __lmdb_get_stmt(the_db, lmdb_stmt_add_count_rollup_sample);
+  time_t        raw_ts;
+  
+  if ( ! stmt ) goto exit_on_error;
+  if ( sqlite3_bind_int(stmt, 1, lmfeature_get_feature_id(the_feature)) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 2, (sqlite3_int64)check_timestamp) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int(stmt, 3, lmfeature_get_in_use(the_feature)) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int(stmt, 4, lmfeature_get_issued(the_feature)) != SQLITE_OK ) goto exit_on_error;
+  
+  raw_ts = lmfeature_get_expiration_date(the_feature);
+  if ( raw_ts != lmfeature_no_expiration ) {
+    if ( sqlite3_bind_int64(stmt, 5, (sqlite3_int64)raw_ts) != SQLITE_OK ) goto exit_on_error;
+  } else {
+    if ( sqlite3_bind_null(stmt, 5) != SQLITE_OK ) goto exit_on_error;
+  }
+  
+  rc = sqlite3_step(stmt);
+  if ( rc == SQLITE_DONE ) {
+    rc = 0;
+  } else {
+    lmlogf(lmlog_level_error, "failed to update count rollups: %s", sqlite3_errmsg(the_db->db_handle));
+  }
+
+exit_on_error:
+  __lmdb_put_stmt(stmt);
+  return rc ? false : true;
+}
+
+//
+
+bool
+__lmdb_count_runs_load(
+  lmdb_ref          the_db
+)
+{
+  lmdb_count_runs   *runs = the_db->count_runs;
+  sqlite3_stmt      *stmt = __lmdb_get_stmt(the_db, lmdb_stmt_get_open_count_runs);
+  int               rc;
+  
+  if ( ! stmt ) return false;
+  if ( runs->open_runs ) memset(runs->open_runs, 0, runs->capacity * sizeof(lmdb_open_count_run));
+  runs->generation = 0;
+  while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
+    lmdb_open_count_run *open_run = __lmdb_count_runs_lookup(runs, sqlite3_column_int(stmt, 1));
+    
+    if ( ! open_run ) break;
+    open_run->run_id = sqlite3_column_int64(stmt, 0);
+    open_run->in_use = sqlite3_column_int(stmt, 2);
+    open_run->issued = sqlite3_column_int(stmt, 3);
+    open_run->expiration_date = (sqlite3_column_type(stmt, 4) == SQLITE_NULL) ? lmfeature_no_expiration : (time_t)sqlite3_column_int64(stmt, 4);
+  }
+  __lmdb_put_stmt(stmt);
+  if ( rc != SQLITE_DONE ) {
+    lmlogf(lmlog_level_warn, "failed while loading open count runs: %s", sqlite3_errmsg(the_db->db_handle));
+    return false;
+  }
+  runs->is_loaded = true;
+  return true;
+}
+
+//
+
+bool
+__lmdb_count_runs_add_check(
+  lmdb_ref          the_db,
+  time_t            check_timestamp
+)
+{
+  lmdb_count_runs   *runs = the_db->count_runs;
+  sqlite3_stmt      *stmt;
+  sqlite3_int64     last_check_id = 0;
+  int               rc;
+  
+  //
+  // If some other writer added checks since our last commit, our open
+  // runs are stale:
+  //
+  if ( ! (stmt = __lmdb_get_stmt(the_db, lmdb_stmt_get_last_check_id)) ) return false;
+  rc = sqlite3_step(stmt);
+  if ( rc == SQLITE_ROW ) last_check_id = sqlite3_column_int64(stmt, 0);
+  __lmdb_put_stmt(stmt);
+  if ( rc != SQLITE_ROW ) return false;
+  
+  if ( ! runs->is_loaded || (last_check_id != runs->last_check_id) ) {
+    if ( ! __lmdb_count_runs_load(the_db) ) return false;
+    runs->last_check_id = last_check_id;
+  }
+  
+  if ( ! (stmt = __lmdb_get_stmt(the_db, lmdb_stmt_add_check)) ) return false;
+  if ( sqlite3_bind_int64(stmt, 1, (sqlite3_int64)check_timestamp) == SQLITE_OK ) {
+    rc = sqlite3_step(stmt);
+  } else {
+    rc = SQLITE_ERROR;
+  }
+  __lmdb_put_stmt(stmt);
+  if ( rc != SQLITE_DONE ) return false;
+  
+  runs->check_id = sqlite3_last_insert_rowid(the_db->db_handle);
+  runs->generation++;
+  return true;
+}
+
+//
+
+bool
+__lmdb_count_runs_end_run(
+  lmdb_ref              the_db,
+  lmdb_open_count_run   *open_run
+)
+{
+  sqlite3_stmt          *stmt = __lmdb_get_stmt(the_db, lmdb_stmt_end_count_run);
+  int                   rc = SQLITE_ERROR;
+  
+  if ( ! stmt ) return false;
+  if ( (sqlite3_bind_int64(stmt, 1, open_run->run_id) == SQLITE_OK) && (sqlite3_bind_int64(stmt, 2, the_db->count_runs->last_check_id) == SQLITE_OK) ) {
+    rc = sqlite3_step(stmt);
+  }
+  __lmdb_put_stmt(stmt);
+  if ( rc != SQLITE_DONE ) return false;
+  open_run->run_id = 0;
+  return true;
+}
+
+//
+
+bool
+__lmdb_count_runs_record(
+  lmdb_ref              the_db,
+  lmfeature_ref         the_feature,
+  time_t                check_timestamp
+)
+{
+  lmdb_count_runs       *runs = the_db->count_runs;
+  lmdb_open_count_run   *open_run;
+  sqlite3_stmt          *stmt;
+  int                   in_use = lmfeature_get_in_use(the_feature);
+  int                   issued = lmfeature_get_issued(the_feature);
+  time_t                expiration_date = lmfeature_get_expiration_date(the_feature);
+  int                   rc = SQLITE_ERROR;
+  
+  if ( ! runs && ! (runs = the_db->count_runs = __lmdb_count_runs_alloc()) ) return false;
+  
+  // The check is only added once the first feature is recorded:
+  if ( ! runs->check_id && ! __lmdb_count_runs_add_check(the_db, check_timestamp) ) return false;
+  
+  if ( ! (open_run = __lmdb_count_runs_lookup(runs, lmfeature_get_feature_id(the_feature))) ) return false;
+  open_run->last_seen = runs->generation;
+  if ( open_run->run_id ) {
+    // Unchanged counts just extend the open run:
+    if ( (open_run->in_use == in_use) && (open_run->issued == issued) && (open_run->expiration_date == expiration_date) ) return true;
+    if ( ! __lmdb_count_runs_end_run(the_db, open_run) ) return false;
+  }
+  
+  if ( ! (stmt = __lmdb_get_stmt(the_db, lmdb_stmt_add_count_run)) ) return false;
+  if ( (sqlite3_bind_int(stmt, 1, lmfeature_get_feature_id(the_feature)) == SQLITE_OK) &&
+       (sqlite3_bind_int(stmt, 2, in_use) == SQLITE_OK) &&
+       (sqlite3_bind_int(stmt, 3, issued) == SQLITE_OK) &&
+       (((expiration_date == lmfeature_no_expiration) ? sqlite3_bind_null(stmt, 4) : sqlite3_bind_int64(stmt, 4, (sqlite3_int64)expiration_date)) == SQLITE_OK) &&
+       (sqlite3_bind_int64(stmt, 5, runs->check_id) == SQLITE_OK)
+  ) {
+    rc = sqlite3_step(stmt);
+  }
+  __lmdb_put_stmt(stmt);
+  if ( rc != SQLITE_DONE ) return false;
+  
+  open_run->run_id = sqlite3_last_insert_rowid(the_db->db_handle);
+  open_run->in_use = in_use;
+  open_run->issued = issued;
+  open_run->expiration_date = expiration_date;
+  return true;
+}
+
+//
+
+bool
+__lmdb_count_runs_finish_commit(
+  lmdb_ref              the_db,
+  bool                  is_ok
+)
+{
+  lmdb_count_runs       *runs = the_db->count_runs;
+  
+  if ( ! is_ok ) {
+    if ( runs ) {
+      runs->is_loaded = false;
+      runs->check_id = 0;
+    }
+    return false;
+  }
+  if ( runs && runs->check_id ) {
+    unsigned int        i = 0;
+    
+    //
+    // A feature that was not recorded in this check ends its run with the
+    // previous check:
+    //
+    while ( i < runs->capacity ) {
+      lmdb_open_count_run *open_run = &runs->open_runs[i++];
+      
+      if ( open_run->run_id && (open_run->last_seen != runs->generation) ) {
+        if ( ! __lmdb_count_runs_end_run(the_db, open_run) ) {
+          runs->check_id = 0;
+          return false;
+        }
+      }
+    }
+    runs->last_check_id = runs->check_id;
+    runs->check_id = 0;
+  }
+  return true;
+}
+
+//
+
+bool
+__lmdb_commit_feature_count(
+  lmdb_ref      the_db,
+  lmfeature_ref the_feature,
+  time_t        check_timestamp
+)
+{
+  if ( lmfeature_is_modified(the_feature) ) {
+    bool        rc;
+    
+    if ( the_db->count_storage == lmdb_count_storage_runs ) {
+      rc = __lmdb_count_runs_record(the_db, the_feature, check_timestamp);
+    } else {
+      rc = __lmdb_add_feature_count_row(the_db, the_feature, check_timestamp);
+    }
+    if ( rc && the_db->has_rollups ) {
+      rc = __lmdb_add_feature_count_rollups(the_db, the_feature, check_timestamp);
+    }
+    
+#ifndef LMDB_DISABLE_RRDTOOL
+    if ( rc && the_db->rrd_journal ) {
+      if ( ! __lmdb_rrd_journal_add_point(the_db->rrd_journal, lmfeature_get_feature_id(the_feature), check_timestamp, lmfeature_get_in_use(the_feature), lmfeature_get_issued(the_feature)) ) {
+        lmlogf(lmlog_level_warn, "unable to journal RRD update for feature id=%d", lmfeature_get_feature_id(the_feature));
+      }
+    }
+#endif
+    if ( rc && the_db->tsdb && ! lmtsdb_is_read_only(the_db->tsdb) ) {
+      if ( ! lmtsdb_update(the_db->tsdb, lmfeature_get_feature_id(the_feature), check_timestamp, lmfeature_get_in_use(the_feature), lmfeature_get_issued(the_feature)) ) {
+        lmlogf(lmlog_level_warn, "unable to update time-series store for feature id=%d", lmfeature_get_feature_id(the_feature));
+      }
+    }
+    
+  	return rc;
+  }
+  return true;
+}
+
+//
+
+const char*
+lmdb_get_schema(void)
+{
+  return __db_schema;
+}
+
+//
+
+int
+__lmdb_get_schema_version(
+  sqlite3           *db_handle
+)
+{
+  int               version = -1;
+  sqlite3_stmt      *stmt;
+  
+  if ( sqlite3_prepare_v2(db_handle, "PRAGMA user_version", -1, &stmt, NULL) == SQLITE_OK ) {
+    if ( sqlite3_step(stmt) == SQLITE_ROW ) version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+  return version;
+}
+
+//
+
+bool
+__lmdb_set_schema_version(
+  sqlite3           *db_handle,
+  int               version
+)
+{
+  char              pragma[32];
+  
+  snprintf(pragma, sizeof(pragma), "PRAGMA user_version = %d", version);
+  if ( sqlite3_exec(db_handle, pragma, NULL, NULL, NULL) != SQLITE_OK ) {
+    lmlogf(lmlog_level_error, "failed to set database schema version: %s", sqlite3_errmsg(db_handle));
+    return false;
+  }
+  return true;
+}
+
+//
+
+/*
+ * Bring the schema of the database up to DB_SCHEMA_VERSION.  The version is
+ * checked again once the write lock is held, since another program may have
+ * upgraded the database in the meantime.  A read-only connection cannot
+ * upgrade the schema; it carries on with what is there.
+ */
+bool
+__lmdb_migrate_schema(
+  sqlite3           *db_handle,
+  bool              is_read_only
+)
+{
+  int               version = __lmdb_get_schema_version(db_handle);
+  
+  if ( version < 0 ) {
+    lmlogf(lmlog_level_error, "failed to read database schema version: %s", sqlite3_errmsg(db_handle));
+    return false;
+  }
+  if ( version >= DB_SCHEMA_VERSION ) {
+    if ( version > DB_SCHEMA_VERSION ) LMDEBUG("database schema version %d is newer than %d", version, DB_SCHEMA_VERSION);
+    return true;
+  }
+  if ( is_read_only ) {
+    LMDEBUG("database schema version %d predates %d, cannot upgrade read-only", version, DB_SCHEMA_VERSION);
+    return true;
+  }
+  
+  if ( sqlite3_exec(db_handle, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK ) {
+    lmlogf(lmlog_level_error, "failed to begin database schema upgrade: %s", sqlite3_errmsg(db_handle));
+    return false;
+  }
+  version = __lmdb_get_schema_version(db_handle);
+  if ( (version >= 0) && (version < DB_SCHEMA_VERSION) ) {
+    lmlogf(lmlog_level_info, "upgrading database schema from version %d to %d", version, DB_SCHEMA_VERSION);
+    while ( version < DB_SCHEMA_VERSION ) {
+      if ( sqlite3_exec(db_handle, __db_migrations[version], NULL, NULL, NULL) != SQLITE_OK ) {
+        lmlogf(lmlog_level_error, "failed to upgrade database schema to version %d: %s", version + 1, sqlite3_errmsg(db_handle));
+        goto exit_on_error;
+      }
+      version++;
+    }
+    if ( ! __lmdb_set_schema_version(db_handle, version) ) goto exit_on_error;
+  }
+  if ( sqlite3_exec(db_handle, "COMMIT", NULL, NULL, NULL) != SQLITE_OK ) {
+    lmlogf(lmlog_level_error, "failed to commit database schema upgrade: %s", sqlite3_errmsg(db_handle));
+    goto exit_on_error;
+  }
+  return true;
+
+exit_on_error:
+  sqlite3_exec(db_handle, "ROLLBACK", NULL, NULL, NULL);
+  return false;
+}
+
+//
+
+/*
+ * Returns a copy of the value of the named property (which the caller must
+ * free) or NULL if it is not set.  Databases that predate the properties
+ * table have no properties, so failing to prepare the query is not an error.
+ */
+char*
+__lmdb_get_property(
+  sqlite3           *db_handle,
+  const char        *name
+)
+{
+  char              *value = NULL;
+  sqlite3_stmt      *stmt;
+  
+  if ( sqlite3_prepare_v2(db_handle, "SELECT value FROM properties WHERE name = ?", -1, &stmt, NULL) == SQLITE_OK ) {
+    if ( (sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC) == SQLITE_OK) && (sqlite3_step(stmt) == SQLITE_ROW) ) {
+      const char    *s = (const char*)sqlite3_column_text(stmt, 0);
+      
+      if ( s ) value = strdup(s);
+    }
+    sqlite3_finalize(stmt);
+  }
+  return value;
+}
+
+//
+
+/*
+ * Set the named property to value, or remove it if value is NULL.
+ */
+bool
+__lmdb_set_property(
+  sqlite3           *db_handle,
+  const char        *name,
+  const char        *value
+)
+{
+  sqlite3_stmt      *stmt;
+  bool              rc = false;
+  
+  if ( sqlite3_prepare_v2(db_handle, value ? "INSERT OR REPLACE INTO properties (name, value) VALUES (?1, ?2)" : "DELETE FROM properties WHERE name = ?1", -1, &stmt, NULL) == SQLITE_OK ) {
+    if ( (sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC) == SQLITE_OK) && (! value || (sqlite3_bind_text(stmt, 2, value, -1, SQLITE_STATIC) == SQLITE_OK)) ) {
+      rc = ( sqlite3_step(stmt) == SQLITE_DONE );
+    }
+    sqlite3_finalize(stmt);
+  }
+  if ( ! rc ) lmlogf(lmlog_level_error, "failed to set database property '%s': %s", name, sqlite3_errmsg(db_handle));
+  return rc;
+}
+
+//
+
+lmdb_count_storage
+__lmdb_read_count_storage(
+  sqlite3           *db_handle
+)
+{
+  lmdb_count_storage  count_storage = lmdb_count_storage_rows;
+  char                *value = __lmdb_get_property(db_handle, "count-storage");
+  
+  if ( value ) {
+    if ( strcmp(value, "runs") == 0 ) count_storage = lmdb_count_storage_runs;
+    free(value);
+  }
+  return count_storage;
+}
+
+//
+
+/*
+ * The rollup buckets are hours, days and months in the local time of the
+ * program that writes them, so they are only of use to programs in the same
+ * time zone.  The zone is identified by its names and UTC offsets in January
+ * and July (to catch daylight saving rules).
+ */
+void
+__lmdb_rollup_timezone(
+  char              *s,
+  size_t            s_size
+)
+{
+  time_t            jan = 1704110400, jul = 1719835200;  // 2024-01-01 and 2024-07-01 at 12:00 UTC
+  struct tm         tm_jan, tm_jul;
+  
+  tzset();
+  if ( localtime_r(&jan, &tm_jan) && localtime_r(&jul, &tm_jul) ) {
+    snprintf(s, s_size, "%s%+ld/%s%+ld",
+        tm_jan.tm_zone ? tm_jan.tm_zone : "", (long)tm_jan.tm_gmtoff,
+        tm_jul.tm_zone ? tm_jul.tm_zone : "", (long)tm_jul.tm_gmtoff
+      );
+  } else {
+    snprintf(s, s_size, "unknown");
+  }
+}
+
+//
+
+/*
+ * Commits update the rollups with an upsert (INSERT ... ON CONFLICT DO UPDATE),
+ * which SQLite supports as of 3.24.0.
+ */
+#define LMDB_ROLLUP_SQLITE_VERSION_MIN      3024000
+#define LMDB_ROLLUP_SQLITE_VERSION_MIN_STR "3.24.0"
+
+//
+
+/*
+ * The rollups are usable if they were built in this program's time zone.  If
+ * they were not, a program that writes counts would leave them inconsistent,
+ * so it drops the claim to them; lmdb_rebuild_rollups() restores it.  The
+ * same goes for a program whose SQLite library cannot update them.
+ */
+bool
+__lmdb_check_rollups(
+  sqlite3           *db_handle,
+  bool              is_read_only
+)
+{
+  char              *value = __lmdb_get_property(db_handle, "rollup-timezone");
+  char              timezone[128];
+  bool              rc = false;
+  
+  if ( value ) {
+    __lmdb_rollup_timezone(timezone, sizeof(timezone));
+    if ( ! is_read_only && (sqlite3_libversion_number() < LMDB_ROLLUP_SQLITE_VERSION_MIN) ) {
+      lmlogf(lmlog_level_warn, "count rollups cannot be maintained with SQLite %s (version " LMDB_ROLLUP_SQLITE_VERSION_MIN_STR " or newer is required) and will not be used; rebuild them with a newer SQLite to use them", sqlite3_libversion());
+      __lmdb_set_property(db_handle, "rollup-timezone", NULL);
+    } else if ( strcmp(value, timezone) == 0 ) {
+      rc = true;
+    } else if ( ! is_read_only ) {
+      lmlogf(lmlog_level_warn, "count rollups were built in time zone %s rather than %s and will not be maintained; rebuild them to use them", value, timezone);
+      __lmdb_set_property(db_handle, "rollup-timezone", NULL);
+    } else {
+      LMDEBUG("count rollups were built in time zone %s rather than %s", value, timezone);
+    }
+    free(value);
+  }
+  return rc;
+}
+
+//
+
+static const char   *__lmdb_journal_mode_pragmas[lmdb_journal_mode_max] = {
+                        "PRAGMA journal_mode",
+                        "PRAGMA journal_mode = DELETE",
+                        "PRAGMA journal_mode = TRUNCATE",
+                        "PRAGMA journal_mode = PERSIST",
+                        "PRAGMA journal_mode = WAL"
+                      };
+
+static const char   *__lmdb_synchronous_pragmas[lmdb_synchronous_max] = {
+                        NULL,
+                        "PRAGMA synchronous = OFF",
+                        "PRAGMA synchronous = NORMAL",
+                        "PRAGMA synchronous = FULL"
+                      };
+
+//
+
+bool
+__lmdb_exec_pragma(
+  sqlite3           *db_handle,
+  const char        *pragma
+)
+{
+  int               rc = sqlite3_exec(db_handle, pragma, NULL, NULL, NULL);
+  
+  if ( rc != SQLITE_OK ) {
+    lmlogf(lmlog_level_warn, "lmdb_create: failed to execute '%s': %s", pragma, sqlite3_errmsg(db_handle));
+    return false;
+  }
+  LMDEBUG("successfully executed '%s'", pragma);
+  return true;
+}
+
+//
+
+/*
+ * Apply the connection tuning in options to db_handle.  None of it is
+ * essential, so failures are logged but do not prevent the database from
+ * being used.  Returns true if the database uses the write-ahead log.
+ */
+bool
+__lmdb_apply_options(
+  sqlite3             *db_handle,
+  bool                is_read_only,
+  const lmdb_options  *options
+)
+{
+  lmdb_journal_mode   journal_mode = (options->journal_mode < lmdb_journal_mode_max) ? options->journal_mode : lmdb_journal_mode_default;
+  char                pragma[64];
+  sqlite3_stmt        *stmt;
+  bool                is_wal = false;
+  
+  if ( options->busy_timeout > 0 ) {
+    sqlite3_busy_handler(db_handle, __lmdb_busy_handler, (void*)(intptr_t)options->busy_timeout);
+  }
+  
+  //
+  // The journaling mode belongs to the database file, so only a read-write
+  // connection can change it; either way, find out what's in effect:
+  //
+  if ( (journal_mode != lmdb_journal_mode_default) && is_read_only ) {
+    LMDEBUG("journaling mode cannot be changed on a read-only connection");
+    journal_mode = lmdb_journal_mode_default;
+  }
+  if ( sqlite3_prepare_v2(db_handle, __lmdb_journal_mode_pragmas[journal_mode], -1, &stmt, NULL) == SQLITE_OK ) {
+    if ( sqlite3_step(stmt) == SQLITE_ROW ) {
+      const char      *mode = (const char*)sqlite3_column_text(stmt, 0);
+      
+      if ( mode ) {
+        is_wal = ( strcasecmp(mode, "wal") == 0 );
+        LMDEBUG("database journaling mode is %s", mode);
+      }
+    } else {
+      lmlogf(lmlog_level_warn, "lmdb_create: failed to set journaling mode: %s", sqlite3_errmsg(db_handle));
+    }
+    sqlite3_finalize(stmt);
+    if ( (journal_mode == lmdb_journal_mode_wal) && ! is_wal ) {
+      lmlog(lmlog_level_warn, "lmdb_create: database cannot use the write-ahead log");
+    }
+  }
+  
+  if ( (options->synchronous > lmdb_synchronous_default) && (options->synchronous < lmdb_synchronous_max) ) {
+    __lmdb_exec_pragma(db_handle, __lmdb_synchronous_pragmas[options->synchronous]);
+  }
+  if ( options->cache_size > 0 ) {
+    // A negative cache size is in KiB rather than pages:
+    snprintf(pragma, sizeof(pragma), "PRAGMA cache_size = -%d", options->cache_size);
+    __lmdb_exec_pragma(db_handle, pragma);
+  }
+  if ( options->mmap_size > 0 ) {
+    snprintf(pragma, sizeof(pragma), "PRAGMA mmap_size = %lld", options->mmap_size);
+    __lmdb_exec_pragma(db_handle, pragma);
+  }
+  return is_wal;
+}
+
+//
+
+lmdb_ref
+__lmdb_create(
+  const char          *db_path,
+  bool                is_read_only,
+  const lmdb_options  *options
+)
+{
+  static const lmdb_options default_options = { 0 };
+  
+  struct stat       finfo;
+  sqlite3           *db_handle;
+  bool              is_new = true, is_wal;
+  int               rc, sqlite_flags = 0;
+  char              timezone[128];
+  
+#ifndef LMDB_IGNORE_SQLITE_VERSION
+  static bool       is_inited = false;
+  if ( ! is_inited ) {
+    /* Ensure we're using an SQLite library at least as new as the one
+     * with which we were compiled:
+     */
+    LMASSERT( sqlite3_libversion_number() >= SQLITE_VERSION_NUMBER );
+    is_inited = true;
+  }
+#endif
+
+  if ( ! options ) options = &default_options;
+  
+  if ( strcmp(db_path, ":memory:") && (stat(db_path, &finfo) == 0) ) {
+    if ( ! S_ISREG(finfo.st_mode) ) {
+      lmlogf(lmlog_level_error, "lmdb_create: %s is not a regular file", db_path);
+      return NULL;
+    }
+    is_new = false;
+  }
+  
+  if ( is_new && is_read_only ) {
+    lmlog(lmlog_level_alert, "lmdb_create:  impossible to open a non-existent database read-only");
+    return NULL;
+  }
+  
+  sqlite_flags = is_read_only ? (SQLITE_OPEN_READONLY) : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+  
+  if ( (rc = sqlite3_open_v2(db_path, &db_handle, sqlite_flags, NULL)) == SQLITE_OK ) {
+    LMDEBUG("successfully opened %sdatabase '%s'", is_read_only ? "read-only " : "", db_path);
+    
+#ifdef SQLITE_DBCONFIG_ENABLE_FKEY
+    if ( (rc = sqlite3_db_config(db_handle, SQLITE_DBCONFIG_ENABLE_FKEY, 1, NULL)) == SQLITE_OK )
+#else
+    if ( (rc = sqlite3_exec(db_handle, "PRAGMA foreign_keys = ON", NULL, NULL, NULL)) == SQLITE_OK )
+#endif
+    {
+      lmdb            *new_db;
+      
+      LMDEBUG("successfully enabled foreign key support on database");
+      
+      // Tune the connection before anything is written to a new database:
+      is_wal = __lmdb_apply_options(db_handle, is_read_only, options);
+      
+      if ( is_new ) {
+        if ( (rc = sqlite3_exec(db_handle, __db_schema, NULL, NULL, NULL)) != SQLITE_OK ) {
+          lmlogf(lmlog_level_error, "failed to initialize database schema: %s", sqlite3_errmsg(db_handle));
+          sqlite3_close(db_handle);
+          return NULL;
+        }
+        if ( ! __lmdb_set_schema_version(db_handle, DB_SCHEMA_VERSION) ) {
+          sqlite3_close(db_handle);
+          return NULL;
+        }
+        __lmdb_rollup_timezone(timezone, sizeof(timezone));
+        __lmdb_set_property(db_handle, "rollup-timezone", timezone);
+        LMDEBUG("successfully initialized database schema");
+      } else if ( ! __lmdb_migrate_schema(db_handle, is_read_only) ) {
+        sqlite3_close(db_handle);
+        return NULL;
+      }
+      new_db = __lmdb_alloc(db_path);
+      if ( new_db ) {
+        new_db->db_handle = db_handle;
+        new_db->is_read_only = is_read_only;
+        new_db->count_storage = __lmdb_read_count_storage(db_handle);
+        LMDEBUG("database stores counts as %s", (new_db->count_storage == lmdb_count_storage_runs) ? "runs" : "rows");
+        new_db->has_rollups = __lmdb_check_rollups(db_handle, is_read_only);
+        LMDEBUG("database count rollups are %s", new_db->has_rollups ? "in use" : "not in use");
+        
+        //
+        // Move write-ahead log checkpoints off of the commit path and onto
+        // a background thread:
+        //
+        if ( is_wal && ! is_read_only && (options->checkpoint_interval > 0) ) {
+          new_db->checkpointer = __lmdb_checkpointer_alloc(db_path, options->checkpoint_interval);
+          if ( new_db->checkpointer ) {
+            sqlite3_wal_autocheckpoint(db_handle, 0);
+            LMDEBUG("checkpointing write-ahead log every %d seconds", options->checkpoint_interval);
+          }
+        }
+        
+        // Register or regexp function (with this connection's cache of compiled patterns):
+        sqlite3_create_function_v2(
+            db_handle,
+            "REGEXP",
+            2,
+            SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+            calloc(1, sizeof(lmdb_regex_cache)),
+            __lmdb_sqlite_regexp_fn,
+            NULL,
+            NULL,
+            __lmdb_regex_cache_dealloc
+          );
+        
+        return (lmdb_ref)new_db;
+      } else {
+        lmlog(lmlog_level_warn, "lmdb_create: failed to allocate new object");
+        sqlite3_close(db_handle);
+      }
+    } else {
+      lmlogf(lmlog_level_error, "lmdb_create: failed to enable foreign key support on database (rc = %d)", rc);
+      sqlite3_close(db_handle);
+    }
+  } else {
+    lmlogf(lmlog_level_error, "lmdb_create: failed to open database '%s' (rc = %d)", db_path, rc);
+    sqlite3_close(db_handle);
+  }
+  return NULL;
+}
+
+//
+
+lmdb_ref
+lmdb_create(
+  const char        *db_path
+)
+{
+  return __lmdb_create(db_path, false, NULL);
+}
+
+//
+
+lmdb_ref
+lmdb_create_read_only(
+  const char        *db_path
+)
+{
+  return __lmdb_create(db_path, true, NULL);
+}
+
+//
+
+lmdb_ref
+lmdb_create_with_options(
+  const char          *db_path,
+  const lmdb_options  *options
+)
+{
+  return __lmdb_create(db_path, false, options);
+}
+
+//
+
+lmdb_ref
+lmdb_create_read_only_with_options(
+  const char          *db_path,
+  const lmdb_options  *options
+)
+{
+  return __lmdb_create(db_path, true, options);
+}
+
+//
+
+lmdb_ref
+lmdb_retain(
+  lmdb_ref          the_db
+)
+{
+  the_db->ref_count++;
+  return the_db;
+}
+
+//
+
+void
+lmdb_release(
+  lmdb_ref          the_db
+)
+{
+  if ( --the_db->ref_count == 0 ) __lmdb_dealloc(the_db);
+}
+
+//
+
+const char*
+lmdb_get_path(
+  lmdb_ref          the_db
+)
+{
+  return the_db->db_path;
+}
+
+//
+
+#ifndef LMDB_DISABLE_RRDTOOL
+
+const char*
+lmdb_get_rrd_repodir(
+  lmdb_ref          the_db
+)
+{
+  return the_db->rrd_journal ? the_db->rrd_journal->rrd_repodir : NULL;
+}
+
+//
+
+bool
+lmdb_set_rrd_repodir(
+  lmdb_ref          the_db,
+  const char        *rrd_repodir
+)
+{
+  int               interval = 0;
+  
+  if ( the_db->rrd_journal ) {
+    interval = the_db->rrd_journal->interval;
+    __lmdb_rrd_journal_dealloc(the_db->rrd_journal);
+    the_db->rrd_journal = NULL;
+  }
+  if ( rrd_repodir ) {
+    if ( directory_exists(rrd_repodir) ) {
+      if ( access(rrd_repodir, R_OK | W_OK) == 0 ) {
+        if ( (the_db->rrd_journal = __lmdb_rrd_journal_alloc(rrd_repodir, the_db->db_path)) ) {
+          if ( interval > 0 ) __lmdb_rrd_journal_set_interval(the_db->rrd_journal, interval);
+          return true;
+        }
+        lmlogf(lmlog_level_error, "unable to allocate RRD journal for directory: %s", rrd_repodir);
+      } else {
+        lmlogf(lmlog_level_warn, "no read+write permission on RRD repository directory: %s", rrd_repodir);
+      }
+    } else {
+      lmlogf(lmlog_level_warn, "RRD repository directory does not exist: %s", rrd_repodir);
+    }
+    return false;
+  }
+  return true;
+}
+
+//
+
+bool
+lmdb_set_rrd_flush_interval(
+  lmdb_ref          the_db,
+  int               interval
+)
+{
+  if ( ! the_db->rrd_journal ) return false;
+  return __lmdb_rrd_journal_set_interval(the_db->rrd_journal, interval);
+}
+
+//
+
+bool
+lmdb_rrd_flush(
+  lmdb_ref          the_db
+)
+{
+  if ( ! the_db->rrd_journal ) return false;
+  return __lmdb_rrd_journal_flush(the_db->rrd_journal);
+}
+
+//
+
+static const char   *__db_rrd_rebuild_features_query =
+    "SELECT feature_id FROM features WHERE ?1 < 0 OR feature_id = ?1 ORDER BY feature_id";
+
+bool
+lmdb_rrd_rebuild(
+  lmdb_ref          the_db,
+  const char        *rrd_repodir,
+  int               feature_id,
+  int               thread_count
+)
+{
+  lmdb_rrd_rebuild_context  context;
+  pthread_t                 *threads = NULL;
+  sqlite3_stmt              *stmt = NULL;
+  unsigned int              capacity = 0;
+  int                       i, started = 0, rc;
+  bool                      is_okay = false;
+  
+  if ( ! rrd_repodir || ! directory_exists(rrd_repodir) || (access(rrd_repodir, R_OK | W_OK | X_OK) != 0) ) {
+    lmlogf(lmlog_level_error, "RRD repository directory does not exist or is not writable: %s", rrd_repodir ? rrd_repodir : "");
+    return false;
+  }
+  memset(&context, 0, sizeof(context));
+  context.db_path = the_db->db_path;
+  context.rrd_repodir = rrd_repodir;
+  context.use_runs = ( the_db->count_storage == lmdb_count_storage_runs );
+  if ( ! (context.lock_path = strcatf("%s/" LMDB_RRD_JOURNAL_NAME ".lock", rrd_repodir)) ) return false;
+  pthread_mutex_init(&context.lock, NULL);
+  
+  // Which features:
+  if ( sqlite3_prepare_v2(the_db->db_handle, __db_rrd_rebuild_features_query, -1, &stmt, NULL) != SQLITE_OK ) {
+    lmlogf(lmlog_level_error, "failed while preparing query '%s': %s", __db_rrd_rebuild_features_query, sqlite3_errmsg(the_db->db_handle));
+    goto exit_on_error;
+  }
+  sqlite3_bind_int(stmt, 1, feature_id);
+  while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
+    if ( context.feature_count == capacity ) {
+      unsigned int  new_capacity = capacity ? 2 * capacity : 256;
+      int           *new_ids = realloc(context.feature_ids, new_capacity * sizeof(int));
+      
+      if ( ! new_ids ) {
+        lmlog(lmlog_level_error, "unable to allocate list of feature ids");
+        goto exit_on_error;
+      }
+      context.feature_ids = new_ids;
+      capacity = new_capacity;
+    }
+    context.feature_ids[context.feature_count++] = sqlite3_column_int(stmt, 0);
+  }
+  if ( rc != SQLITE_DONE ) {
+    lmlogf(lmlog_level_error, "query failed (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
+    goto exit_on_error;
+  }
+  if ( context.feature_count == 0 ) {
+    lmlog(lmlog_level_warn, "no features to rebuild");
+    is_okay = ( feature_id < 0 );
+    goto exit_on_error;
+  }
+  
+  // Start the workers:
+  if ( thread_count <= 0 ) thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if ( thread_count <= 0 ) thread_count = 1;
+  if ( thread_count > context.feature_count ) thread_count = context.feature_count;
+  if ( ! (threads = malloc(thread_count * sizeof(pthread_t))) ) {
+    lmlog(lmlog_level_error, "unable to allocate rebuild threads");
+    goto exit_on_error;
+  }
+  LMDEBUG("rebuilding %u rrd file(s) with %d thread(s)", context.feature_count, thread_count);
+  for ( i = 0; i < thread_count; i++ ) {
+    if ( pthread_create(&threads[i], NULL, __lmdb_rrd_rebuild_thread, &context) != 0 ) {
+      lmlog(lmlog_level_warn, "failed to start rebuild thread");
+      break;
+    }
+    started++;
+  }
+  for ( i = 0; i < started; i++ ) pthread_join(threads[i], NULL);
+  
+  // Features no thread got to:
+  context.failed_count += context.feature_count - context.next_feature;
+  lmlogf(lmlog_level_info, "rebuilt %u rrd file(s), %u failed", context.rebuilt_count, context.failed_count);
+  is_okay = ( context.failed_count == 0 );
+
+exit_on_error:
+  if ( threads ) free((void*)threads);
+  if ( stmt ) sqlite3_finalize(stmt);
+  if ( context.feature_ids ) free((void*)context.feature_ids);
+  pthread_mutex_destroy(&context.lock);
+  free((void*)context.lock_path);
+  return is_okay;
+}
+
+#endif
+
+//
+
+const char*
+lmdb_get_tsdb_path(
+  lmdb_ref          the_db
+)
+{
+  return the_db->tsdb ? lmtsdb_get_path(the_db->tsdb) : NULL;
+}
+
+//
+
+bool
+lmdb_set_tsdb_path(
+  lmdb_ref          the_db,
+  const char        *tsdb_path
+)
+{
+  if ( the_db->tsdb ) {
+    lmtsdb_close(the_db->tsdb);
+    the_db->tsdb = NULL;
+  }
+  if ( tsdb_path ) {
+    if ( ! (the_db->tsdb = lmtsdb_open(tsdb_path, the_db->is_read_only)) ) return false;
+  }
+  return true;
+}
+
+//
+
+void
+lmdb_load_all_features(
+  lmdb_ref          the_db
+)
+{
+  sqlite3_stmt    *stmt = NULL;
+  int             rc;
+  int             tbl_feature_id;
+  const char      *tbl_feature_string, *tbl_vendor, *tbl_version;
+  lmfeature_ref   a_feature;
+  bool            done = false;
+  
+  if ( sqlite3_prepare_v2(the_db->db_handle, __db_get_features_query, -1, &stmt, NULL) != SQLITE_OK ) {
+    lmlogf(lmlog_level_warn, "failed while preparing query '%s': %s", __db_get_features_query, sqlite3_errmsg(the_db->db_handle));
+    return;
+  }
+  while ( ! done ) {
+    rc = sqlite3_step(stmt);
+    switch ( rc ) {
+    
+      case SQLITE_ROW: {
+        /* Extant feature, wrap with an lmfeature: */
+        tbl_feature_id = sqlite3_column_int(stmt, 0);
+        
+         // Check the featureset first
+        a_feature = lmfeatureset_get_feature_by_id(the_db->features, tbl_feature_id);
+        if ( ! a_feature ) {
+          tbl_feature_string = (const char*)sqlite3_column_text(stmt, 1);
+          tbl_vendor = (const char*)sqlite3_column_text(stmt, 2);
+          tbl_version = (const char*)sqlite3_column_text(stmt, 3);
+          
+          a_feature = lmfeature_pool_create_feature(the_db->feature_pool, tbl_feature_id, tbl_feature_string, tbl_vendor, tbl_version);
+          if ( a_feature ) {
+            bool      ok = lmfeatureset_add_feature(the_db->features, a_feature);
+            lmfeature_release(a_feature);
+          }
+        }
+        break;
+      }
+      
+      case SQLITE_DONE:
+        done = true;
+        break;
+      
+      default:
+        lmlogf(lmlog_level_warn, "query failed (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
+        break;
+      
+    }
+  }
+  sqlite3_finalize(stmt);
+}
+
+//
+
+static const char   *__db_lookup_features_query =
+    "SELECT feature_id, f.feature_string, f.vendor, f.version FROM features AS f";
+static const char   *__db_lookup_features_orderby =
+    " ORDER BY f.vendor, f.version, f.feature_string";
+
+lmfeatureset_ref
+lmdb_lookup_features(
+  lmdb_ref            the_db,
+  lmdb_predicate_ref  predicate
+)
+{
+  lmfeatureset_ref    out_featureset = NULL;
+  unsigned int        bind_index = 0;
+  mempool_ref         sql_pool = mempool_alloc();
+  strbuf_ref          sql = sql_pool ? strbuf_alloc(sql_pool, 0) : NULL;
+  const char          *query_str = NULL;
+  
+  if ( sql ) {
+    strbuf_append(sql, __db_lookup_features_query);
+    if ( predicate ) {
+      strbuf_append(sql, " WHERE ");
+      __lmdb_predicate_append_sql(sql, predicate, &bind_index);
+    }
+    strbuf_append(sql, __db_lookup_features_orderby);
+    query_str = strbuf_get_cstring(sql);
+  }
+  if ( query_str ) {
+    sqlite3_stmt    *stmt = __lmdb_query_cache_get(the_db, query_str);
+    
+    bind_index = 0;
+    if ( stmt && (! predicate || __lmdb_predicate_bind(predicate, stmt, &bind_index)) ) {
+      int           rc;
+      
+      out_featureset = lmfeatureset_create();
+      if ( out_featureset ) {
+        while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
+          lmfeature_ref   feature = lmfeature_pool_create_feature(the_db->feature_pool, 
+                                            sqlite3_column_int(stmt, 0),
+                                            (const char*)sqlite3_column_text(stmt, 1),
+                                            (const char*)sqlite3_column_text(stmt, 2),
+                                            (const char*)sqlite3_column_text(stmt, 3)
+                                          );
+          if ( feature ) {
+            lmfeatureset_add_feature(out_featureset, feature);
+            lmfeature_release(feature);
+          }
+        }
+      }
+    }
+    __lmdb_query_cache_put(the_db, stmt);
+  }
+  if ( sql_pool ) mempool_dealloc(sql_pool);
+  return out_featureset;
+}
+
+//
+
+lmfeatureset_ref
+lmdb_get_features(
+  lmdb_ref          the_db
+)
+{
+  return the_db->features;
+}
+
+//
+
+lmfeature_ref
+lmdb_get_feature_by_feature_id(
+  lmdb_ref      the_db,
+  int           feature_id
+)
+{
+  // Check the featureset first
+  lmfeature_ref feature = lmfeatureset_get_feature_by_id(the_db->features, feature_id);
+  
+  if ( ! feature ) {
+    sqlite3_stmt  *stmt = NULL;
+    int           rc;
+    int           tbl_feature_id;
+    const char    *tbl_feature_string, *tbl_vendor, *tbl_version;
+
+    if ( ! (stmt = __lmdb_get_stmt(the_db, lmdb_stmt_get_feature_by_id)) ) goto exit_on_error;
+    if ( sqlite3_bind_int(stmt, 1, feature_id) != SQLITE_OK ) {
+      lmlogf(lmlog_level_warn, "failed while binding parameter 1 to query: %s", sqlite3_errmsg(the_db->db_handle));
+      goto exit_on_error;
+    }
+    rc = sqlite3_step(stmt);
+    switch ( rc ) {
+    
+      case SQLITE_ROW: {
+        /* Extant feature, wrap with an lmfeature: */
+        tbl_feature_id = sqlite3_column_int(stmt, 0);
+        tbl_feature_string = (const char*)sqlite3_column_text(stmt, 1);
+        tbl_vendor = (const char*)sqlite3_column_text(stmt, 2);
+        tbl_version = (const char*)sqlite3_column_text(stmt, 3);
+        
+        feature = lmfeature_pool_create_feature(the_db->feature_pool, tbl_feature_id, tbl_feature_string, tbl_vendor, tbl_version);
+        if ( feature ) {
+          bool      ok = lmfeatureset_add_feature(the_db->features, feature);
+          lmfeature_release(feature);
+          if ( ! ok ) feature = NULL;
+        }
+        break;
+      }
+      
+      default:
+        lmlogf(lmlog_level_warn, "query failed (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
+        break;
+      
+    }
+exit_on_error:
+    __lmdb_put_stmt(stmt);
+  }
+  return feature;
+    
+}
+
+//
+
+lmfeature_ref
+lmdb_get_feature_by_name(
+  lmdb_ref      the_db,
+  const char    *feature_string,
+  const char    *vendor,
+  const char    *version
+)
+{
+  // Check the featureset first
+  lmfeature_ref feature = lmfeatureset_get_feature_by_name(the_db->features, feature_string, vendor, version);
+  
+  if ( ! feature ) {
+    sqlite3_stmt  *stmt = NULL;
+    int           rc;
+    int           tbl_feature_id;
+    const char    *tbl_feature_string, *tbl_vendor, *tbl_version;
+
+    if ( ! (stmt = __lmdb_get_stmt(the_db, lmdb_stmt_get_feature_by_name)) ) goto exit_on_error;
+    if ( sqlite3_bind_text(stmt, 1, feature_string, -1, SQLITE_STATIC) != SQLITE_OK ) {
+      lmlogf(lmlog_level_warn, "failed while binding parameter 1 to query: %s", sqlite3_errmsg(the_db->db_handle));
+      goto exit_on_error;
+    }
+    if ( sqlite3_bind_text(stmt, 2, vendor, -1, SQLITE_STATIC) != SQLITE_OK ) {
+      lmlogf(lmlog_level_warn, "failed while binding parameter 2 to query: %s", sqlite3_errmsg(the_db->db_handle));
+      goto exit_on_error;
+    }
+    if ( sqlite3_bind_text(stmt, 3, version, -1, SQLITE_STATIC) != SQLITE_OK ) {
+      lmlogf(lmlog_level_warn, "failed while binding parameter 3 to query: %s", sqlite3_errmsg(the_db->db_handle));
+      goto exit_on_error;
+    }
+    rc = sqlite3_step(stmt);
+    switch ( rc ) {
+    
+      case SQLITE_ROW: {
+        /* Extant feature, wrap with an lmfeature: */
+        tbl_feature_id = sqlite3_column_int(stmt, 0);
+        tbl_feature_string = (const char*)sqlite3_column_text(stmt, 1);
+        tbl_vendor = (const char*)sqlite3_column_text(stmt, 2);
+        tbl_version = (const char*)sqlite3_column_text(stmt, 3);
+        
+        LMDEBUG("feature %s for vendor %s (version %s) found in database with id %d", feature_string, vendor, version, tbl_feature_id);
+        
+        feature = lmfeature_pool_create_feature(the_db->feature_pool, tbl_feature_id, tbl_feature_string, tbl_vendor, tbl_version);
+        if ( feature ) {
+          bool      ok = lmfeatureset_add_feature(the_db->features, feature);
+          lmfeature_release(feature);
+          if ( ! ok ) feature = NULL;
+        }
+        break;
+      }
+      
+      case SQLITE_DONE: {
+        /* If the database is read-only, we can't add the feature: */
+        if ( the_db->is_read_only ) goto exit_on_error;
+        
+        /* Unknown feature, add it: */
+        __lmdb_put_stmt(stmt);
+        
+        LMDEBUG("feature %s for vendor %s (version %s) not present in database", feature_string, vendor, version);
+        
+        if ( ! (stmt = __lmdb_get_stmt(the_db, lmdb_stmt_add_feature)) ) goto exit_on_error;
+        if ( sqlite3_bind_text(stmt, 1, feature_string, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_text(stmt, 2, vendor, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_text(stmt, 3, version, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        rc = sqlite3_step(stmt);
+        if ( rc == SQLITE_DONE ) {
+          sqlite3_int64     tbl_feature_id = sqlite3_last_insert_rowid(the_db->db_handle);
+          
+          feature = lmfeature_pool_create_feature(the_db->feature_pool, tbl_feature_id, feature_string, vendor, version);
+          if ( feature ) {
+            bool      ok = lmfeatureset_add_feature(the_db->features, feature);
+            lmfeature_release(feature);
+            if ( ! ok ) feature = NULL;
+          }
+        }
+        break;
+      }
+      
+      default:
+        lmlogf(lmlog_level_warn, "query failed (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
+        break;
+
+    }
+exit_on_error:
+    __lmdb_put_stmt(stmt);
+  }
+  return feature;
+}
+
+//
+
+static const char   *__db_resolve_tuples_table =
+    "CREATE TEMP TABLE IF NOT EXISTS lmdb_resolve_tuples (\n"
+    "  feature_string        TEXT,\n"
+    "  vendor                TEXT,\n"
+    "  version               TEXT\n"
+    ");\n"
+    "DELETE FROM temp.lmdb_resolve_tuples;\n";
+
+typedef struct {
+  lmdb_ref          the_db;
+  sqlite3_stmt      *stmt;
+  unsigned int      count;
+  bool              is_okay;
+} lmdb_resolve_context;
+
+bool
+__lmdb_resolve_features_iterator(
+  const void        *context,
+  lmfeature_ref     the_feature
+)
+{
+  lmdb_resolve_context  *CONTEXT = (lmdb_resolve_context*)context;
+  const char            *feature_string = lmfeature_get_feature_string(the_feature);
+  const char            *vendor = lmfeature_get_vendor(the_feature);
+  const char            *version = lmfeature_get_version(the_feature);
+  
+  // Already cached?
+  if ( lmfeatureset_get_feature_by_name(CONTEXT->the_db->features, feature_string, vendor, version) ) return true;
+  
+  if ( (sqlite3_bind_text(CONTEXT->stmt, 1, feature_string, -1, SQLITE_STATIC) != SQLITE_OK) ||
+       (sqlite3_bind_text(CONTEXT->stmt, 2, vendor, -1, SQLITE_STATIC) != SQLITE_OK) ||
+       (sqlite3_bind_text(CONTEXT->stmt, 3, version, -1, SQLITE_STATIC) != SQLITE_OK) ||
+       (sqlite3_step(CONTEXT->stmt) != SQLITE_DONE)
+  ) {
+    lmlogf(lmlog_level_warn, "failed to stage feature %s for vendor %s (version %s): %s", feature_string, vendor, version, sqlite3_errmsg(CONTEXT->the_db->db_handle));
+    CONTEXT->is_okay = false;
+    return false;
+  }
+  __lmdb_put_stmt(CONTEXT->stmt);
+  CONTEXT->count++;
+  return true;
+}
+
+//
+
+bool
+lmdb_resolve_features(
+  lmdb_ref          the_db,
+  lmfeatureset_ref  features
+)
+{
+  lmdb_resolve_context  context = {
+                            .the_db = the_db,
+                            .stmt = NULL,
+                            .count = 0,
+                            .is_okay = true
+                          };
+  bool                  in_transaction = false;
+  sqlite3_stmt          *stmt = NULL;
+  int                   rc;
+  
+  if ( ! the_db->is_read_only ) {
+    if ( ! __lmdb_transaction_begin(the_db) ) return false;
+    in_transaction = true;
+  }
+  
+  // Stage every tuple that isn't already cached in a temp table:
+  if ( ! __lmdb_exec_simple(the_db, __db_resolve_tuples_table) ) goto exit_on_error;
+  if ( ! (context.stmt = __lmdb_get_stmt(the_db, lmdb_stmt_add_resolve_tuple)) ) goto exit_on_error;
+  lmfeatureset_iterate(features, __lmdb_resolve_features_iterator, &context);
+  __lmdb_put_stmt(context.stmt);
+  if ( ! context.is_okay ) goto exit_on_error;
+  if ( context.count == 0 ) goto exit_on_success;
+  LMDEBUG("resolving %u feature(s) not present in feature set", context.count);
+  
+  // Add the tuples not yet in the database:
+  if ( ! the_db->is_read_only ) {
+    if ( ! (stmt = __lmdb_get_stmt(the_db, lmdb_stmt_add_resolve_features)) ) goto exit_on_error;
+    if ( (rc = sqlite3_step(stmt)) != SQLITE_DONE ) {
+      lmlogf(lmlog_level_warn, "failed to add features (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
+      goto exit_on_error;
+    }
+    LMDEBUG("%d feature(s) added to database", sqlite3_changes(the_db->db_handle));
+    __lmdb_put_stmt(stmt);
+  }
+  
+  // Cache all of them:
+  if ( ! (stmt = __lmdb_get_stmt(the_db, lmdb_stmt_get_resolve_features)) ) goto exit_on_error;
+  while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
+    lmfeature_ref   feature = lmfeature_pool_create_feature(the_db->feature_pool,
+                                      sqlite3_column_int(stmt, 0),
+                                      (const char*)sqlite3_column_text(stmt, 1),
+                                      (const char*)sqlite3_column_text(stmt, 2),
+                                      (const char*)sqlite3_column_text(stmt, 3)
+                                    );
+    if ( feature ) {
+      bool          ok = lmfeatureset_add_feature(the_db->features, feature);
+      
+      lmfeature_release(feature);
+      if ( ! ok ) break;
+    } else {
+      break;
+    }
+  }
+  if ( rc != SQLITE_DONE ) {
+    lmlogf(lmlog_level_warn, "failed to load resolved features (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
+    goto exit_on_error;
+  }
+  __lmdb_put_stmt(stmt);
+  stmt = NULL;
+  
+exit_on_success:
+  __lmdb_exec_simple(the_db, "DELETE FROM temp.lmdb_resolve_tuples");
+  if ( in_transaction ) return __lmdb_transaction_end(the_db, true);
+  return true;
+
+exit_on_error:
+  __lmdb_put_stmt(stmt);
+  if ( in_transaction ) __lmdb_transaction_end(the_db, false);
+  return false;
+}
+
+//
+
+const char *lmdb_unknown_version = "unknown";
+
+lmfeature_ref
+lmdb_get_feature_by_vendor(
+  lmdb_ref      the_db,
+  const char    *feature_string,
+  const char    *vendor
+)
+{
+  sqlite3_stmt  *stmt = __lmdb_get_stmt(the_db, lmdb_stmt_get_latest_feature_by_vendor);
+  lmfeature_ref feature = NULL;
+  int           rc;
+  
+  if ( ! stmt ) return NULL;
+  if ( sqlite3_bind_text(stmt, 1, feature_string, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_text(stmt, 2, vendor, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+  rc = sqlite3_step(stmt);
+  switch ( rc ) {
+  
+    case SQLITE_ROW: {
+      int       feature_id = sqlite3_column_int(stmt, 0);
+      
+      __lmdb_put_stmt(stmt);
+      return lmdb_get_feature_by_feature_id(the_db, feature_id);
+    }
+    
+    case SQLITE_DONE:
+      /* Never seen with any version, so add it without one: */
+      __lmdb_put_stmt(stmt);
+      return lmdb_get_feature_by_name(the_db, feature_string, vendor, lmdb_unknown_version);
+      
+    default:
+      lmlogf(lmlog_level_warn, "query failed (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
+      break;
+      
+  }
+exit_on_error:
+  __lmdb_put_stmt(stmt);
+  return feature;
+}
+
+//
+
+lmfeature_ref
+lmdb_add_feature(
+  lmdb_ref      the_db,
+  lmfeature_ref new_feature
+)
+{
+  lmfeature_ref from_db_feature;
+  
+  // It better have the proper feature_id:
+  if ( lmfeature_get_feature_id(new_feature) != lmfeature_no_id ) return NULL;
+  
+  // Check to be sure it's not already present in the feature set:
+  if ( lmfeatureset_get_feature_by_name(the_db->features, lmfeature_get_feature_string(new_feature), lmfeature_get_vendor(new_feature), lmfeature_get_version(new_feature)) ) return NULL;
+  
+  // Use its feature string, vendor, and version to add to the database (or load the record from the database):
+  if ( (from_db_feature = lmdb_get_feature_by_name(the_db, lmfeature_get_feature_string(new_feature), lmfeature_get_vendor(new_feature), lmfeature_get_version(new_feature))) ) {
+    // Set the new in-db feature's counts if it was modified:
+    if ( lmfeature_is_modified(new_feature) ) {
+      lmfeature_set_expiration_date(from_db_feature, lmfeature_get_expiration_date(new_feature));
+      lmfeature_set_in_use(from_db_feature, lmfeature_get_in_use(new_feature));
+      lmfeature_set_issued(from_db_feature, lmfeature_get_issued(new_feature));
+    }
+    return from_db_feature;
+  }
+  return NULL;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+bool
+__lmdb_checkouts_load_open(
+  lmdb_ref          the_db
+)
+{
+  lmdb_checkout_sessions  *sessions = the_db->checkouts;
+  sqlite3_stmt      *stmt = __lmdb_get_stmt(the_db, lmdb_stmt_get_open_checkouts);
+  int               rc;
+  
+  if ( ! stmt ) return false;
+  while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
+    lmdb_checkout_t   checkout;
+    int               feature_id = sqlite3_column_int(stmt, 1);
+    size_t            key_len, total_len;
+    
+    checkout.user = (const char*)sqlite3_column_text(stmt, 2);
+    checkout.host = (const char*)sqlite3_column_text(stmt, 3);
+    checkout.display = (const char*)sqlite3_column_text(stmt, 4);
+    checkout.version = (const char*)sqlite3_column_text(stmt, 5);
+    checkout.server_host = (const char*)sqlite3_column_text(stmt, 6);
+    checkout.server_port = (const char*)sqlite3_column_text(stmt, 7);
+    checkout.handle = (const char*)sqlite3_column_text(stmt, 8);
+    checkout.license_count = sqlite3_column_int(stmt, 9);
+    checkout.start_timestamp = (time_t)sqlite3_column_int64(stmt, 10);
+    
+    if ( (key_len = __lmdb_checkout_sessions_make_key(sessions, feature_id, &checkout, &total_len)) ) {
+      unsigned int            hash = __lmdb_checkout_sessions_hash(sessions->scratch, key_len);
+      lmdb_checkout_session   *session = __lmdb_checkout_sessions_lookup(sessions, hash, sessions->scratch, key_len);
+      
+      if ( ! session ) session = __lmdb_checkout_sessions_insert(sessions, hash, key_len, total_len, feature_id, &checkout);
+      if ( session ) {
+        session->checkout_id = sqlite3_column_int64(stmt, 0);
+        continue;
+      }
+    }
+    lmlog(lmlog_level_error, "unable to allocate checkout session");
+    break;
+  }
+  __lmdb_put_stmt(stmt);
+  if ( rc != SQLITE_DONE ) return false;
+  LMDEBUG("loaded %u open checkout session(s)", sessions->count);
+  return true;
+}
+
+//
+
+bool
+lmdb_enable_checkout_tracking(
+  lmdb_ref          the_db
+)
+{
+  if ( the_db->checkouts ) return true;
+  if ( the_db->is_read_only ) {
+    lmlog(lmlog_level_error, "checkout tracking requires a writable database");
+    return false;
+  }
+  if ( ! __lmdb_exec_simple(the_db, DB_SCHEMA_CHECKOUTS) ) return false;
+  if ( ! (the_db->checkouts = __lmdb_checkout_sessions_alloc()) ) {
+    lmlog(lmlog_level_error, "unable to allocate checkout session set");
+    return false;
+  }
+  if ( ! __lmdb_checkouts_load_open(the_db) ) {
+    __lmdb_checkout_sessions_dealloc(the_db->checkouts);
+    the_db->checkouts = NULL;
+    return false;
+  }
+  return true;
+}
+
+//
+
+void
+lmdb_checkouts_begin_poll(
+  lmdb_ref          the_db
+)
+{
+  if ( the_db->checkouts ) the_db->checkouts->generation++;
+}
+
+//
+
+bool
+lmdb_checkouts_observe(
+  lmdb_ref                the_db,
+  lmfeature_ref           the_feature,
+  const lmdb_checkout_t   *the_checkout
+)
+{
+  lmdb_checkout_sessions  *sessions = the_db->checkouts;
+  lmdb_checkout_session   *session;
+  int                     feature_id = lmfeature_get_feature_id(the_feature);
+  size_t                  key_len, total_len;
+  unsigned int            hash;
+  
+  if ( ! sessions || (feature_id == lmfeature_no_id) ) return false;
+  if ( ! (key_len = __lmdb_checkout_sessions_make_key(sessions, feature_id, the_checkout, &total_len)) ) return false;
+  hash = __lmdb_checkout_sessions_hash(sessions->scratch, key_len);
+  if ( ! (session = __lmdb_checkout_sessions_lookup(sessions, hash, sessions->scratch, key_len)) ) {
+    if ( ! (session = __lmdb_checkout_sessions_insert(sessions, hash, key_len, total_len, feature_id, the_checkout)) ) return false;
+    LMDEBUG("new checkout of %s by %s@%s", lmfeature_get_feature_string(the_feature), session->checkout.user, session->checkout.host);
+  }
+  session->last_seen = sessions->generation;
+  session->is_ended = false;
+  return true;
+}
+
+//
+
+void
+lmdb_checkouts_end_poll(
+  lmdb_ref          the_db,
+  bool              is_complete
+)
+{
+  lmdb_checkout_sessions  *sessions = the_db->checkouts;
+  unsigned int            i;
+  
+  if ( ! sessions || ! is_complete ) return;
+  for ( i = 0; i < sessions->capacity; i++ ) {
+    lmdb_checkout_session *session = sessions->buckets[i];
+    
+    while ( session ) {
+      if ( session->last_seen != sessions->generation ) session->is_ended = true;
+      session = session->link;
+    }
+  }
+}
+
+//
+
+/*
+ * Within the commit transaction, insert rows for new sessions and set the
+ * end time of ended ones.  Nothing in memory changes until the outcome
+ * of the transaction is known (see __lmdb_checkouts_finish_commit()), so
+ * when commits are nested in a batch the rows that an earlier commit in
+ * the batch wrote are not written again.
+ */
+bool
+__lmdb_checkouts_write(
+  lmdb_ref          the_db,
+  time_t            check_timestamp,
+  unsigned int      *started,
+  unsigned int      *ended
+)
+{
+  lmdb_checkout_sessions  *sessions = the_db->checkouts;
+  sqlite3_stmt            *add_stmt = NULL, *end_stmt = NULL;
+  bool                    ok = false;
+  unsigned int            i;
+  
+  *started = *ended = 0;
+  if ( ! (add_stmt = __lmdb_get_stmt(the_db, lmdb_stmt_add_checkout)) ) return false;
+  if ( ! (end_stmt = __lmdb_get_stmt(the_db, lmdb_stmt_end_checkout)) ) return false;
+  for ( i = 0; i < sessions->capacity; i++ ) {
+    lmdb_checkout_session *session = sessions->buckets[i];
+    
+    while ( session ) {
+      sqlite3_int64       checkout_id = session->new_checkout_id ? session->new_checkout_id : session->checkout_id;
+      
+      if ( session->is_ended ) {
+        if ( checkout_id && ! session->is_end_written ) {
+          if ( sqlite3_bind_int64(end_stmt, 1, checkout_id) != SQLITE_OK ) goto exit_on_error;
+          if ( sqlite3_bind_int64(end_stmt, 2, (sqlite3_int64)check_timestamp) != SQLITE_OK ) goto exit_on_error;
+          if ( sqlite3_step(end_stmt) != SQLITE_DONE ) goto exit_on_error;
+          __lmdb_put_stmt(end_stmt);
+          session->is_end_written = true;
+          (*ended)++;
+        }
+      } else if ( session->is_end_written ) {
+        //
+        // Seen again after this transaction ended it, so it never ended:
+        //
+        if ( sqlite3_bind_int64(end_stmt, 1, checkout_id) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_null(end_stmt, 2) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_step(end_stmt) != SQLITE_DONE ) goto exit_on_error;
+        __lmdb_put_stmt(end_stmt);
+        session->is_end_written = false;
+      } else if ( ! checkout_id ) {
+        const lmdb_checkout_t   *c = &session->checkout;
+        
+        if ( sqlite3_bind_int(add_stmt, 1, session->feature_id) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_text(add_stmt, 2, c->user, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_text(add_stmt, 3, c->host, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_text(add_stmt, 4, c->display, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_text(add_stmt, 5, c->version, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_text(add_stmt, 6, c->server_host, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_text(add_stmt, 7, c->server_port, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_text(add_stmt, 8, c->handle, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_int(add_stmt, 9, c->license_count) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_bind_int64(add_stmt, 10, (sqlite3_int64)c->start_timestamp) != SQLITE_OK ) goto exit_on_error;
+        if ( sqlite3_step(add_stmt) != SQLITE_DONE ) goto exit_on_error;
+        __lmdb_put_stmt(add_stmt);
+        session->new_checkout_id = sqlite3_last_insert_rowid(the_db->db_handle);
+        (*started)++;
+      }
+      session = session->link;
+    }
+  }
+  ok = true;
+  
+exit_on_error:
+  if ( ! ok ) lmlogf(lmlog_level_warn, "failed to write checkout sessions: %s", sqlite3_errmsg(the_db->db_handle));
+  __lmdb_put_stmt(add_stmt);
+  __lmdb_put_stmt(end_stmt);
+  return ok;
+}
+
+//
+
+void
+__lmdb_checkouts_finish_commit(
+  lmdb_ref          the_db,
+  bool              was_committed
+)
+{
+  lmdb_checkout_sessions  *sessions = the_db->checkouts;
+  unsigned int            i;
+  
+  for ( i = 0; i < sessions->capacity; i++ ) {
+    lmdb_checkout_session **prev = &sessions->buckets[i], *session;
+    
+    while ( (session = *prev) ) {
+      if ( was_committed ) {
+        if ( session->new_checkout_id ) session->checkout_id = session->new_checkout_id;
+        if ( session->is_ended && (session->is_end_written || ! session->checkout_id) ) {
+          *prev = session->link;
+          sessions->count--;
+          free((void*)session);
+          continue;
+        }
+        // Seen again after its row was ended, it needs a new one:
+        if ( session->is_end_written ) session->checkout_id = 0;
+      }
+      session->new_checkout_id = 0;
+      session->is_end_written = false;
+      prev = &session->link;
+    }
+  }
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+const time_t lmdb_check_timestamp_now = 0;
+
+struct __lmdb_commit_counts_data {
+  bool        ok;
+  time_t      when;
+  lmdb_ref    the_db;
+  unsigned    rows_written;
+};
+
+bool
+__lmdb_commit_counts_iterator(
+  const void    *context,
+  lmfeature_ref feature
+)
+{
+  struct __lmdb_commit_counts_data   *CONTEXT = (struct __lmdb_commit_counts_data*)context;
+  
+  // Failure so long as at least one commit fails; once a failure is seen
+  // the transaction is going to be rolled back, so stop early:
+  if ( ! __lmdb_commit_feature_count(CONTEXT->the_db, feature, CONTEXT->when) ) {
+    CONTEXT->ok = false;
+    return false;
+  }
+  CONTEXT->rows_written++;
+	return true;
+}
+
+bool
+lmdb_commit_counts_with_stats(
+  lmdb_ref              the_db,
+  time_t                check_timestamp,
+  lmdb_commit_stats_t   *stats
+)
+{
+  struct timespec       t0, t1;
+  unsigned int          checkouts_started = 0, checkouts_ended = 0;
+  
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if ( stats ) {
+    stats->rows_written = 0;
+    stats->checkouts_started = stats->checkouts_ended = 0;
+    stats->elapsed = 0.0;
+  }
+  if ( ! the_db->is_read_only ) {
+    struct __lmdb_commit_counts_data context = {
+                .ok = true,
+                .when = check_timestamp,
+                .the_db = the_db,
+                .rows_written = 0
+              };
+    
+    if ( check_timestamp == lmdb_check_timestamp_now ) context.when = time(NULL);
+    
+    //
+    // All of the rows for this check are written in a single transaction so
+    // that the database sees one fsync per check rather than one per row:
+    //
+    if ( ! __lmdb_transaction_begin(the_db) ) return false;
+    lmfeatureset_iterate_modified(the_db->features, __lmdb_commit_counts_iterator, &context);
+    if ( the_db->count_storage == lmdb_count_storage_runs ) {
+      context.ok = __lmdb_count_runs_finish_commit(the_db, context.ok);
+    }
+    if ( context.ok && the_db->checkouts ) {
+      context.ok = __lmdb_checkouts_write(the_db, context.when, &checkouts_started, &checkouts_ended);
+    }
+    
+    //
+    // The features' modifications are final (and the checkout sessions
+    // updated) once the outermost transaction has committed; a nested
+    // one is not committed yet:
+    //
+    if ( context.ok ) lmfeatureset_stage_modified(the_db->features);
+    if ( ! __lmdb_transaction_end(the_db, context.ok) ) {
+      context.ok = false;
+      context.rows_written = 0;
+      checkouts_started = checkouts_ended = 0;
+    }
+    if ( stats ) {
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      stats->rows_written = context.rows_written;
+      stats->checkouts_started = checkouts_started;
+      stats->checkouts_ended = checkouts_ended;
+      stats->elapsed = (double)(t1.tv_sec - t0.tv_sec) + 1e-9 * (double)(t1.tv_nsec - t0.tv_nsec);
+    }
+    return context.ok;
+  }
+  return false;
+}
+
+//
+
+bool
+lmdb_commit_counts(
+  lmdb_ref      the_db,
+  time_t        check_timestamp
+)
+{
+  return lmdb_commit_counts_with_stats(the_db, check_timestamp, NULL);
+}
+
+//
+
+bool
+__lmdb_reset_in_use_counts_iterator(
+  const void    *context,
+  lmfeature_ref feature
+)
+{
+  (void)context;
+  lmfeature_set_in_use(feature, 0);
+  return true;
+}
+
+void
+lmdb_reset_in_use_counts(
+  lmdb_ref      the_db
+)
+{
+  lmfeatureset_iterate(the_db->features, __lmdb_reset_in_use_counts_iterator, NULL);
+}
+
+//
+
+bool
+lmdb_get_last_check_timestamp(
+  lmdb_ref      the_db,
+  time_t        *check_timestamp
+)
+{
+  sqlite3_stmt  *stmt = __lmdb_get_stmt(the_db, (the_db->count_storage == lmdb_count_storage_runs) ? lmdb_stmt_get_last_run_check_timestamp : lmdb_stmt_get_last_check_timestamp);
+  bool          rc = false;
+  
+  if ( stmt ) {
+    if ( sqlite3_step(stmt) == SQLITE_ROW ) {
+      if ( check_timestamp ) *check_timestamp = (time_t)sqlite3_column_int64(stmt, 0);
+      rc = true;
+    }
+    __lmdb_put_stmt(stmt);
+  }
+  return rc;
+}
+
+//
+
+bool
+lmdb_load_last_counts(
+  lmdb_ref      the_db
+)
+{
+  sqlite3_stmt  *stmt = __lmdb_get_stmt(the_db, (the_db->count_storage == lmdb_count_storage_runs) ? lmdb_stmt_get_last_run_counts : lmdb_stmt_get_last_counts);
+  int           rc;
+  
+  if ( ! stmt ) return false;
+  while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
+    //
+    // SQLite takes the bare columns from the row holding the MAX() (the
+    // latest count row or run):
+    //
+    lmfeature_ref   feature = lmdb_get_feature_by_feature_id(the_db, sqlite3_column_int(stmt, 0));
+    
+    if ( feature ) {
+      lmfeature_set_in_use(feature, sqlite3_column_int(stmt, 1));
+      lmfeature_set_issued(feature, sqlite3_column_int(stmt, 2));
+      if ( sqlite3_column_type(stmt, 3) == SQLITE_NULL ) {
+        lmfeature_set_expiration_date(feature, lmfeature_no_expiration);
+      } else {
+        lmfeature_set_expiration_date(feature, (time_t)sqlite3_column_int64(stmt, 3));
+      }
+    }
+  }
+  __lmdb_put_stmt(stmt);
+  if ( rc != SQLITE_DONE ) {
+    lmlogf(lmlog_level_warn, "failed while loading last counts: %s", sqlite3_errmsg(the_db->db_handle));
+    return false;
+  }
+  lmfeatureset_clear_modified(the_db->features);
+  return true;
+}
+
+//
+
+bool
+lmdb_begin_batch(
+  lmdb_ref      the_db
+)
+{
+  if ( the_db->is_read_only ) return false;
+  return __lmdb_transaction_begin(the_db);
+}
+
+//
+
+bool
+lmdb_end_batch(
+  lmdb_ref      the_db,
+  bool          should_commit
+)
+{
+  return __lmdb_transaction_end(the_db, should_commit);
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+/*
+ * Converting the counts table to runs:  each count row is assigned to a
+ * check by its timestamp -- a feature with several rows at one timestamp
+ * is assigned to as many consecutive checks at that timestamp -- and each
+ * feature's rows are then split into runs wherever the counts changed or
+ * the feature was missing from a check.  The runs that include the latest
+ * check are left open.
+ */
+static const char   *__db_compact_counts =
+    "DELETE FROM count_runs;\n"
+    "DELETE FROM checks;\n"
+    "CREATE TEMP TABLE lmdb_compact_rows AS\n"
+    "  SELECT feature_id, issued, in_use, expiration_timestamp, checked_timestamp,\n"
+    "         ROW_NUMBER() OVER (PARTITION BY feature_id, checked_timestamp ORDER BY rowid) AS seq\n"
+    "    FROM counts;\n"
+    "CREATE TEMP TABLE lmdb_compact_checks AS\n"
+    "  SELECT ROW_NUMBER() OVER (ORDER BY checked_timestamp, seq) AS check_id, checked_timestamp, seq\n"
+    "    FROM (SELECT DISTINCT checked_timestamp, seq FROM temp.lmdb_compact_rows);\n"
+    "CREATE INDEX temp.lmdb_compact_checks_idx\n"
+    "  ON lmdb_compact_checks(checked_timestamp, seq);\n"
+    "INSERT INTO checks (check_id, checked_timestamp)\n"
+    "  SELECT check_id, checked_timestamp FROM temp.lmdb_compact_checks ORDER BY check_id;\n"
+    "INSERT INTO count_runs (feature_id, issued, in_use, expiration_timestamp, first_check_id, last_check_id)\n"
+    "  SELECT feature_id, issued, in_use, expiration_timestamp, MIN(check_id), MAX(check_id)\n"
+    "    FROM (\n"
+    "      SELECT *, SUM(is_start) OVER (PARTITION BY feature_id ORDER BY check_id) AS run_number\n"
+    "        FROM (\n"
+    "          SELECT r.feature_id AS feature_id, r.issued AS issued, r.in_use AS in_use,\n"
+    "                 r.expiration_timestamp AS expiration_timestamp, k.check_id AS check_id,\n"
+    "                 CASE WHEN (LAG(k.check_id) OVER w = k.check_id - 1) AND (LAG(r.issued) OVER w = r.issued)\n"
+    "                       AND (LAG(r.in_use) OVER w = r.in_use) AND (LAG(r.expiration_timestamp) OVER w IS r.expiration_timestamp)\n"
+    "                      THEN 0 ELSE 1 END AS is_start\n"
+    "            FROM temp.lmdb_compact_rows AS r\n"
+    "            INNER JOIN temp.lmdb_compact_checks AS k ON (k.checked_timestamp = r.checked_timestamp AND k.seq = r.seq)\n"
+    "            WINDOW w AS (PARTITION BY r.feature_id ORDER BY k.check_id)\n"
+    "        )\n"
+    "    )\n"
+    "    GROUP BY feature_id, run_number\n"
+    "    ORDER BY MIN(check_id), feature_id;\n"
+    "UPDATE count_runs SET last_check_id = NULL WHERE last_check_id = (SELECT MAX(check_id) FROM checks);\n"
+    "DROP TABLE temp.lmdb_compact_rows;\n"
+    "DROP TABLE temp.lmdb_compact_checks;\n"
+    "DELETE FROM counts;\n"
+    "INSERT OR REPLACE INTO properties (name, value) VALUES ('count-storage', 'runs');\n"
+    ;
+
+//
+
+sqlite3_int64
+__lmdb_count_rows(
+  lmdb_ref      the_db,
+  const char    *table
+)
+{
+  const char    *query = strcatm("SELECT COUNT(*) FROM ", table, NULL);
+  sqlite3_int64 count = -1;
+  
+  if ( query ) {
+    sqlite3_stmt  *stmt;
+    
+    if ( sqlite3_prepare_v2(the_db->db_handle, query, -1, &stmt, NULL) == SQLITE_OK ) {
+      if ( sqlite3_step(stmt) == SQLITE_ROW ) count = sqlite3_column_int64(stmt, 0);
+      sqlite3_finalize(stmt);
+    }
+    free((void*)query);
+  }
+  return count;
+}
+
+//
+
+lmdb_count_storage
+lmdb_get_count_storage(
+  lmdb_ref      the_db
+)
+{
+  return the_db->count_storage;
+}
+
+//
+
+bool
+lmdb_compact_counts(
+  lmdb_ref      the_db
+)
+{
+  sqlite3_int64 row_count;
+  
+  if ( the_db->is_read_only ) {
+    lmlog(lmlog_level_error, "unable to compact counts in a read-only database");
+    return false;
+  }
+  if ( the_db->count_storage == lmdb_count_storage_runs ) {
+    lmlog(lmlog_level_info, "database counts are already compacted");
+    return true;
+  }
+  if ( ! __lmdb_transaction_begin(the_db) ) return false;
+  row_count = __lmdb_count_rows(the_db, "counts");
+  if ( ! __lmdb_exec_simple(the_db, DB_SCHEMA_COUNT_RUNS) || ! __lmdb_exec_simple(the_db, __db_compact_counts) ) {
+    __lmdb_transaction_end(the_db, false);
+    return false;
+  }
+  lmlogf(lmlog_level_info, "compacted %lld count row(s) into %lld run(s) over %lld check(s)",
+      (long long)row_count, (long long)__lmdb_count_rows(the_db, "count_runs"), (long long)__lmdb_count_rows(the_db, "checks"));
+  if ( ! __lmdb_transaction_end(the_db, true) ) return false;
+  the_db->count_storage = lmdb_count_storage_runs;
+  
+  //
+  // Give the space held by the count rows back to the filesystem (not
+  // possible inside an enclosing batch):
+  //
+  if ( the_db->transaction_depth == 0 ) __lmdb_exec_simple(the_db, "VACUUM");
+  return true;
+}
+
+//
+
+/*
+ * Rebuild the rollups from the raw samples:  hours first, then days from
+ * the hours and months from the days.  The source of the samples is
+ * substituted for the %s.
+ */
+static const char   *__db_rebuild_count_rollups_fmt =
+    "DELETE FROM count_rollups;\n"
+    "INSERT INTO count_rollups (tier, bucket, feature_id, sample_count, in_use_min, in_use_max, in_use_sum, issued_min, issued_max, issued_sum, expiration_timestamp, first_timestamp, last_timestamp)\n"
+    "  SELECT 1, CAST(strftime('%%Y%%m%%d%%H', checked_timestamp, 'unixepoch', 'localtime') AS INTEGER) AS hour, feature_id,\n"
+    "         COUNT(*), MIN(in_use), MAX(in_use), SUM(in_use), MIN(issued), MAX(issued), SUM(issued),\n"
+    "         MAX(expiration_timestamp), MIN(checked_timestamp), MAX(checked_timestamp)\n"
+    "    FROM %s GROUP BY hour, feature_id;\n"
+    "INSERT INTO count_rollups (tier, bucket, feature_id, sample_count, in_use_min, in_use_max, in_use_sum, issued_min, issued_max, issued_sum, expiration_timestamp, first_timestamp, last_timestamp)\n"
+    "  SELECT 2, bucket / 100 AS day, feature_id,\n"
+    "         SUM(sample_count), MIN(in_use_min), MAX(in_use_max), SUM(in_use_sum), MIN(issued_min), MAX(issued_max), SUM(issued_sum),\n"
+    "         MAX(expiration_timestamp), MIN(first_timestamp), MAX(last_timestamp)\n"
+    "    FROM count_rollups WHERE tier = 1 GROUP BY day, feature_id;\n"
+    "INSERT INTO count_rollups (tier, bucket, feature_id, sample_count, in_use_min, in_use_max, in_use_sum, issued_min, issued_max, issued_sum, expiration_timestamp, first_timestamp, last_timestamp)\n"
+    "  SELECT 3, bucket / 100 AS month, feature_id,\n"
+    "         SUM(sample_count), MIN(in_use_min), MAX(in_use_max), SUM(in_use_sum), MIN(issued_min), MAX(issued_max), SUM(issued_sum),\n"
+    "         MAX(expiration_timestamp), MIN(first_timestamp), MAX(last_timestamp)\n"
+    "    FROM count_rollups WHERE tier = 2 GROUP BY month, feature_id;\n";
+
+//
+
+bool
+lmdb_rebuild_rollups(
+  lmdb_ref      the_db
+)
+{
+  const char    *query;
+  char          timezone[128];
+  
+  if ( the_db->is_read_only ) {
+    lmlog(lmlog_level_error, "unable to rebuild rollups in a read-only database");
+    return false;
+  }
+  if ( sqlite3_libversion_number() < LMDB_ROLLUP_SQLITE_VERSION_MIN ) {
+    lmlogf(lmlog_level_error, "unable to rebuild rollups with SQLite %s (version " LMDB_ROLLUP_SQLITE_VERSION_MIN_STR " or newer is required)", sqlite3_libversion());
+    return false;
+  }
+  query = strcatf(__db_rebuild_count_rollups_fmt, (the_db->count_storage == lmdb_count_storage_runs) ? "expanded_counts" : "counts");
+  if ( ! query ) return false;
+  __lmdb_rollup_timezone(timezone, sizeof(timezone));
+  if ( ! __lmdb_transaction_begin(the_db) ) {
+    free((void*)query);
+    return false;
+  }
+  if ( ! __lmdb_exec_simple(the_db, DB_SCHEMA_PROPERTIES DB_SCHEMA_COUNT_ROLLUPS) || ! __lmdb_exec_simple(the_db, query) || ! __lmdb_set_property(the_db->db_handle, "rollup-timezone", timezone) ) {
+    free((void*)query);
+    __lmdb_transaction_end(the_db, false);
+    return false;
+  }
+  free((void*)query);
+  lmlogf(lmlog_level_info, "rebuilt %lld count rollup(s) in time zone %s", (long long)__lmdb_count_rows(the_db, "count_rollups"), timezone);
+  if ( ! __lmdb_transaction_end(the_db, true) ) return false;
+  the_db->has_rollups = true;
+  return true;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+bool
+lmdb_enable_log_ingest(
+  lmdb_ref          the_db
+)
+{
+  if ( the_db->is_read_only ) {
+    lmlog(lmlog_level_error, "log ingest requires a writable database");
+    return false;
+  }
+  return __lmdb_exec_simple(the_db, DB_SCHEMA_LOG_INGEST);
+}
+
+//
+
+bool
+lmdb_get_log_checkpoint(
+  lmdb_ref                the_db,
+  const char              *log_path,
+  lmdb_log_checkpoint_t   *checkpoint
+)
+{
+  sqlite3_stmt  *stmt = __lmdb_get_stmt(the_db, lmdb_stmt_get_log_checkpoint);
+  bool          ok = false;
+  
+  memset(checkpoint, 0, sizeof(*checkpoint));
+  if ( ! stmt ) return false;
+  if ( sqlite3_bind_text(stmt, 1, log_path, -1, SQLITE_STATIC) == SQLITE_OK ) {
+    switch ( sqlite3_step(stmt) ) {
+      case SQLITE_ROW:
+        checkpoint->device = (dev_t)sqlite3_column_int64(stmt, 0);
+        checkpoint->inode = (ino_t)sqlite3_column_int64(stmt, 1);
+        checkpoint->offset = (off_t)sqlite3_column_int64(stmt, 2);
+        checkpoint->event_timestamp = (time_t)sqlite3_column_int64(stmt, 3);
+        ok = true;
+        break;
+      case SQLITE_DONE:
+        ok = true;
+        break;
+      default:
+        lmlogf(lmlog_level_warn, "failed while reading checkpoint for %s: %s", log_path, sqlite3_errmsg(the_db->db_handle));
+        break;
+    }
+  }
+  __lmdb_put_stmt(stmt);
+  return ok;
+}
+
+//
+
+bool
+lmdb_set_log_checkpoint(
+  lmdb_ref                      the_db,
+  const char                    *log_path,
+  const lmdb_log_checkpoint_t   *checkpoint
+)
+{
+  sqlite3_stmt  *stmt = __lmdb_get_stmt(the_db, lmdb_stmt_set_log_checkpoint);
+  int           rc = -1;
+  
+  if ( ! stmt ) return false;
+  if ( sqlite3_bind_text(stmt, 1, log_path, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 2, (sqlite3_int64)checkpoint->device) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 3, (sqlite3_int64)checkpoint->inode) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 4, (sqlite3_int64)checkpoint->offset) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 5, (sqlite3_int64)checkpoint->event_timestamp) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 6, (sqlite3_int64)time(NULL)) != SQLITE_OK ) goto exit_on_error;
+  rc = sqlite3_step(stmt);
+  if ( rc != SQLITE_DONE ) lmlogf(lmlog_level_warn, "failed while writing checkpoint for %s: %s", log_path, sqlite3_errmsg(the_db->db_handle));
+
+exit_on_error:
+  __lmdb_put_stmt(stmt);
+  return ( rc == SQLITE_DONE );
+}
+
+//
+
+bool
+lmdb_add_denial(
+  lmdb_ref      the_db,
+  lmfeature_ref the_feature,
+  const char    *user,
+  const char    *host,
+  const char    *reason,
+  bool          is_unsupported,
+  time_t        event_timestamp
+)
+{
+  sqlite3_stmt  *stmt = __lmdb_get_stmt(the_db, lmdb_stmt_add_denial);
+  int           rc = -1;
+  
+  if ( ! stmt ) return false;
+  if ( sqlite3_bind_int(stmt, 1, lmfeature_get_feature_id(the_feature)) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_text(stmt, 2, user, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_text(stmt, 3, host, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_text(stmt, 4, reason, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int(stmt, 5, is_unsupported ? 1 : 0) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 6, (sqlite3_int64)event_timestamp) != SQLITE_OK ) goto exit_on_error;
+  rc = sqlite3_step(stmt);
+  if ( rc != SQLITE_DONE ) lmlogf(lmlog_level_warn, "failed while adding denial: %s", sqlite3_errmsg(the_db->db_handle));
+
+exit_on_error:
+  __lmdb_put_stmt(stmt);
+  return ( rc == SQLITE_DONE );
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+/*
+ * A report on a database that stores count runs can usually be computed
+ * from the runs without expanding them into rows:  the checks selected by
+ * the report are split into segments of consecutive check ids that fall in
+ * the same aggregation bucket, and each run contributes the overlap of its
+ * range of check ids with each segment to the feature's bucket.  Such a
+ * report is held in memory as rows.
+ */
+typedef struct {
+  int                   feature_id;
+  const char            *vendor, *version, *feature_string;
+  lmdb_int_range_t      in_use, issued;
+  time_t                expiration_timestamp;
+  lmdb_time_range_t     check_timestamp;
+} lmdb_usage_report_row;
+
+typedef struct _lmdb_usage_report {
+  lmdb_ref              				parent_db;
+  lmdb_usage_report_aggregate  	aggregate;
+  lmdb_usage_report_range				range;
+  sqlite3_stmt          				*query;
+  mempool_ref                   pool;
+  unsigned int                  row_count, row_capacity;
+  lmdb_usage_report_row         *rows;
+} lmdb_usage_report;
+
+bool __lmdb_predicate_split(lmdb_predicate_ref the_predicate, bool allow_or, strbuf_ref feature_sql, strbuf_ref check_sql);
+bool __lmdb_predicate_get_checked_bounds(lmdb_predicate_ref the_predicate, sqlite3_int64 *lo, sqlite3_int64 *hi);
+
+//
+
+typedef struct {
+  sqlite3_int64         lo, hi;           /* range of check ids */
+  unsigned int          bucket;
+  unsigned int          index;            /* of check lo in the timestamp array */
+  bool                  is_ordered;       /* timestamps never decrease */
+} lmdb_check_segment;
+
+typedef struct {
+  unsigned int          feature_serial;
+  sqlite3_int64         check_count;
+  int                   in_use_min, in_use_max, issued_min, issued_max;
+  sqlite3_int64         in_use_sum, issued_sum;
+  bool                  has_expiration;
+  time_t                expiration_timestamp;
+  time_t                start, end;
+} lmdb_usage_report_bucket;
+
+//
+
+int
+__lmdb_usage_report_strcmp(
+  const char    *s1,
+  const char    *s2
+)
+{
+  // NULL sorts ahead of any string, as in SQLite:
+  if ( ! s1 ) return s2 ? -1 : 0;
+  if ( ! s2 ) return 1;
+  return strcmp(s1, s2);
+}
+
+int
+__lmdb_usage_report_row_cmp(
+  const void    *p1,
+  const void    *p2
+)
+{
+  const lmdb_usage_report_row   *r1 = (const lmdb_usage_report_row*)p1;
+  const lmdb_usage_report_row   *r2 = (const lmdb_usage_report_row*)p2;
+  int                           cmp;
+
+  // Same order as DB_QUERY_ORDER_BY:
+  if ( r1->check_timestamp.start != r2->check_timestamp.start ) return ( r1->check_timestamp.start < r2->check_timestamp.start ) ? -1 : 1;
+  if ( (cmp = __lmdb_usage_report_strcmp(r1->vendor, r2->vendor)) ) return cmp;
+  if ( (cmp = __lmdb_usage_report_strcmp(r1->version, r2->version)) ) return cmp;
+  return __lmdb_usage_report_strcmp(r1->feature_string, r2->feature_string);
+}
+
+//
+
+bool
+__lmdb_usage_report_add_rows(
+  lmdb_usage_report         *the_report,
+  lmdb_usage_report_bucket  *buckets,
+  unsigned int              *touched,
+  unsigned int              touched_count,
+  const lmdb_usage_report_row *feature
+)
+{
+  if ( the_report->row_count + touched_count > the_report->row_capacity ) {
+    unsigned int            new_capacity = the_report->row_capacity ? the_report->row_capacity : 256;
+    lmdb_usage_report_row   *new_rows;
+
+    while ( new_capacity < the_report->row_count + touched_count ) new_capacity *= 2;
+    if ( ! (new_rows = realloc(the_report->rows, new_capacity * sizeof(lmdb_usage_report_row))) ) return false;
+    the_report->rows = new_rows;
+    the_report->row_capacity = new_capacity;
+  }
+  while ( touched_count-- ) {
+    lmdb_usage_report_bucket  *bucket = &buckets[*touched++];
+    lmdb_usage_report_row     *row = &the_report->rows[the_report->row_count++];
+
+    *row = *feature;
+    row->in_use.min = bucket->in_use_min;
+    row->in_use.max = bucket->in_use_max;
+    row->in_use.avg = (int)((double)bucket->in_use_sum / (double)bucket->check_count);
+    row->issued.min = bucket->issued_min;
+    row->issued.max = bucket->issued_max;
+    row->issued.avg = (int)((double)bucket->issued_sum / (double)bucket->check_count);
+    row->expiration_timestamp = bucket->has_expiration ? bucket->expiration_timestamp : 0;
+    row->check_timestamp.start = bucket->start;
+    row->check_timestamp.end = bucket->end;
+  }
+  return true;
+}
+
+//
+
+/*
+ * A report's range is tested as a span of check timestamps, computed before
+ * the query is run and bound to it, so an index on the timestamps can be
+ * searched rather than every row being tested:
+ */
+#define DB_QUERY_RANGE \
+    "c.checked_timestamp BETWEEN :range_start AND :range_end"
+
+bool
+__lmdb_usage_report_bind_range(
+  sqlite3_stmt              *stmt,
+  sqlite3_int64             range_start,
+  sqlite3_int64             range_end
+)
+{
+  int                       idx;
+  
+  if ( (idx = sqlite3_bind_parameter_index(stmt, ":range_start")) && (sqlite3_bind_int64(stmt, idx, range_start) != SQLITE_OK) ) return false;
+  if ( (idx = sqlite3_bind_parameter_index(stmt, ":range_end")) && (sqlite3_bind_int64(stmt, idx, range_end) != SQLITE_OK) ) return false;
+  return true;
+}
+
 //
 
-lmfeature_ref
-lmdb_get_feature_by_feature_id(
-  lmdb_ref      the_db,
-  int           feature_id
+/*
+ * Returns false if nothing has been checked yet.
+ */
+bool
+__lmdb_get_last_checked_timestamp(
+  lmdb_ref                  the_db,
+  sqlite3_int64             *timestamp
 )
 {
-  // Check the featureset first
-  lmfeature_ref feature = lmfeatureset_get_feature_by_id(the_db->features, feature_id);
+  sqlite3_stmt              *stmt = __lmdb_get_stmt(the_db, (the_db->count_storage == lmdb_count_storage_runs) ? lmdb_stmt_get_last_run_checked_timestamp : lmdb_stmt_get_last_checked_timestamp);
+  bool                      rc = false;
   
-  if ( ! feature ) {
-    sqlite3_stmt  *stmt = NULL;
-    int           rc;
-    int           tbl_feature_id;
-    const char    *tbl_feature_string, *tbl_vendor, *tbl_version;
-
-    if ( sqlite3_prepare_v2(the_db->db_handle, __db_get_feature_by_id_query, -1, &stmt, NULL) != SQLITE_OK ) {
-      lmlogf(lmlog_level_warn, "failed while preparing query '%s': %s", __db_get_feature_by_id_query, sqlite3_errmsg(the_db->db_handle));
-      goto exit_on_error;
-    }
-    if ( sqlite3_bind_int(stmt, 1, feature_id) != SQLITE_OK ) {
-      lmlogf(lmlog_level_warn, "failed while binding parameter 1 to query: %s", sqlite3_errmsg(the_db->db_handle));
-      goto exit_on_error;
-    }
-    rc = sqlite3_step(stmt);
-    switch ( rc ) {
-    
-      case SQLITE_ROW: {
-        /* Extant feature, wrap with an lmfeature: */
-        tbl_feature_id = sqlite3_column_int(stmt, 0);
-        tbl_feature_string = (const char*)sqlite3_column_text(stmt, 1);
-        tbl_vendor = (const char*)sqlite3_column_text(stmt, 2);
-        tbl_version = (const char*)sqlite3_column_text(stmt, 3);
-        
-        feature = lmfeature_create(tbl_feature_id, tbl_feature_string, tbl_vendor, tbl_version);
-        if ( feature ) {
-          bool      ok = lmfeatureset_add_feature(the_db->features, feature);
-          lmfeature_release(feature);
-          if ( ! ok ) feature = NULL;
-        }
-        break;
-      }
-      
-      default:
-        lmlogf(lmlog_level_warn, "query failed (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
-        break;
-      
+  if ( stmt ) {
+    if ( (sqlite3_step(stmt) == SQLITE_ROW) && (sqlite3_column_type(stmt, 0) != SQLITE_NULL) ) {
+      *timestamp = sqlite3_column_int64(stmt, 0);
+      rc = true;
     }
-exit_on_error:
-    if ( stmt ) sqlite3_finalize(stmt);
+    __lmdb_put_stmt(stmt);
   }
-  return feature;
-    
+  return rc;
 }
 
 //
 
-lmfeature_ref
-lmdb_get_feature_by_name(
-  lmdb_ref      the_db,
-  const char    *feature_string,
-  const char    *vendor,
-  const char    *version
+bool
+__lmdb_usage_report_load_runs(
+  lmdb_usage_report         *the_report,
+  strbuf_ref                sql,
+  const char                *bucket_str,
+  const char                *feature_str,
+  const char                *check_str,
+  lmdb_predicate_ref        predicate,
+  sqlite3_int64             range_start,
+  sqlite3_int64             range_end
 )
 {
-  // Check the featureset first
-  lmfeature_ref feature = lmfeatureset_get_feature_by_name(the_db->features, feature_string, vendor, version);
-  
-  if ( ! feature ) {
-    sqlite3_stmt  *stmt = NULL;
-    int           rc;
-    int           tbl_feature_id;
-    const char    *tbl_feature_string, *tbl_vendor, *tbl_version;
+  lmdb_ref                  the_db = the_report->parent_db;
+  const char                *query_str;
+  sqlite3_stmt              *stmt = NULL;
+  time_t                    *timestamps = NULL;
+  unsigned int              check_count = 0, check_capacity = 0;
+  lmdb_check_segment        *segments = NULL;
+  unsigned int              segment_count = 0, segment_capacity = 0;
+  lmdb_usage_report_bucket  *buckets = NULL;
+  unsigned int              bucket_count = 0;
+  unsigned int              *touched = NULL, touched_count = 0, feature_serial = 0;
+  lmdb_usage_report_row     feature;
+  bool                      is_okay = false;
+  unsigned int              bind_index;
+  int                       rc;
 
-    if ( sqlite3_prepare_v2(the_db->db_handle, __db_get_feature_by_name_query, -1, &stmt, NULL) != SQLITE_OK ) {
-      lmlogf(lmlog_level_warn, "failed while preparing query '%s': %s", __db_get_feature_by_name_query, sqlite3_errmsg(the_db->db_handle));
-      goto exit_on_error;
+  //
+  // Gather the selected checks in order and split them into segments:
+  //
+  strbuf_reset(sql);
+  strbuf_appendm(sql,
+                  "SELECT check_id, checked_timestamp, DENSE_RANK() OVER (ORDER BY bucket)"
+                  "  FROM (SELECT c.check_id AS check_id, c.checked_timestamp AS checked_timestamp, ", (bucket_str ? bucket_str : "0"), " AS bucket"
+                  "          FROM checks AS c", (check_str ? " WHERE " : ""), (check_str ? check_str : ""), ")"
+                  "  ORDER BY check_id",
+                  NULL
+                );
+  if ( ! (query_str = strbuf_get_cstring(sql)) ) goto exit_on_error;
+  stmt = __lmdb_query_cache_get(the_db, query_str);
+  if ( ! stmt ) goto exit_on_error;
+  if ( ! __lmdb_usage_report_bind_range(stmt, range_start, range_end) ) goto exit_on_error;
+  bind_index = 0;
+  if ( predicate && ! __lmdb_predicate_bind(predicate, stmt, &bind_index) ) goto exit_on_error;
+  while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
+    sqlite3_int64           check_id = sqlite3_column_int64(stmt, 0);
+    time_t                  timestamp = (time_t)sqlite3_column_int64(stmt, 1);
+    unsigned int            bucket = (unsigned int)sqlite3_column_int(stmt, 2) - 1;
+    lmdb_check_segment      *segment = segment_count ? &segments[segment_count - 1] : NULL;
+
+    if ( check_count == check_capacity ) {
+      unsigned int          new_capacity = check_capacity ? 2 * check_capacity : 1024;
+      time_t                *new_timestamps = realloc(timestamps, new_capacity * sizeof(time_t));
+
+      if ( ! new_timestamps ) goto exit_on_error;
+      timestamps = new_timestamps;
+      check_capacity = new_capacity;
     }
-    if ( sqlite3_bind_text(stmt, 1, feature_string, -1, SQLITE_STATIC) != SQLITE_OK ) {
-      lmlogf(lmlog_level_warn, "failed while binding parameter 1 to query: %s", sqlite3_errmsg(the_db->db_handle));
-      goto exit_on_error;
+    if ( segment && (segment->hi + 1 == check_id) && (segment->bucket == bucket) ) {
+      segment->hi = check_id;
+      if ( timestamp < timestamps[check_count - 1] ) segment->is_ordered = false;
+    } else {
+      if ( segment_count == segment_capacity ) {
+        unsigned int        new_capacity = segment_capacity ? 2 * segment_capacity : 64;
+        lmdb_check_segment  *new_segments = realloc(segments, new_capacity * sizeof(lmdb_check_segment));
+
+        if ( ! new_segments ) goto exit_on_error;
+        segments = new_segments;
+        segment_capacity = new_capacity;
+      }
+      segment = &segments[segment_count++];
+      segment->lo = segment->hi = check_id;
+      segment->bucket = bucket;
+      segment->index = check_count;
+      segment->is_ordered = true;
     }
-    if ( sqlite3_bind_text(stmt, 2, vendor, -1, SQLITE_STATIC) != SQLITE_OK ) {
-      lmlogf(lmlog_level_warn, "failed while binding parameter 2 to query: %s", sqlite3_errmsg(the_db->db_handle));
-      goto exit_on_error;
+    timestamps[check_count++] = timestamp;
+    if ( bucket >= bucket_count ) bucket_count = bucket + 1;
+  }
+  if ( rc != SQLITE_DONE ) goto exit_on_error;
+  __lmdb_query_cache_put(the_db, stmt);
+  stmt = NULL;
+  if ( segment_count == 0 ) {
+    is_okay = true;
+    goto exit_on_error;
+  }
+
+  buckets = calloc(bucket_count, sizeof(lmdb_usage_report_bucket));
+  touched = malloc(bucket_count * sizeof(unsigned int));
+  if ( ! buckets || ! touched ) goto exit_on_error;
+
+  //
+  // Walk each feature's runs in order, accumulating their overlap with the
+  // segments into the buckets:
+  //
+  strbuf_reset(sql);
+  strbuf_appendm(sql,
+                  "SELECT r.feature_id, r.in_use, r.issued, r.expiration_timestamp, r.first_check_id, r.last_check_id, f.vendor, f.version, f.feature_string"
+                  "  FROM count_runs AS r"
+                  "  INNER JOIN features AS f ON (f.feature_id = r.feature_id)"
+                  "  WHERE r.first_check_id <= ?2 AND (r.last_check_id IS NULL OR r.last_check_id >= ?1)",
+                  (feature_str ? " AND (" : ""), (feature_str ? feature_str : ""), (feature_str ? ")" : ""),
+                  "  ORDER BY r.feature_id, r.first_check_id",
+                  NULL
+                );
+  if ( ! (query_str = strbuf_get_cstring(sql)) ) goto exit_on_error;
+  stmt = __lmdb_query_cache_get(the_db, query_str);
+  if ( ! stmt ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 1, segments[0].lo) != SQLITE_OK ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 2, segments[segment_count - 1].hi) != SQLITE_OK ) goto exit_on_error;
+  bind_index = 0;
+  if ( predicate && ! __lmdb_predicate_bind(predicate, stmt, &bind_index) ) goto exit_on_error;
+
+  memset(&feature, 0, sizeof(feature));
+  feature.feature_id = -1;
+  while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
+    int                     feature_id = sqlite3_column_int(stmt, 0);
+    int                     in_use = sqlite3_column_int(stmt, 1);
+    int                     issued = sqlite3_column_int(stmt, 2);
+    bool                    has_expiration = ( sqlite3_column_type(stmt, 3) != SQLITE_NULL );
+    time_t                  expiration_timestamp = (time_t)sqlite3_column_int64(stmt, 3);
+    sqlite3_int64           first = sqlite3_column_int64(stmt, 4);
+    sqlite3_int64           last = ( sqlite3_column_type(stmt, 5) == SQLITE_NULL ) ? LLONG_MAX : sqlite3_column_int64(stmt, 5);
+    unsigned int            s_lo = 0, s_hi = segment_count;
+
+    if ( feature_id != feature.feature_id ) {
+      const char            *s;
+
+      if ( ! __lmdb_usage_report_add_rows(the_report, buckets, touched, touched_count, &feature) ) goto exit_on_error;
+      touched_count = 0;
+      feature_serial++;
+      feature.feature_id = feature_id;
+      feature.vendor = (s = (const char*)sqlite3_column_text(stmt, 6)) ? mempool_strdup(the_report->pool, s) : NULL;
+      feature.version = (s = (const char*)sqlite3_column_text(stmt, 7)) ? mempool_strdup(the_report->pool, s) : NULL;
+      feature.feature_string = (s = (const char*)sqlite3_column_text(stmt, 8)) ? mempool_strdup(the_report->pool, s) : NULL;
     }
-    if ( sqlite3_bind_text(stmt, 3, version, -1, SQLITE_STATIC) != SQLITE_OK ) {
-      lmlogf(lmlog_level_warn, "failed while binding parameter 3 to query: %s", sqlite3_errmsg(the_db->db_handle));
-      goto exit_on_error;
+
+    // Find the first segment that ends at or after the start of the run:
+    while ( s_lo < s_hi ) {
+      unsigned int          s_mid = (s_lo + s_hi) / 2;
+
+      if ( segments[s_mid].hi < first ) {
+        s_lo = s_mid + 1;
+      } else {
+        s_hi = s_mid;
+      }
     }
-    rc = sqlite3_step(stmt);
-    switch ( rc ) {
-    
-      case SQLITE_ROW: {
-        /* Extant feature, wrap with an lmfeature: */
-        tbl_feature_id = sqlite3_column_int(stmt, 0);
-        tbl_feature_string = (const char*)sqlite3_column_text(stmt, 1);
-        tbl_vendor = (const char*)sqlite3_column_text(stmt, 2);
-        tbl_version = (const char*)sqlite3_column_text(stmt, 3);
-        
-        LMDEBUG("feature %s for vendor %s (version %s) found in database with id %d", feature_string, vendor, version, tbl_feature_id);
-        
-        feature = lmfeature_create(tbl_feature_id, tbl_feature_string, tbl_vendor, tbl_version);
-        if ( feature ) {
-          bool      ok = lmfeatureset_add_feature(the_db->features, feature);
-          lmfeature_release(feature);
-          if ( ! ok ) feature = NULL;
+    while ( (s_lo < segment_count) && (segments[s_lo].lo <= last) ) {
+      lmdb_check_segment        *segment = &segments[s_lo++];
+      lmdb_usage_report_bucket  *bucket = &buckets[segment->bucket];
+      sqlite3_int64             lo = ( first > segment->lo ) ? first : segment->lo;
+      sqlite3_int64             hi = ( last < segment->hi ) ? last : segment->hi;
+      sqlite3_int64             n = hi - lo + 1;
+      unsigned int              i = segment->index + (unsigned int)(lo - segment->lo);
+      unsigned int              i_end = segment->index + (unsigned int)(hi - segment->lo);
+      time_t                    start = timestamps[i], end = timestamps[i_end];
+
+      if ( ! segment->is_ordered ) {
+        while ( ++i <= i_end ) {
+          if ( timestamps[i] < start ) start = timestamps[i];
+          if ( timestamps[i] > end ) end = timestamps[i];
         }
-        break;
       }
-      
-      case SQLITE_DONE: {
-        /* If the database is read-only, we can't add the feature: */
-        if ( the_db->is_read_only ) goto exit_on_error;
-        
-        /* Unknown feature, add it: */
-        sqlite3_finalize(stmt);
-        stmt = NULL;
-        
-        LMDEBUG("feature %s for vendor %s (version %s) not present in database", feature_string, vendor, version);
-        
-        if ( sqlite3_prepare_v2(the_db->db_handle, __db_add_feature_query, -1, &stmt, NULL) != SQLITE_OK ) goto exit_on_error;
-        if ( sqlite3_bind_text(stmt, 1, feature_string, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
-        if ( sqlite3_bind_text(stmt, 2, vendor, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
-        if ( sqlite3_bind_text(stmt, 3, version, -1, SQLITE_STATIC) != SQLITE_OK ) goto exit_on_error;
-        rc = sqlite3_step(stmt);
-        if ( rc == SQLITE_DONE ) {
-          sqlite3_int64     tbl_feature_id = sqlite3_last_insert_rowid(the_db->db_handle);
-          
-          feature = lmfeature_create(tbl_feature_id, feature_string, vendor, version);
-          if ( feature ) {
-            bool      ok = lmfeatureset_add_feature(the_db->features, feature);
-            lmfeature_release(feature);
-            if ( ! ok ) feature = NULL;
-          }
-        }
-        break;
+      if ( bucket->feature_serial != feature_serial ) {
+        bucket->feature_serial = feature_serial;
+        bucket->check_count = 0;
+        bucket->in_use_min = bucket->in_use_max = in_use;
+        bucket->issued_min = bucket->issued_max = issued;
+        bucket->in_use_sum = bucket->issued_sum = 0;
+        bucket->has_expiration = false;
+        bucket->start = start;
+        bucket->end = end;
+        touched[touched_count++] = segment->bucket;
+      } else {
+        if ( in_use < bucket->in_use_min ) bucket->in_use_min = in_use;
+        if ( in_use > bucket->in_use_max ) bucket->in_use_max = in_use;
+        if ( issued < bucket->issued_min ) bucket->issued_min = issued;
+        if ( issued > bucket->issued_max ) bucket->issued_max = issued;
+        if ( start < bucket->start ) bucket->start = start;
+        if ( end > bucket->end ) bucket->end = end;
+      }
+      bucket->check_count += n;
+      bucket->in_use_sum += n * in_use;
+      bucket->issued_sum += n * issued;
+      if ( has_expiration && (! bucket->has_expiration || (expiration_timestamp > bucket->expiration_timestamp)) ) {
+        bucket->has_expiration = true;
+        bucket->expiration_timestamp = expiration_timestamp;
       }
-      
-      default:
-        lmlogf(lmlog_level_warn, "query failed (rc = %d): %s", rc, sqlite3_errmsg(the_db->db_handle));
-        break;
-
     }
-exit_on_error:
-    if ( stmt ) sqlite3_finalize(stmt);
   }
-  return feature;
+  if ( rc != SQLITE_DONE ) goto exit_on_error;
+  if ( ! __lmdb_usage_report_add_rows(the_report, buckets, touched, touched_count, &feature) ) goto exit_on_error;
+
+  if ( the_report->row_count > 1 ) qsort(the_report->rows, the_report->row_count, sizeof(lmdb_usage_report_row), __lmdb_usage_report_row_cmp);
+  is_okay = true;
+
+exit_on_error:
+  __lmdb_query_cache_put(the_db, stmt);
+  if ( touched ) free((void*)touched);
+  if ( buckets ) free((void*)buckets);
+  if ( segments ) free((void*)segments);
+  if ( timestamps ) free((void*)timestamps);
+  if ( ! is_okay ) lmlogf(lmlog_level_debug, "unable to compute report from count runs: %s", sqlite3_errmsg(the_db->db_handle));
+  return is_okay;
 }
 
 //
 
-lmfeature_ref
-lmdb_add_feature(
-  lmdb_ref      the_db,
-  lmfeature_ref new_feature
+/*
+ * Aggregated reports are answered from the count rollups:  the months, days
+ * and hours that lie wholly inside [lo, hi] come from the coarsest tier that
+ * does not straddle the report's buckets and the samples in the (at most two)
+ * hours containing lo and hi come from the counts themselves.  Each piece
+ * carries the hour key (YYYYMMDDHH, zero-filled below the tier's bucket) of
+ * the period it covers, from which okey_str derives the report's bucket.
+ */
+#define DB_ROLLUP_COLUMNS \
+    "feature_id, sample_count, in_use_min, in_use_max, in_use_sum, issued_min, issued_max, issued_sum, expiration_timestamp, first_timestamp, last_timestamp"
+
+#define DB_ROLLUP_HOUR_KEY(T) \
+    "CAST(strftime('%Y%m%d%H', " T ", 'unixepoch', 'localtime') AS INTEGER)"
+
+/*
+ * Below the coarsest tier only the days (hours) of the months (days) at
+ * either end are needed, as two ranges of buckets:
+ */
+#define DB_ROLLUP_HOURS_IN(RANGE) \
+    "SELECT bucket AS hkey, " DB_ROLLUP_COLUMNS " FROM count_rollups WHERE tier = 1 AND " RANGE
+
+#define DB_ROLLUP_DAYS_IN(RANGE) \
+    "SELECT bucket * 100 AS hkey, " DB_ROLLUP_COLUMNS " FROM count_rollups WHERE tier = 2 AND " RANGE
+
+#define DB_ROLLUP_MONTHS_IN(RANGE) \
+    "SELECT bucket * 10000 AS hkey, " DB_ROLLUP_COLUMNS " FROM count_rollups WHERE tier = 3 AND " RANGE
+
+/* Longest span of time (in seconds) that shares a single hour key: */
+#define LMDB_ROLLUP_HOUR_WINDOW 10800
+
+bool
+__lmdb_usage_report_load_rollups(
+  lmdb_usage_report         *the_report,
+  strbuf_ref                sql,
+  const char                *okey_str,
+  int                       max_tier,
+  const char                *feature_str,
+  lmdb_predicate_ref        predicate,
+  sqlite3_int64             lo,
+  sqlite3_int64             hi
 )
 {
-  lmfeature_ref from_db_feature;
-  
-  // It better have the proper feature_id:
-  if ( lmfeature_get_feature_id(new_feature) != lmfeature_no_id ) return NULL;
+  lmdb_ref                  the_db = the_report->parent_db;
+  const char                *raw_str = (the_report->parent_db->count_storage == lmdb_count_storage_runs) ? "expanded_counts" : "counts";
+  const char                *query_str;
+  sqlite3_stmt              *stmt = NULL;
+  sqlite3_int64             hour_lo = -1, hour_hi = LLONG_MAX, head_hi, tail_lo;
+  unsigned int              bind_index = 0;
+  bool                      is_okay = false;
   
-  // Check to be sure it's not already present in the feature set:
-  if ( lmfeatureset_get_feature_by_name(the_db->features, lmfeature_get_feature_string(new_feature), lmfeature_get_vendor(new_feature), lmfeature_get_version(new_feature)) ) return NULL;
-  
-  // Use its feature string, vendor, and version to add to the database (or load the record from the database):
-  if ( (from_db_feature = lmdb_get_feature_by_name(the_db, lmfeature_get_feature_string(new_feature), lmfeature_get_vendor(new_feature), lmfeature_get_version(new_feature))) ) {
-    // Set the new in-db feature's counts if it was modified:
-    if ( lmfeature_is_modified(new_feature) ) {
-      lmfeature_set_expiration_date(from_db_feature, lmfeature_get_expiration_date(new_feature));
-      lmfeature_set_in_use(from_db_feature, lmfeature_get_in_use(new_feature));
-      lmfeature_set_issued(from_db_feature, lmfeature_get_issued(new_feature));
+  //
+  // Hour keys of the bounds; an unbounded end gets a key beyond every bucket:
+  //
+  if ( ! (stmt = __lmdb_get_stmt(the_db, lmdb_stmt_get_rollup_hour_keys)) ) return false;
+  if ( (sqlite3_bind_int64(stmt, 1, lo) == SQLITE_OK) && (sqlite3_bind_int64(stmt, 2, hi) == SQLITE_OK) && (sqlite3_step(stmt) == SQLITE_ROW) ) {
+    is_okay = true;
+    if ( lo != LLONG_MIN ) {
+      if ( sqlite3_column_type(stmt, 0) == SQLITE_NULL ) is_okay = false;
+      hour_lo = sqlite3_column_int64(stmt, 0);
+    }
+    if ( hi != LLONG_MAX ) {
+      if ( sqlite3_column_type(stmt, 1) == SQLITE_NULL ) is_okay = false;
+      hour_hi = sqlite3_column_int64(stmt, 1);
     }
-    return from_db_feature;
   }
-  return NULL;
+  __lmdb_put_stmt(stmt);
+  stmt = NULL;
+  if ( ! is_okay ) return false;
+  is_okay = false;
+  
+  //
+  // The samples in the hours containing lo and hi are found in [lo, head_hi]
+  // and [tail_lo, hi], which do not overlap:
+  //
+  if ( lo > LLONG_MAX - LMDB_ROLLUP_HOUR_WINDOW ) {
+    head_hi = hi;
+    tail_lo = LLONG_MAX;
+  } else {
+    head_hi = lo + LMDB_ROLLUP_HOUR_WINDOW - 1;
+    if ( head_hi > hi ) head_hi = hi;
+    tail_lo = lo + LMDB_ROLLUP_HOUR_WINDOW;
+    if ( (hi > LLONG_MIN + LMDB_ROLLUP_HOUR_WINDOW) && (hi - LMDB_ROLLUP_HOUR_WINDOW + 1 > tail_lo) ) tail_lo = hi - LMDB_ROLLUP_HOUR_WINDOW + 1;
+  }
+  
+  strbuf_reset(sql);
+  strbuf_appendm(sql,
+                  "SELECT f.feature_id, f.vendor, f.version, f.feature_string,"
+                  " MIN(p.in_use_min) AS in_use_min, MAX(p.in_use_max) AS in_use_max, CAST(SUM(p.in_use_sum) AS REAL) / SUM(p.sample_count) AS in_use_avg,"
+                  " MIN(p.issued_min) AS issued_min, MAX(p.issued_max) AS issued_max, CAST(SUM(p.issued_sum) AS REAL) / SUM(p.sample_count) AS issued_avg,"
+                  " MIN(p.first_timestamp) AS start_timestamp, MAX(p.last_timestamp) AS end_timestamp, MAX(p.expiration_timestamp) AS expiration_timestamp"
+                  "  FROM (",
+                  ((max_tier >= 2) ? DB_ROLLUP_HOURS_IN("bucket > ?3 AND bucket < MIN(?4, (?3 / 100 + 1) * 100)")
+                                     " UNION ALL " DB_ROLLUP_HOURS_IN("bucket >= MAX(?4 / 100 * 100, (?3 / 100 + 1) * 100) AND bucket < ?4")
+                                   : DB_ROLLUP_HOURS_IN("bucket > ?3 AND bucket < ?4")),
+                  ((max_tier >= 3) ? " UNION ALL " DB_ROLLUP_DAYS_IN("bucket > ?3 / 100 AND bucket < MIN(?4 / 100, (?3 / 10000 + 1) * 100)")
+                                     " UNION ALL " DB_ROLLUP_DAYS_IN("bucket >= MAX(?4 / 10000 * 100, (?3 / 10000 + 1) * 100) AND bucket < ?4 / 100")
+                                     " UNION ALL " DB_ROLLUP_MONTHS_IN("bucket > ?3 / 10000 AND bucket < ?4 / 10000")
+                                   : ((max_tier == 2) ? " UNION ALL " DB_ROLLUP_DAYS_IN("bucket > ?3 / 100 AND bucket < ?4 / 100") : "")),
+                  " UNION ALL "
+                  "SELECT hkey, feature_id, 1, in_use, in_use, in_use, issued, issued, issued, expiration_timestamp, checked_timestamp, checked_timestamp"
+                  "  FROM (SELECT " DB_ROLLUP_HOUR_KEY("checked_timestamp") " AS hkey, feature_id, in_use, issued, expiration_timestamp, checked_timestamp"
+                  "          FROM ", raw_str,
+                  "          WHERE checked_timestamp BETWEEN ?1 AND ?5)"
+                  "  WHERE hkey IN (?3, ?4)"
+                  " UNION ALL "
+                  "SELECT hkey, feature_id, 1, in_use, in_use, in_use, issued, issued, issued, expiration_timestamp, checked_timestamp, checked_timestamp"
+                  "  FROM (SELECT " DB_ROLLUP_HOUR_KEY("checked_timestamp") " AS hkey, feature_id, in_use, issued, expiration_timestamp, checked_timestamp"
+                  "          FROM ", raw_str,
+                  "          WHERE checked_timestamp BETWEEN ?6 AND ?2)"
+                  "  WHERE hkey IN (?3, ?4)"
+                  ") AS p"
+                  "  INNER JOIN features AS f ON (f.feature_id = p.feature_id)",
+                  (feature_str ? " WHERE " : ""), (feature_str ? feature_str : ""),
+                  "  GROUP BY ", (okey_str ? okey_str : ""), (okey_str ? ", " : ""), "p.feature_id, f.vendor, f.version, f.feature_string",
+                  DB_QUERY_ORDER_BY,
+                  NULL
+                );
+  if ( ! (query_str = strbuf_get_cstring(sql)) ) goto exit_on_error;
+  stmt = __lmdb_query_cache_get(the_db, query_str);
+  if ( ! stmt ) goto exit_on_error;
+  if ( sqlite3_bind_int64(stmt, 1, lo) != SQLITE_OK || sqlite3_bind_int64(stmt, 2, hi) != SQLITE_OK ||
+       sqlite3_bind_int64(stmt, 3, hour_lo) != SQLITE_OK || sqlite3_bind_int64(stmt, 4, hour_hi) != SQLITE_OK ||
+       sqlite3_bind_int64(stmt, 5, head_hi) != SQLITE_OK || sqlite3_bind_int64(stmt, 6, tail_lo) != SQLITE_OK
+  ) goto exit_on_error;
+  if ( predicate && ! __lmdb_predicate_bind(predicate, stmt, &bind_index) ) goto exit_on_error;
+  the_report->query = stmt;
+  stmt = NULL;
+  is_okay = true;
+
+exit_on_error:
+  __lmdb_query_cache_put(the_db, stmt);
+  return is_okay;
 }
 
 //
 
-const time_t lmdb_check_timestamp_now = 0;
+/*
+ * With a time-series store attached, aggregated reports are answered from
+ * its consolidated points:  the features are selected from the database and
+ * for each the finest level whose points reach back to the start of the
+ * range is fetched.  Each point counts once toward its bucket (keyed by
+ * the local time at the start of its interval) and is reported by the
+ * start of its interval.  The store keeps no expiration timestamps, so
+ * each feature's comes from the latest count the database holds for it
+ * at or before the end of the range.
+ */
+typedef struct {
+  lmdb_usage_report         *the_report;
+  lmdb_usage_report_row     feature;
+  bool                      has_failed;
+  bool                      has_bucket;
+  int64_t                   key;
+  unsigned int              point_count;
+  int                       in_use_min, in_use_max, issued_min, issued_max;
+  double                    in_use_sum, issued_sum;
+  time_t                    start, end;
+  time_t                    expiration_timestamp;
+} lmdb_usage_report_tsdb_context;
 
-struct __lmdb_commit_counts_data {
-  bool        ok;
-  time_t      when;
-  lmdb_ref    the_db;
-};
+int64_t
+__lmdb_usage_report_tsdb_key(
+  lmdb_usage_report_aggregate aggregate,
+  time_t                    timestamp
+)
+{
+  struct tm                 local;
+  char                      week[16];
+
+  if ( aggregate == lmdb_usage_report_aggregate_total ) return 0;
+  localtime_r(&timestamp, &local);
+  switch ( aggregate ) {
+    case lmdb_usage_report_aggregate_hourly:
+      return ((int64_t)(local.tm_year + 1900) * 1000000) + ((local.tm_mon + 1) * 10000) + (local.tm_mday * 100) + local.tm_hour;
+    case lmdb_usage_report_aggregate_daily:
+      return ((int64_t)(local.tm_year + 1900) * 10000) + ((local.tm_mon + 1) * 100) + local.tm_mday;
+    case lmdb_usage_report_aggregate_weekly:
+      strftime(week, sizeof(week), "%Y%W", &local);
+      return strtoll(week, NULL, 10);
+    case lmdb_usage_report_aggregate_monthly:
+      return ((int64_t)(local.tm_year + 1900) * 100) + (local.tm_mon + 1);
+    default:
+      return local.tm_year + 1900;
+  }
+}
 
 bool
-__lmdb_commit_counts_iterator(
-  const void    *context,
-  lmfeature_ref feature
+__lmdb_usage_report_tsdb_add_row(
+  lmdb_usage_report_tsdb_context  *context
 )
 {
-  struct __lmdb_commit_counts_data   *CONTEXT = (struct __lmdb_commit_counts_data*)context;
-  
-  // Failure so long as at least one commit fails:
-  if ( ! __lmdb_commit_feature_count(CONTEXT->the_db, feature, CONTEXT->when) ) CONTEXT->ok = false;
+  lmdb_usage_report         *the_report = context->the_report;
+  lmdb_usage_report_row     *row;
 
-	return true;
+  if ( ! context->has_bucket ) return true;
+  context->has_bucket = false;
+  if ( the_report->row_count == the_report->row_capacity ) {
+    unsigned int            new_capacity = the_report->row_capacity ? 2 * the_report->row_capacity : 256;
+    lmdb_usage_report_row   *new_rows = realloc(the_report->rows, new_capacity * sizeof(lmdb_usage_report_row));
+
+    if ( ! new_rows ) return false;
+    the_report->rows = new_rows;
+    the_report->row_capacity = new_capacity;
+  }
+  row = &the_report->rows[the_report->row_count++];
+  *row = context->feature;
+  row->in_use.min = context->in_use_min;
+  row->in_use.max = context->in_use_max;
+  row->in_use.avg = (int)(context->in_use_sum / context->point_count);
+  row->issued.min = context->issued_min;
+  row->issued.max = context->issued_max;
+  row->issued.avg = (int)(context->issued_sum / context->point_count);
+  row->expiration_timestamp = context->expiration_timestamp;
+  row->check_timestamp.start = context->start;
+  row->check_timestamp.end = context->end;
+  return true;
 }
 
 bool
-lmdb_commit_counts(
-  lmdb_ref      the_db,
-  time_t        check_timestamp
+__lmdb_usage_report_tsdb_iterator(
+  const void                *context,
+  time_t                    timestamp,
+  double                    in_use,
+  double                    issued
 )
 {
-  if ( ! the_db->is_read_only ) {
-    struct __lmdb_commit_counts_data context = {
-                .ok = true,
-                .when = check_timestamp,
-                .the_db = the_db
-              };
+  lmdb_usage_report_tsdb_context  *CONTEXT = (lmdb_usage_report_tsdb_context*)context;
+  int64_t                   key;
+  int                       in_use_int, issued_int;
+
+  // Intervals without samples are left out:
+  if ( isnan(in_use) || isnan(issued) ) return true;
+  in_use_int = (int)(in_use + 0.5);
+  issued_int = (int)(issued + 0.5);
+
+  key = __lmdb_usage_report_tsdb_key(CONTEXT->the_report->aggregate, timestamp);
+  if ( CONTEXT->has_bucket && (key != CONTEXT->key) ) {
+    if ( ! __lmdb_usage_report_tsdb_add_row(CONTEXT) ) {
+      CONTEXT->has_failed = true;
+      return false;
+    }
+  }
+  if ( ! CONTEXT->has_bucket ) {
+    CONTEXT->has_bucket = true;
+    CONTEXT->key = key;
+    CONTEXT->point_count = 0;
+    CONTEXT->in_use_min = CONTEXT->in_use_max = in_use_int;
+    CONTEXT->issued_min = CONTEXT->issued_max = issued_int;
+    CONTEXT->in_use_sum = CONTEXT->issued_sum = 0.0;
+    CONTEXT->start = timestamp;
+  } else {
+    if ( in_use_int < CONTEXT->in_use_min ) CONTEXT->in_use_min = in_use_int;
+    if ( in_use_int > CONTEXT->in_use_max ) CONTEXT->in_use_max = in_use_int;
+    if ( issued_int < CONTEXT->issued_min ) CONTEXT->issued_min = issued_int;
+    if ( issued_int > CONTEXT->issued_max ) CONTEXT->issued_max = issued_int;
+  }
+  CONTEXT->point_count++;
+  CONTEXT->in_use_sum += in_use;
+  CONTEXT->issued_sum += issued;
+  CONTEXT->end = timestamp;
+  return true;
+}
+
+bool
+__lmdb_usage_report_load_tsdb(
+  lmdb_usage_report         *the_report,
+  strbuf_ref                sql,
+  const char                *feature_str,
+  lmdb_predicate_ref        predicate,
+  sqlite3_int64             lo,
+  sqlite3_int64             hi
+)
+{
+  lmdb_ref                  the_db = the_report->parent_db;
+  const char                *query_str;
+  sqlite3_stmt              *stmt = NULL;
+  unsigned int              bind_index = 0;
+  lmdb_usage_report_tsdb_context context;
+  time_t                    start = ( lo < 0 ) ? -1 : (time_t)lo;
+  time_t                    end = (time_t)hi;
+  bool                      is_okay = false;
+  int                       rc;
+
+  strbuf_reset(sql);
+  strbuf_appendm(sql,
+                  "SELECT f.feature_id, f.vendor, f.version, f.feature_string, ",
+                  ((the_db->count_storage == lmdb_count_storage_runs) ?
+                      "(SELECT r.expiration_timestamp FROM count_runs AS r"
+                      "   INNER JOIN checks AS k ON (k.check_id = r.first_check_id)"
+                      "   WHERE r.feature_id = f.feature_id AND k.checked_timestamp <= :range_end"
+                      "   ORDER BY r.first_check_id DESC LIMIT 1)"
+                    :
+                      "(SELECT c.expiration_timestamp FROM counts AS c"
+                      "   WHERE c.feature_id = f.feature_id AND c.checked_timestamp <= :range_end"
+                      "   ORDER BY c.checked_timestamp DESC LIMIT 1)"
+                  ),
+                  " FROM features AS f",
+                  (feature_str ? " WHERE " : ""), (feature_str ? feature_str : ""),
+                  "  ORDER BY f.feature_id",
+                  NULL
+                );
+  if ( ! (query_str = strbuf_get_cstring(sql)) ) goto exit_on_error;
+  if ( ! (stmt = __lmdb_query_cache_get(the_db, query_str)) ) goto exit_on_error;
+  if ( ! __lmdb_usage_report_bind_range(stmt, lo, hi) ) goto exit_on_error;
+  if ( predicate && ! __lmdb_predicate_bind(predicate, stmt, &bind_index) ) goto exit_on_error;
+
+  memset(&context, 0, sizeof(context));
+  context.the_report = the_report;
+  while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW ) {
+    const char              *s;
+
+    context.feature.feature_id = sqlite3_column_int(stmt, 0);
+    context.feature.vendor = (s = (const char*)sqlite3_column_text(stmt, 1)) ? mempool_strdup(the_report->pool, s) : NULL;
+    context.feature.version = (s = (const char*)sqlite3_column_text(stmt, 2)) ? mempool_strdup(the_report->pool, s) : NULL;
+    context.feature.feature_string = (s = (const char*)sqlite3_column_text(stmt, 3)) ? mempool_strdup(the_report->pool, s) : NULL;
+    context.expiration_timestamp = (time_t)sqlite3_column_int64(stmt, 4);
+    context.has_bucket = false;
+    lmtsdb_fetch(the_db->tsdb, context.feature.feature_id, lmtsdb_select_level(the_db->tsdb, context.feature.feature_id, start), start, end, __lmdb_usage_report_tsdb_iterator, &context);
+    if ( context.has_failed || ! __lmdb_usage_report_tsdb_add_row(&context) ) goto exit_on_error;
+  }
+  if ( rc != SQLITE_DONE ) goto exit_on_error;
+
+  if ( the_report->row_count > 1 ) qsort(the_report->rows, the_report->row_count, sizeof(lmdb_usage_report_row), __lmdb_usage_report_row_cmp);
+  is_okay = true;
+
+exit_on_error:
+  __lmdb_query_cache_put(the_db, stmt);
+  if ( ! is_okay ) lmlogf(lmlog_level_debug, "unable to compute report from time-series store: %s", sqlite3_errmsg(the_db->db_handle));
+  return is_okay;
+}
+//
+
+/*
+ * Build the report's query for its aggregate and range, limited by
+ * predicate, and either run it (into rows) or leave it ready to be stepped
+ * by lmdb_usage_report_iterate().  Queries come from the database's cache of
+ * prepared statements with the predicate's values and the range bound to
+ * them, so rebuilding a report of the same shape does not compile anything.
+ */
+bool
+__lmdb_usage_report_load(
+  lmdb_usage_report     *the_report,
+  lmdb_predicate_ref    predicate
+)
+{
+  lmdb_ref              the_db = the_report->parent_db;
+  bool                  is_runs = ( the_db->count_storage == lmdb_count_storage_runs );
+  const char            *query_str = NULL;
+  const char            *base_str = NULL, *order_str = NULL, *group_str = "", *bucket_str = NULL, *range_str = NULL;
+  mempool_ref           sql_pool = NULL;
+  strbuf_ref            sql = NULL;
+  const char            *okey_str = NULL;
+  int                   max_tier = 0;
+  sqlite3_int64         range_start = LLONG_MIN, range_end = LLONG_MAX;
+  unsigned int          bind_index = 0;
+  bool                  is_okay = false;
+
+  /* What aggregation should be performed? */
+  switch ( the_report->aggregate ) {
+
+    case lmdb_usage_report_aggregate_none:
+      base_str = DB_QUERY_BASE_NOAGGR;
+      order_str = DB_QUERY_ORDER_BY;
+      break;
+    case lmdb_usage_report_aggregate_hourly:
+      base_str = DB_QUERY_BASE_AGGR;
+      okey_str = "p.hkey";
+      max_tier = 1;
+      bucket_str = "strftime('%Y%m%d%H', c.checked_timestamp, 'unixepoch', 'localtime')";
+      group_str = "  GROUP BY strftime('%Y%m%d%H', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
+      order_str = DB_QUERY_ORDER_BY;
+      break;
+    case lmdb_usage_report_aggregate_daily:
+      base_str = DB_QUERY_BASE_AGGR;
+      okey_str = "p.hkey / 100";
+      max_tier = 2;
+      bucket_str = "strftime('%Y%m%d', c.checked_timestamp, 'unixepoch', 'localtime')";
+      group_str = "  GROUP BY strftime('%Y%m%d', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
+      order_str = DB_QUERY_ORDER_BY;
+      break;
+    case lmdb_usage_report_aggregate_weekly:
+      base_str = DB_QUERY_BASE_AGGR;
+      okey_str = "strftime('%Y%W', printf('%04d-%02d-%02d', p.hkey / 1000000, p.hkey / 10000 % 100, p.hkey / 100 % 100))";
+      max_tier = 2;
+      bucket_str = "strftime('%Y%W', c.checked_timestamp, 'unixepoch', 'localtime')";
+      group_str = "  GROUP BY strftime('%Y%W', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
+      order_str = DB_QUERY_ORDER_BY;
+      break;
+    case lmdb_usage_report_aggregate_monthly:
+      base_str = DB_QUERY_BASE_AGGR;
+      okey_str = "p.hkey / 10000";
+      max_tier = 3;
+      bucket_str = "strftime('%Y%m', c.checked_timestamp, 'unixepoch', 'localtime')";
+      group_str = "  GROUP BY strftime('%Y%m', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
+      order_str = DB_QUERY_ORDER_BY;
+      break;
+    case lmdb_usage_report_aggregate_yearly:
+      base_str = DB_QUERY_BASE_AGGR;
+      okey_str = "p.hkey / 1000000";
+      max_tier = 3;
+      bucket_str = "strftime('%Y', c.checked_timestamp, 'unixepoch', 'localtime')";
+      group_str = "  GROUP BY strftime('%Y', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
+      order_str = DB_QUERY_ORDER_BY;
+      break;
+    case lmdb_usage_report_aggregate_total:
+      base_str = DB_QUERY_BASE_AGGR;
+      max_tier = 3;
+      group_str = "  GROUP BY c.feature_id, f.vendor, f.version, f.feature_string";
+      order_str = DB_QUERY_ORDER_BY;
+      break;
+
+    case lmdb_usage_report_aggregate_undef:
+    case lmdb_usage_report_aggregate_max:
+      // Never gets here, but compilers love to complain about unhandled enums
+      break;
+
+  }
+
+  switch ( the_report->range ) {
+
+  	case lmdb_usage_report_range_none:
+   		break;
+
+    case lmdb_usage_report_range_last_check:
+      // Resolved once, an empty range if nothing has been checked:
+      range_str = DB_QUERY_RANGE;
+      if ( __lmdb_get_last_checked_timestamp(the_db, &range_start) ) {
+        range_end = range_start;
+      } else {
+        range_start = 1;
+        range_end = 0;
+      }
+      break;
+
+    case lmdb_usage_report_range_last_hour:
+      range_str = DB_QUERY_RANGE;
+      range_start = (sqlite3_int64)time(NULL) - 3600;
+      break;
+
+    case lmdb_usage_report_range_last_day:
+      range_str = DB_QUERY_RANGE;
+      range_start = (sqlite3_int64)time(NULL) - 86400;
+      break;
+
+    case lmdb_usage_report_range_last_week:
+      range_str = DB_QUERY_RANGE;
+      range_start = (sqlite3_int64)time(NULL) - 604800;
+      break;
+
+    case lmdb_usage_report_range_last_month:
+      range_str = DB_QUERY_RANGE;
+      range_start = (sqlite3_int64)time(NULL) - 2592000;
+      break;
+
+    case lmdb_usage_report_range_last_year:
+      range_str = DB_QUERY_RANGE;
+      range_start = (sqlite3_int64)time(NULL) - 31536000;
+      break;
+
+    case lmdb_usage_report_range_undef:
+  	case lmdb_usage_report_range_max:
+      // Never gets here, but compilers love to complain about unhandled enums
+      break;
+  }
+
+  //
+  // All SQL is assembled in builders drawn from a single pool:
+  //
+  if ( ! (sql_pool = mempool_alloc()) || ! (sql = strbuf_alloc(sql_pool, 1024)) ) goto exit_on_error;
+  
+  //
+  // Aggregated reports are answered from the time-series store, if one is
+  // attached, under the same conditions.  A raw report lists the checks
+  // themselves, which the store's consolidated points do not reproduce:
+  //
+  if ( the_db->tsdb && (the_report->aggregate != lmdb_usage_report_aggregate_none) ) {
+    strbuf_ref    feature_sql = strbuf_alloc(sql_pool, 0), check_sql = strbuf_alloc(sql_pool, 0);
+    sqlite3_int64 lo = range_start, hi = range_end;
     
-    if ( check_timestamp == lmdb_check_timestamp_now ) context.when = time(NULL);
+    if ( ! feature_sql || ! check_sql ) goto exit_on_error;
+    if ( ! predicate || (__lmdb_predicate_split(predicate, true, feature_sql, check_sql) && (! strbuf_get_length(check_sql) || __lmdb_predicate_get_checked_bounds(predicate, &lo, &hi))) ) {
+      if ( (the_report->pool = mempool_alloc()) ) {
+        if ( __lmdb_usage_report_load_tsdb(the_report, sql, (strbuf_get_length(feature_sql) ? strbuf_get_cstring(feature_sql) : NULL), predicate, lo, hi) ) {
+          is_okay = true;
+          goto exit_on_error;
+        }
+        if ( the_report->rows ) free((void*)the_report->rows);
+        the_report->rows = NULL;
+        the_report->row_count = the_report->row_capacity = 0;
+        mempool_dealloc(the_report->pool);
+        the_report->pool = NULL;
+      }
+    } else {
+      LMDEBUG("report predicate cannot be answered from the time-series store");
+    }
+  }
+  
+  //
+  // Aggregates are answered from the count rollups when the predicate
+  // tests nothing but the features and a single range of check
+  // timestamps:
+  //
+  if ( the_db->has_rollups && max_tier ) {
+    strbuf_ref    feature_sql = strbuf_alloc(sql_pool, 0), check_sql = strbuf_alloc(sql_pool, 0);
+    sqlite3_int64 lo = range_start, hi = range_end;
     
-    lmfeatureset_iterate(the_db->features, __lmdb_commit_counts_iterator, &context);
-    return context.ok;
+    if ( ! feature_sql || ! check_sql ) goto exit_on_error;
+    if ( ! predicate || (__lmdb_predicate_split(predicate, true, feature_sql, check_sql) && (! strbuf_get_length(check_sql) || __lmdb_predicate_get_checked_bounds(predicate, &lo, &hi))) ) {
+      if ( __lmdb_usage_report_load_rollups(the_report, sql, okey_str, max_tier, (strbuf_get_length(feature_sql) ? strbuf_get_cstring(feature_sql) : NULL), predicate, lo, hi) ) {
+        is_okay = true;
+        goto exit_on_error;
+      }
+    }
   }
-  return false;
+
+  //
+  // Aggregates over count runs are computed from the runs directly when
+  // the predicate can be split into tests on the features and tests on
+  // the check timestamps.  A top-level OR is only split when it tests
+  // nothing but features; the feature tests are parenthesized in the
+  // runs query, so the range still applies to every check:
+  //
+  if ( is_runs && (the_report->aggregate != lmdb_usage_report_aggregate_none) ) {
+    strbuf_ref    feature_sql = strbuf_alloc(sql_pool, 0), check_sql = strbuf_alloc(sql_pool, 0);
+
+    if ( ! feature_sql || ! check_sql ) goto exit_on_error;
+    if ( ! predicate || __lmdb_predicate_split(predicate, true, feature_sql, check_sql) ) {
+      if ( range_str ) {
+        if ( strbuf_get_length(check_sql) ) strbuf_append(check_sql, " AND ");
+        strbuf_append(check_sql, range_str);
+      }
+      if ( (the_report->pool = mempool_alloc()) ) {
+        if ( __lmdb_usage_report_load_runs(the_report, sql, bucket_str,
+                  (strbuf_get_length(feature_sql) ? strbuf_get_cstring(feature_sql) : NULL),
+                  (strbuf_get_length(check_sql) ? strbuf_get_cstring(check_sql) : NULL),
+                  predicate, range_start, range_end)
+        ) {
+          is_okay = true;
+          goto exit_on_error;
+        }
+        if ( the_report->rows ) free((void*)the_report->rows);
+        the_report->rows = NULL;
+        the_report->row_count = the_report->row_capacity = 0;
+        mempool_dealloc(the_report->pool);
+        the_report->pool = NULL;
+      }
+    }
+  }
+
+  strbuf_reset(sql);
+  strbuf_appendm(sql, base_str, (is_runs ? DB_QUERY_FROM_EXPANDED_COUNTS : DB_QUERY_FROM_COUNTS), NULL);
+  if ( predicate ) {
+    strbuf_append(sql, " WHERE (");
+    __lmdb_predicate_append_sql(sql, predicate, &bind_index);
+    strbuf_append(sql, ")");
+    if ( range_str ) strbuf_appendm(sql, " AND ", range_str, NULL);
+  } else if ( range_str ) {
+    strbuf_appendm(sql, " WHERE ", range_str, NULL);
+  }
+  strbuf_appendm(sql, group_str, order_str, NULL);
+  if ( ! (query_str = strbuf_get_cstring(sql)) ) goto exit_on_error;
+  if ( ! (the_report->query = __lmdb_query_cache_get(the_db, query_str)) ) goto exit_on_error;
+  bind_index = 0;
+  if ( ! __lmdb_usage_report_bind_range(the_report->query, range_start, range_end) ||
+       (predicate && ! __lmdb_predicate_bind(predicate, the_report->query, &bind_index))
+  ) {
+    __lmdb_query_cache_put(the_db, the_report->query);
+    the_report->query = NULL;
+    goto exit_on_error;
+  }
+  is_okay = true;
+
+exit_on_error:
+  if ( sql_pool ) mempool_dealloc(sql_pool);
+  return is_okay;
 }
 
 //
 
-bool
-lmdb_get_last_check_timestamp(
-  lmdb_ref      the_db,
-  time_t        *check_timestamp
+void
+__lmdb_usage_report_unload(
+  lmdb_usage_report     *the_report
 )
 {
-  sqlite3_stmt  *stmt = NULL;
-  bool          rc = false;
-  
-  if ( sqlite3_prepare_v2(the_db->db_handle, __db_get_last_check_timestamp_query, -1, &stmt, NULL) == SQLITE_OK ) {
-    if ( sqlite3_step(stmt) == SQLITE_ROW ) {
-      if ( check_timestamp ) *check_timestamp = (time_t)sqlite3_column_int64(stmt, 0);
-      rc = true;
-    }
-    sqlite3_finalize(stmt);
-  }
-  return rc;
+  if ( the_report->query ) __lmdb_query_cache_put(the_report->parent_db, the_report->query);
+  the_report->query = NULL;
+  if ( the_report->rows ) free((void*)the_report->rows);
+  the_report->rows = NULL;
+  the_report->row_count = the_report->row_capacity = 0;
+  if ( the_report->pool ) mempool_dealloc(the_report->pool);
+  the_report->pool = NULL;
 }
 
-//
-#if 0
-#pragma mark -
-#endif
 //
 
-typedef struct _lmdb_usage_report {
-  lmdb_ref              				parent_db;
-  lmdb_usage_report_aggregate  	aggregate;
-  lmdb_usage_report_range				range;
-  sqlite3_stmt          				*query;
-} lmdb_usage_report;
-
 lmdb_usage_report_ref
 lmdb_usage_report_create(
   lmdb_ref              				the_db,
@@ -949,125 +5297,26 @@ lmdb_usage_report_create(
   lmdb_predicate_ref    				predicate
 )
 {
-  if ( (aggregate > lmdb_usage_report_aggregate_undef) && 
+  if ( (aggregate > lmdb_usage_report_aggregate_undef) &&
        (aggregate < lmdb_usage_report_aggregate_max) &&
-       (range > lmdb_usage_report_range_undef) && 
+       (range > lmdb_usage_report_range_undef) &&
        (range < lmdb_usage_report_range_max)
   	)
 	{
     lmdb_usage_report    *new_query = malloc(sizeof(lmdb_usage_report));
-    
+
     if ( new_query ) {
-      const char  *query_str = NULL;
-      const char  *base_str, *order_str, *group_str = "";
-      const char  *predicate_str = predicate ? lmdb_predicate_get_string(predicate) : NULL;
-      
       new_query->parent_db = lmdb_retain(the_db);
+      new_query->aggregate = aggregate;
+      new_query->range = range;
       new_query->query = NULL;
+      new_query->pool = NULL;
+      new_query->row_count = new_query->row_capacity = 0;
+      new_query->rows = NULL;
       
-      /* What aggregation should be performed? */
-      switch ( aggregate ) {
-      
-        case lmdb_usage_report_aggregate_none:
-          base_str = DB_QUERY_BASE_NOAGGR;
-          order_str = DB_QUERY_ORDER_BY;
-          break;
-        case lmdb_usage_report_aggregate_hourly:
-          base_str = DB_QUERY_BASE_AGGR;
-          group_str = "  GROUP BY strftime('%Y%m%d%H', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
-          order_str = DB_QUERY_ORDER_BY;
-          break;
-        case lmdb_usage_report_aggregate_daily:
-          base_str = DB_QUERY_BASE_AGGR;
-          group_str = "  GROUP BY strftime('%Y%m%d', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
-          order_str = DB_QUERY_ORDER_BY;
-          break;
-        case lmdb_usage_report_aggregate_weekly:
-          base_str = DB_QUERY_BASE_AGGR;
-          group_str = "  GROUP BY strftime('%Y%W', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
-          order_str = DB_QUERY_ORDER_BY;
-          break;
-        case lmdb_usage_report_aggregate_monthly:
-          base_str = DB_QUERY_BASE_AGGR;
-          group_str = "  GROUP BY strftime('%Y%m', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
-          order_str = DB_QUERY_ORDER_BY;
-          break;
-        case lmdb_usage_report_aggregate_yearly:
-          base_str = DB_QUERY_BASE_AGGR;
-          group_str = "  GROUP BY strftime('%Y', c.checked_timestamp, 'unixepoch', 'localtime'), c.feature_id, f.vendor, f.version, f.feature_string";
-          order_str = DB_QUERY_ORDER_BY;
-          break;
-        case lmdb_usage_report_aggregate_total:
-          base_str = DB_QUERY_BASE_AGGR;
-          group_str = "  GROUP BY c.feature_id, f.vendor, f.version, f.feature_string";
-          order_str = DB_QUERY_ORDER_BY;
-          break;
-        
-        case lmdb_usage_report_aggregate_undef:
-        case lmdb_usage_report_aggregate_max:
-          // Never gets here, but compilers love to complain about unhandled enums
-          break;
-          
-      }
-      
-      switch ( range ) {
-      
-      	case lmdb_usage_report_range_none:
-       		break;
-          
-        case lmdb_usage_report_range_last_check: {
-        	predicate_str = strappendm(predicate_str, predicate_str ? " AND" : "c.checked_timestamp = (SELECT MAX(checked_timestamp) FROM counts)", predicate_str ? " c.checked_timestamp = (SELECT MAX(checked_timestamp) FROM counts)" : NULL, NULL);
-         	break;
-        }
-          
-        case lmdb_usage_report_range_last_hour: {
-          predicate_str = strappendm(predicate_str, predicate_str ? " AND" : " strftime('%s', 'now') - c.checked_timestamp <= 3600", predicate_str ? " strftime('%s', 'now') - c.checked_timestamp <= 3600" : NULL, NULL);
-           break;
-        }
-          
-        case lmdb_usage_report_range_last_day: {
-          predicate_str = strappendm(predicate_str, predicate_str ? " AND" : " strftime('%s', 'now') - c.checked_timestamp <= 86400", predicate_str ? " strftime('%s', 'now') - c.checked_timestamp <= 86400" : NULL, NULL);
-           break;
-        }
-          
-        case lmdb_usage_report_range_last_week: {
-          predicate_str = strappendm(predicate_str, predicate_str ? " AND" : " strftime('%s', 'now') - c.checked_timestamp <= 604800", predicate_str ? " strftime('%s', 'now') - c.checked_timestamp <= 604800" : NULL, NULL);
-           break;
-        }
-          
-        case lmdb_usage_report_range_last_month: {
-          predicate_str = strappendm(predicate_str, predicate_str ? " AND" : " strftime('%s', 'now') - c.checked_timestamp <= 2592000", predicate_str ? " strftime('%s', 'now') - c.checked_timestamp <= 2592000" : NULL, NULL);
-           break;
-        }
-          
-        case lmdb_usage_report_range_last_year: {
-          predicate_str = strappendm(predicate_str, predicate_str ? " AND" : " strftime('%s', 'now') - c.checked_timestamp <= 31536000", predicate_str ? " strftime('%s', 'now') - c.checked_timestamp <= 31536000" : NULL, NULL);
-           break;
-        }
-      
-        case lmdb_usage_report_range_undef:
-      	case lmdb_usage_report_range_max:
-          // Never gets here, but compilers love to complain about unhandled enums
-          break;
-      }
-      
-      if ( predicate_str ) {
-        query_str = strcatm(base_str, " WHERE " , predicate_str, group_str, order_str, NULL);
-        free((void*)predicate_str);
-      } else {
-        query_str = strcatm(base_str, group_str, order_str, NULL);
-      }
-      if ( query_str ) {
-        LMDEBUG("QUERY:  %s\n", query_str);
-        if ( sqlite3_prepare_v2(the_db->db_handle, query_str, -1, &new_query->query, NULL) != SQLITE_OK ) {
-          free((void*)new_query);
-          new_query = NULL;
-          lmdb_release(the_db);
-        } else {
-          new_query->aggregate = aggregate;
-          new_query->range = range;
-        }
-        free((void*)query_str);
+      if ( ! __lmdb_usage_report_load(new_query, predicate) ) {
+        lmdb_usage_report_release(new_query);
+        new_query = NULL;
       }
     }
     return (lmdb_usage_report_ref)new_query;
@@ -1077,12 +5326,29 @@ lmdb_usage_report_create(
 
 //
 
+bool
+lmdb_usage_report_rebind(
+  lmdb_usage_report_ref         the_query,
+  lmdb_usage_report_range				range,
+  lmdb_predicate_ref    				predicate
+)
+{
+  if ( (range > lmdb_usage_report_range_undef) && (range < lmdb_usage_report_range_max) ) {
+    __lmdb_usage_report_unload(the_query);
+    the_query->range = range;
+    return __lmdb_usage_report_load(the_query, predicate);
+  }
+  return false;
+}
+
+//
+
 void
 lmdb_usage_report_release(
   lmdb_usage_report_ref  the_query
 )
 {
-  if ( the_query->query ) sqlite3_finalize(the_query->query);
+  __lmdb_usage_report_unload(the_query);
   lmdb_release(the_query->parent_db);
   free((void*)the_query);
 }
@@ -1097,8 +5363,20 @@ lmdb_usage_report_iterate(
 )
 {
   bool              is_okay = false;
-  
-  if ( the_query->query ) {
+
+  if ( the_query->pool ) {
+    unsigned int    i = 0;
+
+    is_okay = true;
+    while ( is_okay && (i < the_query->row_count) ) {
+      lmdb_usage_report_row *row = &the_query->rows[i++];
+
+      if ( iterator_fn ) {
+        /* Any NULL strings should have an empty string substituted: */
+        if ( ! iterator_fn(context, row->feature_id, (row->vendor ? row->vendor : ""), (row->version ? row->version : ""), (row->feature_string ? row->feature_string : ""), row->in_use, row->issued, row->expiration_timestamp, row->check_timestamp) ) is_okay = false;
+      }
+    }
+  } else if ( the_query->query ) {
     is_okay = true;
     while ( is_okay && (sqlite3_step(the_query->query) == SQLITE_ROW) ) {
       if ( iterator_fn ) {
@@ -1393,6 +5671,7 @@ lmdb_predicate_add_test(
         }
         last->next = new_combiner;
         new_combiner->next = new_test;
+        rc = true;
       } else {
         free((void*)new_test);
       }
@@ -1427,6 +5706,7 @@ lmdb_predicate_add_expression(
         }
         last->next = new_combiner;
         new_combiner->next = new_expr;
+        rc = true;
       } else {
         lmdb_predicate_release(other_predicate);
         free((void*)new_expr);
@@ -1438,67 +5718,337 @@ lmdb_predicate_add_expression(
 
 //
 
+/*
+ * Append value as a quoted SQL string literal (embedded quotes doubled).
+ */
+bool
+__lmdb_sql_append_quoted(
+  strbuf_ref            sql,
+  const char            *value
+)
+{
+  const char            *quote;
+  
+  if ( ! strbuf_append_bytes(sql, "'", 1) ) return false;
+  while ( (quote = strchr(value, '\'')) ) {
+    if ( ! strbuf_append_bytes(sql, value, quote - value + 1) || ! strbuf_append_bytes(sql, "'", 1) ) return false;
+    value = quote + 1;
+  }
+  return strbuf_appendm(sql, value, "'", NULL);
+}
+
+//
+
+bool
+__lmdb_predicate_node_append_sql(
+  strbuf_ref            sql,
+  lmdb_predicate_node   *p,
+  unsigned int          *bind_index
+)
+{
+  switch ( p->node_type ) {
+  
+    case lmdb_predicate_node_type_test: {
+      lmdb_predicate_node_test        *node = (lmdb_predicate_node_test*)p;
+      struct lmdb_field_descriptor    field_desc = lmdb_field_descriptors[node->field];
+      struct lmdb_operator_descriptor op_desc = lmdb_operator_descriptors[node->operator];
+      
+      if ( ! strbuf_appendm(sql, field_desc.name, op_desc.name, NULL) ) return false;
+      if ( op_desc.is_unary ) return true;
+      if ( bind_index ) return strbuf_appendf(sql, ":v%u", ++(*bind_index));
+      if ( field_desc.should_be_quoted ) return __lmdb_sql_append_quoted(sql, node->value);
+      return strbuf_append(sql, node->value);
+    }
+    
+    case lmdb_predicate_node_type_expression: {
+      lmdb_predicate_node_expression  *node = (lmdb_predicate_node_expression*)p;
+      
+      return strbuf_append(sql, " ( ") && __lmdb_predicate_append_sql(sql, node->expression, bind_index) && strbuf_append(sql, " ) ");
+    }
+    
+  }
+  return true;
+}
+
+//
+
+bool
+__lmdb_predicate_append_sql(
+  strbuf_ref            sql,
+  lmdb_predicate_ref    the_predicate,
+  unsigned int          *bind_index
+)
+{
+  lmdb_predicate_node   *p = the_predicate->chain;
+  bool                  has_terms = false;
+  
+  while ( p ) {
+    if ( p->node_type == lmdb_predicate_node_type_combiner ) {
+      lmdb_predicate_node_combiner  *node = (lmdb_predicate_node_combiner*)p;
+      
+      if ( has_terms && ! strbuf_append(sql, lmdb_combiner_names[node->op]) ) return false;
+    } else {
+      if ( ! __lmdb_predicate_node_append_sql(sql, p, bind_index) ) return false;
+      has_terms = true;
+    }
+    p = p->next;
+  }
+  return true;
+}
+
+//
+
 const char*
 lmdb_predicate_get_string(
   lmdb_predicate_ref    the_predicate
 )
 {
+  mempool_ref           pool = mempool_alloc();
   const char            *out = NULL;
+  
+  if ( pool ) {
+    strbuf_ref          sql = strbuf_alloc(pool, 0);
+    
+    if ( sql && __lmdb_predicate_append_sql(sql, the_predicate, NULL) && strbuf_get_length(sql) ) out = strbuf_copy_cstring(sql);
+    mempool_dealloc(pool);
+  }
+  return out;
+}
+
+//
+
+/*
+ * Supply the values of the_predicate's tests to the parameters named by
+ * __lmdb_predicate_append_sql() (those that are present in stmt).  Fields that
+ * hold numbers get their value as an integer or real where it parses as one;
+ * everything else is bound as text.
+ */
+bool
+__lmdb_predicate_bind(
+  lmdb_predicate_ref    the_predicate,
+  sqlite3_stmt          *stmt,
+  unsigned int          *bind_index
+)
+{
   lmdb_predicate_node   *p = the_predicate->chain;
   
   while ( p ) {
     switch ( p->node_type ) {
     
       case lmdb_predicate_node_type_test: {
-        lmdb_predicate_node_test        *node = (lmdb_predicate_node_test*)p;
-        struct lmdb_field_descriptor    field_desc = lmdb_field_descriptors[node->field];
-        struct lmdb_operator_descriptor op_desc = lmdb_operator_descriptors[node->operator];
+        lmdb_predicate_node_test  *node = (lmdb_predicate_node_test*)p;
+        char                      param[16];
+        int                       idx, rc;
         
-        if ( op_desc.is_unary ) {
-          if ( out ) {
-            out = strcatm(out, field_desc.name, op_desc.name, NULL);
-          } else {
-            out = strcatm(field_desc.name, op_desc.name, NULL);
-          }
-        } else if ( field_desc.should_be_quoted ) {
-          if ( out ) {
-            out = strcatm(out, field_desc.name, op_desc.name, "'", node->value, "'", NULL);
-          } else {
-            out = strcatm(field_desc.name, op_desc.name, "'", node->value, "'", NULL);
-          }
-        } else {
-          if ( out ) {
-            out = strcatm(out, field_desc.name, op_desc.name, node->value, NULL);
+        if ( lmdb_operator_descriptors[node->operator].is_unary ) break;
+        snprintf(param, sizeof(param), ":v%u", ++(*bind_index));
+        if ( ! (idx = sqlite3_bind_parameter_index(stmt, param)) ) break;
+        rc = SQLITE_MISUSE;
+        if ( ! lmdb_field_descriptors[node->field].should_be_quoted && *node->value ) {
+          char                    *end;
+          long long               i_value;
+          double                  d_value;
+          
+          errno = 0;
+          i_value = strtoll(node->value, &end, 10);
+          if ( ! errno && ! *end ) {
+            rc = sqlite3_bind_int64(stmt, idx, (sqlite3_int64)i_value);
           } else {
-            out = strcatm(field_desc.name, op_desc.name, node->value, NULL);
+            d_value = strtod(node->value, &end);
+            if ( ! *end ) rc = sqlite3_bind_double(stmt, idx, d_value);
           }
         }
+        if ( rc == SQLITE_MISUSE ) rc = sqlite3_bind_text(stmt, idx, node->value, -1, SQLITE_TRANSIENT);
+        if ( rc != SQLITE_OK ) return false;
         break;
       }
       
-      case lmdb_predicate_node_type_combiner: {
-        lmdb_predicate_node_combiner  *node = (lmdb_predicate_node_combiner*)p;
-        
-        if ( out ) {
-          out = strcatm(out, lmdb_combiner_names[node->op], NULL);
-        }
+      case lmdb_predicate_node_type_expression:
+        if ( ! __lmdb_predicate_bind(((lmdb_predicate_node_expression*)p)->expression, stmt, bind_index) ) return false;
         break;
+        
+    }
+    p = p->next;
+  }
+  return true;
+}
+
+//
+
+/*
+ * Classes of the fields tested by a predicate:  the feature fields, the
+ * check timestamp, and the count values.
+ */
+enum {
+  lmdb_predicate_field_class_feature = 1 << 0,
+  lmdb_predicate_field_class_checked = 1 << 1,
+  lmdb_predicate_field_class_count = 1 << 2
+};
+
+unsigned int
+__lmdb_predicate_node_get_field_classes(
+  lmdb_predicate_node   *p
+)
+{
+  unsigned int          classes = 0;
+  
+  switch ( p->node_type ) {
+  
+    case lmdb_predicate_node_type_test: {
+      switch ( ((lmdb_predicate_node_test*)p)->field ) {
+        case lmdb_predicate_field_feature_id:
+        case lmdb_predicate_field_feature:
+        case lmdb_predicate_field_vendor:
+        case lmdb_predicate_field_version:
+          classes = lmdb_predicate_field_class_feature;
+          break;
+        case lmdb_predicate_field_checked:
+          classes = lmdb_predicate_field_class_checked;
+          break;
+        default:
+          classes = lmdb_predicate_field_class_count;
+          break;
+      }
+      break;
+    }
+    
+    case lmdb_predicate_node_type_expression: {
+      lmdb_predicate_node *sub = ((lmdb_predicate_node_expression*)p)->expression->chain;
+      
+      while ( sub ) {
+        classes |= __lmdb_predicate_node_get_field_classes(sub);
+        sub = sub->next;
       }
+      break;
+    }
+    
+  }
+  return classes;
+}
+
+//
+
+bool
+__lmdb_predicate_split(
+  lmdb_predicate_ref    the_predicate,
+  bool                  allow_or,
+  strbuf_ref            feature_sql,
+  strbuf_ref            check_sql
+)
+{
+  lmdb_predicate_node   *p = the_predicate->chain;
+  unsigned int          classes = 0, bind_index = 0;
+  bool                  has_or = false;
+  
+  while ( p ) {
+    if ( p->node_type == lmdb_predicate_node_type_combiner ) {
+      if ( ((lmdb_predicate_node_combiner*)p)->op == lmdb_predicate_combiner_or ) has_or = true;
+    } else {
+      classes |= __lmdb_predicate_node_get_field_classes(p);
+    }
+    p = p->next;
+  }
+  if ( classes & lmdb_predicate_field_class_count ) return false;
+  
+  if ( has_or ) {
+    // Only separable if nothing but features are tested:
+    if ( ! allow_or || (classes != lmdb_predicate_field_class_feature) ) return false;
+    return __lmdb_predicate_append_sql(feature_sql, the_predicate, &bind_index);
+  }
+  
+  //
+  // Every term is ANDed, so each can go to whichever side it tests:
+  //
+  p = the_predicate->chain;
+  while ( p ) {
+    if ( p->node_type != lmdb_predicate_node_type_combiner ) {
+      strbuf_ref        side;
       
-      case lmdb_predicate_node_type_expression: {
-        lmdb_predicate_node_expression  *node = (lmdb_predicate_node_expression*)p;
-        const char                      *expression_string = lmdb_predicate_get_string(node->expression);
+      switch ( __lmdb_predicate_node_get_field_classes(p) ) {
+        case lmdb_predicate_field_class_feature:
+          side = feature_sql;
+          break;
+        case lmdb_predicate_field_class_checked:
+          side = check_sql;
+          break;
+        default:
+          side = NULL;
+          break;
+      }
+      if ( ! side ) return false;
+      if ( strbuf_get_length(side) && ! strbuf_append(side, " AND ") ) return false;
+      if ( ! __lmdb_predicate_node_append_sql(side, p, &bind_index) ) return false;
+    }
+    p = p->next;
+  }
+  return true;
+}
+
+//
+
+/*
+ * Narrow [*lo, *hi] to the check timestamps the_predicate allows.  Only
+ * possible if its tests on the check timestamp are top-level, ANDed
+ * comparisons against integers; returns false otherwise.
+ */
+bool
+__lmdb_predicate_get_checked_bounds(
+  lmdb_predicate_ref    the_predicate,
+  sqlite3_int64         *lo,
+  sqlite3_int64         *hi
+)
+{
+  lmdb_predicate_node   *p = the_predicate->chain;
+  
+  while ( p ) {
+    switch ( p->node_type ) {
+    
+      case lmdb_predicate_node_type_combiner:
+        if ( ((lmdb_predicate_node_combiner*)p)->op == lmdb_predicate_combiner_or ) return false;
+        break;
         
-        if ( out ) {
-          out = strcatm(out, " ( ", expression_string, " ) ", NULL);
-        } else {
-          out = strcatm(" ( ", expression_string, " ) ", NULL);
+      case lmdb_predicate_node_type_test: {
+        lmdb_predicate_node_test  *node = (lmdb_predicate_node_test*)p;
+        
+        if ( node->field == lmdb_predicate_field_checked ) {
+          char                    *end;
+          long long               value;
+          
+          errno = 0;
+          value = strtoll(node->value, &end, 10);
+          if ( errno || (end == node->value) || *end ) return false;
+          switch ( node->operator ) {
+            case lmdb_predicate_operator_eq:
+              if ( value > *lo ) *lo = value;
+              if ( value < *hi ) *hi = value;
+              break;
+            case lmdb_predicate_operator_ge:
+              if ( value > *lo ) *lo = value;
+              break;
+            case lmdb_predicate_operator_gt:
+              if ( value == LLONG_MAX ) return false;
+              if ( value >= *lo ) *lo = value + 1;
+              break;
+            case lmdb_predicate_operator_le:
+              if ( value < *hi ) *hi = value;
+              break;
+            case lmdb_predicate_operator_lt:
+              if ( value == LLONG_MIN ) return false;
+              if ( value <= *hi ) *hi = value - 1;
+              break;
+            default:
+              return false;
+          }
         }
-        free((void*)expression_string);
         break;
       }
+      
+      default:
+        if ( __lmdb_predicate_node_get_field_classes(p) & lmdb_predicate_field_class_checked ) return false;
+        break;
+        
     }
     p = p->next;
   }
-  return out;
+  return true;
 }
@@ -124,6 +124,12 @@ bool lmdb_predicate_add_expression(lmdb_predicate_ref the_predicate, lmdb_predic
   Generates the SQL WHERE clause associated with the_predicate and
   returns as a C string.  The caller is reponsible for free'ing the
   non-NULL pointer returned.
+
+  String values are quoted (with embedded quotes doubled), so the
+  text is safe to display or hand to sqlite3.  The library's own
+  queries do not use it:  they refer to each value through a named
+  parameter and bind the values to a cached prepared statement, so
+  predicates of the same shape share one compiled query.
 */
 const char* lmdb_predicate_get_string(lmdb_predicate_ref the_predicate);
 
@@ -152,17 +158,115 @@ typedef struct _lmdb * lmdb_ref;
   db_path.  The connection is opened with read-write capability.
   
   If no file existed at db_path, then the lmdb schema is
-  executed to create the necessary tables and indices.
+  executed to create the necessary tables and indices.  An
+  existing database created with an older version of the
+  schema (see PRAGMA user_version) is upgraded in place.
 */
 lmdb_ref lmdb_create(const char *db_path);
 
 /*!
   @function lmdb_create_read_only
   Connect to an extant SQLite database at db_path.  The
-  connection is opened with read-only capability.
+  connection is opened with read-only capability, so an
+  older schema is used as-is rather than upgraded.
 */
 lmdb_ref lmdb_create_read_only(const char *db_path);
 
+/*!
+  @typedef lmdb_journal_mode
+  The SQLite journaling modes that can be requested for a database:
+
+    lmdb_journal_mode_default
+      leave the journaling mode of the database file as-is
+
+    lmdb_journal_mode_delete, lmdb_journal_mode_truncate,
+    lmdb_journal_mode_persist
+      rollback journal; readers and the writer block one another
+
+    lmdb_journal_mode_wal
+      write-ahead log; readers never block the writer and the writer
+      never blocks readers
+
+  The journaling mode is a property of the database file, so it is only
+  changed by read-write connections.
+*/
+typedef enum {
+  lmdb_journal_mode_default = 0,
+  lmdb_journal_mode_delete,
+  lmdb_journal_mode_truncate,
+  lmdb_journal_mode_persist,
+  lmdb_journal_mode_wal,
+  //
+  lmdb_journal_mode_max
+} lmdb_journal_mode;
+
+/*!
+  @typedef lmdb_synchronous
+  The SQLite synchronous levels that can be requested for a connection;
+  lmdb_synchronous_default leaves SQLite's default in effect.
+*/
+typedef enum {
+  lmdb_synchronous_default = 0,
+  lmdb_synchronous_off,
+  lmdb_synchronous_normal,
+  lmdb_synchronous_full,
+  //
+  lmdb_synchronous_max
+} lmdb_synchronous;
+
+/*!
+  @typedef lmdb_options
+  Tuning applied to a database connection when it is opened.  A zero
+  value in any field leaves SQLite's default in effect:
+
+    journal_mode
+      journaling mode of the database file (see lmdb_journal_mode)
+
+    synchronous
+      how aggressively SQLite syncs to disk (see lmdb_synchronous); with
+      the write-ahead log, lmdb_synchronous_normal is durable against
+      application crashes and syncs only when checkpointing
+
+    cache_size
+      size of the page cache, in KiB
+
+    mmap_size
+      maximum number of bytes of the database file to memory-map
+
+    busy_timeout
+      milliseconds to keep retrying an operation that finds the database
+      locked by another connection; the retries back off from 1 ms to
+      100 ms between attempts
+
+    checkpoint_interval
+      seconds between checkpoints of the write-ahead log; when non-zero
+      and the database uses the write-ahead log, read-write connections
+      checkpoint from a background thread (which never waits on readers
+      or the writer) rather than at the end of a commit
+*/
+typedef struct {
+  lmdb_journal_mode   journal_mode;
+  lmdb_synchronous    synchronous;
+  int                 cache_size;
+  long long           mmap_size;
+  int                 busy_timeout;
+  int                 checkpoint_interval;
+} lmdb_options;
+
+/*!
+  @function lmdb_create_with_options
+  Same as lmdb_create() but with the connection tuned by options (which
+  may be NULL).
+*/
+lmdb_ref lmdb_create_with_options(const char *db_path, const lmdb_options *options);
+
+/*!
+  @function lmdb_create_read_only_with_options
+  Same as lmdb_create_read_only() but with the connection tuned by
+  options (which may be NULL).
+*/
+lmdb_ref lmdb_create_read_only_with_options(const char *db_path, const lmdb_options *options);
+
 /*!
   @function lmdb_retain
   Increase the reference count of the_db.
@@ -196,10 +300,72 @@ const char* lmdb_get_rrd_repodir(lmdb_ref the_db);
   @function lmdb_set_rrd_repodir
   Set the_db to use the directory at rrd_repodir to create and
   update RRD file(s) for all counted features.
+
+  Committing counts does not touch the RRD files:  each committed count
+  is appended to a journal in rrd_repodir, which is applied to the RRD
+  files in batches by lmdb_rrd_flush(), by a background thread (see
+  lmdb_set_rrd_flush_interval()), and when the_db is released.
 */
 bool lmdb_set_rrd_repodir(lmdb_ref the_db, const char *rrd_repodir);
+
+/*!
+  @function lmdb_set_rrd_flush_interval
+  Flush the RRD journal of the_db from a background thread every
+  interval seconds; an interval of zero stops the thread.  Returns
+  false if the_db has no RRD repository directory or the thread could
+  not be started.
+*/
+bool lmdb_set_rrd_flush_interval(lmdb_ref the_db, int interval);
+
+/*!
+  @function lmdb_rrd_flush
+  Apply the counts in the RRD journal of the_db to the RRD files:  the
+  points are grouped by feature and each RRD file is updated with as
+  few calls as possible, created (and filled from the database) when
+  not yet present.  Returns false if the_db has no RRD repository
+  directory or the journal could not be read.
+*/
+bool lmdb_rrd_flush(lmdb_ref the_db);
+
+/*!
+  @function lmdb_rrd_rebuild
+  Rewrite the RRD file in rrd_repodir for the feature with the given
+  feature_id (or for every feature when feature_id is lmfeature_no_id)
+  from the counts in the_db.  The files are rebuilt by thread_count
+  threads (when zero or less, one per online CPU), each with its own
+  read-only connection to the database; each file is written under a
+  temporary name and renamed into place, so a program collecting counts
+  into the same repository is never blocked while it is rebuilt.
+  Features without counts are skipped.
+
+  Returns false if any file could not be rebuilt.
+*/
+bool lmdb_rrd_rebuild(lmdb_ref the_db, const char *rrd_repodir, int feature_id, int thread_count);
 #endif
 
+/*!
+  @function lmdb_get_tsdb_path
+  Returns the path of the time-series store attached to the_db, or
+  NULL if none is attached.
+*/
+const char* lmdb_get_tsdb_path(lmdb_ref the_db);
+
+/*!
+  @function lmdb_set_tsdb_path
+  Attach the time-series store at tsdb_path (see lmtsdb.h) to the_db,
+  replacing any store already attached; a NULL tsdb_path detaches it.
+  The store is opened read-only if the_db is.
+
+  Counts committed to a writable the_db are also folded into the store,
+  which is synchronized when the enclosing transaction commits.
+  Aggregated usage reports on the_db are answered from the store's
+  consolidated points when their predicate tests only the feature tuple
+  and check timestamps; raw reports are always answered from the_db.
+
+  Returns false if the store could not be opened.
+*/
+bool lmdb_set_tsdb_path(lmdb_ref the_db, const char *tsdb_path);
+
 /*!
   @function lmdb_load_all_features
   Force the_db to load the entire list of defined feature tuples
@@ -253,6 +419,40 @@ lmfeature_ref lmdb_get_feature_by_feature_id(lmdb_ref the_db, int feature_id);
 */
 lmfeature_ref lmdb_get_feature_by_name(lmdb_ref the_db, const char *feature_string, const char *vendor, const char *version);
 
+/*!
+  @function lmdb_resolve_features
+  Resolve a batch of features against the_db in one pass:  the
+  (feature_string,vendor,version) tuple of each feature in features that
+  is not already in the lmfeatureset for the_db is staged in a temporary
+  table, the tuples not present in the database are added with a single
+  INSERT (unless the_db was opened read-only), and the matching rows are
+  loaded into the lmfeatureset for the_db with a single join.  The
+  features in features are not modified -- they only name the tuples,
+  and subsequent calls to lmdb_get_feature_by_name() for those tuples
+  will be satisfied from the lmfeatureset.
+
+  The work is done inside a transaction (nested within an enclosing
+  batch, if any).  Returns false if any step failed.
+*/
+bool lmdb_resolve_features(lmdb_ref the_db, lmfeatureset_ref features);
+
+/*!
+  @constant lmdb_unknown_version
+  The version given to features whose version could not be determined.
+*/
+extern const char *lmdb_unknown_version;
+
+/*!
+  @function lmdb_get_feature_by_vendor
+  Check the_db for a feature given just a feature string and vendor (e.g.
+  as named in a license server log, which omits the version).  The most
+  recently added version of the feature is returned.  If the feature is
+  not present in the database with any version, it is added with
+  lmdb_unknown_version as its version, so the_db must not have been opened
+  read-only.
+*/
+lmfeature_ref lmdb_get_feature_by_vendor(lmdb_ref the_db, const char *feature_string, const char *vendor);
+
 /*!
   @function lmdb_add_feature
   Given an externally-created lmfeature object new_feature, attempt to add
@@ -281,6 +481,39 @@ extern const time_t lmdb_check_timestamp_now;
 */
 bool lmdb_commit_counts(lmdb_ref the_db, time_t check_timestamp);
 
+/*!
+  @typedef lmdb_commit_stats_t
+  Statistics gathered by lmdb_commit_counts_with_stats():  the number of
+  feature counts recorded in the database, the number of checkout sessions
+  started and ended (if checkout tracking is enabled), and the wall time
+  (in seconds) the commit took.
+*/
+typedef struct {
+  unsigned int    rows_written;
+  unsigned int    checkouts_started;
+  unsigned int    checkouts_ended;
+  double          elapsed;
+} lmdb_commit_stats_t;
+
+/*!
+  @function lmdb_commit_counts_with_stats
+  Identical to lmdb_commit_counts() but if stats is non-NULL it is filled-in
+  with the number of rows written and the time taken.  Only features that were
+  modified since the previous commit are written, and all rows are written
+  inside a single transaction; on any failure the transaction is rolled back
+  and no rows are recorded.
+*/
+bool lmdb_commit_counts_with_stats(lmdb_ref the_db, time_t check_timestamp, lmdb_commit_stats_t *stats);
+
+/*!
+  @function lmdb_reset_in_use_counts
+  Zero the in-use count of every feature cached by the_db and mark each
+  as modified.  Long-running collectors call this before each poll so
+  that the counts accumulated by lmfeature_add_in_use() start afresh and
+  every known feature is written by the next lmdb_commit_counts().
+*/
+void lmdb_reset_in_use_counts(lmdb_ref the_db);
+
 /*!
   @function lmdb_get_last_check_timestamp
   Attempt to retrieve the maximum timestamp from the in-use counts table
@@ -290,6 +523,215 @@ bool lmdb_commit_counts(lmdb_ref the_db, time_t check_timestamp);
 */
 bool lmdb_get_last_check_timestamp(lmdb_ref the_db, time_t *check_timestamp);
 
+/*!
+  @function lmdb_load_last_counts
+  Load every feature in the_db and set its in-use and issued counts and
+  expiration date to the values most recently recorded for it, so that
+  incremental changes can be applied to them.  The features are left
+  unmodified, so this should be called before any counts are changed.
+
+  Returns false in case of error.
+*/
+bool lmdb_load_last_counts(lmdb_ref the_db);
+
+/*!
+  @function lmdb_begin_batch
+  Start a batch of changes to the_db:  everything written (including
+  by lmdb_commit_counts()) until the matching lmdb_end_batch() is part
+  of a single transaction.  Batches may be nested.
+
+  Returns false on error (e.g. the_db is read-only).
+*/
+bool lmdb_begin_batch(lmdb_ref the_db);
+
+/*!
+  @function lmdb_end_batch
+  Finish a batch started by lmdb_begin_batch().  When the outermost
+  batch ends its changes are committed if should_commit is true and
+  every nested batch committed, or rolled back otherwise.
+
+  Returns true if the changes were (or, for a nested batch, will be)
+  committed.
+*/
+bool lmdb_end_batch(lmdb_ref the_db, bool should_commit);
+
+/*!
+  @typedef lmdb_count_storage
+  How a database stores the counts committed to it:
+
+    lmdb_count_storage_rows
+      a row per feature per commit (the counts table)
+
+    lmdb_count_storage_runs
+      a row per commit (the checks table) and, per feature, a row per run of
+      consecutive commits over which its counts did not change (the
+      count_runs table)
+
+  Newly-created databases store runs; older databases store rows until they
+  are converted by lmdb_compact_counts().  Reports return the same results
+  for either.
+*/
+typedef enum {
+  lmdb_count_storage_rows = 0,
+  lmdb_count_storage_runs
+} lmdb_count_storage;
+
+/*!
+  @function lmdb_get_count_storage
+  Returns the manner in which the_db stores counts.
+*/
+lmdb_count_storage lmdb_get_count_storage(lmdb_ref the_db);
+
+/*!
+  @function lmdb_compact_counts
+  Convert the count rows in the_db to runs and switch it to storing runs
+  from then on; the database file is vacuumed afterwards.  Does nothing if
+  the_db already stores runs.
+
+  Returns false in case of error, in which case the_db is unchanged.
+*/
+bool lmdb_compact_counts(lmdb_ref the_db);
+
+/*!
+  @function lmdb_rebuild_rollups
+  Recompute the hourly, daily and monthly rollups of the counts in the_db
+  (per feature, the minimum, maximum and sum of the in-use and issued
+  counts) in the local time zone of the calling program.  Commits keep
+  the rollups up to date from then on and aggregated usage reports are
+  answered from them rather than from every sample.
+
+  Newly-created databases start out with rollups; existing databases need
+  them to be built once, and again if the time zone of the programs that
+  write to them changes.  Maintaining the rollups requires SQLite 3.24.0
+  or newer:  a program linked against an older library does not use them
+  and will not rebuild them.
+
+  Returns false in case of error, in which case the_db is unchanged.
+*/
+bool lmdb_rebuild_rollups(lmdb_ref the_db);
+
+#if 0
+#pragma mark -
+#endif
+
+/*!
+  @typedef lmdb_checkout_t
+  A single license checkout as reported by lmstat:  who holds it, where,
+  through which license server connection, since when, and how many
+  seats.  The display, version, and server fields may be empty strings
+  but not NULL.
+*/
+typedef struct {
+  const char    *user;
+  const char    *host;
+  const char    *display;
+  const char    *version;
+  const char    *server_host;
+  const char    *server_port;
+  const char    *handle;
+  time_t        start_timestamp;
+  int           license_count;
+} lmdb_checkout_t;
+
+/*!
+  @function lmdb_enable_checkout_tracking
+  Enable the recording of checkout sessions in the_db.  The checkouts table
+  is created if not present and the sessions that were still open at the
+  end of the last run are loaded so that they can be matched against the
+  next poll.
+
+  Sessions are kept in memory between polls; each poll is bracketed by
+  lmdb_checkouts_begin_poll() and lmdb_checkouts_end_poll() with a call to
+  lmdb_checkouts_observe() for every checkout seen.  The next commit then
+  inserts a row for each new session and sets the end time of each session
+  that was not seen.
+
+  Returns false on error (e.g. the_db is read-only).
+*/
+bool lmdb_enable_checkout_tracking(lmdb_ref the_db);
+
+/*!
+  @function lmdb_checkouts_begin_poll
+  Start a new poll of checkouts for the_db.
+*/
+void lmdb_checkouts_begin_poll(lmdb_ref the_db);
+
+/*!
+  @function lmdb_checkouts_observe
+  Note that the_checkout (of the_feature) was present in the current poll.
+  If no open session matches it, a new session is started.  The strings in
+  the_checkout are copied.
+
+  Returns false if checkout tracking is not enabled or memory could not be
+  allocated.
+*/
+bool lmdb_checkouts_observe(lmdb_ref the_db, lmfeature_ref the_feature, const lmdb_checkout_t *the_checkout);
+
+/*!
+  @function lmdb_checkouts_end_poll
+  Finish the current poll of checkouts.  If is_complete is true, every open
+  session that was not observed during the poll is ended (at the time of the
+  next commit).  Pass false when some lmstat source could not be read, since
+  the sessions it would have reported are probably still open.
+*/
+void lmdb_checkouts_end_poll(lmdb_ref the_db, bool is_complete);
+
+#if 0
+#pragma mark -
+#endif
+
+/*!
+  @typedef lmdb_log_checkpoint_t
+  How far a license server debug log has been ingested:  the device and
+  inode of the file, the byte offset of the first line not yet ingested,
+  and the timestamp of the last event (which carries the date forward,
+  since most log lines only include a time of day).
+*/
+typedef struct {
+  dev_t         device;
+  ino_t         inode;
+  off_t         offset;
+  time_t        event_timestamp;
+} lmdb_log_checkpoint_t;
+
+/*!
+  @function lmdb_enable_log_ingest
+  Create the log checkpoint and denial tables in the_db if not present.
+
+  Returns false on error (e.g. the_db is read-only).
+*/
+bool lmdb_enable_log_ingest(lmdb_ref the_db);
+
+/*!
+  @function lmdb_get_log_checkpoint
+  Fill-in checkpoint with the position recorded for the log at log_path.
+  If no checkpoint has been recorded, checkpoint is zeroed.
+
+  Returns false in case of error.
+*/
+bool lmdb_get_log_checkpoint(lmdb_ref the_db, const char *log_path, lmdb_log_checkpoint_t *checkpoint);
+
+/*!
+  @function lmdb_set_log_checkpoint
+  Record checkpoint as the position reached in the log at log_path.  To
+  ingest each log line exactly once, set the checkpoint in the same batch
+  as the changes produced by the lines it covers.
+
+  Returns false in case of error.
+*/
+bool lmdb_set_log_checkpoint(lmdb_ref the_db, const char *log_path, const lmdb_log_checkpoint_t *checkpoint);
+
+/*!
+  @function lmdb_add_denial
+  Record that a request by user on host for the_feature was denied at
+  event_timestamp for the given reason (any of which strings may be NULL).
+  Set is_unsupported if the license server did not support the feature
+  at all.
+
+  Returns false in case of error.
+*/
+bool lmdb_add_denial(lmdb_ref the_db, lmfeature_ref the_feature, const char *user, const char *host, const char *reason, bool is_unsupported, time_t event_timestamp);
+
 #if 0
 #pragma mark -
 #endif
@@ -359,6 +801,17 @@ typedef struct _lmdb_usage_report * lmdb_usage_report_ref;
 */
 lmdb_usage_report_ref lmdb_usage_report_create(lmdb_ref the_db, lmdb_usage_report_aggregate aggregate, lmdb_usage_report_range range, lmdb_predicate_ref predicate);
 
+/*!
+  @function lmdb_usage_report_rebind
+  Reload the_query with a new range and predicate, keeping its
+  aggregate function.  The query is rebuilt from the database's cache
+  of prepared statements, so when the predicate has the same shape as
+  before (the same tests, with different values) only the new values
+  are bound.  Returns false if the query could not be reloaded, in
+  which case the_query yields no rows.
+*/
+bool lmdb_usage_report_rebind(lmdb_usage_report_ref the_query, lmdb_usage_report_range range, lmdb_predicate_ref predicate);
+
 /*!
   @function lmdb_usage_report_release
   Decrement the reference count of the_query.  When the count reaches
@@ -7,6 +7,7 @@
  */
 
 #include "lmfeature.h"
+#include "mempool.h"
 
 //
 
@@ -16,23 +17,65 @@ const time_t lmfeature_no_expiration = 0;
 
 //
 
+struct _lmfeatureset;
+struct _lmfeature_pool;
+
+/*
+ * Feature records are packed into 64 bytes (one cache line, with the
+ * reference count, flags, id and counts at its head).  Features created by
+ * lmfeature_create() hold their strings right after the record; features
+ * drawn from an lmfeature_pool live in the pool's slabs and point at its
+ * interned strings.
+ */
 typedef struct _lmfeature {
-  unsigned int  ref_count;
-  
-  bool          is_modified;
+  unsigned int  ref_count : 29;
+  unsigned int  is_modified : 1;
+  unsigned int  is_staged : 1;
+  unsigned int  is_pooled : 1;
   
   int           feature_id;
-  char          *feature_string;
-  char          *vendor;
-  char          *version;
-  
+  int           issued, in_use;
   time_t        expiration_date;
   
-  int           issued, in_use;
+  const char    *feature_string;
+  const char    *vendor;
+  const char    *version;
+  
+  /* The featureset that tracks modifications to this feature (weak
+   * reference), the link in that set's modified list (or in the pool's
+   * free list once released) and the link in its staged list:
+   */
+  struct _lmfeatureset  *owner;
+  struct _lmfeature     *next_modified;
+  struct _lmfeature     *next_staged;
 } lmfeature;
 
 //
 
+void
+__lmfeature_init(
+  lmfeature         *new_feature,
+  int               feature_id,
+  time_t            expiration_date,
+  int               issued,
+  int               in_use
+)
+{
+  new_feature->ref_count = 1;
+  new_feature->is_modified = false;
+  new_feature->is_staged = false;
+  new_feature->is_pooled = false;
+  new_feature->owner = NULL;
+  new_feature->next_modified = NULL;
+  new_feature->next_staged = NULL;
+  new_feature->feature_id = feature_id;
+  new_feature->expiration_date = expiration_date;
+  new_feature->issued = issued;
+  new_feature->in_use = in_use;
+}
+
+//
+
 lmfeature*
 __lmfeature_alloc(
   int               feature_id,
@@ -52,37 +95,35 @@ __lmfeature_alloc(
   
   if ( new_obj_mem ) {
     new_feature = (lmfeature*)new_obj_mem;
+    __lmfeature_init(new_feature, feature_id, expiration_date, issued, in_use);
     
     new_obj_mem += sizeof(lmfeature);
-    
-    new_feature->ref_count = 1;
-    new_feature->is_modified = false;
-    new_feature->feature_id = feature_id;
-    
-    new_feature->feature_string = (char*)new_obj_mem;
+    new_feature->feature_string = memcpy(new_obj_mem, feature_string, feature_string_len);
     new_obj_mem += feature_string_len;
-    strcpy(new_feature->feature_string, feature_string);
-    
-    new_feature->vendor = (char*)new_obj_mem;
+    new_feature->vendor = memcpy(new_obj_mem, vendor, vendor_len);
     new_obj_mem += vendor_len;
-    strcpy(new_feature->vendor, vendor);
-    
-    new_feature->version = (char*)new_obj_mem;
-    new_obj_mem += version_len;
-    strcpy(new_feature->version, version);
-    
-    new_feature->expiration_date = expiration_date;
-    
-    new_feature->issued = issued;
-    new_feature->in_use = in_use;
-    
-    return new_feature;
+    new_feature->version = memcpy(new_obj_mem, version, version_len);
   }
   return new_feature;
 }
 
 //
 
+void __lmfeatureset_push_modified(struct _lmfeatureset *the_featureset, lmfeature *the_feature);
+
+void
+__lmfeature_mark_modified(
+  lmfeature   *the_feature
+)
+{
+  if ( ! the_feature->is_modified ) {
+    the_feature->is_modified = true;
+    if ( the_feature->owner ) __lmfeatureset_push_modified(the_feature->owner, the_feature);
+  }
+}
+
+//
+
 void
 __lmfeature_set_expiration_date(
   lmfeature   *the_feature,
@@ -90,7 +131,7 @@ __lmfeature_set_expiration_date(
 )
 {
   the_feature->expiration_date = expiration_date;
-  the_feature->is_modified = true;
+  __lmfeature_mark_modified(the_feature);
 }
 
 //
@@ -102,7 +143,7 @@ __lmfeature_set_issued(
 )
 {
   the_feature->issued = issued;
-  the_feature->is_modified = true;
+  __lmfeature_mark_modified(the_feature);
 }
 
 //
@@ -114,7 +155,7 @@ __lmfeature_set_in_use(
 )
 {
   the_feature->in_use = in_use;
-  the_feature->is_modified = true;
+  __lmfeature_mark_modified(the_feature);
 }
 
 //
@@ -168,13 +209,19 @@ lmfeature_retain(
 
 //
 
+void __lmfeature_pool_reclaim(lmfeature *the_feature);
+
 void
 lmfeature_release(
   lmfeature_ref   the_feature
 )
 {
   if ( --((lmfeature*)the_feature)->ref_count == 0 ) {
-    free((void*)the_feature);
+    if ( the_feature->is_pooled ) {
+      __lmfeature_pool_reclaim((lmfeature*)the_feature);
+    } else {
+      free((void*)the_feature);
+    }
   }
 }
 
@@ -309,55 +356,526 @@ lmfeature_add_in_use(
 #endif
 //
 
-typedef struct _lmfeatureset_node {
-  lmfeature_ref               feature;
-  struct _lmfeatureset_node   *next;
-} lmfeatureset_node;
+/*
+ * A feature pool hands out feature records from slabs and interns the
+ * strings they refer to, so that thousands of features sharing a few
+ * dozen vendors and versions share single copies of those strings.
+ *
+ * Slabs are aligned to their size, so a record finds its slab (and the
+ * slab its pool) by masking its address; the first record-sized slot of
+ * each slab holds the slab header.  Released records go on a free list
+ * and are reused; slabs and strings are only returned when the pool is
+ * deallocated, which happens once the pool and every feature drawn from it
+ * have been released.
+ */
+#ifndef LMFEATURE_POOL_SLAB_SIZE
+#define LMFEATURE_POOL_SLAB_SIZE  16384
+#endif
+
+typedef struct _lmfeature_pool_slab {
+  struct _lmfeature_pool        *pool;
+  struct _lmfeature_pool_slab   *next;
+} lmfeature_pool_slab;
+
+typedef struct _lmfeature_pool {
+  unsigned int          ref_count;
+  lmfeature_pool_slab   *slabs;
+  lmfeature             *free_records;
+  unsigned int          next_record;
+  mempool_ref           strings;
+  unsigned int          string_count, string_mask;
+  const char            **string_slots;
+} lmfeature_pool;
+
+#define LMFEATURE_POOL_RECORDS_PER_SLAB (LMFEATURE_POOL_SLAB_SIZE / sizeof(lmfeature))
+
+//
+
+lmfeature_pool*
+__lmfeature_pool_alloc(void)
+{
+  lmfeature_pool    *new_pool = calloc(1, sizeof(lmfeature_pool));
+  
+  if ( new_pool ) {
+    new_pool->ref_count = 1;
+    new_pool->next_record = LMFEATURE_POOL_RECORDS_PER_SLAB;
+    if ( ! (new_pool->strings = mempool_alloc()) ) {
+      free((void*)new_pool);
+      new_pool = NULL;
+    }
+  }
+  return new_pool;
+}
+
+//
+
+void
+__lmfeature_pool_dealloc(
+  lmfeature_pool    *the_pool
+)
+{
+  lmfeature_pool_slab *slab = the_pool->slabs;
+  
+  while ( slab ) {
+    lmfeature_pool_slab *next = slab->next;
+    
+    free((void*)slab);
+    slab = next;
+  }
+  if ( the_pool->string_slots ) free((void*)the_pool->string_slots);
+  mempool_dealloc(the_pool->strings);
+  free((void*)the_pool);
+}
 
 //
 
-lmfeatureset_node*
-__lmfeatureset_node_alloc(
-  lmfeature_ref       feature
+/*
+ * Returns the pool's copy of s, adding one if necessary.
+ */
+const char*
+__lmfeature_pool_intern(
+  lmfeature_pool    *the_pool,
+  const char        *s
 )
 {
-  lmfeatureset_node   *new_node = malloc(sizeof(lmfeatureset_node));
+  unsigned int      hash = 2166136261U, i;
+  const char        *p = s;
+  
+  // Keep the table at most half full:
+  if ( 2 * (the_pool->string_count + 1) > (the_pool->string_slots ? the_pool->string_mask + 1 : 0) ) {
+    unsigned int    new_capacity = the_pool->string_slots ? 2 * (the_pool->string_mask + 1) : 64;
+    const char      **new_slots = calloc(new_capacity, sizeof(const char*));
+    
+    if ( ! new_slots ) return NULL;
+    if ( the_pool->string_slots ) {
+      for ( i = 0; i <= the_pool->string_mask; i++ ) {
+        const char  *old = the_pool->string_slots[i];
+        unsigned int  h = 2166136261U, j;
+        
+        if ( ! old ) continue;
+        while ( *old ) h = (h ^ (unsigned char)*old++) * 16777619U;
+        j = h & (new_capacity - 1);
+        while ( new_slots[j] ) j = (j + 1) & (new_capacity - 1);
+        new_slots[j] = the_pool->string_slots[i];
+      }
+      free((void*)the_pool->string_slots);
+    }
+    the_pool->string_slots = new_slots;
+    the_pool->string_mask = new_capacity - 1;
+  }
   
-  if ( new_node ) {
-    new_node->feature = feature ? lmfeature_retain(feature) : NULL;
-    new_node->next = NULL;
+  while ( *p ) hash = (hash ^ (unsigned char)*p++) * 16777619U;
+  i = hash & the_pool->string_mask;
+  while ( the_pool->string_slots[i] ) {
+    if ( strcmp(the_pool->string_slots[i], s) == 0 ) return the_pool->string_slots[i];
+    i = (i + 1) & the_pool->string_mask;
   }
-  return new_node;
+  if ( (the_pool->string_slots[i] = mempool_strdup(the_pool->strings, s)) ) the_pool->string_count++;
+  return the_pool->string_slots[i];
+}
+
+//
+
+lmfeature*
+__lmfeature_pool_alloc_record(
+  lmfeature_pool    *the_pool
+)
+{
+  lmfeature         *record = the_pool->free_records;
+  
+  if ( record ) {
+    the_pool->free_records = record->next_modified;
+  } else {
+    if ( the_pool->next_record == LMFEATURE_POOL_RECORDS_PER_SLAB ) {
+      lmfeature_pool_slab *new_slab = aligned_alloc(LMFEATURE_POOL_SLAB_SIZE, LMFEATURE_POOL_SLAB_SIZE);
+      
+      if ( ! new_slab ) return NULL;
+      new_slab->pool = the_pool;
+      new_slab->next = the_pool->slabs;
+      the_pool->slabs = new_slab;
+      // Record zero is the slab header:
+      the_pool->next_record = 1;
+    }
+    record = (lmfeature*)the_pool->slabs + the_pool->next_record++;
+  }
+  return record;
+}
+
+//
+
+void
+__lmfeature_pool_reclaim(
+  lmfeature         *the_feature
+)
+{
+  lmfeature_pool    *the_pool = ((lmfeature_pool_slab*)((uintptr_t)the_feature & ~((uintptr_t)LMFEATURE_POOL_SLAB_SIZE - 1)))->pool;
+  
+  the_feature->next_modified = the_pool->free_records;
+  the_pool->free_records = the_feature;
+  lmfeature_pool_release((lmfeature_pool_ref)the_pool);
+}
+
+//
+
+lmfeature_pool_ref
+lmfeature_pool_create(void)
+{
+  return (lmfeature_pool_ref)__lmfeature_pool_alloc();
+}
+
+//
+
+lmfeature_pool_ref
+lmfeature_pool_retain(
+  lmfeature_pool_ref  the_pool
+)
+{
+  ((lmfeature_pool*)the_pool)->ref_count++;
+  return the_pool;
 }
 
 //
 
 void
-__lmfeatureset_node_dealloc(
-  lmfeatureset_node   *node
+lmfeature_pool_release(
+  lmfeature_pool_ref  the_pool
+)
+{
+  if ( --((lmfeature_pool*)the_pool)->ref_count == 0 ) {
+    __lmfeature_pool_dealloc((lmfeature_pool*)the_pool);
+  }
+}
+
+//
+
+lmfeature_ref
+lmfeature_pool_create_feature_with_stats(
+  lmfeature_pool_ref  a_pool,
+  int                 feature_id,
+  const char          *feature_string,
+  const char          *vendor,
+  const char          *version,
+  time_t              expiration_date,
+  int                 issued,
+  int                 in_use
+)
+{
+  lmfeature_pool      *the_pool = (lmfeature_pool*)a_pool;
+  lmfeature           *new_feature = NULL;
+  
+  if ( ! the_pool ) return lmfeature_create_with_stats(feature_id, feature_string, vendor, version, expiration_date, issued, in_use);
+  if ( feature_string && *feature_string && vendor && *vendor && version && *version ) {
+    if ( ! (feature_string = __lmfeature_pool_intern(the_pool, feature_string)) ||
+         ! (vendor = __lmfeature_pool_intern(the_pool, vendor)) ||
+         ! (version = __lmfeature_pool_intern(the_pool, version)) ||
+         ! (new_feature = __lmfeature_pool_alloc_record(the_pool))
+    ) return NULL;
+    __lmfeature_init(new_feature, feature_id, expiration_date, issued, in_use);
+    new_feature->is_pooled = true;
+    new_feature->feature_string = feature_string;
+    new_feature->vendor = vendor;
+    new_feature->version = version;
+    // Each feature keeps its pool alive:
+    the_pool->ref_count++;
+  }
+  return (lmfeature_ref)new_feature;
+}
+
+//
+
+lmfeature_ref
+lmfeature_pool_create_feature(
+  lmfeature_pool_ref  the_pool,
+  int                 feature_id,
+  const char          *feature_string,
+  const char          *vendor,
+  const char          *version
 )
 {
-  if ( node->feature ) lmfeature_release(node->feature);
-  free((void*)node);
+  return lmfeature_pool_create_feature_with_stats(the_pool, feature_id, feature_string, vendor, version, lmfeature_no_expiration, 0, 0);
 }
 
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+/*
+ * A feature set keeps its features in an array of entries (in the order they
+ * were added) with open-addressing hash indexes over it:
+ *
+ *   - by feature id (features with no id are not indexed; the most recently
+ *     added one is remembered instead)
+ *   - by the (feature string, vendor, version) tuple
+ *   - by each of the feature string, vendor, and version individually; each
+ *     slot holds the first of a chain of entries sharing that value, which
+ *     is how wildcard lookups avoid a scan of the whole set
+ *
+ * Slots hold an entry index plus one, so zero marks an empty slot.  Features
+ * are never removed from a set, so no tombstones are needed.  The tables are
+ * kept at most half full.
+ *
+ * Iteration is ordered by feature id, with the features lacking an id first
+ * (most recently added first); the order array is sorted on demand, which is
+ * only necessary when features were not added in that order.
+ */
+enum {
+  lmfeatureset_field_feature_string = 0,
+  lmfeatureset_field_vendor,
+  lmfeatureset_field_version,
+  lmfeatureset_field_max
+};
+
+typedef struct {
+  lmfeature_ref       feature;
+  unsigned int        serial;
+  unsigned int        tuple_hash;
+  unsigned int        field_hash[lmfeatureset_field_max];
+  unsigned int        next_by_field[lmfeatureset_field_max];
+} lmfeatureset_entry;
+
 //
 
 typedef struct _lmfeatureset {
   unsigned int        ref_count;
-  lmfeatureset_node   *features;
+  unsigned int        count, capacity;
+  lmfeatureset_entry  *entries;
+  unsigned int        *order;
+  bool                is_ordered;
+  unsigned int        last_no_id;
+  unsigned int        index_mask;
+  unsigned int        *by_id, *by_tuple, *by_field[lmfeatureset_field_max];
+  lmfeature           *modified, *staged;
 } lmfeatureset;
 
 //
 
+#ifndef LMFEATURESET_MIN_INDEX_CAPACITY
+#define LMFEATURESET_MIN_INDEX_CAPACITY 64
+#endif
+
+static inline unsigned int
+__lmfeatureset_hash_string(
+  unsigned int      hash,
+  const char        *s
+)
+{
+  while ( *s ) hash = (hash ^ (unsigned char)*s++) * 16777619U;
+  return hash;
+}
+
+static inline unsigned int
+__lmfeatureset_hash_id(
+  int               feature_id
+)
+{
+  return (unsigned int)feature_id * 2654435769U;
+}
+
+static inline const char*
+__lmfeatureset_field_value(
+  lmfeature_ref     the_feature,
+  int               field
+)
+{
+  switch ( field ) {
+    case lmfeatureset_field_feature_string:
+      return the_feature->feature_string;
+    case lmfeatureset_field_vendor:
+      return the_feature->vendor;
+  }
+  return the_feature->version;
+}
+
+//
+
+/*
+ * Iteration order:  ascending feature id, features with no id ahead of the
+ * rest in reverse of the order they were added.
+ */
+int
+__lmfeatureset_entry_compare(
+  const lmfeatureset_entry  *e1,
+  const lmfeatureset_entry  *e2
+)
+{
+  int               id1 = e1->feature->feature_id, id2 = e2->feature->feature_id;
+  
+  if ( id1 != id2 ) return ( id1 < id2 ) ? -1 : 1;
+  if ( e1->serial == e2->serial ) return 0;
+  if ( id1 == lmfeature_no_id ) return ( e1->serial > e2->serial ) ? -1 : 1;
+  return ( e1->serial < e2->serial ) ? -1 : 1;
+}
+
+/*
+ * qsort() passes no context to its comparator, so the entries being ordered
+ * are made available here for the duration of the sort:
+ */
+static const lmfeatureset_entry   *__lmfeatureset_order_entries = NULL;
+
+int
+__lmfeatureset_order_compare(
+  const void        *i1,
+  const void        *i2
+)
+{
+  return __lmfeatureset_entry_compare(
+              &__lmfeatureset_order_entries[*((unsigned int*)i1)],
+              &__lmfeatureset_order_entries[*((unsigned int*)i2)]
+            );
+}
+
+//
+
+void
+__lmfeatureset_make_ordered(
+  lmfeatureset      *the_featureset
+)
+{
+  if ( ! the_featureset->is_ordered ) {
+    __lmfeatureset_order_entries = the_featureset->entries;
+    qsort(the_featureset->order, the_featureset->count, sizeof(unsigned int), __lmfeatureset_order_compare);
+    __lmfeatureset_order_entries = NULL;
+    the_featureset->is_ordered = true;
+  }
+}
+
+//
+
+unsigned int*
+__lmfeatureset_id_slot(
+  const lmfeatureset  *the_featureset,
+  int                 feature_id
+)
+{
+  unsigned int        i = __lmfeatureset_hash_id(feature_id) & the_featureset->index_mask;
+  
+  while ( the_featureset->by_id[i] ) {
+    if ( the_featureset->entries[the_featureset->by_id[i] - 1].feature->feature_id == feature_id ) break;
+    i = (i + 1) & the_featureset->index_mask;
+  }
+  return &the_featureset->by_id[i];
+}
+
+//
+
+unsigned int*
+__lmfeatureset_tuple_slot(
+  const lmfeatureset  *the_featureset,
+  unsigned int        hash,
+  const char          *feature_string,
+  const char          *vendor,
+  const char          *version
+)
+{
+  unsigned int        i = hash & the_featureset->index_mask;
+  
+  while ( the_featureset->by_tuple[i] ) {
+    const lmfeatureset_entry  *e = &the_featureset->entries[the_featureset->by_tuple[i] - 1];
+    
+    if ( (e->tuple_hash == hash) && (strcmp(e->feature->feature_string, feature_string) == 0) &&
+         (strcmp(e->feature->vendor, vendor) == 0) && (strcmp(e->feature->version, version) == 0)
+    ) break;
+    i = (i + 1) & the_featureset->index_mask;
+  }
+  return &the_featureset->by_tuple[i];
+}
+
+//
+
+unsigned int*
+__lmfeatureset_field_slot(
+  const lmfeatureset  *the_featureset,
+  int                 field,
+  unsigned int        hash,
+  const char          *value
+)
+{
+  unsigned int        *slots = the_featureset->by_field[field];
+  unsigned int        i = hash & the_featureset->index_mask;
+  
+  while ( slots[i] ) {
+    const lmfeatureset_entry  *e = &the_featureset->entries[slots[i] - 1];
+    
+    if ( (e->field_hash[field] == hash) && (strcmp(__lmfeatureset_field_value(e->feature, field), value) == 0) ) break;
+    i = (i + 1) & the_featureset->index_mask;
+  }
+  return &slots[i];
+}
+
+//
+
+/*
+ * Grow all of the index tables to new_capacity (a power of two) and re-insert
+ * the occupied slots of the old ones.
+ */
+bool
+__lmfeatureset_reindex(
+  lmfeatureset      *the_featureset,
+  unsigned int      new_capacity
+)
+{
+  unsigned int      old_capacity = the_featureset->by_id ? the_featureset->index_mask + 1 : 0;
+  unsigned int      *old_slots[2 + lmfeatureset_field_max] = { the_featureset->by_id, the_featureset->by_tuple, the_featureset->by_field[0], the_featureset->by_field[1], the_featureset->by_field[2] };
+  unsigned int      *new_slots = calloc((2 + lmfeatureset_field_max) * new_capacity, sizeof(unsigned int));
+  unsigned int      t, i;
+  
+  if ( ! new_slots ) return false;
+  for ( t = 0; t < 2 + lmfeatureset_field_max; t++ ) {
+    unsigned int    *slots = new_slots + t * new_capacity;
+    
+    for ( i = 0; i < old_capacity; i++ ) {
+      unsigned int  e_index = old_slots[t][i], j;
+      
+      if ( ! e_index ) continue;
+      switch ( t ) {
+        case 0:
+          j = __lmfeatureset_hash_id(the_featureset->entries[e_index - 1].feature->feature_id);
+          break;
+        case 1:
+          j = the_featureset->entries[e_index - 1].tuple_hash;
+          break;
+        default:
+          j = the_featureset->entries[e_index - 1].field_hash[t - 2];
+          break;
+      }
+      j &= new_capacity - 1;
+      while ( slots[j] ) j = (j + 1) & (new_capacity - 1);
+      slots[j] = e_index;
+    }
+  }
+  // All five tables live in one allocation headed by by_id:
+  if ( the_featureset->by_id ) free((void*)the_featureset->by_id);
+  the_featureset->by_id = new_slots;
+  the_featureset->by_tuple = new_slots + new_capacity;
+  for ( t = 0; t < lmfeatureset_field_max; t++ ) the_featureset->by_field[t] = new_slots + (2 + t) * new_capacity;
+  the_featureset->index_mask = new_capacity - 1;
+  return true;
+}
+
+//
+
+void
+__lmfeatureset_push_modified(
+  lmfeatureset      *the_featureset,
+  lmfeature         *the_feature
+)
+{
+  the_feature->next_modified = the_featureset->modified;
+  the_featureset->modified = the_feature;
+}
+
+//
+
 lmfeatureset*
 __lmfeatureset_alloc()
 {
-  lmfeatureset      *new_set = malloc(sizeof(lmfeatureset));
+  lmfeatureset      *new_set = calloc(1, sizeof(lmfeatureset));
 
   if ( new_set ) {
     new_set->ref_count = 1;
-    new_set->features = NULL;
+    new_set->is_ordered = true;
   }
   return new_set;
 }
@@ -369,14 +887,24 @@ __lmfeatureset_dealloc(
   lmfeatureset      *the_featureset
 )
 {
-  lmfeatureset_node *node, *next;
+  unsigned int      i = 0;
   
-  node = the_featureset->features;
-  while ( node ) {
-    next = node->next;
-    __lmfeatureset_node_dealloc(node);
-    node = next;
+  while ( i < the_featureset->count ) {
+    lmfeature       *feature = (lmfeature*)the_featureset->entries[i++].feature;
+    
+    // Features that outlive us must not point back at this set:
+    if ( feature->owner == the_featureset ) {
+      feature->owner = NULL;
+      feature->next_modified = NULL;
+      feature->is_staged = false;
+      feature->next_staged = NULL;
+    }
+    lmfeature_release(feature);
   }
+  if ( the_featureset->entries ) free((void*)the_featureset->entries);
+  if ( the_featureset->order ) free((void*)the_featureset->order);
+  if ( the_featureset->by_id ) free((void*)the_featureset->by_id);
+  free((void*)the_featureset);
 }
 
 //
@@ -393,70 +921,111 @@ lmfeatureset_create()
 
 //
 
+lmfeatureset_ref
+lmfeatureset_retain(
+  lmfeatureset_ref  the_featureset
+)
+{
+  ((lmfeatureset*)the_featureset)->ref_count++;
+  return the_featureset;
+}
+
+//
+
 void
 lmfeatureset_release(
   lmfeatureset_ref  the_featureset
 )
 {
-  __lmfeatureset_dealloc((lmfeatureset*)the_featureset);
+  if ( --((lmfeatureset*)the_featureset)->ref_count == 0 ) {
+    __lmfeatureset_dealloc((lmfeatureset*)the_featureset);
+  }
+}
+
+//
+
+void
+__lmfeatureset_claim_feature(
+  lmfeatureset      *the_featureset,
+  lmfeature         *the_feature
+)
+{
+  // The first set a feature is added to tracks its modifications:
+  if ( ! the_feature->owner ) {
+    the_feature->owner = the_featureset;
+    if ( the_feature->is_modified ) __lmfeatureset_push_modified(the_featureset, the_feature);
+  }
 }
 
 //
 
 bool
 lmfeatureset_add_feature(
-  lmfeatureset_ref  the_featureset,
+  lmfeatureset_ref  a_featureset,
   lmfeature_ref     the_feature
 )
 {
+  lmfeatureset        *the_featureset = (lmfeatureset*)a_featureset;
+  lmfeatureset_entry  *new_entry;
+  unsigned int        tuple_hash, e_index, field, *slot;
+  
   if ( ! the_feature ) return false;
   
-  if ( ! the_featureset->features ) {
-    // Empty list means we just add it, period:
-    ((lmfeatureset*)the_featureset)->features = __lmfeatureset_node_alloc(the_feature);
-  } else {
-    int               feature_id = lmfeature_get_feature_id(the_feature);
-    lmfeatureset_node *node, *node_prev, *new_node;
-    
-    // First, figure out if we already have this id, or where in the chain we want to insert it:
-    node = the_featureset->features;
-    node_prev = NULL;
-    while ( node ) {
-      // We want to insert before this node if it's id exceeds the new one:
-      if ( lmfeature_get_feature_id(node->feature) > feature_id ) break;
-        
-      // Hmm...same feature id?  Only time that isn't bad is if the id is not set yet:
-      if ( lmfeature_get_feature_id(node->feature) == feature_id ) {
-        // Ah, if it's a feature with no id, we should go ahead and add it:
-        if ( feature_id == lmfeature_no_id ) break;
-        return false;
-      }
-      
-      node_prev = node;
-      node = node->next;
-    }
+  // Make room first, so that the slots found below stay valid:
+  if ( the_featureset->count == the_featureset->capacity ) {
+    unsigned int        new_capacity = the_featureset->capacity ? 2 * the_featureset->capacity : 16;
+    lmfeatureset_entry  *new_entries = realloc(the_featureset->entries, new_capacity * sizeof(lmfeatureset_entry));
+    unsigned int        *new_order;
     
-    // Second, ensure no feature with matchine name/vendor/version are present:
-    if ( lmfeatureset_get_feature_by_name(the_featureset, lmfeature_get_feature_string(the_feature), lmfeature_get_vendor(the_feature), lmfeature_get_version(the_feature)) ) return false;
-    
-    new_node = __lmfeatureset_node_alloc(the_feature);
-    if ( ! new_node ) return false;
+    //
+    // The capacity only grows once both arrays have:  if the second
+    // realloc() fails the first array is merely larger than it needs to be.
+    //
+    if ( ! new_entries ) return false;
+    the_featureset->entries = new_entries;
+    if ( ! (new_order = realloc(the_featureset->order, new_capacity * sizeof(unsigned int))) ) return false;
+    the_featureset->order = new_order;
+    the_featureset->capacity = new_capacity;
+  }
+  if ( ! the_featureset->by_id || (2 * (the_featureset->count + 1) > the_featureset->index_mask + 1) ) {
+    if ( ! __lmfeatureset_reindex(the_featureset, the_featureset->by_id ? 2 * (the_featureset->index_mask + 1) : LMFEATURESET_MIN_INDEX_CAPACITY) ) return false;
+  }
+  
+  // Already have this id?  Features with no id yet are not considered:
+  if ( (the_feature->feature_id != lmfeature_no_id) && *__lmfeatureset_id_slot(the_featureset, the_feature->feature_id) ) return false;
+  
+  // Already have this name/vendor/version?
+  tuple_hash = __lmfeatureset_hash_string(__lmfeatureset_hash_string(__lmfeatureset_hash_string(2166136261U, the_feature->feature_string) * 31U, the_feature->vendor) * 31U, the_feature->version);
+  slot = __lmfeatureset_tuple_slot(the_featureset, tuple_hash, the_feature->feature_string, the_feature->vendor, the_feature->version);
+  if ( *slot ) return false;
+  
+  e_index = the_featureset->count++;
+  new_entry = &the_featureset->entries[e_index];
+  new_entry->feature = lmfeature_retain(the_feature);
+  new_entry->serial = e_index;
+  new_entry->tuple_hash = tuple_hash;
+  *slot = e_index + 1;
+  if ( the_feature->feature_id == lmfeature_no_id ) {
+    the_featureset->last_no_id = e_index + 1;
+  } else {
+    *__lmfeatureset_id_slot(the_featureset, the_feature->feature_id) = e_index + 1;
+  }
+  for ( field = 0; field < lmfeatureset_field_max; field++ ) {
+    const char        *value = __lmfeatureset_field_value(the_feature, field);
     
-    // If node is NULL, we went through the entire list and node_prev is the node prior to the new_node
-    // If node is not NULL, then node should be linked to the new_node and node_prev should link to the
-    //    new_node instead of node (except if node_prev is NULL, in which case we need to replace the
-    //    head of the linked list with new_node)
-    if ( ! node ) {
-      node_prev->next = new_node;
-    } else {
-      new_node->next = node;
-      if ( ! node_prev ) {
-        ((lmfeatureset*)the_featureset)->features = new_node;
-      } else {
-        node_prev->next = new_node;
-      }
-    }
+    new_entry->field_hash[field] = __lmfeatureset_hash_string(2166136261U, value);
+    slot = __lmfeatureset_field_slot(the_featureset, field, new_entry->field_hash[field], value);
+    new_entry->next_by_field[field] = *slot;
+    *slot = e_index + 1;
+  }
+  
+  // Still in iteration order?
+  if ( the_featureset->is_ordered && e_index && (__lmfeatureset_entry_compare(&the_featureset->entries[the_featureset->order[e_index - 1]], new_entry) > 0) ) {
+    the_featureset->is_ordered = false;
   }
+  the_featureset->order[e_index] = e_index;
+  
+  __lmfeatureset_claim_feature(the_featureset, (lmfeature*)the_feature);
   return true;
 }
 
@@ -468,17 +1037,11 @@ lmfeatureset_get_feature_by_id(
   int               feature_id
 )
 {
-  lmfeature_ref     f = NULL;
-  lmfeatureset_node *node = the_featureset->features;
+  unsigned int      e_index;
   
-  while ( node ) {
-    if ( lmfeature_get_feature_id(node->feature) == feature_id ) {
-      f = node->feature;
-      break;
-    }
-    node = node->next;
-  }
-  return f;
+  if ( ! the_featureset->count ) return NULL;
+  e_index = ( feature_id == lmfeature_no_id ) ? the_featureset->last_no_id : *__lmfeatureset_id_slot(the_featureset, feature_id);
+  return e_index ? the_featureset->entries[e_index - 1].feature : NULL;
 }
 
 //
@@ -491,21 +1054,44 @@ lmfeatureset_get_feature_by_name(
   const char        *version
 )
 {
-  lmfeature_ref     f = NULL;
-  lmfeatureset_node *node = the_featureset->features;
+  const char        *values[lmfeatureset_field_max] = { feature_string, vendor, version };
+  const lmfeatureset_entry  *best = NULL;
+  unsigned int      e_index, field;
+  
+  if ( ! the_featureset->count ) return NULL;
   
-  while ( node ) {
-    if ( (! feature_string || ((feature_string && strcmp(feature_string, lmfeature_get_feature_string(node->feature)) == 0))) &&
-         (! vendor || ((vendor && strcmp(vendor, lmfeature_get_vendor(node->feature)) == 0))) &&
-         (! version || ((version && strcmp(version, lmfeature_get_version(node->feature)) == 0)))
-       )
-    {
-      f = node->feature;
-      break;
+  if ( feature_string && vendor && version ) {
+    unsigned int    tuple_hash = __lmfeatureset_hash_string(__lmfeatureset_hash_string(__lmfeatureset_hash_string(2166136261U, feature_string) * 31U, vendor) * 31U, version);
+    
+    e_index = *__lmfeatureset_tuple_slot(the_featureset, tuple_hash, feature_string, vendor, version);
+    return e_index ? the_featureset->entries[e_index - 1].feature : NULL;
+  }
+  
+  // No constraints at all?  That's the first feature:
+  if ( ! feature_string && ! vendor && ! version ) {
+    __lmfeatureset_make_ordered((lmfeatureset*)the_featureset);
+    return the_featureset->entries[the_featureset->order[0]].feature;
+  }
+  
+  //
+  // Walk the chain of one of the given fields (the feature string being the
+  // most selective, the vendor the least) and return the matching feature
+  // that comes first in iteration order:
+  //
+  field = feature_string ? lmfeatureset_field_feature_string : (version ? lmfeatureset_field_version : lmfeatureset_field_vendor);
+  e_index = *__lmfeatureset_field_slot(the_featureset, field, __lmfeatureset_hash_string(2166136261U, values[field]), values[field]);
+  while ( e_index ) {
+    const lmfeatureset_entry  *e = &the_featureset->entries[e_index - 1];
+    
+    if ( (! feature_string || (strcmp(feature_string, e->feature->feature_string) == 0)) &&
+         (! vendor || (strcmp(vendor, e->feature->vendor) == 0)) &&
+         (! version || (strcmp(version, e->feature->version) == 0))
+    ) {
+      if ( ! best || (__lmfeatureset_entry_compare(e, best) < 0) ) best = e;
     }
-    node = node->next;
+    e_index = e->next_by_field[field];
   }
-  return f;
+  return best ? best->feature : NULL;
 }
 
 //
@@ -517,10 +1103,94 @@ lmfeatureset_iterate(
   const void              *context
 )
 {
-  lmfeatureset_node *node = the_featureset->features;
+  unsigned int            i = 0;
+  
+  __lmfeatureset_make_ordered((lmfeatureset*)the_featureset);
+  while ( i < the_featureset->count ) {
+    if ( ! iterator(context, the_featureset->entries[the_featureset->order[i++]].feature) ) break;
+  }
+}
+
+//
+
+void
+lmfeatureset_iterate_modified(
+  lmfeatureset_ref        the_featureset,
+  lmfeatureset_iterator   iterator,
+  const void              *context
+)
+{
+  lmfeature         *feature = the_featureset->modified;
+  
+  while ( feature ) {
+    if ( ! iterator(context, (lmfeature_ref)feature) ) break;
+    feature = feature->next_modified;
+  }
+}
+
+//
+
+void
+lmfeatureset_clear_modified(
+  lmfeatureset_ref        the_featureset
+)
+{
+  lmfeature         *feature = the_featureset->modified;
+  
+  while ( feature ) {
+    lmfeature       *next = feature->next_modified;
+    
+    feature->is_modified = false;
+    feature->next_modified = NULL;
+    feature = next;
+  }
+  ((lmfeatureset*)the_featureset)->modified = NULL;
+}
+
+//
+
+void
+lmfeatureset_stage_modified(
+  lmfeatureset_ref        the_featureset
+)
+{
+  lmfeatureset      *FEATURESET = (lmfeatureset*)the_featureset;
+  lmfeature         *feature = FEATURESET->modified;
+  
+  while ( feature ) {
+    lmfeature       *next = feature->next_modified;
+    
+    feature->is_modified = false;
+    feature->next_modified = NULL;
+    if ( ! feature->is_staged ) {
+      feature->is_staged = true;
+      feature->next_staged = FEATURESET->staged;
+      FEATURESET->staged = feature;
+    }
+    feature = next;
+  }
+  FEATURESET->modified = NULL;
+}
+
+//
+
+void
+lmfeatureset_finish_staged(
+  lmfeatureset_ref        the_featureset,
+  bool                    was_committed
+)
+{
+  lmfeatureset      *FEATURESET = (lmfeatureset*)the_featureset;
+  lmfeature         *feature = FEATURESET->staged;
   
-  while ( node ) {
-    if ( ! iterator(context, node->feature) ) break;
-    node = node->next;
+  while ( feature ) {
+    lmfeature       *next = feature->next_staged;
+    
+    feature->is_staged = false;
+    feature->next_staged = NULL;
+    // Modifications that were not kept must be written again:
+    if ( ! was_committed ) __lmfeature_mark_modified(feature);
+    feature = next;
   }
+  FEATURESET->staged = NULL;
 }
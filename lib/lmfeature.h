@@ -155,6 +155,66 @@ void lmfeature_set_in_use(lmfeature_ref the_feature, int in_use);
 */
 void lmfeature_add_in_use(lmfeature_ref the_feature, int in_use);
 
+/*!
+  @typedef lmfeature_pool_ref
+  Type of an opaque reference to an lmfeature_pool object.  A pool
+  allocates feature records in slabs and shares a single copy of each
+  distinct feature, vendor, and version string among the features
+  drawn from it, which saves memory and allocations when large
+  catalogs of features are loaded.
+*/
+typedef const struct _lmfeature_pool * lmfeature_pool_ref;
+
+/*!
+  @function lmfeature_pool_create
+  Allocate and initialize an empty feature pool.
+*/
+lmfeature_pool_ref lmfeature_pool_create(void);
+
+/*!
+  @function lmfeature_pool_retain
+  Increment the reference count of the_pool.
+*/
+lmfeature_pool_ref lmfeature_pool_retain(lmfeature_pool_ref the_pool);
+
+/*!
+  @function lmfeature_pool_release
+  Decrement the reference count of the_pool.  Every feature drawn
+  from the_pool also holds a reference to it, so the pool is
+  deallocated once it and all of its features have been released.
+*/
+void lmfeature_pool_release(lmfeature_pool_ref the_pool);
+
+/*!
+  @function lmfeature_pool_create_feature_with_stats
+  Like lmfeature_create_with_stats(), but the feature is allocated
+  from the_pool.  The result is used (retained, released, added to
+  sets) exactly like any other lmfeature.  If the_pool is NULL the
+  feature is allocated on its own via lmfeature_create_with_stats().
+*/
+lmfeature_ref lmfeature_pool_create_feature_with_stats(
+                  lmfeature_pool_ref  the_pool,
+                  int                 feature_id,
+                  const char          *feature_string,
+                  const char          *vendor,
+                  const char          *version,
+                  time_t              expiration_date,
+                  int                 issued,
+                  int                 in_use
+                );
+
+/*!
+  @function lmfeature_pool_create_feature
+  Like lmfeature_create(), but the feature is allocated from the_pool.
+*/
+lmfeature_ref lmfeature_pool_create_feature(
+                  lmfeature_pool_ref  the_pool,
+                  int                 feature_id,
+                  const char          *feature_string,
+                  const char          *vendor,
+                  const char          *version
+                );
+
 /*!
   @typedef lmfeatureset_ref
   Type of an opaque reference to a set of zero of more lmfeature
@@ -232,4 +292,38 @@ typedef bool (*lmfeatureset_iterator)(const void *context, lmfeature_ref a_featu
 */
 void lmfeatureset_iterate(lmfeatureset_ref the_featureset, lmfeatureset_iterator iterator, const void *context);
 
+/*!
+  @function lmfeatureset_iterate_modified
+  Call the iterator function on each lmfeature object in the_featureset that
+  has been modified since it was added or since the last call to
+  lmfeatureset_clear_modified().  Only features whose modifications are tracked
+  by the_featureset (the first set to which a feature was added) are visited,
+  so the cost is proportional to the number of modified features rather than
+  the size of the set.
+*/
+void lmfeatureset_iterate_modified(lmfeatureset_ref the_featureset, lmfeatureset_iterator iterator, const void *context);
+
+/*!
+  @function lmfeatureset_clear_modified
+  Reset the modified state of every feature tracked by the_featureset and
+  empty its list of modified features.
+*/
+void lmfeatureset_clear_modified(lmfeatureset_ref the_featureset);
+
+/*!
+  @function lmfeatureset_stage_modified
+  Like lmfeatureset_clear_modified(), but the features are remembered until
+  lmfeatureset_finish_staged() is called.  Used once the modifications have
+  been written by a transaction whose outcome is not yet known.
+*/
+void lmfeatureset_stage_modified(lmfeatureset_ref the_featureset);
+
+/*!
+  @function lmfeatureset_finish_staged
+  Forget the features staged by lmfeatureset_stage_modified().  If
+  was_committed is false their modifications were not kept, so they are
+  marked as modified again.
+*/
+void lmfeatureset_finish_staged(lmfeatureset_ref the_featureset, bool was_committed);
+
 #endif /* __LMFEATURE_H__ */
@@ -0,0 +1,594 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmstat_parser.c
+ *
+ * Push-style parser for the output of "lmstat -a".
+ *
+ */
+
+#include "lmstat_parser.h"
+#include "lmfeature.h"
+#include "lmlog.h"
+
+//
+
+char*
+lmstat_field_strdup(
+  lmstat_field  f
+)
+{
+  char          *s = malloc(f.len + 1);
+
+  if ( s ) {
+    if ( f.len ) memcpy(s, f.ptr, f.len);
+    s[f.len] = '\0';
+  }
+  return s;
+}
+
+//
+
+enum {
+  lmstat_parser_state_idle = 0,
+  lmstat_parser_state_usage,
+  lmstat_parser_state_vendor,
+  lmstat_parser_state_stopped
+};
+
+typedef struct _lmstat_parser {
+  lmstat_parser_callbacks callbacks;
+  void                    *context;
+  int                     state;
+  //
+  // From the last usage line:
+  //
+  int                     issued, in_use;
+  //
+  // Copies of the current feature (from the usage line) and the vendor
+  // and version (from the last vendor line), packed into one buffer:
+  //
+  lmstat_field            feature, vendor, version;
+  char                    *names;
+  size_t                  names_capacity;
+} lmstat_parser;
+
+//
+
+static inline bool
+__lmstat_is_space(
+  char          c
+)
+{
+  return ( c == ' ' || c == '\t' );
+}
+
+//
+
+static inline const char*
+__lmstat_skip_space(
+  const char    *p,
+  const char    *e
+)
+{
+  while ( (p < e) && __lmstat_is_space(*p) ) p++;
+  return p;
+}
+
+//
+
+/*
+ * ASCII-only case folding; avoids the locale lookups behind tolower().
+ */
+static inline char
+__lmstat_lower(
+  char          c
+)
+{
+  return ( (c >= 'A') && (c <= 'Z') ) ? (c | 0x20) : c;
+}
+
+//
+
+/*
+ * If the characters at p match token (ignoring case), return the pointer
+ * to the first character following it, otherwise NULL.  The token must
+ * be lowercase.
+ */
+static inline const char*
+__lmstat_match_ci(
+  const char    *p,
+  const char    *e,
+  const char    *token
+)
+{
+  while ( *token ) {
+    if ( (p >= e) || (__lmstat_lower(*p) != *token) ) return NULL;
+    p++, token++;
+  }
+  return p;
+}
+
+//
+
+/*
+ * Search [p, e) for token (ignoring case); returns a pointer to the
+ * character following the first occurrence, or NULL.  The token must be
+ * lowercase and begin with a letter.
+ */
+static const char*
+__lmstat_find_ci(
+  const char    *p,
+  const char    *e,
+  const char    *token
+)
+{
+  while ( p < e ) {
+    if ( __lmstat_lower(*p) == token[0] ) {
+      const char  *m = __lmstat_match_ci(p, e, token);
+
+      if ( m ) return m;
+    }
+    p++;
+  }
+  return NULL;
+}
+
+//
+
+static inline const char*
+__lmstat_parse_int(
+  const char    *p,
+  const char    *e,
+  int           *value
+)
+{
+  const char    *s = p;
+  int           v = 0;
+
+  while ( (p < e) && (*p >= '0') && (*p <= '9') ) {
+    v = 10 * v + (*p - '0');
+    p++;
+  }
+  if ( p == s ) return NULL;
+  *value = v;
+  return p;
+}
+
+//
+
+static inline const char*
+__lmstat_memchr(
+  const char    *p,
+  const char    *e,
+  char          c
+)
+{
+  return ( p < e ) ? memchr(p, c, e - p) : NULL;
+}
+
+//
+
+time_t
+lmstat_parse_expiry(
+  const char    *s,
+  size_t        len
+)
+{
+  static const char *months = "janfebmaraprmayjunjulaugsepoctnovdec";
+  const char    *e = s + len;
+  const char    *p;
+  struct tm     expire_conv;
+  int           day, month, year;
+  char          mon[3];
+
+  if ( (p = __lmstat_match_ci(s, e, "permanent")) && (p == e) ) return lmfeature_no_expiration;
+
+  if ( ! (p = __lmstat_parse_int(s, e, &day)) || (p >= e) || (*p != '-') ) return lmfeature_no_expiration;
+  p++;
+  if ( e - p < 4 ) return lmfeature_no_expiration;
+  mon[0] = __lmstat_lower(p[0]); mon[1] = __lmstat_lower(p[1]); mon[2] = __lmstat_lower(p[2]);
+  for ( month = 0; month < 12; month++ ) if ( memcmp(months + 3 * month, mon, 3) == 0 ) break;
+  if ( (month == 12) || (p[3] != '-') ) return lmfeature_no_expiration;
+  p += 4;
+  if ( ! (p = __lmstat_parse_int(p, e, &year)) ) return lmfeature_no_expiration;
+
+  // A year that's all zeroes => permanent
+  if ( year == 0 ) return lmfeature_no_expiration;
+
+  memset(&expire_conv, 0, sizeof(expire_conv));
+  expire_conv.tm_mday = day;
+  expire_conv.tm_mon = month;
+  expire_conv.tm_year = year - 1900;
+  expire_conv.tm_isdst = -1;
+  return mktime(&expire_conv);
+}
+
+//
+
+time_t
+lmstat_parse_start_time(
+  const char    *s,
+  size_t        len,
+  time_t        reference
+)
+{
+  const char    *e = s + len;
+  const char    *p = s;
+  struct tm     start_conv, ref_conv;
+  int           month, day, hour, minute;
+  time_t        start_ts;
+
+  // Skip the day of the week:
+  while ( (p < e) && ! __lmstat_is_space(*p) ) p++;
+  p = __lmstat_skip_space(p, e);
+
+  if ( ! (p = __lmstat_parse_int(p, e, &month)) || (p >= e) || (*p != '/') ) return -1;
+  if ( ! (p = __lmstat_parse_int(p + 1, e, &day)) ) return -1;
+  p = __lmstat_skip_space(p, e);
+  if ( ! (p = __lmstat_parse_int(p, e, &hour)) || (p >= e) || (*p != ':') ) return -1;
+  if ( ! (p = __lmstat_parse_int(p + 1, e, &minute)) ) return -1;
+  if ( (month < 1) || (month > 12) || (day < 1) || (day > 31) || (hour > 23) || (minute > 59) ) return -1;
+
+  localtime_r(&reference, &ref_conv);
+  memset(&start_conv, 0, sizeof(start_conv));
+  start_conv.tm_year = ref_conv.tm_year;
+  start_conv.tm_mon = month - 1;
+  start_conv.tm_mday = day;
+  start_conv.tm_hour = hour;
+  start_conv.tm_min = minute;
+  start_conv.tm_isdst = -1;
+  start_ts = mktime(&start_conv);
+
+  //
+  // A checkout in December seen in January started last year:
+  //
+  if ( start_ts > reference + 24 * 60 * 60 ) {
+    memset(&start_conv, 0, sizeof(start_conv));
+    start_conv.tm_year = ref_conv.tm_year - 1;
+    start_conv.tm_mon = month - 1;
+    start_conv.tm_mday = day;
+    start_conv.tm_hour = hour;
+    start_conv.tm_min = minute;
+    start_conv.tm_isdst = -1;
+    start_ts = mktime(&start_conv);
+  }
+  return start_ts;
+}
+
+//
+
+bool
+__lmstat_parser_set_names(
+  lmstat_parser *the_parser,
+  lmstat_field  feature,
+  lmstat_field  vendor,
+  lmstat_field  version
+)
+{
+  size_t        need = feature.len + vendor.len + version.len;
+
+  if ( need > the_parser->names_capacity ) {
+    size_t      new_capacity = the_parser->names_capacity ? the_parser->names_capacity : 64;
+    bool        is_feature_in_names = the_parser->names && (feature.ptr >= the_parser->names) && (feature.ptr < the_parser->names + the_parser->names_capacity);
+    size_t      feature_offset = is_feature_in_names ? (feature.ptr - the_parser->names) : 0;
+    char        *p;
+
+    while ( new_capacity < need ) new_capacity *= 2;
+    if ( ! (p = realloc(the_parser->names, new_capacity)) ) return false;
+    the_parser->names = p;
+    the_parser->names_capacity = new_capacity;
+    //
+    // The realloc may have moved (and freed) the block the feature
+    // pointed into:
+    //
+    if ( is_feature_in_names ) feature.ptr = p + feature_offset;
+  }
+  //
+  // The feature may already live in the buffer (from the usage line), so
+  // move it before copying the others after it:
+  //
+  if ( feature.len ) memmove(the_parser->names, feature.ptr, feature.len);
+  if ( vendor.len ) memcpy(the_parser->names + feature.len, vendor.ptr, vendor.len);
+  if ( version.len ) memcpy(the_parser->names + feature.len + vendor.len, version.ptr, version.len);
+  the_parser->feature.ptr = the_parser->names;
+  the_parser->feature.len = feature.len;
+  the_parser->vendor.ptr = the_parser->names + feature.len;
+  the_parser->vendor.len = vendor.len;
+  the_parser->version.ptr = the_parser->names + feature.len + vendor.len;
+  the_parser->version.len = version.len;
+  return true;
+}
+
+//
+
+/*
+ * Users of <feature>:  (Total of <N> license(s) issued;  Total of <M> license(s) in use)
+ *
+ * p points just past the "Users of " prefix.
+ */
+bool
+__lmstat_parser_usage_line(
+  lmstat_parser *the_parser,
+  const char    *p,
+  const char    *e
+)
+{
+  lmstat_usage_record record;
+  const char          *colon = __lmstat_memchr(p, e, ':');
+  lmstat_field        none = { NULL, 0 };
+
+  //
+  // Anything unparseable (e.g. "Uncounted" or error text) means there
+  // is no current feature:
+  //
+  the_parser->state = lmstat_parser_state_idle;
+  if ( ! colon ) return true;
+  record.feature.ptr = p;
+  record.feature.len = colon - p;
+  if ( ! (p = __lmstat_find_ci(colon + 1, e, "total of")) ) return true;
+  if ( ! (p = __lmstat_parse_int(__lmstat_skip_space(p, e), e, &record.issued)) ) return true;
+  if ( ! (p = __lmstat_match_ci(__lmstat_skip_space(p, e), e, "license")) ) return true;
+  if ( ! (p = __lmstat_find_ci(p, e, "issued")) ) return true;
+  if ( ! (p = __lmstat_find_ci(p, e, "total of")) ) return true;
+  if ( ! (p = __lmstat_parse_int(__lmstat_skip_space(p, e), e, &record.in_use)) ) return true;
+  if ( ! (p = __lmstat_match_ci(__lmstat_skip_space(p, e), e, "license")) ) return true;
+  if ( ! __lmstat_find_ci(p, e, "in use") ) return true;
+
+  if ( ! __lmstat_parser_set_names(the_parser, record.feature, none, none) ) {
+    lmlog(lmlog_level_error, "lmstat_parser:  unable to allocate feature name storage");
+    return true;
+  }
+  the_parser->issued = record.issued;
+  the_parser->in_use = record.in_use;
+  the_parser->state = lmstat_parser_state_usage;
+  return the_parser->callbacks.usage ? the_parser->callbacks.usage(the_parser->context, &record) : true;
+}
+
+//
+
+/*
+ * "<feature>" v<version>, vendor: <vendor>, expiry: <date>
+ *
+ * p points at the opening quote.
+ */
+bool
+__lmstat_parser_vendor_line(
+  lmstat_parser *the_parser,
+  const char    *p,
+  const char    *e
+)
+{
+  lmstat_vendor_record  record;
+  const char            *q;
+
+  if ( the_parser->state == lmstat_parser_state_idle ) return true;
+  the_parser->state = lmstat_parser_state_usage;
+
+  p++;
+  if ( ! (q = __lmstat_memchr(p, e, '"')) ) return true;
+  record.feature.ptr = p;
+  record.feature.len = q - p;
+  if ( (record.feature.len != the_parser->feature.len) || memcmp(record.feature.ptr, the_parser->feature.ptr, record.feature.len) ) return true;
+
+  p = __lmstat_skip_space(q + 1, e);
+  if ( (p >= e) || ((*p != 'v') && (*p != 'V')) ) return true;
+  p++;
+  if ( ! (q = __lmstat_memchr(p, e, ',')) || (q == p) ) return true;
+  record.version.ptr = p;
+  record.version.len = q - p;
+
+  if ( ! (p = __lmstat_match_ci(__lmstat_skip_space(q + 1, e), e, "vendor:")) ) return true;
+  p = __lmstat_skip_space(p, e);
+  if ( ! (q = __lmstat_memchr(p, e, ',')) || (q == p) ) return true;
+  record.vendor.ptr = p;
+  record.vendor.len = q - p;
+
+  if ( ! (p = __lmstat_match_ci(__lmstat_skip_space(q + 1, e), e, "expiry:")) ) return true;
+  p = __lmstat_skip_space(p, e);
+  q = p;
+  while ( (q < e) && ! __lmstat_is_space(*q) && (*q != ',') ) q++;
+  if ( q == p ) return true;
+  record.expiry.ptr = p;
+  record.expiry.len = q - p;
+  record.expiration_date = lmstat_parse_expiry(p, q - p);
+  record.issued = the_parser->issued;
+  record.in_use = the_parser->in_use;
+
+  if ( ! __lmstat_parser_set_names(the_parser, the_parser->feature, record.vendor, record.version) ) {
+    lmlog(lmlog_level_error, "lmstat_parser:  unable to allocate feature name storage");
+    return true;
+  }
+  the_parser->state = lmstat_parser_state_vendor;
+  return the_parser->callbacks.vendor ? the_parser->callbacks.vendor(the_parser->context, &record) : true;
+}
+
+//
+
+/*
+ * <user> <host> {<display>} (v<version>) (<server>/<port> <handle>), start <day> <m>/<d> <H>:<MM>{, <n> licenses}
+ *
+ * p points at the first non-whitespace character.
+ */
+bool
+__lmstat_parser_user_line(
+  lmstat_parser *the_parser,
+  const char    *p,
+  const char    *e
+)
+{
+  lmstat_user_record    record;
+  const char            *paren, *q;
+
+  //
+  // The "(v" that opens the checkout version is the anchor for the rest
+  // of the line:
+  //
+  paren = p;
+  while ( (paren = __lmstat_memchr(paren + 1, e, '(')) ) {
+    if ( (paren + 1 < e) && (paren[1] == 'v') && __lmstat_is_space(paren[-1]) ) break;
+  }
+  if ( ! paren ) return true;
+  paren--;
+
+  memset(&record, 0, sizeof(record));
+  record.feature = the_parser->feature;
+  record.vendor = the_parser->vendor;
+  record.version = the_parser->version;
+  record.license_count = 1;
+
+  q = p;
+  while ( (q < paren) && ! __lmstat_is_space(*q) ) q++;
+  record.user.ptr = p;
+  record.user.len = q - p;
+  p = __lmstat_skip_space(q, paren);
+  q = p;
+  while ( (q < paren) && ! __lmstat_is_space(*q) ) q++;
+  if ( q == p ) return true;
+  record.host.ptr = p;
+  record.host.len = q - p;
+  p = __lmstat_skip_space(q, paren);
+  record.display.ptr = p;
+  record.display.len = paren - p;
+
+  p = paren + 3;
+  if ( ! (q = __lmstat_memchr(p, e, ')')) ) return true;
+  record.checkout_version.ptr = p;
+  record.checkout_version.len = q - p;
+
+  p = __lmstat_skip_space(q + 1, e);
+  if ( (p >= e) || (*p != '(') ) return true;
+  p++;
+  if ( ! (q = __lmstat_memchr(p, e, ')')) ) return true;
+  {
+    const char  *slash = __lmstat_memchr(p, q, '/');
+    const char  *space;
+
+    if ( ! slash || ! (space = __lmstat_memchr(slash, q, ' ')) ) return true;
+    record.server_host.ptr = p;
+    record.server_host.len = slash - p;
+    record.server_port.ptr = slash + 1;
+    record.server_port.len = space - (slash + 1);
+    p = __lmstat_skip_space(space, q);
+    record.handle.ptr = p;
+    record.handle.len = q - p;
+  }
+
+  //
+  // The handle is followed by ", start <when>":
+  //
+  p = __lmstat_skip_space(q + 1, e);
+  if ( (p < e) && (*p == ',') ) p = __lmstat_skip_space(p + 1, e);
+  if ( ! (p = __lmstat_match_ci(p, e, "start")) ) return true;
+  p = __lmstat_skip_space(p, e);
+  q = p;
+  while ( (q < e) && (*q != ',') && (*q != '(') ) q++;
+  record.start.ptr = p;
+  record.start.len = q - p;
+  while ( record.start.len && __lmstat_is_space(record.start.ptr[record.start.len - 1]) ) record.start.len--;
+
+  if ( (q < e) && (*q == ',') ) {
+    int         count;
+
+    p = __lmstat_skip_space(q + 1, e);
+    if ( (p = __lmstat_parse_int(p, e, &count)) && __lmstat_match_ci(__lmstat_skip_space(p, e), e, "license") ) {
+      record.license_count = count;
+    }
+  }
+  return the_parser->callbacks.user ? the_parser->callbacks.user(the_parser->context, &record) : true;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+lmstat_parser_ref
+lmstat_parser_create(
+  const lmstat_parser_callbacks *callbacks,
+  void                          *context
+)
+{
+  lmstat_parser     *new_parser = malloc(sizeof(lmstat_parser));
+
+  if ( new_parser ) {
+    memset(new_parser, 0, sizeof(lmstat_parser));
+    if ( callbacks ) new_parser->callbacks = *callbacks;
+    new_parser->context = context;
+    new_parser->state = lmstat_parser_state_idle;
+  }
+  return (lmstat_parser_ref)new_parser;
+}
+
+//
+
+void
+lmstat_parser_release(
+  lmstat_parser_ref the_parser
+)
+{
+  if ( the_parser->names ) free((void*)the_parser->names);
+  free((void*)the_parser);
+}
+
+//
+
+void
+lmstat_parser_reset(
+  lmstat_parser_ref the_parser
+)
+{
+  ((lmstat_parser*)the_parser)->state = lmstat_parser_state_idle;
+}
+
+//
+
+bool
+lmstat_parser_push_line(
+  lmstat_parser_ref the_parser,
+  const char        *line,
+  size_t            line_len
+)
+{
+  lmstat_parser     *THE_PARSER = (lmstat_parser*)the_parser;
+  const char        *e = line + line_len;
+  const char        *p;
+  bool              rc = true;
+
+  if ( THE_PARSER->state == lmstat_parser_state_stopped ) return false;
+
+  while ( (e > line) && ((e[-1] == '\n') || (e[-1] == '\r')) ) e--;
+  p = __lmstat_skip_space(line, e);
+  if ( p == e ) return true;
+
+  //
+  // Classify the line by its first non-blank character; only the per-user
+  // lines (by far the most numerous) need any searching:
+  //
+  switch ( *p ) {
+
+    case 'U':
+    case 'u': {
+      const char    *q = __lmstat_match_ci(p, e, "users of ");
+
+      if ( q ) {
+        rc = __lmstat_parser_usage_line(THE_PARSER, q, e);
+        break;
+      }
+      // Could be a user name starting with U:
+      if ( (THE_PARSER->state == lmstat_parser_state_vendor) && THE_PARSER->callbacks.user ) rc = __lmstat_parser_user_line(THE_PARSER, p, e);
+      break;
+    }
+
+    case '"':
+      rc = __lmstat_parser_vendor_line(THE_PARSER, p, e);
+      break;
+
+    default:
+      if ( (THE_PARSER->state == lmstat_parser_state_vendor) && THE_PARSER->callbacks.user ) rc = __lmstat_parser_user_line(THE_PARSER, p, e);
+      break;
+
+  }
+  if ( ! rc ) THE_PARSER->state = lmstat_parser_state_stopped;
+  return rc;
+}
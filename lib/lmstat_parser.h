@@ -0,0 +1,170 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmstat_parser.h
+ *
+ * Push-style parser for the output of "lmstat -a".  Lines are fed to the
+ * parser one at a time and callbacks are made for each usage summary,
+ * feature/vendor line, and per-user checkout line that is recognized.
+ *
+ */
+
+#ifndef __LMSTAT_PARSER_H__
+#define __LMSTAT_PARSER_H__
+
+#include "config.h"
+
+/*!
+  @typedef lmstat_field
+  A field extracted by the parser:  a pointer to the first character and
+  the number of characters.  Fields are NOT NUL-terminated and (unless
+  otherwise noted) point into the line that was passed to the parser, so
+  they are only valid for the duration of the callback.  An absent field
+  has a NULL ptr and a len of zero.
+*/
+typedef struct {
+  const char    *ptr;
+  size_t        len;
+} lmstat_field;
+
+/*!
+  @function lmstat_field_is_equal
+  Returns true if field f contains exactly the C string s.
+*/
+static inline bool lmstat_field_is_equal(lmstat_field f, const char *s)
+{
+  return ( f.ptr && (strncmp(f.ptr, s, f.len) == 0) && (s[f.len] == '\0') ) ? true : false;
+}
+
+/*!
+  @function lmstat_field_strdup
+  Returns a malloc()'d, NUL-terminated copy of field f.  The caller is
+  responsible for free'ing the returned pointer.
+*/
+char* lmstat_field_strdup(lmstat_field f);
+
+/*!
+  @typedef lmstat_usage_record
+  Produced for each "Users of <feature>:  (Total of N licenses issued;
+  Total of M licenses in use)" line.
+*/
+typedef struct {
+  lmstat_field  feature;
+  int           issued;
+  int           in_use;
+} lmstat_usage_record;
+
+/*!
+  @typedef lmstat_vendor_record
+  Produced for each '"<feature>" v<version>, vendor: <vendor>, expiry: <date>'
+  line that follows a usage line for the same feature.  The issued and
+  in_use counts are carried over from that usage line; expiration_date is
+  lmfeature_no_expiration for permanent licenses.
+*/
+typedef struct {
+  lmstat_field  feature;
+  lmstat_field  version;
+  lmstat_field  vendor;
+  lmstat_field  expiry;
+  time_t        expiration_date;
+  int           issued;
+  int           in_use;
+} lmstat_vendor_record;
+
+/*!
+  @typedef lmstat_user_record
+  Produced for each per-user checkout line that follows a vendor line:
+
+    <user> <host> <display> (v<version>) (<server>/<port> <handle>), start <day> <m>/<d> <H>:<MM>{, <n> licenses}
+
+  The feature, vendor, and version fields refer to the vendor line the
+  checkout appeared under; they point into storage owned by the parser and
+  remain valid until the next vendor line is parsed.  The start field is
+  the unparsed "<day> <m>/<d> <H>:<MM>" text.  The display field may be
+  empty.
+*/
+typedef struct {
+  lmstat_field  feature;
+  lmstat_field  vendor;
+  lmstat_field  version;
+  lmstat_field  user;
+  lmstat_field  host;
+  lmstat_field  display;
+  lmstat_field  checkout_version;
+  lmstat_field  server_host;
+  lmstat_field  server_port;
+  lmstat_field  handle;
+  lmstat_field  start;
+  int           license_count;
+} lmstat_user_record;
+
+/*!
+  @typedef lmstat_parser_callbacks
+  The functions the parser calls as records are recognized.  Any may be
+  NULL.  Returning false from a callback stops the parser:  subsequent
+  calls to lmstat_parser_push_line() return false without doing anything.
+*/
+typedef struct {
+  bool  (*usage)(void *context, const lmstat_usage_record *record);
+  bool  (*vendor)(void *context, const lmstat_vendor_record *record);
+  bool  (*user)(void *context, const lmstat_user_record *record);
+} lmstat_parser_callbacks;
+
+/*!
+  @typedef lmstat_parser_ref
+  Type of an opaque reference to an lmstat parser.
+*/
+typedef const struct _lmstat_parser * lmstat_parser_ref;
+
+/*!
+  @function lmstat_parser_create
+  Create a new parser that will make the given callbacks (which are
+  copied) with context as their first argument.
+
+  Returns NULL in case of any error.
+*/
+lmstat_parser_ref lmstat_parser_create(const lmstat_parser_callbacks *callbacks, void *context);
+
+/*!
+  @function lmstat_parser_release
+  Dispose of the_parser.
+*/
+void lmstat_parser_release(lmstat_parser_ref the_parser);
+
+/*!
+  @function lmstat_parser_reset
+  Return the_parser to its initial state (e.g. before parsing the output
+  of another lmstat invocation).
+*/
+void lmstat_parser_reset(lmstat_parser_ref the_parser);
+
+/*!
+  @function lmstat_parser_push_line
+  Parse the line of line_len characters at line.  The line need not be
+  NUL-terminated; trailing CR/NL characters are ignored.
+
+  Returns false if a callback requested that parsing stop.
+*/
+bool lmstat_parser_push_line(lmstat_parser_ref the_parser, const char *line, size_t line_len);
+
+/*!
+  @function lmstat_parse_expiry
+  Convert an lmstat/FLEXlm expiry date ("dd-mmm-yyyy" or "permanent") of
+  len characters at s to a Unix timestamp (local midnight).  A year of all
+  zeroes is taken to mean permanent, in which case lmfeature_no_expiration
+  is returned; lmfeature_no_expiration is also returned if the date
+  cannot be parsed.
+*/
+time_t lmstat_parse_expiry(const char *s, size_t len);
+
+/*!
+  @function lmstat_parse_start_time
+  Convert the start field of a checkout ("<day> <m>/<d> <H>:<MM>", which
+  lacks a year) of len characters at s to a Unix timestamp.  The year is
+  chosen so that the result is not more than a day after reference (the
+  time at which the lmstat output was produced).
+
+  Returns -1 if the time cannot be parsed.
+*/
+time_t lmstat_parse_start_time(const char *s, size_t len, time_t reference);
+
+#endif /* __LMSTAT_PARSER_H__ */
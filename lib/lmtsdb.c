@@ -0,0 +1,1046 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmtsdb.c
+ *
+ * Embedded multi-resolution time-series store for feature counts
+ *
+ */
+
+#include "lmtsdb.h"
+#include "lmlog.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//
+
+/*
+ * The store is a single file:  a header page followed by one fixed-size
+ * slot per feature.  A slot starts with two copies of the feature's state
+ * (the newest interval and running sums at each level); the copy named by
+ * the active field is current and the other is where updates are staged.
+ * After the header come two copies of the rings, one for each state copy;
+ * each has one pair of columns (in_use, issued) of doubles per level, the
+ * interval numbered b held in row b % row_count.
+ *
+ * Updates write only the staged state and its rings; lmtsdb_sync() writes
+ * them out, then flips active and counts any new slots in the file header,
+ * and writes those out.  Each state copy carries a generation and a
+ * checksum, so readers never act on a copy that is being rewritten, and
+ * a reader rechecks the generation after copying points out of the rings.
+ *
+ * The two copies of the rings differ only in the rows the active copy's
+ * last round of updates wrote:  from the newest interval of the inactive
+ * state (or the first interval, if it holds no samples) through the newest
+ * interval of the active state.  Staging copies those rows across before
+ * any are written; a discard or a recovered crash copies back the rows
+ * the abandoned round wrote.
+ *
+ * Everything is stored in host byte order.
+ */
+
+#define LMTSDB_MAGIC              "LMTSDB\r\n"
+#define LMTSDB_VERSION            2
+#define LMTSDB_STEP               300
+#define LMTSDB_PAGE_SIZE          4096
+#define LMTSDB_SLOT_DATA_OFFSET   512
+#define LMTSDB_MIN_CAPACITY       16
+#define LMTSDB_READ_RETRIES       8
+
+static const struct {
+  unsigned int    steps_per_row, row_count;
+} __lmtsdb_levels[lmtsdb_level_max] = {
+    {    1, 5184 },   /* 18 days @ 5 minutes */
+    {   12, 1440 },   /* 60 days @ 1 hour */
+    {  144, 1800 },   /* 900 days @ 12 hours */
+    {  288, 1080 },   /* 1080 days @ 24 hours */
+    { 2016,  730 }    /* 14 years @ 7 days */
+  };
+
+typedef struct {
+  char                magic[8];
+  uint32_t            version;
+  uint32_t            step;
+  uint32_t            level_count;
+  uint32_t            slot_count;
+  uint64_t            slot_size;
+  uint32_t            steps_per_row[lmtsdb_level_max];
+  uint32_t            row_count[lmtsdb_level_max];
+} lmtsdb_file_header;
+
+typedef struct {
+  int64_t             bucket;           /* newest interval written */
+  int64_t             first_bucket;     /* oldest interval written */
+  double              in_use_sum, issued_sum;
+  int64_t             sample_count;     /* samples in the newest interval */
+} lmtsdb_level_state;
+
+typedef struct {
+  uint64_t            generation;       /* zero until the first sample */
+  int64_t             last_update;
+  lmtsdb_level_state  levels[lmtsdb_level_max];
+  uint64_t            checksum;
+} lmtsdb_slot_state;
+
+typedef struct {
+  int32_t             feature_id;
+  uint32_t            active;
+  lmtsdb_slot_state   state[2];
+} lmtsdb_slot_header;
+
+typedef struct _lmtsdb {
+  char                *path;
+  int                 fd;
+  bool                is_read_only;
+  //
+  void                *base;
+  size_t              map_size;
+  unsigned int        slot_capacity;
+  unsigned int        slot_count;
+  //
+  unsigned int        index_capacity;
+  unsigned int        *index;           /* slot + 1 by feature id, open addressing */
+  //
+  bool                *is_staged;
+  unsigned int        *staged;
+  unsigned int        staged_count;
+} lmtsdb;
+
+//
+
+static size_t           __lmtsdb_slot_size = 0;
+static size_t           __lmtsdb_rings_size = 0;
+static size_t           __lmtsdb_column_offset[lmtsdb_level_max];
+
+void
+__lmtsdb_init_layout(void)
+{
+  if ( ! __lmtsdb_slot_size ) {
+    size_t        offset = 0;
+    unsigned int  level = 0;
+
+    while ( level < lmtsdb_level_max ) {
+      __lmtsdb_column_offset[level] = offset;
+      offset += 2 * __lmtsdb_levels[level].row_count * sizeof(double);
+      level++;
+    }
+    __lmtsdb_rings_size = offset;
+    offset = LMTSDB_SLOT_DATA_OFFSET + 2 * __lmtsdb_rings_size;
+    __lmtsdb_slot_size = (offset + LMTSDB_PAGE_SIZE - 1) / LMTSDB_PAGE_SIZE * LMTSDB_PAGE_SIZE;
+  }
+}
+
+//
+
+unsigned int
+lmtsdb_level_get_step(
+  lmtsdb_level    level
+)
+{
+  return ( level < lmtsdb_level_max ) ? LMTSDB_STEP * __lmtsdb_levels[level].steps_per_row : 0;
+}
+
+//
+
+unsigned int
+lmtsdb_level_get_row_count(
+  lmtsdb_level    level
+)
+{
+  return ( level < lmtsdb_level_max ) ? __lmtsdb_levels[level].row_count : 0;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+uint64_t
+__lmtsdb_state_checksum(
+  const lmtsdb_slot_state   *state
+)
+{
+  const unsigned char       *p = (const unsigned char*)state;
+  const unsigned char       *p_end = (const unsigned char*)&state->checksum;
+  uint64_t                  hash = 0xcbf29ce484222325ULL;
+
+  // FNV-1a over everything ahead of the checksum:
+  while ( p < p_end ) {
+    hash ^= *p++;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+//
+
+static inline lmtsdb_file_header*
+__lmtsdb_header(
+  lmtsdb          *the_tsdb
+)
+{
+  return (lmtsdb_file_header*)the_tsdb->base;
+}
+
+static inline lmtsdb_slot_header*
+__lmtsdb_slot(
+  lmtsdb          *the_tsdb,
+  unsigned int    slot
+)
+{
+  return (lmtsdb_slot_header*)((char*)the_tsdb->base + LMTSDB_PAGE_SIZE + (size_t)slot * __lmtsdb_slot_size);
+}
+
+static inline double*
+__lmtsdb_column(
+  lmtsdb          *the_tsdb,
+  unsigned int    slot,
+  unsigned int    copy,
+  lmtsdb_level    level,
+  bool            is_issued
+)
+{
+  double          *column = (double*)((char*)__lmtsdb_slot(the_tsdb, slot) + LMTSDB_SLOT_DATA_OFFSET + copy * __lmtsdb_rings_size + __lmtsdb_column_offset[level]);
+
+  return is_issued ? column + __lmtsdb_levels[level].row_count : column;
+}
+
+static inline int64_t
+__lmtsdb_bucket(
+  time_t          timestamp,
+  unsigned int    width
+)
+{
+  return ( timestamp < 0 ) ? -1 : (int64_t)timestamp / width;
+}
+
+//
+
+/*
+ * Copy the current state of a slot and, if copy is not NULL, set *copy
+ * to the state copy (and so the rings) it came from.  A writer sees its
+ * own staged state; a reader retries while the copy it reads is being
+ * rewritten.  Returns false if no intact copy could be read.
+ */
+bool
+__lmtsdb_get_state(
+  lmtsdb              *the_tsdb,
+  unsigned int        slot,
+  lmtsdb_slot_state   *state,
+  unsigned int        *copy
+)
+{
+  lmtsdb_slot_header  *header = __lmtsdb_slot(the_tsdb, slot);
+  unsigned int        retries = LMTSDB_READ_RETRIES;
+
+  if ( ! the_tsdb->is_read_only ) {
+    unsigned int      current = the_tsdb->is_staged[slot] ? 1 - header->active : header->active;
+
+    *state = header->state[current];
+    if ( copy ) *copy = current;
+    return true;
+  }
+  while ( retries-- ) {
+    uint32_t          active = *(volatile uint32_t*)&header->active & 1;
+
+    __sync_synchronize();
+    *state = header->state[active];
+    __sync_synchronize();
+    if ( state->checksum == __lmtsdb_state_checksum(state) ) {
+      if ( copy ) *copy = active;
+      return true;
+    }
+  }
+  return false;
+}
+
+//
+
+/*
+ * Make row_count rows of each column of one level of the to_copy rings,
+ * starting with row first_row and wrapping around, match the other copy.
+ * Rows that already match are not written.
+ */
+void
+__lmtsdb_copy_rows(
+  lmtsdb              *the_tsdb,
+  unsigned int        slot,
+  unsigned int        to_copy,
+  lmtsdb_level        level,
+  unsigned int        first_row,
+  unsigned int        row_count
+)
+{
+  unsigned int        ring_rows = __lmtsdb_levels[level].row_count;
+  int                 is_issued = 0;
+
+  while ( is_issued < 2 ) {
+    const double      *src = __lmtsdb_column(the_tsdb, slot, 1 - to_copy, level, is_issued);
+    double            *dst = __lmtsdb_column(the_tsdb, slot, to_copy, level, is_issued);
+    unsigned int      i = 0, row = first_row % ring_rows;
+
+    while ( i++ < row_count ) {
+      if ( memcmp(&dst[row], &src[row], sizeof(double)) ) dst[row] = src[row];
+      if ( ++row == ring_rows ) row = 0;
+    }
+    is_issued++;
+  }
+}
+
+//
+
+/*
+ * Make the to_copy rings match the other copy in the rows written from
+ * interval first_bucket through interval last_bucket at each level, or
+ * in every row if first_bucket is NULL.
+ */
+void
+__lmtsdb_copy_rounds(
+  lmtsdb              *the_tsdb,
+  unsigned int        slot,
+  unsigned int        to_copy,
+  const int64_t       first_bucket[lmtsdb_level_max],
+  const int64_t       last_bucket[lmtsdb_level_max]
+)
+{
+  unsigned int        level = 0;
+
+  while ( level < lmtsdb_level_max ) {
+    unsigned int      ring_rows = __lmtsdb_levels[level].row_count;
+
+    if ( ! first_bucket || (last_bucket[level] - first_bucket[level] + 1 >= ring_rows) ) {
+      __lmtsdb_copy_rows(the_tsdb, slot, to_copy, level, 0, ring_rows);
+    } else if ( last_bucket[level] >= first_bucket[level] ) {
+      __lmtsdb_copy_rows(the_tsdb, slot, to_copy, level, (unsigned int)(first_bucket[level] % ring_rows), (unsigned int)(last_bucket[level] - first_bucket[level] + 1));
+    }
+    level++;
+  }
+}
+
+//
+
+/*
+ * The rows a round of updates wrote, from the state it started from
+ * (prior) to the state it produced (newer).
+ */
+void
+__lmtsdb_get_round(
+  const lmtsdb_slot_state   *prior,
+  const lmtsdb_slot_state   *newer,
+  int64_t                   first_bucket[lmtsdb_level_max],
+  int64_t                   last_bucket[lmtsdb_level_max]
+)
+{
+  unsigned int              level = 0;
+
+  while ( level < lmtsdb_level_max ) {
+    if ( ! newer->last_update ) {
+      first_bucket[level] = 0;
+      last_bucket[level] = -1;
+    } else {
+      first_bucket[level] = prior->last_update ? prior->levels[level].bucket : newer->levels[level].first_bucket;
+      last_bucket[level] = newer->levels[level].bucket;
+    }
+    level++;
+  }
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+bool
+__lmtsdb_index_add(
+  lmtsdb          *the_tsdb,
+  int             feature_id,
+  unsigned int    slot
+)
+{
+  unsigned int    i;
+
+  if ( 2 * (the_tsdb->slot_count + 1) > the_tsdb->index_capacity ) {
+    unsigned int  new_capacity = the_tsdb->index_capacity ? 2 * the_tsdb->index_capacity : 2 * LMTSDB_MIN_CAPACITY;
+    unsigned int  *new_index = calloc(new_capacity, sizeof(unsigned int));
+
+    if ( ! new_index ) return false;
+    for ( i = 0; i < the_tsdb->index_capacity; i++ ) {
+      if ( the_tsdb->index[i] ) {
+        unsigned int  j = (unsigned int)__lmtsdb_slot(the_tsdb, the_tsdb->index[i] - 1)->feature_id & (new_capacity - 1);
+
+        while ( new_index[j] ) j = (j + 1) & (new_capacity - 1);
+        new_index[j] = the_tsdb->index[i];
+      }
+    }
+    if ( the_tsdb->index ) free((void*)the_tsdb->index);
+    the_tsdb->index = new_index;
+    the_tsdb->index_capacity = new_capacity;
+  }
+  i = (unsigned int)feature_id & (the_tsdb->index_capacity - 1);
+  while ( the_tsdb->index[i] ) i = (i + 1) & (the_tsdb->index_capacity - 1);
+  the_tsdb->index[i] = slot + 1;
+  return true;
+}
+
+//
+
+void
+__lmtsdb_index_remove(
+  lmtsdb          *the_tsdb,
+  unsigned int    slot
+)
+{
+  unsigned int    i = (unsigned int)__lmtsdb_slot(the_tsdb, slot)->feature_id & (the_tsdb->index_capacity - 1);
+  unsigned int    j;
+
+  while ( the_tsdb->index[i] && (the_tsdb->index[i] != slot + 1) ) i = (i + 1) & (the_tsdb->index_capacity - 1);
+  if ( ! the_tsdb->index[i] ) return;
+
+  // Close the gap so that no probe sequence is cut short:
+  the_tsdb->index[i] = 0;
+  j = i;
+  while ( the_tsdb->index[j = (j + 1) & (the_tsdb->index_capacity - 1)] ) {
+    unsigned int  k = (unsigned int)__lmtsdb_slot(the_tsdb, the_tsdb->index[j] - 1)->feature_id & (the_tsdb->index_capacity - 1);
+
+    if ( (i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)) ) continue;
+    the_tsdb->index[i] = the_tsdb->index[j];
+    the_tsdb->index[j] = 0;
+    i = j;
+  }
+}
+
+//
+
+bool
+__lmtsdb_map(
+  lmtsdb          *the_tsdb,
+  size_t          map_size
+)
+{
+  void            *base;
+
+  if ( the_tsdb->base ) {
+    munmap(the_tsdb->base, the_tsdb->map_size);
+    the_tsdb->base = NULL;
+  }
+  base = mmap(NULL, map_size, the_tsdb->is_read_only ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, the_tsdb->fd, 0);
+  if ( base == MAP_FAILED ) {
+    lmlogf(lmlog_level_error, "unable to map time-series store %s: %s", the_tsdb->path, strerror(errno));
+    return false;
+  }
+  the_tsdb->base = base;
+  the_tsdb->map_size = map_size;
+  the_tsdb->slot_capacity = (unsigned int)((map_size - LMTSDB_PAGE_SIZE) / __lmtsdb_slot_size);
+  return true;
+}
+
+//
+
+/*
+ * Index the slots other processes have added since this one last looked,
+ * remapping the file if it has grown.
+ */
+bool
+__lmtsdb_refresh(
+  lmtsdb          *the_tsdb
+)
+{
+  unsigned int    slot_count = *(volatile uint32_t*)&__lmtsdb_header(the_tsdb)->slot_count;
+
+  if ( slot_count > the_tsdb->slot_capacity ) {
+    struct stat   finfo;
+
+    if ( fstat(the_tsdb->fd, &finfo) != 0 ) return false;
+    if ( (size_t)finfo.st_size < LMTSDB_PAGE_SIZE + (size_t)slot_count * __lmtsdb_slot_size ) return false;
+    if ( ! __lmtsdb_map(the_tsdb, (size_t)finfo.st_size) ) return false;
+  }
+  while ( the_tsdb->slot_count < slot_count ) {
+    if ( ! __lmtsdb_index_add(the_tsdb, __lmtsdb_slot(the_tsdb, the_tsdb->slot_count)->feature_id, the_tsdb->slot_count) ) return false;
+    the_tsdb->slot_count++;
+  }
+  return true;
+}
+
+//
+
+/*
+ * Returns the slot of feature_id, or -1 if it has none.
+ */
+int
+__lmtsdb_lookup(
+  lmtsdb          *the_tsdb,
+  int             feature_id
+)
+{
+  int             pass = the_tsdb->is_read_only ? 2 : 1;
+
+  while ( pass-- ) {
+    if ( the_tsdb->index_capacity ) {
+      unsigned int  i = (unsigned int)feature_id & (the_tsdb->index_capacity - 1);
+
+      while ( the_tsdb->index[i] ) {
+        if ( __lmtsdb_slot(the_tsdb, the_tsdb->index[i] - 1)->feature_id == feature_id ) return the_tsdb->index[i] - 1;
+        i = (i + 1) & (the_tsdb->index_capacity - 1);
+      }
+    }
+    if ( pass && ! __lmtsdb_refresh(the_tsdb) ) break;
+  }
+  return -1;
+}
+
+//
+
+/*
+ * Writers check each slot's state when the store is opened:  if the
+ * active copy was torn by a crash the other copy is made active, and a
+ * slot with no intact copy starts over empty.  Unless the inactive copy
+ * is intact and no newer than the active one, a round of updates was
+ * cut short, so the inactive rings are made to match the active rings
+ * again in full.
+ */
+void
+__lmtsdb_recover_slot(
+  lmtsdb              *the_tsdb,
+  unsigned int        slot
+)
+{
+  lmtsdb_slot_header  *header = __lmtsdb_slot(the_tsdb, slot);
+  unsigned int        active = header->active & 1;
+  lmtsdb_slot_state   *other;
+
+  if ( header->state[active].checksum == __lmtsdb_state_checksum(&header->state[active]) ) {
+    header->active = active;
+  } else if ( header->state[1 - active].checksum == __lmtsdb_state_checksum(&header->state[1 - active]) ) {
+    lmlogf(lmlog_level_warn, "time-series store %s: reverted feature %d to its previous state", the_tsdb->path, header->feature_id);
+    header->active = active = 1 - active;
+  } else {
+    lmlogf(lmlog_level_warn, "time-series store %s: no intact state for feature %d, starting over", the_tsdb->path, header->feature_id);
+    memset(&header->state[0], 0, sizeof(lmtsdb_slot_state));
+    header->state[0].checksum = __lmtsdb_state_checksum(&header->state[0]);
+    header->active = active = 0;
+  }
+  other = &header->state[1 - active];
+  if ( (other->checksum != __lmtsdb_state_checksum(other)) || (other->generation > header->state[active].generation) ) {
+    LMDEBUG("time-series store %s: dropping unsynchronized updates to feature %d", the_tsdb->path, header->feature_id);
+    __lmtsdb_copy_rounds(the_tsdb, slot, 1 - active, NULL, NULL);
+
+    // The rows must be out before the state that vouches for them:
+    msync(header, __lmtsdb_slot_size, MS_SYNC);
+    *other = header->state[active];
+  }
+}
+
+//
+
+bool
+__lmtsdb_initialize(
+  lmtsdb              *the_tsdb
+)
+{
+  lmtsdb_file_header  *header;
+  unsigned int        level = 0;
+
+  if ( ftruncate(the_tsdb->fd, LMTSDB_PAGE_SIZE + LMTSDB_MIN_CAPACITY * __lmtsdb_slot_size) != 0 ) {
+    lmlogf(lmlog_level_error, "unable to size time-series store %s: %s", the_tsdb->path, strerror(errno));
+    return false;
+  }
+  if ( ! __lmtsdb_map(the_tsdb, LMTSDB_PAGE_SIZE + LMTSDB_MIN_CAPACITY * __lmtsdb_slot_size) ) return false;
+  header = __lmtsdb_header(the_tsdb);
+  header->version = LMTSDB_VERSION;
+  header->step = LMTSDB_STEP;
+  header->level_count = lmtsdb_level_max;
+  header->slot_count = 0;
+  header->slot_size = __lmtsdb_slot_size;
+  while ( level < lmtsdb_level_max ) {
+    header->steps_per_row[level] = __lmtsdb_levels[level].steps_per_row;
+    header->row_count[level] = __lmtsdb_levels[level].row_count;
+    level++;
+  }
+  if ( msync(the_tsdb->base, LMTSDB_PAGE_SIZE, MS_SYNC) != 0 ) return false;
+
+  // The magic goes last, once the rest of the header is on disk:
+  memcpy(header->magic, LMTSDB_MAGIC, sizeof(header->magic));
+  return ( msync(the_tsdb->base, LMTSDB_PAGE_SIZE, MS_SYNC) == 0 );
+}
+
+//
+
+bool
+__lmtsdb_validate(
+  lmtsdb              *the_tsdb,
+  size_t              file_size
+)
+{
+  lmtsdb_file_header  *header = __lmtsdb_header(the_tsdb);
+  unsigned int        level = 0;
+
+  if ( memcmp(header->magic, LMTSDB_MAGIC, sizeof(header->magic)) ) {
+    lmlogf(lmlog_level_error, "not a time-series store: %s", the_tsdb->path);
+    return false;
+  }
+  if ( (header->version != LMTSDB_VERSION) || (header->step != LMTSDB_STEP) || (header->level_count != lmtsdb_level_max) || (header->slot_size != __lmtsdb_slot_size) ) {
+    lmlogf(lmlog_level_error, "time-series store %s has an incompatible layout", the_tsdb->path);
+    return false;
+  }
+  while ( level < lmtsdb_level_max ) {
+    if ( (header->steps_per_row[level] != __lmtsdb_levels[level].steps_per_row) || (header->row_count[level] != __lmtsdb_levels[level].row_count) ) {
+      lmlogf(lmlog_level_error, "time-series store %s has an incompatible layout", the_tsdb->path);
+      return false;
+    }
+    level++;
+  }
+  if ( file_size < LMTSDB_PAGE_SIZE + (size_t)header->slot_count * __lmtsdb_slot_size ) {
+    lmlogf(lmlog_level_error, "time-series store %s is truncated", the_tsdb->path);
+    return false;
+  }
+  return true;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+lmtsdb_ref
+lmtsdb_open(
+  const char    *path,
+  bool          read_only
+)
+{
+  lmtsdb        *new_tsdb = malloc(sizeof(lmtsdb));
+  struct stat   finfo;
+
+  __lmtsdb_init_layout();
+  if ( ! new_tsdb ) return NULL;
+  memset(new_tsdb, 0, sizeof(lmtsdb));
+  new_tsdb->fd = -1;
+  new_tsdb->is_read_only = read_only;
+  if ( ! (new_tsdb->path = strdup(path)) ) goto exit_on_error;
+
+  if ( (new_tsdb->fd = open(path, read_only ? O_RDONLY : (O_RDWR | O_CREAT), 0644)) < 0 ) {
+    lmlogf(lmlog_level_error, "unable to open time-series store %s: %s", path, strerror(errno));
+    goto exit_on_error;
+  }
+  if ( ! read_only && (flock(new_tsdb->fd, LOCK_EX | LOCK_NB) != 0) ) {
+    lmlogf(lmlog_level_error, "time-series store %s is already open for writing", path);
+    goto exit_on_error;
+  }
+  if ( fstat(new_tsdb->fd, &finfo) != 0 ) goto exit_on_error;
+
+  if ( (finfo.st_size == 0) && ! read_only ) {
+    if ( ! __lmtsdb_initialize(new_tsdb) ) goto exit_on_error;
+    LMDEBUG("created time-series store %s", path);
+  } else {
+    if ( (size_t)finfo.st_size < LMTSDB_PAGE_SIZE + __lmtsdb_slot_size ) {
+      lmlogf(lmlog_level_error, "not a time-series store: %s", path);
+      goto exit_on_error;
+    }
+    if ( ! __lmtsdb_map(new_tsdb, (size_t)finfo.st_size) ) goto exit_on_error;
+    if ( ! __lmtsdb_validate(new_tsdb, (size_t)finfo.st_size) ) goto exit_on_error;
+  }
+  if ( ! read_only ) {
+    if ( ! (new_tsdb->is_staged = calloc(new_tsdb->slot_capacity, sizeof(bool))) ) goto exit_on_error;
+    if ( ! (new_tsdb->staged = malloc(new_tsdb->slot_capacity * sizeof(unsigned int))) ) goto exit_on_error;
+  }
+  if ( ! __lmtsdb_refresh(new_tsdb) ) goto exit_on_error;
+  if ( ! read_only ) {
+    unsigned int  slot = 0;
+
+    while ( slot < new_tsdb->slot_count ) __lmtsdb_recover_slot(new_tsdb, slot++);
+    if ( msync(new_tsdb->base, new_tsdb->map_size, MS_SYNC) != 0 ) goto exit_on_error;
+  }
+  return (lmtsdb_ref)new_tsdb;
+
+exit_on_error:
+  lmtsdb_close((lmtsdb_ref)new_tsdb);
+  return NULL;
+}
+
+//
+
+void
+lmtsdb_close(
+  lmtsdb_ref    the_tsdb
+)
+{
+  if ( the_tsdb->base && the_tsdb->is_staged ) lmtsdb_discard(the_tsdb);
+  if ( the_tsdb->base ) munmap(the_tsdb->base, the_tsdb->map_size);
+  if ( the_tsdb->fd >= 0 ) close(the_tsdb->fd);
+  if ( the_tsdb->index ) free((void*)the_tsdb->index);
+  if ( the_tsdb->is_staged ) free((void*)the_tsdb->is_staged);
+  if ( the_tsdb->staged ) free((void*)the_tsdb->staged);
+  if ( the_tsdb->path ) free((void*)the_tsdb->path);
+  free((void*)the_tsdb);
+}
+
+//
+
+const char*
+lmtsdb_get_path(
+  lmtsdb_ref    the_tsdb
+)
+{
+  return the_tsdb->path;
+}
+
+//
+
+bool
+lmtsdb_is_read_only(
+  lmtsdb_ref    the_tsdb
+)
+{
+  return the_tsdb->is_read_only;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+/*
+ * Add a slot for feature_id, growing the file (by doubling) if necessary.
+ * The slot is not counted in the file header until the next sync.
+ */
+int
+__lmtsdb_add_slot(
+  lmtsdb              *the_tsdb,
+  int                 feature_id
+)
+{
+  unsigned int        slot = the_tsdb->slot_count;
+  lmtsdb_slot_header  *header;
+
+  if ( slot == the_tsdb->slot_capacity ) {
+    unsigned int      new_capacity = 2 * the_tsdb->slot_capacity;
+    size_t            new_size = LMTSDB_PAGE_SIZE + (size_t)new_capacity * __lmtsdb_slot_size;
+    bool              *new_is_staged;
+    unsigned int      *new_staged;
+
+    if ( ftruncate(the_tsdb->fd, new_size) != 0 ) {
+      lmlogf(lmlog_level_error, "unable to grow time-series store %s: %s", the_tsdb->path, strerror(errno));
+      return -1;
+    }
+    if ( ! (new_is_staged = realloc(the_tsdb->is_staged, new_capacity * sizeof(bool))) ) return -1;
+    memset(new_is_staged + the_tsdb->slot_capacity, 0, (new_capacity - the_tsdb->slot_capacity) * sizeof(bool));
+    the_tsdb->is_staged = new_is_staged;
+    if ( ! (new_staged = realloc(the_tsdb->staged, new_capacity * sizeof(unsigned int))) ) return -1;
+    the_tsdb->staged = new_staged;
+    if ( ! __lmtsdb_map(the_tsdb, new_size) ) return -1;
+    LMDEBUG("grew time-series store %s to %u slots", the_tsdb->path, the_tsdb->slot_capacity);
+  }
+
+  // The space may hold a slot abandoned by a crash or a discard:
+  header = __lmtsdb_slot(the_tsdb, slot);
+  memset(header, 0, __lmtsdb_slot_size);
+  header->feature_id = feature_id;
+  header->state[0].checksum = __lmtsdb_state_checksum(&header->state[0]);
+  if ( ! __lmtsdb_index_add(the_tsdb, feature_id, slot) ) return -1;
+  the_tsdb->slot_count++;
+  return (int)slot;
+}
+
+//
+
+bool
+lmtsdb_update(
+  lmtsdb_ref          the_tsdb,
+  int                 feature_id,
+  time_t              timestamp,
+  double              in_use,
+  double              issued
+)
+{
+  lmtsdb_slot_header  *header;
+  lmtsdb_slot_state   *state;
+  int                 slot;
+  unsigned int        level = 0;
+  bool                is_first;
+
+  if ( the_tsdb->is_read_only || (timestamp < 0) ) return false;
+  if ( (slot = __lmtsdb_lookup(the_tsdb, feature_id)) < 0 ) {
+    if ( (slot = __lmtsdb_add_slot(the_tsdb, feature_id)) < 0 ) return false;
+  }
+  header = __lmtsdb_slot(the_tsdb, slot);
+  state = &header->state[1 - header->active];
+  if ( ! the_tsdb->is_staged[slot] ) {
+    int64_t           first_bucket[lmtsdb_level_max], last_bucket[lmtsdb_level_max];
+
+    if ( timestamp <= header->state[header->active].last_update ) return true;
+
+    //
+    // The staged state still describes the round that produced the active
+    // one, so it says which rows to bring across.  The new generation is
+    // in place before any row changes, for readers that are still
+    // copying out of these rings:
+    //
+    __lmtsdb_get_round(state, &header->state[header->active], first_bucket, last_bucket);
+    *state = header->state[header->active];
+    state->generation++;
+    __sync_synchronize();
+    __lmtsdb_copy_rounds(the_tsdb, slot, 1 - header->active, first_bucket, last_bucket);
+    the_tsdb->is_staged[slot] = true;
+    the_tsdb->staged[the_tsdb->staged_count++] = slot;
+  } else if ( timestamp <= state->last_update ) {
+    return true;
+  }
+  is_first = ( state->last_update == 0 );
+
+  while ( level < lmtsdb_level_max ) {
+    lmtsdb_level_state  *level_state = &state->levels[level];
+    unsigned int        row_count = __lmtsdb_levels[level].row_count;
+    double              *in_use_column = __lmtsdb_column(the_tsdb, slot, 1 - header->active, level, false);
+    double              *issued_column = __lmtsdb_column(the_tsdb, slot, 1 - header->active, level, true);
+    int64_t             bucket = __lmtsdb_bucket(timestamp, lmtsdb_level_get_step(level));
+
+    if ( is_first ) {
+      level_state->bucket = level_state->first_bucket = bucket;
+    } else if ( bucket != level_state->bucket ) {
+      // Intervals skipped since the last sample have no value:
+      int64_t           gap = bucket - level_state->bucket - 1, b = level_state->bucket + 1;
+
+      if ( gap > row_count ) gap = row_count;
+      while ( gap-- > 0 ) {
+        in_use_column[b % row_count] = issued_column[b % row_count] = NAN;
+        b++;
+      }
+      level_state->bucket = bucket;
+      level_state->in_use_sum = level_state->issued_sum = 0.0;
+      level_state->sample_count = 0;
+    }
+    level_state->in_use_sum += in_use;
+    level_state->issued_sum += issued;
+    level_state->sample_count++;
+    in_use_column[bucket % row_count] = level_state->in_use_sum / level_state->sample_count;
+    issued_column[bucket % row_count] = level_state->issued_sum / level_state->sample_count;
+    level++;
+  }
+  state->last_update = timestamp;
+  state->checksum = __lmtsdb_state_checksum(state);
+  return true;
+}
+
+//
+
+bool
+lmtsdb_sync(
+  lmtsdb_ref          the_tsdb
+)
+{
+  lmtsdb_file_header  *header;
+  unsigned int        i = 0;
+
+  if ( the_tsdb->is_read_only ) return true;
+  header = __lmtsdb_header(the_tsdb);
+  if ( ! the_tsdb->staged_count && (header->slot_count == the_tsdb->slot_count) ) return true;
+
+  // Rings, staged states, and new slots first...
+  if ( msync(the_tsdb->base, the_tsdb->map_size, MS_SYNC) != 0 ) goto exit_on_error;
+
+  // ...then the switch to the staged states:
+  while ( i < the_tsdb->staged_count ) {
+    unsigned int      slot = the_tsdb->staged[i++];
+    lmtsdb_slot_header *slot_header = __lmtsdb_slot(the_tsdb, slot);
+
+    __sync_synchronize();
+    slot_header->active = 1 - slot_header->active;
+    the_tsdb->is_staged[slot] = false;
+  }
+  the_tsdb->staged_count = 0;
+  __sync_synchronize();
+  header->slot_count = the_tsdb->slot_count;
+  if ( msync(the_tsdb->base, the_tsdb->map_size, MS_SYNC) != 0 ) goto exit_on_error;
+  return true;
+
+exit_on_error:
+  lmlogf(lmlog_level_error, "unable to write time-series store %s: %s", the_tsdb->path, strerror(errno));
+  return false;
+}
+
+//
+
+void
+lmtsdb_discard(
+  lmtsdb_ref          the_tsdb
+)
+{
+  if ( the_tsdb->is_read_only ) return;
+  while ( the_tsdb->staged_count ) {
+    unsigned int        slot = the_tsdb->staged[--the_tsdb->staged_count];
+    lmtsdb_slot_header  *header = __lmtsdb_slot(the_tsdb, slot);
+    lmtsdb_slot_state   *state = &header->state[1 - header->active];
+    int64_t             first_bucket[lmtsdb_level_max], last_bucket[lmtsdb_level_max];
+
+    // Put back the rows the abandoned round wrote, and write them out
+    // before the state that vouches for them:
+    __lmtsdb_get_round(&header->state[header->active], state, first_bucket, last_bucket);
+    __lmtsdb_copy_rounds(the_tsdb, slot, 1 - header->active, first_bucket, last_bucket);
+    msync(header, __lmtsdb_slot_size, MS_SYNC);
+    *state = header->state[header->active];
+    the_tsdb->is_staged[slot] = false;
+  }
+  while ( the_tsdb->slot_count > __lmtsdb_header(the_tsdb)->slot_count ) __lmtsdb_index_remove(the_tsdb, --the_tsdb->slot_count);
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+bool
+lmtsdb_get_last_update(
+  lmtsdb_ref          the_tsdb,
+  int                 feature_id,
+  time_t              *timestamp
+)
+{
+  int                 slot = __lmtsdb_lookup(the_tsdb, feature_id);
+  lmtsdb_slot_state   state;
+
+  if ( (slot < 0) || ! __lmtsdb_get_state(the_tsdb, slot, &state, NULL) ) return false;
+  *timestamp = (time_t)state.last_update;
+  return true;
+}
+
+//
+
+bool
+lmtsdb_iterate_features(
+  lmtsdb_ref          the_tsdb,
+  lmtsdb_feature_iterator_fn iterator_fn,
+  const void          *context
+)
+{
+  unsigned int        slot = 0;
+
+  if ( the_tsdb->is_read_only && ! __lmtsdb_refresh(the_tsdb) ) return false;
+  while ( slot < the_tsdb->slot_count ) {
+    lmtsdb_slot_state state;
+
+    if ( __lmtsdb_get_state(the_tsdb, slot, &state, NULL) && state.last_update ) {
+      if ( ! iterator_fn(context, __lmtsdb_slot(the_tsdb, slot)->feature_id, (time_t)state.last_update) ) return false;
+    }
+    slot++;
+  }
+  return true;
+}
+
+//
+
+lmtsdb_level
+lmtsdb_select_level(
+  lmtsdb_ref          the_tsdb,
+  int                 feature_id,
+  time_t              start_timestamp
+)
+{
+  int                 slot = __lmtsdb_lookup(the_tsdb, feature_id);
+  lmtsdb_slot_state   state;
+  unsigned int        level = 0;
+
+  if ( (slot < 0) || ! __lmtsdb_get_state(the_tsdb, slot, &state, NULL) ) return lmtsdb_level_5min;
+  while ( level < lmtsdb_level_max - 1 ) {
+    int64_t           oldest = state.levels[level].bucket - __lmtsdb_levels[level].row_count + 1;
+    int64_t           wanted = state.levels[level].first_bucket;
+
+    //
+    // Nothing before the feature's first sample need be covered:
+    //
+    if ( start_timestamp >= 0 ) {
+      int64_t         start_bucket = __lmtsdb_bucket(start_timestamp, lmtsdb_level_get_step(level));
+
+      if ( start_bucket > wanted ) wanted = start_bucket;
+    }
+    if ( oldest <= wanted ) break;
+    level++;
+  }
+  return (lmtsdb_level)level;
+}
+
+//
+
+bool
+lmtsdb_fetch(
+  lmtsdb_ref          the_tsdb,
+  int                 feature_id,
+  lmtsdb_level        level,
+  time_t              start_timestamp,
+  time_t              end_timestamp,
+  lmtsdb_point_iterator_fn iterator_fn,
+  const void          *context
+)
+{
+  int                 slot = __lmtsdb_lookup(the_tsdb, feature_id);
+  lmtsdb_slot_header  *header;
+  lmtsdb_slot_state   state;
+  lmtsdb_level_state  *level_state;
+  unsigned int        width, row_count, copy, point_count = 0, i;
+  unsigned int        retries = LMTSDB_READ_RETRIES;
+  int64_t             b_lo = 0, b_hi = -1;
+  double              *points = NULL;
+  bool                rc = false;
+
+  if ( (level >= lmtsdb_level_max) || (slot < 0) ) return false;
+  header = __lmtsdb_slot(the_tsdb, slot);
+  width = lmtsdb_level_get_step(level);
+  row_count = __lmtsdb_levels[level].row_count;
+
+  //
+  // The points are copied out of the rings before any are handed to
+  // iterator_fn; a reader starts over if the writer has since begun
+  // staging into the copy it read:
+  //
+  while ( retries-- ) {
+    const double      *in_use_column, *issued_column;
+
+    if ( ! __lmtsdb_get_state(the_tsdb, slot, &state, &copy) ) goto exit_on_error;
+    if ( ! state.last_update || (end_timestamp < 0) ) {
+      rc = true;
+      goto exit_on_error;
+    }
+    level_state = &state.levels[level];
+    b_lo = level_state->bucket - row_count + 1;
+    if ( b_lo < level_state->first_bucket ) b_lo = level_state->first_bucket;
+    if ( b_lo < __lmtsdb_bucket(start_timestamp, width) ) b_lo = __lmtsdb_bucket(start_timestamp, width);
+    b_hi = __lmtsdb_bucket(end_timestamp, width);
+    if ( b_hi > level_state->bucket ) b_hi = level_state->bucket;
+    if ( b_lo > b_hi ) {
+      rc = true;
+      goto exit_on_error;
+    }
+    point_count = (unsigned int)(b_hi - b_lo + 1);
+    if ( ! points && ! (points = malloc(2 * row_count * sizeof(double))) ) goto exit_on_error;
+
+    in_use_column = __lmtsdb_column(the_tsdb, slot, copy, level, false);
+    issued_column = __lmtsdb_column(the_tsdb, slot, copy, level, true);
+    for ( i = 0; i < point_count; i++ ) {
+      points[2 * i] = in_use_column[(b_lo + i) % row_count];
+      points[2 * i + 1] = issued_column[(b_lo + i) % row_count];
+    }
+    if ( ! the_tsdb->is_read_only ) break;
+    __sync_synchronize();
+    if ( ((*(volatile uint32_t*)&header->active & 1) == copy) && (*(volatile uint64_t*)&header->state[copy].generation == state.generation) ) break;
+    point_count = 0;
+  }
+  if ( ! point_count ) goto exit_on_error;
+
+  rc = true;
+  for ( i = 0; i < point_count; i++ ) {
+    if ( ! iterator_fn(context, (time_t)((b_lo + i) * width), points[2 * i], points[2 * i + 1]) ) {
+      rc = false;
+      break;
+    }
+  }
+
+exit_on_error:
+  if ( points ) free((void*)points);
+  return rc;
+}
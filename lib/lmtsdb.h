@@ -0,0 +1,185 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmtsdb.h
+ *
+ * Embedded multi-resolution time-series store for feature counts
+ *
+ */
+
+#ifndef __LMTSDB_H__
+#define __LMTSDB_H__
+
+#include "config.h"
+
+/*!
+  @typedef lmtsdb_level
+  Enumerates the consolidation levels kept for every feature.  They
+  match the archives of the RRD files:
+
+    lmtsdb_level_5min       18 days of 5 minute averages
+    lmtsdb_level_1hour      60 days of 1 hour averages
+    lmtsdb_level_12hours    900 days of 12 hour averages
+    lmtsdb_level_1day       1080 days of 1 day averages
+    lmtsdb_level_7days      14 years of 7 day averages
+*/
+typedef enum {
+  lmtsdb_level_5min = 0,
+  lmtsdb_level_1hour,
+  lmtsdb_level_12hours,
+  lmtsdb_level_1day,
+  lmtsdb_level_7days,
+  //
+  lmtsdb_level_max
+} lmtsdb_level;
+
+/*!
+  @function lmtsdb_level_get_step
+  Returns the number of seconds covered by each point at the given
+  consolidation level.
+*/
+unsigned int lmtsdb_level_get_step(lmtsdb_level level);
+
+/*!
+  @function lmtsdb_level_get_row_count
+  Returns the number of points retained at the given consolidation
+  level.
+*/
+unsigned int lmtsdb_level_get_row_count(lmtsdb_level level);
+
+/*!
+  @typedef lmtsdb_ref
+  Type of an opaque reference to an lmtsdb object.
+*/
+typedef struct _lmtsdb * lmtsdb_ref;
+
+/*!
+  @function lmtsdb_open
+  Map the time-series store at path into memory, creating it if it
+  does not exist (and read_only is false).  Each feature owns a slot
+  holding one fixed-size ring of in_use values and one of issued
+  values per consolidation level, so an update touches a constant
+  number of cells.  The rings are kept twice over, once for the
+  synchronized state and once for the staged one.
+
+  Only one writer may have a store open at a time:  a writable open
+  fails if another process holds the store for writing.  Any number of
+  read-only opens may share it with the writer.
+
+  Returns NULL if the store could not be opened.
+*/
+lmtsdb_ref lmtsdb_open(const char *path, bool read_only);
+
+/*!
+  @function lmtsdb_close
+  Unmap the_tsdb and dispose of it.  Any updates not yet made durable
+  by lmtsdb_sync() are discarded.
+*/
+void lmtsdb_close(lmtsdb_ref the_tsdb);
+
+/*!
+  @function lmtsdb_get_path
+  Returns the filesystem path of the_tsdb.
+*/
+const char* lmtsdb_get_path(lmtsdb_ref the_tsdb);
+
+/*!
+  @function lmtsdb_is_read_only
+  Returns true if the_tsdb was opened read-only.
+*/
+bool lmtsdb_is_read_only(lmtsdb_ref the_tsdb);
+
+/*!
+  @function lmtsdb_update
+  Fold a single sample of the in_use and issued counts of the feature
+  with the given feature_id, taken at timestamp, into every
+  consolidation level.  A slot is added for a feature the first time
+  it is updated.
+
+  Samples at or before the feature's last update are ignored, so
+  replaying a run of samples is harmless.  The update is staged:  it
+  becomes durable and visible to readers when lmtsdb_sync() is called.
+
+  Returns false if the store is read-only or could not be grown.
+*/
+bool lmtsdb_update(lmtsdb_ref the_tsdb, int feature_id, time_t timestamp, double in_use, double issued);
+
+/*!
+  @function lmtsdb_sync
+  Make all staged updates durable and visible to readers.  The data
+  cells are written out before the slot states that refer to them, so
+  a crash at any point leaves every slot in its old or its new state.
+
+  Returns false if the store could not be written out.
+*/
+bool lmtsdb_sync(lmtsdb_ref the_tsdb);
+
+/*!
+  @function lmtsdb_discard
+  Abandon all staged updates; each feature reverts to its last
+  synchronized state.
+*/
+void lmtsdb_discard(lmtsdb_ref the_tsdb);
+
+/*!
+  @function lmtsdb_get_last_update
+  If the feature with the given feature_id has a slot in the_tsdb, set
+  *timestamp to the time of its last sample and return true.  Readers
+  see only synchronized samples.
+*/
+bool lmtsdb_get_last_update(lmtsdb_ref the_tsdb, int feature_id, time_t *timestamp);
+
+/*!
+  @typedef lmtsdb_feature_iterator_fn
+  Type of a callback function passed to lmtsdb_iterate_features().  The
+  context is a caller-defined pointer-sized value passed through from
+  lmtsdb_iterate_features().
+
+  The function should return false to terminate iteration or true to
+  continue.
+*/
+typedef bool (*lmtsdb_feature_iterator_fn)(const void *context, int feature_id, time_t last_update);
+
+/*!
+  @function lmtsdb_iterate_features
+  Call iterator_fn for each feature that has a slot in the_tsdb, in the
+  order the slots were added.
+
+  Returns true if all features were enumerated.
+*/
+bool lmtsdb_iterate_features(lmtsdb_ref the_tsdb, lmtsdb_feature_iterator_fn iterator_fn, const void *context);
+
+/*!
+  @function lmtsdb_select_level
+  Returns the finest consolidation level whose retained points for the
+  feature with the given feature_id reach back to start_timestamp (or
+  to the feature's first sample, if that is later or start_timestamp
+  is negative), or the coarsest level if none does.
+*/
+lmtsdb_level lmtsdb_select_level(lmtsdb_ref the_tsdb, int feature_id, time_t start_timestamp);
+
+/*!
+  @typedef lmtsdb_point_iterator_fn
+  Type of a callback function passed to lmtsdb_fetch().  The timestamp
+  is the start of the interval the point covers; in_use and issued are
+  the averages of the samples taken in that interval, or NAN if none
+  were.
+
+  The function should return false to terminate iteration or true to
+  continue.
+*/
+typedef bool (*lmtsdb_point_iterator_fn)(const void *context, time_t timestamp, double in_use, double issued);
+
+/*!
+  @function lmtsdb_fetch
+  Call iterator_fn, in time order, for each retained point at the given
+  consolidation level of the feature with the given feature_id whose
+  interval overlaps [start_timestamp, end_timestamp].  The interval in
+  progress is included, with the averages of the samples taken so far.
+  Readers see only synchronized samples.
+
+  Returns false if the feature has no slot in the_tsdb or iteration was
+  terminated by iterator_fn.
+*/
+bool lmtsdb_fetch(lmtsdb_ref the_tsdb, int feature_id, lmtsdb_level level, time_t start_timestamp, time_t end_timestamp, lmtsdb_point_iterator_fn iterator_fn, const void *context);
+
+#endif /* __LMTSDB_H__ */
@@ -203,6 +203,39 @@ mempool_alloc_bytes_clear(
 
 //
 
+void*
+mempool_realloc_bytes(
+  mempool_ref   pool,
+  void          *p,
+  size_t        old_bytes,
+  size_t        bytes
+)
+{
+  mempool_bucket_t    *b = pool->buckets;
+  void                *new_p;
+  
+  if ( ! p ) return mempool_alloc_bytes(pool, bytes);
+  if ( bytes <= old_bytes ) return p;
+  
+  // Extend in-place if p was the last thing allocated from its bucket:
+  while ( b ) {
+    if ( (p >= b->base) && (b->current == p + old_bytes) ) {
+      if ( b->used + (bytes - old_bytes) <= b->capacity ) {
+        b->used += bytes - old_bytes;
+        b->current += bytes - old_bytes;
+        return p;
+      }
+      break;
+    }
+    b = b->next;
+  }
+  new_p = mempool_alloc_bytes(pool, bytes);
+  if ( new_p ) memcpy(new_p, p, old_bytes);
+  return new_p;
+}
+
+//
+
 const char*
 mempool_strdup(
   mempool_ref   pool,
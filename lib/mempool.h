@@ -63,6 +63,18 @@ void* mempool_alloc_bytes(mempool_ref pool, size_t bytes);
 */
 void* mempool_alloc_bytes_clear(mempool_ref pool, size_t bytes);
 
+/*!
+  @function mempool_realloc_bytes
+  
+  Resize an allocation of old_bytes at p (made from pool) to hold the
+  given number of bytes.  If p is the most recent allocation in its
+  bucket and the bucket has room, it is simply extended; otherwise,
+  a new region is allocated from the pool and the old_bytes at p are
+  copied to it (the old region is not reclaimed until the pool is
+  reset or deallocated).  A NULL p behaves like mempool_alloc_bytes().
+*/
+void* mempool_realloc_bytes(mempool_ref pool, void *p, size_t old_bytes, size_t bytes);
+
 /*!
   @function mempool_strdup
   
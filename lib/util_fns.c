@@ -179,6 +179,192 @@ strcatf(
   return out;
 }
 
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+typedef struct _strbuf {
+  mempool_ref   pool;
+  char          *buffer;
+  size_t        length, capacity;
+  bool          has_failed;
+} strbuf;
+
+//
+
+strbuf_ref
+strbuf_alloc(
+  mempool_ref   pool,
+  size_t        capacity
+)
+{
+  strbuf        *new_buffer = mempool_alloc_bytes(pool, sizeof(strbuf));
+  
+  if ( new_buffer ) {
+    if ( capacity < 64 ) capacity = 64;
+    new_buffer->pool = pool;
+    new_buffer->length = 0;
+    new_buffer->capacity = capacity;
+    new_buffer->has_failed = false;
+    if ( (new_buffer->buffer = mempool_alloc_bytes(pool, capacity + 1)) ) {
+      new_buffer->buffer[0] = '\0';
+    } else {
+      new_buffer = NULL;
+    }
+  }
+  return new_buffer;
+}
+
+//
+
+bool
+__strbuf_reserve(
+  strbuf_ref    the_buffer,
+  size_t        len
+)
+{
+  if ( the_buffer->has_failed ) return false;
+  if ( the_buffer->length + len > the_buffer->capacity ) {
+    size_t      new_capacity = 2 * the_buffer->capacity;
+    char        *new_buffer;
+    
+    if ( new_capacity < the_buffer->length + len ) new_capacity = the_buffer->length + len;
+    new_buffer = mempool_realloc_bytes(the_buffer->pool, the_buffer->buffer, the_buffer->capacity + 1, new_capacity + 1);
+    if ( ! new_buffer ) {
+      lmlogf(lmlog_level_warn, "strbuf: failed to grow string to %lu characters", (unsigned long)new_capacity);
+      the_buffer->has_failed = true;
+      return false;
+    }
+    the_buffer->buffer = new_buffer;
+    the_buffer->capacity = new_capacity;
+  }
+  return true;
+}
+
+//
+
+bool
+strbuf_append_bytes(
+  strbuf_ref    the_buffer,
+  const char    *s,
+  size_t        len
+)
+{
+  if ( ! __strbuf_reserve(the_buffer, len) ) return false;
+  memcpy(the_buffer->buffer + the_buffer->length, s, len);
+  the_buffer->length += len;
+  the_buffer->buffer[the_buffer->length] = '\0';
+  return true;
+}
+
+//
+
+bool
+strbuf_append(
+  strbuf_ref    the_buffer,
+  const char    *s
+)
+{
+  return strbuf_append_bytes(the_buffer, s, strlen(s));
+}
+
+//
+
+bool
+strbuf_appendm(
+  strbuf_ref    the_buffer,
+  ...
+)
+{
+  const char    *s;
+  bool          rc = true;
+  va_list       vargs;
+
+  va_start(vargs, the_buffer);
+  while ( rc && (s = va_arg(vargs, const char*)) ) rc = strbuf_append_bytes(the_buffer, s, strlen(s));
+  va_end(vargs);
+  return rc;
+}
+
+//
+
+bool
+strbuf_appendf(
+  strbuf_ref    the_buffer,
+  const char    *format,
+  ...
+)
+{
+  int           l;
+  va_list       vargs;
+
+  va_start(vargs, format);
+  l = vsnprintf(NULL, 0, format, vargs);
+  va_end(vargs);
+  if ( l < 0 ) {
+    the_buffer->has_failed = true;
+    return false;
+  }
+  if ( ! __strbuf_reserve(the_buffer, l) ) return false;
+  va_start(vargs, format);
+  vsnprintf(the_buffer->buffer + the_buffer->length, l + 1, format, vargs);
+  va_end(vargs);
+  the_buffer->length += l;
+  return true;
+}
+
+//
+
+void
+strbuf_reset(
+  strbuf_ref    the_buffer
+)
+{
+  the_buffer->length = 0;
+  the_buffer->buffer[0] = '\0';
+  the_buffer->has_failed = false;
+}
+
+//
+
+size_t
+strbuf_get_length(
+  strbuf_ref    the_buffer
+)
+{
+  return the_buffer->length;
+}
+
+//
+
+const char*
+strbuf_get_cstring(
+  strbuf_ref    the_buffer
+)
+{
+  return the_buffer->has_failed ? NULL : the_buffer->buffer;
+}
+
+//
+
+const char*
+strbuf_copy_cstring(
+  strbuf_ref    the_buffer
+)
+{
+  char          *out;
+  
+  if ( the_buffer->has_failed ) return NULL;
+  if ( (out = malloc(the_buffer->length + 1)) ) {
+    memcpy(out, the_buffer->buffer, the_buffer->length + 1);
+  } else {
+    lmlogf(lmlog_level_warn, "strbuf_copy_cstring: failed to allocate space for string (errno = %d)", errno);
+  }
+  return out;
+}
+
 //
 
 int
@@ -248,3 +434,83 @@ str_next_word(
   }
   return str_next_word_none;
 }
+
+//
+
+size_t
+json_escape(
+  char        *dst,
+  const char  *s,
+  size_t      len
+)
+{
+  static const char hex_digits[] = "0123456789abcdef";
+  const char  *end = s + len;
+  char        *p = dst;
+  
+  while ( s < end ) {
+    const char  *run = s;
+    
+    // Copy runs of characters that need no escaping in one go:
+    while ( (s < end) && ((unsigned char)*s >= 0x20) && (*s != '"') && (*s != '\\') ) s++;
+    if ( s > run ) {
+      memcpy(p, run, s - run);
+      p += s - run;
+    }
+    if ( s < end ) {
+      *p++ = '\\';
+      switch ( *s ) {
+        case '"':
+        case '\\':
+          *p++ = *s;
+          break;
+        case '\n':
+          *p++ = 'n';
+          break;
+        case '\r':
+          *p++ = 'r';
+          break;
+        case '\t':
+          *p++ = 't';
+          break;
+        case '\b':
+          *p++ = 'b';
+          break;
+        case '\f':
+          *p++ = 'f';
+          break;
+        default:
+          *p++ = 'u';
+          *p++ = '0';
+          *p++ = '0';
+          *p++ = hex_digits[((unsigned char)*s >> 4) & 0xf];
+          *p++ = hex_digits[(unsigned char)*s & 0xf];
+          break;
+      }
+      s++;
+    }
+  }
+  return p - dst;
+}
+
+//
+
+void
+fputs_json_string(
+  const char  *s,
+  FILE        *stream
+)
+{
+  char        escaped[6 * 256];
+  size_t      len = strlen(s);
+  
+  fputc('"', stream);
+  while ( len ) {
+    size_t    n = ( len > 256 ) ? 256 : len;
+    
+    fwrite(escaped, 1, json_escape(escaped, s, n), stream);
+    s += n;
+    len -= n;
+  }
+  fputc('"', stream);
+}
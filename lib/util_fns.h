@@ -81,6 +81,82 @@ const char* strdcatm(const char *delim, ...);
 */
 const char*	strcatf(const char *format, ...);
 
+/*!
+  @typedef strbuf_ref
+  Type of a reference to a growable string builder.  The builder and
+  its buffer are allocated from a mempool, so appending is amortized
+  linear in the length of the string and nothing needs to be free'd
+  apart from the pool itself.
+*/
+typedef struct _strbuf * strbuf_ref;
+
+/*!
+  @function strbuf_alloc
+  Allocate a new (empty) string builder from pool with room for at
+  least capacity characters before it needs to grow.
+*/
+strbuf_ref strbuf_alloc(mempool_ref pool, size_t capacity);
+
+/*!
+  @function strbuf_append_bytes
+  Append len characters starting at s to the_buffer.  Returns false
+  if the_buffer could not be grown; the_buffer remembers the failure,
+  and strbuf_get_cstring() and strbuf_copy_cstring() will then return
+  NULL, so a sequence of appends can be checked once at the end.
+*/
+bool strbuf_append_bytes(strbuf_ref the_buffer, const char *s, size_t len);
+
+/*!
+  @function strbuf_append
+  Append the C string s to the_buffer.
+*/
+bool strbuf_append(strbuf_ref the_buffer, const char *s);
+
+/*!
+  @function strbuf_appendm
+  Append an arbitrary number of C strings to the_buffer.  The list of
+  strings must be terminated by a NULL pointer:
+  
+    strbuf_appendm(sb, "SELECT ", columns, " FROM ", table, NULL);
+*/
+bool strbuf_appendm(strbuf_ref the_buffer, ...);
+
+/*!
+  @function strbuf_appendf
+  Append the string that results from formatting a variable list of
+  arguments according to the given format string.
+*/
+bool strbuf_appendf(strbuf_ref the_buffer, const char *format, ...);
+
+/*!
+  @function strbuf_reset
+  Empty the_buffer (keeping the space it has already allocated) and
+  clear any append failure.
+*/
+void strbuf_reset(strbuf_ref the_buffer);
+
+/*!
+  @function strbuf_get_length
+  Returns the number of characters in the_buffer.
+*/
+size_t strbuf_get_length(strbuf_ref the_buffer);
+
+/*!
+  @function strbuf_get_cstring
+  Returns the NUL-terminated contents of the_buffer, or NULL if an
+  append failed.  The string belongs to the pool and is only valid
+  until the next append.
+*/
+const char* strbuf_get_cstring(strbuf_ref the_buffer);
+
+/*!
+  @function strbuf_copy_cstring
+  Returns a malloc'ed copy of the contents of the_buffer, or NULL if
+  an append failed.  The caller owns the returned non-NULL pointer
+  and is responsible for free'ing it.
+*/
+const char* strbuf_copy_cstring(strbuf_ref the_buffer);
+
 /*!
   @function is_eol
   Returns true if the character argument c is a NUL, CR, or NL
@@ -136,4 +212,21 @@ enum {
 */
 int str_next_word(const char* *s, mempool_ref pool, const char* *word);
 
+/*!
+  @function json_escape
+  Copy the len bytes at s to dst as the body of a JSON string (without
+  the enclosing quotes):  quotes, backslashes, and control characters
+  are escaped and all other bytes are copied as-is.  The dst buffer
+  must have room for 6 * len bytes.
+
+  Returns the number of bytes written to dst.
+*/
+size_t json_escape(char *dst, const char *s, size_t len);
+
+/*!
+  @function fputs_json_string
+  Write the C string s to stream as a quoted JSON string.
+*/
+void fputs_json_string(const char *s, FILE *stream);
+
 #endif /* __UTIL_FNS_H__ */
@@ -11,10 +11,9 @@
 #include "lmdb.h"
 #include "lmlog.h"
 #include "util_fns.h"
+#include "lmstat_collector.h"
 
-//
-
-extern char **environ;
+#include <signal.h>
 
 //
 
@@ -24,12 +23,6 @@ static int          flexlm_feature_match_count = 8;
 
 //
 
-static const char   *lmstat_feature_regex = "(Users of ([^:]+):.*Total of ([0-9]+) licenses? issued;[[:space:]]+Total of ([0-9]+) licenses? in use|\"([^\"]+)\"[[:space:]]+v([^,]+),[[:space:]]+vendor:[[:space:]]+([^,]+),[[:space:]]+expiry:[[:space:]]+([[:digit:]]{1,2}-[[:alpha:]]{3}-([[:digit:]]{1,4})|permanent))";
-static int          lmstat_feature_regex_flags = REG_ICASE | REG_EXTENDED;
-static int          lmstat_feature_match_count = 9;
-
-//
-
 bool
 lmdb_usage_iterator(
 	const void				*context,
@@ -62,6 +55,486 @@ lmdb_usage_iterator(
 
 //
 
+bool
+__lmdb_cli_apply_license_iterator(
+  const void    *context,
+  lmfeature_ref license_feature
+)
+{
+  lmdb_ref      the_database = (lmdb_ref)context;
+  lmfeature_ref feature = lmdb_get_feature_by_name(the_database, lmfeature_get_feature_string(license_feature), lmfeature_get_vendor(license_feature), lmfeature_get_version(license_feature));
+  
+  if ( feature ) {
+    lmfeature_add_issued(feature, lmfeature_get_issued(license_feature));
+    if ( lmfeature_get_expiration_date(license_feature) != lmfeature_get_expiration_date(feature) ) {
+      LMDEBUG("%s (%s %s), setting expiration timestamp %lld", lmfeature_get_feature_string(feature), lmfeature_get_vendor(feature), lmfeature_get_version(feature), (long long int)lmfeature_get_expiration_date(license_feature));
+      lmfeature_set_expiration_date(feature, lmfeature_get_expiration_date(license_feature));
+    }
+  }
+  return true;
+}
+
+//
+
+bool
+lmdb_cli_scan_license_file(
+  lmdb_ref      the_database,
+  const char    *license_path
+)
+{
+  fscanln_ref       flexlm_scanner = fscanln_create_with_file(license_path);
+  lmfeatureset_ref  license_features = NULL;
+  
+  if ( flexlm_scanner && ! (license_features = lmfeatureset_create()) ) {
+    fscanln_release(flexlm_scanner);
+    flexlm_scanner = NULL;
+  }
+  if ( flexlm_scanner ) {
+    LMDEBUG("opened FLEXlm license file %s for scanning", license_path);
+    if ( fscanln_set_line_regex(flexlm_scanner, flexlm_feature_regex, flexlm_feature_regex_flags, flexlm_feature_match_count) ) {
+      const char      *next_line;
+
+      while ( fscanln_get_line(flexlm_scanner, &next_line, NULL) ) {
+        const char  *vendor, *version, *feature_string, *expiration, *count;
+        time_t      expire_ts = lmfeature_no_expiration;
+
+        feature_string = fscanln_get_sub_match_string(flexlm_scanner, 2);
+        vendor = fscanln_get_sub_match_string(flexlm_scanner, 3);
+        version = fscanln_get_sub_match_string(flexlm_scanner, 4);
+        expiration = fscanln_get_sub_match_string(flexlm_scanner, 5);
+        count = fscanln_get_sub_match_string(flexlm_scanner, 7);
+
+        if ( expiration ) {
+          if ( strcasecmp(expiration, "permanent") != 0 ) {
+            const char	*year = expiration;
+            int					dashes = 0;
+
+            while ( *year && (dashes < 2) ) {
+              if ( *year == '-' ) dashes++;
+              year++;
+            }
+            if ( dashes == 2 ) {
+              size_t    zero_run = strspn(year, "0");
+
+              if ( zero_run && (*(year + zero_run) == '\0') ) {
+                // A year that's all zeroes => permanent
+              } else {
+                struct tm   expire_conv;
+
+                memset(&expire_conv, 0, sizeof(expire_conv));
+                expire_conv.tm_isdst = -1;
+                if ( strptime(expiration, "%d-%b-%Y", &expire_conv) ) {
+                  expire_ts = mktime(&expire_conv);
+                }
+              }
+            }
+          }
+        }
+
+        if ( feature_string && vendor && version ) {
+          lmfeature_ref   feature = lmfeatureset_get_feature_by_name(license_features, feature_string, vendor, version);
+
+          if ( ! feature ) {
+            if ( (feature = lmfeature_create(lmfeature_no_id, feature_string, vendor, version)) ) {
+              lmfeatureset_add_feature(license_features, feature);
+              lmfeature_release(feature);
+            }
+          }
+          if ( feature ) {
+            long    issued = strtol(count, NULL, 10);
+
+            if ( issued >= 0 ) {
+              LMDEBUG("%s (%s %s), incrementing seat count by %ld", feature_string, vendor, version, issued);
+              lmfeature_add_issued(feature, issued);
+            }
+            lmfeature_set_expiration_date(feature, expire_ts);
+          }
+        }
+      }
+    }
+    fscanln_release(flexlm_scanner);
+    
+    //
+    // Resolve all of the license file's features in one go, then apply
+    // their totals:
+    //
+    lmdb_resolve_features(the_database, license_features);
+    lmfeatureset_iterate(license_features, __lmdb_cli_apply_license_iterator, the_database);
+  } else {
+    lmlogf(lmlog_level_error, "failed to create file scanner for '%s'", license_path);
+  }
+  if ( license_features ) lmfeatureset_release(license_features);
+  return ( flexlm_scanner != NULL );
+}
+
+//
+
+bool
+__lmdb_cli_reset_issued_iterator(
+  const void    *context,
+  lmfeature_ref feature
+)
+{
+  (void)context;
+  lmfeature_set_issued(feature, 0);
+  return true;
+}
+
+void
+lmdb_cli_reset_issued_counts(
+  lmdb_ref      the_database
+)
+{
+  lmfeatureset_iterate(lmdb_get_features(the_database), __lmdb_cli_reset_issued_iterator, NULL);
+}
+
+//
+
+struct lmdb_cli_apply_snapshot_context {
+  lmdb_ref          the_database;
+  lmfeatureset_ref  issued_this_poll;
+};
+
+bool
+__lmdb_cli_apply_snapshot_iterator(
+  const void        *context,
+  const char        *feature_string,
+  const char        *vendor,
+  const char        *version,
+  int               in_use,
+  int               issued,
+  time_t            expire_ts
+)
+{
+  struct lmdb_cli_apply_snapshot_context  *CONTEXT = (struct lmdb_cli_apply_snapshot_context*)context;
+  lmfeature_ref     feature = lmdb_get_feature_by_name(CONTEXT->the_database, feature_string, vendor, version);
+  
+  if ( feature ) {
+    LMDEBUG("%s (%s %s), incrementing in-use by %d (issued = %d)", feature_string, vendor, version, in_use, issued);
+    lmfeature_add_in_use(feature, in_use);
+    if ( issued > 0 ) {
+      //
+      // The same feature may be served by more than one license server,
+      // so the first issued count seen in this poll replaces the value
+      // from the license file and the rest add to it:
+      //
+      if ( lmfeatureset_get_feature_by_id(CONTEXT->issued_this_poll, lmfeature_get_feature_id(feature)) ) {
+        lmfeature_add_issued(feature, issued);
+      } else {
+        lmfeature_set_issued(feature, issued);
+        lmfeatureset_add_feature(CONTEXT->issued_this_poll, feature);
+      }
+    }
+    if ( expire_ts != lmfeature_get_expiration_date(feature) ) {
+      LMDEBUG("%s (%s %s), setting expiration timestamp %lld", feature_string, vendor, version, (long long int)expire_ts);
+      lmfeature_set_expiration_date(feature, expire_ts);
+    }
+  }
+  return true;
+}
+
+//
+
+bool
+__lmdb_cli_collect_snapshot_iterator(
+  const void        *context,
+  const char        *feature_string,
+  const char        *vendor,
+  const char        *version,
+  int               in_use,
+  int               issued,
+  time_t            expire_ts
+)
+{
+  lmfeatureset_ref  the_features = (lmfeatureset_ref)context;
+  
+  (void)in_use; (void)issued; (void)expire_ts;
+  if ( ! lmfeatureset_get_feature_by_name(the_features, feature_string, vendor, version) ) {
+    lmfeature_ref   feature = lmfeature_create(lmfeature_no_id, feature_string, vendor, version);
+    
+    if ( feature ) {
+      lmfeatureset_add_feature(the_features, feature);
+      lmfeature_release(feature);
+    }
+  }
+  return true;
+}
+
+bool
+__lmdb_cli_collect_checkout_iterator(
+  const void            *context,
+  const char            *feature_string,
+  const char            *vendor,
+  const char            *version,
+  const lmdb_checkout_t *checkout
+)
+{
+  (void)checkout;
+  return __lmdb_cli_collect_snapshot_iterator(context, feature_string, vendor, version, 0, 0, lmfeature_no_expiration);
+}
+
+//
+
+bool
+__lmdb_cli_apply_checkout_iterator(
+  const void            *context,
+  const char            *feature_string,
+  const char            *vendor,
+  const char            *version,
+  const lmdb_checkout_t *checkout
+)
+{
+  struct lmdb_cli_apply_snapshot_context  *CONTEXT = (struct lmdb_cli_apply_snapshot_context*)context;
+  lmfeature_ref         feature = lmdb_get_feature_by_name(CONTEXT->the_database, feature_string, vendor, version);
+  
+  if ( feature ) lmdb_checkouts_observe(CONTEXT->the_database, feature, checkout);
+  return true;
+}
+
+//
+
+bool
+lmdb_cli_apply_snapshot(
+  lmdb_ref            the_database,
+  lmfeatureset_ref    issued_this_poll,
+  lmstat_snapshot_ref the_snapshot
+)
+{
+  struct lmdb_cli_apply_snapshot_context  context = {
+                .the_database = the_database,
+                .issued_this_poll = issued_this_poll
+              };
+  
+  if ( lmstat_snapshot_is_ok(the_snapshot) ) {
+    lmfeatureset_ref  snapshot_features = lmfeatureset_create();
+    
+    // Resolve every feature named in the snapshot in one go:
+    if ( snapshot_features ) {
+      lmstat_snapshot_iterate(the_snapshot, __lmdb_cli_collect_snapshot_iterator, snapshot_features);
+      lmstat_snapshot_iterate_checkouts(the_snapshot, __lmdb_cli_collect_checkout_iterator, snapshot_features);
+      lmdb_resolve_features(the_database, snapshot_features);
+      lmfeatureset_release(snapshot_features);
+    }
+    LMDEBUG("applying %u count(s) from lmstat source", lmstat_snapshot_get_count(the_snapshot));
+    lmstat_snapshot_iterate(the_snapshot, __lmdb_cli_apply_snapshot_iterator, &context);
+    if ( lmstat_snapshot_get_checkout_count(the_snapshot) ) {
+      LMDEBUG("applying %u checkout(s) from lmstat source", lmstat_snapshot_get_checkout_count(the_snapshot));
+      lmstat_snapshot_iterate_checkouts(the_snapshot, __lmdb_cli_apply_checkout_iterator, &context);
+    }
+    return true;
+  } else {
+    const lmstat_source *the_source = lmstat_snapshot_get_source(the_snapshot);
+    
+    switch ( the_source->kind ) {
+      case lmstat_interface_kind_static_output:
+        lmlogf(lmlog_level_error, "failed to scan lmstat output file '%s'", the_source->interface.static_output);
+        break;
+      case lmstat_interface_kind_command:
+        lmlogf(lmlog_level_error, "failed to scan output of lmstat command '%s'", the_source->interface.command);
+        break;
+      case lmstat_interface_kind_exec:
+        lmlogf(lmlog_level_error, "failed to scan output of lmstat command '%s'", the_source->interface.exec[0]);
+        break;
+      default:
+        break;
+    }
+  }
+  return false;
+}
+
+//
+
+bool
+lmdb_cli_scan_lmstat(
+  lmdb_ref                the_database,
+  const lmstat_source     *sources,
+  unsigned int            source_count,
+  lmstat_snapshot_options options
+)
+{
+  lmfeatureset_ref    issued_this_poll;
+  lmstat_snapshot_ref the_snapshot;
+  bool                is_complete = true;
+  
+  if ( source_count == 0 ) return true;
+  
+  if ( ! (issued_this_poll = lmfeatureset_create()) ) return false;
+  
+  lmdb_checkouts_begin_poll(the_database);
+  if ( source_count == 1 ) {
+    //
+    // No sense in starting a thread for a single source:
+    //
+    if ( (the_snapshot = lmstat_snapshot_create_with_source(sources, options)) ) {
+      if ( ! lmdb_cli_apply_snapshot(the_database, issued_this_poll, the_snapshot) ) is_complete = false;
+      lmstat_snapshot_release(the_snapshot);
+    } else {
+      is_complete = false;
+    }
+  } else {
+    //
+    // Each source is scanned by its own thread; snapshots are applied to
+    // the database (from this thread only) as they complete, so the poll
+    // takes about as long as the slowest source:
+    //
+    lmstat_collector_ref  the_collector = lmstat_collector_create(sources, source_count, options);
+    unsigned int          snapshot_count = 0;
+    
+    if ( ! the_collector ) {
+      lmdb_checkouts_end_poll(the_database, false);
+      lmfeatureset_release(issued_this_poll);
+      return false;
+    }
+    while ( (the_snapshot = lmstat_collector_next_snapshot(the_collector)) ) {
+      if ( ! lmdb_cli_apply_snapshot(the_database, issued_this_poll, the_snapshot) ) is_complete = false;
+      lmstat_snapshot_release(the_snapshot);
+      snapshot_count++;
+    }
+    if ( snapshot_count < source_count ) is_complete = false;
+    lmstat_collector_release(the_collector);
+  }
+  //
+  // Checkouts that went unseen are only ended if every source reported;
+  // otherwise a source that failed would appear to have lost all of its
+  // sessions:
+  //
+  lmdb_checkouts_end_poll(the_database, is_complete);
+  lmfeatureset_release(issued_this_poll);
+  return true;
+}
+
+//
+
+bool
+lmdb_cli_commit_counts(
+  lmdb_ref      the_database
+)
+{
+  lmdb_commit_stats_t   commit_stats;
+  
+  if ( lmdb_commit_counts_with_stats(the_database, lmdb_check_timestamp_now, &commit_stats) ) {
+    lmlogf(lmlog_level_info, "committed %u count(s), %u checkout(s) started, %u checkout(s) ended in %.3f ms", commit_stats.rows_written, commit_stats.checkouts_started, commit_stats.checkouts_ended, 1000.0 * commit_stats.elapsed);
+    return true;
+  }
+  lmlog(lmlog_level_error, "failed to commit license counts to the database");
+  return false;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+static volatile sig_atomic_t  lmdb_cli_should_exit = 0;
+static volatile sig_atomic_t  lmdb_cli_should_reload = 0;
+
+void
+lmdb_cli_signal_handler(
+  int           signum
+)
+{
+  switch ( signum ) {
+    case SIGHUP:
+      lmdb_cli_should_reload = 1;
+      break;
+    default:
+      lmdb_cli_should_exit = 1;
+      break;
+  }
+}
+
+//
+
+void
+lmdb_cli_timespec_add(
+  struct timespec   *t,
+  int               seconds
+)
+{
+  t->tv_sec += seconds;
+}
+
+//
+
+int
+lmdb_cli_run_daemon(
+  lmdb_ref                the_database,
+  lmconfig                *the_conf,
+  const lmstat_source     *sources,
+  unsigned int            source_count,
+  lmstat_snapshot_options options
+)
+{
+  struct sigaction    sa;
+  struct timespec     next_poll, now;
+  int                 rc = 0;
+  
+  //
+  // No SA_RESTART, so a signal interrupts the sleep between polls:
+  //
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = lmdb_cli_signal_handler;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  
+  lmlogf(lmlog_level_info, "running as a daemon, polling every %d second(s)", the_conf->poll_interval);
+  
+  clock_gettime(CLOCK_MONOTONIC, &next_poll);
+  while ( ! lmdb_cli_should_exit ) {
+    if ( lmdb_cli_should_reload ) {
+      //
+      // Issued counts come from the license file, so a reload starts
+      // them over:
+      //
+      lmdb_cli_should_reload = 0;
+      lmlogf(lmlog_level_info, "rescanning FLEXlm license file %s", the_conf->flexlm_license_path);
+      lmdb_cli_reset_issued_counts(the_database);
+      lmdb_cli_scan_license_file(the_database, the_conf->flexlm_license_path);
+    }
+    
+    //
+    // In-use counts accumulate as lmstat output is scanned, so they must
+    // start from zero on each poll:
+    //
+    lmdb_reset_in_use_counts(the_database);
+    lmdb_cli_scan_lmstat(the_database, sources, source_count, options);
+    if ( ! lmdb_cli_commit_counts(the_database) ) rc = EIO;
+    
+    //
+    // Schedule against the monotonic clock so polls don't drift; if a
+    // poll overran one or more intervals, skip ahead rather than firing
+    // a burst of back-to-back polls:
+    //
+    lmdb_cli_timespec_add(&next_poll, the_conf->poll_interval);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while ( (next_poll.tv_sec < now.tv_sec) || ((next_poll.tv_sec == now.tv_sec) && (next_poll.tv_nsec <= now.tv_nsec)) ) {
+      lmlog(lmlog_level_warn, "poll overran the polling interval, skipping a poll");
+      lmdb_cli_timespec_add(&next_poll, the_conf->poll_interval);
+    }
+    while ( ! lmdb_cli_should_exit && ! lmdb_cli_should_reload ) {
+      int     sleep_rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_poll, NULL);
+      
+      if ( sleep_rc == 0 ) break;
+      if ( sleep_rc != EINTR ) {
+        lmlogf(lmlog_level_error, "failure while waiting for next poll: %s", strerror(sleep_rc));
+        lmdb_cli_should_exit = 1;
+        rc = sleep_rc;
+      }
+    }
+  }
+  lmlog(lmlog_level_info, "exiting daemon mode");
+  return rc;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
 int
 main(
   int           argc,
@@ -84,218 +557,97 @@ main(
   the_conf = lmconfig_update_with_options(the_conf, argc, argv);
   
   if ( the_conf ) {
-    lmdb_ref          the_database = NULL;
+    lmdb_ref                the_database = NULL;
+    lmstat_source           *sources;
+    unsigned int            source_count = 0;
+    lmstat_snapshot_options options = 0;
+    
+    //
+    // The lmstat interface configured by lmstat-static-output/lmstat-cmd/
+    // lmstat-cmd-and-args is polled alongside any lmstat-source entries:
+    //
+    sources = malloc(sizeof(lmstat_source) * (the_conf->lmstat_source_count + 1));
+    if ( ! sources ) {
+      lmlog(lmlog_level_error, "unable to allocate list of lmstat sources");
+      lmconfig_dealloc(the_conf);
+      return ENOMEM;
+    }
+    if ( the_conf->lmstat_interface_kind != lmstat_interface_kind_unset ) {
+      sources[0].kind = the_conf->lmstat_interface_kind;
+      sources[0].interface.static_output = the_conf->lmstat_interface.static_output;
+      source_count++;
+    }
+    if ( the_conf->lmstat_source_count ) {
+      memcpy(&sources[source_count], the_conf->lmstat_sources, sizeof(lmstat_source) * the_conf->lmstat_source_count);
+      source_count += the_conf->lmstat_source_count;
+    }
     
     //
     // If a database file was present, get it opened.  If there was
     // no file, at least open an in-memory database:
     //
-    the_database = lmdb_create(the_conf->license_db_path ?  : ":memory:");
+    the_database = lmdb_create_with_options(the_conf->license_db_path ?  : ":memory:", &the_conf->db_options);
     if ( the_database ) {
 #ifndef LMDB_DISABLE_RRDTOOL
       if ( the_conf->rrd_repodir && the_conf->should_update_rrds ) {
-        lmdb_set_rrd_repodir(the_database, the_conf->rrd_repodir);
+        if ( lmdb_set_rrd_repodir(the_database, the_conf->rrd_repodir) && the_conf->should_run_as_daemon ) {
+          lmdb_set_rrd_flush_interval(the_database, the_conf->rrd_flush_interval);
+        }
       }
 #endif
+      if ( the_conf->tsdb_path && ! lmdb_set_tsdb_path(the_database, the_conf->tsdb_path) ) {
+        lmlogf(lmlog_level_warn, "counts will not be added to the time-series store %s", the_conf->tsdb_path);
+      }
+      if ( the_conf->should_compact_counts ) {
+        if ( ! lmdb_compact_counts(the_database) ) {
+          lmlog(lmlog_level_error, "unable to compact the database's counts");
+          rc = EIO;
+        }
+      }
+      if ( the_conf->should_rebuild_rollups ) {
+        if ( ! lmdb_rebuild_rollups(the_database) ) {
+          lmlog(lmlog_level_error, "unable to rebuild the database's count rollups");
+          rc = EIO;
+        }
+      }
+      if ( the_conf->should_track_checkouts ) {
+        if ( lmdb_enable_checkout_tracking(the_database) ) {
+          options |= lmstat_snapshot_option_capture_checkouts;
+        } else {
+          lmlog(lmlog_level_error, "unable to enable checkout tracking");
+        }
+      }
       //
       // If a FLEXlm license file was present, then scan it for features:
       //
       if ( the_conf->flexlm_license_path ) {
-        fscanln_ref   flexlm_scanner = fscanln_create_with_file(the_conf->flexlm_license_path);
-        
-        if ( flexlm_scanner ) {
-          LMDEBUG("opened FLEXlm license file %s for scanning", the_conf->flexlm_license_path);
-          if ( fscanln_set_line_regex(flexlm_scanner, flexlm_feature_regex, flexlm_feature_regex_flags, flexlm_feature_match_count) ) {
-            const char      *next_line;
-            
-            while ( fscanln_get_line(flexlm_scanner, &next_line, NULL) ) {
-              const char  *vendor, *version, *feature_string, *expiration, *count;
-              time_t      expire_ts = lmfeature_no_expiration;
-              
-              feature_string = fscanln_get_sub_match_string(flexlm_scanner, 2);
-              vendor = fscanln_get_sub_match_string(flexlm_scanner, 3);
-              version = fscanln_get_sub_match_string(flexlm_scanner, 4);
-              expiration = fscanln_get_sub_match_string(flexlm_scanner, 5);
-              count = fscanln_get_sub_match_string(flexlm_scanner, 7);
-                
-              if ( expiration ) {
-                if ( strcasecmp(expiration, "permanent") != 0 ) {
-                	const char	*year = expiration;
-                	int					dashes = 0;
-                	
-                	while ( *year && (dashes < 2) ) {
-                		if ( *year == '-' ) dashes++;
-                		year++;
-                	}
-                	if ( dashes == 2 ) {
-										size_t    zero_run = strspn(year, "0");
-									
-										if ( zero_run && (*(year + zero_run) == '\0') ) {
-											// A year that's all zeroes => permanent
-										} else {
-											struct tm   expire_conv;
-										
-											memset(&expire_conv, 0, sizeof(expire_conv));
-											expire_conv.tm_isdst = -1;
-											if ( strptime(expiration, "%d-%b-%Y", &expire_conv) ) {
-												expire_ts = mktime(&expire_conv);
-											}
-										}
-									}
-                }
-              }
+        lmdb_cli_scan_license_file(the_database, the_conf->flexlm_license_path);
         
-              if ( feature_string && vendor && version ) {
-                lmfeature_ref   feature = lmdb_get_feature_by_name(the_database, feature_string, vendor, version);
-                
-                if ( feature ) {
-                  long    issued = strtol(count, NULL, 10);
-                  
-                  if ( issued >= 0 ) {
-                    LMDEBUG("%s (%s %s), incrementing seat count by %ld", feature_string, vendor, version, issued);
-                    lmfeature_add_issued(feature, issued);
-                  }
-                  if ( expire_ts != lmfeature_get_expiration_date(feature) ) {
-                    LMDEBUG("%s (%s %s), setting expiration timestamp %lld", feature_string, vendor, version, (long long int)expire_ts);
-                    lmfeature_set_expiration_date(feature, expire_ts);
-                  }
-                }
-              }
-            }
-          }
-          fscanln_release(flexlm_scanner);
+        if ( the_conf->should_run_as_daemon ) {
+          //
+          // The database, its cached features, and its prepared statements
+          // all stay live between polls:
+          //
+          rc = lmdb_cli_run_daemon(the_database, the_conf, sources, source_count, options);
         } else {
-          lmlogf(lmlog_level_error, "failed to create file scanner for '%s'", the_conf->flexlm_license_path);
+          //
+          // If any lmstat stuff was configured, handle it now:
+          //
+          lmdb_cli_scan_lmstat(the_database, sources, source_count, options);
+          
+          //
+          // Save any updates:
+          //
+          if ( ! lmdb_cli_commit_counts(the_database) ) rc = EIO;
         }
-      
-				//
-				// If any lmstat stuff was configured, handle it now:
-				//
-				if ( the_conf->lmstat_interface_kind != lmstat_interface_kind_unset ) {
-					fscanln_ref     lmstat_scanner = NULL;
-				
-					switch ( the_conf->lmstat_interface_kind ) {
-				
-						default:
-						case lmstat_interface_kind_unset:
-							break;
-					
-						case lmstat_interface_kind_static_output:
-							LMDEBUG("attempting to open %s lmstat output", the_conf->lmstat_interface.static_output);
-							lmstat_scanner = fscanln_create_with_file(the_conf->lmstat_interface.static_output);
-							break;
-					
-						case lmstat_interface_kind_command:
-							LMDEBUG("attempting to execute \"%s\" lmstat command in shell", the_conf->lmstat_interface.command);
-							lmstat_scanner = fscanln_create_with_command(the_conf->lmstat_interface.command);
-							break;
-					
-						case lmstat_interface_kind_exec:
-							LMDEBUG("attempting to execute \"%s\"", the_conf->lmstat_interface.exec[0]);
-							lmstat_scanner = fscanln_create_with_execve(the_conf->lmstat_interface.exec[0], the_conf->lmstat_interface.exec, environ, true);
-							break;
-					
-					}
-					if ( lmstat_scanner ) {
-						LMDEBUG("lmstat source opened and ready to scan");
-						if ( fscanln_set_line_regex(lmstat_scanner, lmstat_feature_regex, lmstat_feature_regex_flags, lmstat_feature_match_count) ) {
-							const char    *next_line;
-							const char    *vendor = NULL, *version = NULL, *feature_string = NULL, *expiration = NULL;
-							time_t        expire_ts = lmfeature_no_expiration;
-							int           in_use = -1, issued = -1;
-						
-							while ( fscanln_get_line(lmstat_scanner, &next_line, NULL) ) {
-								//
-								// What did we match, a "Users of" line or a vendor info line?
-								//
-								if ( strstr(next_line, "Users of") ) {
-								  const char		*issued_string = fscanln_get_sub_match_string(lmstat_scanner, 3);
-									const char    *in_use_string = fscanln_get_sub_match_string(lmstat_scanner, 4);
-                  const char    *feature_scanned = fscanln_get_sub_match_string(lmstat_scanner, 2);
-                  
-                  lmlogf(lmlog_level_debug, "Found Users of line: %s %s of %s", feature_scanned ? feature_scanned : "<unknown>", in_use_string ? in_use_string : "<unknown>", issued_string ? issued_string : "<unknown>");
-									if ( feature_string ) {
-                    free((void*)feature_string);
-                    feature_string= NULL;
-                  }
-                  in_use = -1; issued = -1;
-                  if ( feature_scanned ) {
-                    feature_string = strdup(feature_scanned);
-										in_use = in_use_string ? strtol(in_use_string, NULL, 10) : 0;
-										issued = issued_string ? strtol(issued_string, NULL, 10) : 0;
-									}
-									// Reset other pieces that will come from a vendor info line:
-									vendor = version = expiration = NULL;
-									expire_ts = lmfeature_no_expiration;
-								} else if ( feature_string && (in_use >= 0) ) {
-									//
-									// Vendor info line:
-									//
-									const char    *feature_string_check = fscanln_get_sub_match_string(lmstat_scanner, 5);
-                  
-                  lmlogf(lmlog_level_debug, "Found vendor line: %s", feature_string_check ? feature_string_check : "<unknown>");
-								
-									if ( strcmp(feature_string, feature_string_check) == 0 ) {
-										version = fscanln_get_sub_match_string(lmstat_scanner, 6);
-										vendor = fscanln_get_sub_match_string(lmstat_scanner, 7);
-										expiration = fscanln_get_sub_match_string(lmstat_scanner, 8);
-									
-										if ( expiration ) {
-											if ( strcasecmp(expiration, "permanent") != 0 ) {
-												const char	*year = expiration;
-												int					dashes = 0;
-									
-												while ( *year && (dashes < 2) ) {
-													if ( *year == '-' ) dashes++;
-													year++;
-												}
-												if ( dashes == 2 ) {
-													size_t    zero_run = strspn(year, "0");
-											
-													if ( zero_run && (*(year + zero_run) == '\0') ) {
-														// A year that's all zeroes => permanent
-													} else {
-														struct tm   expire_conv;
-												
-														memset(&expire_conv, 0, sizeof(expire_conv));
-														expire_conv.tm_isdst = -1;
-														if ( strptime(expiration, "%d-%b-%Y", &expire_conv) ) {
-															expire_ts = mktime(&expire_conv);
-														}
-													}
-												}
-											}
-										}
-										LMDEBUG("from lmstat => %s (%s %s) expires %lld = %d", feature_string, vendor, version, (long long int)expire_ts, in_use);
-										if ( (in_use >= 0) && feature_string && vendor && version ) {
-											lmfeature_ref   feature = lmdb_get_feature_by_name(the_database, feature_string, vendor, version);
-										
-											if ( feature ) {
-												LMDEBUG("%s (%s %s), incrementing in-use by %d (issued = %d)", feature_string, vendor, version, in_use, issued);
-												lmfeature_add_in_use(feature, in_use);
-												if ( issued > 0 ) lmfeature_set_issued(feature, issued);
-											
-												if ( expire_ts != lmfeature_get_expiration_date(feature) ) {
-													LMDEBUG("%s (%s %s), setting expiration timestamp %lld", feature_string, vendor, version, (long long int)expire_ts);
-													lmfeature_set_expiration_date(feature, expire_ts);
-												}
-											}
-										}
-									}
-								}
-							}
-						}
-						fscanln_release(lmstat_scanner);
-					}
-				}
-			
-				//
-				// Save any updates:
-				//
-				lmdb_commit_counts(the_database, lmdb_check_timestamp_now);
-			}
+      } else if ( the_conf->should_run_as_daemon ) {
+        lmlog(lmlog_level_error, "a FLEXlm license file is required when running as a daemon");
+        rc = EINVAL;
+      }
       lmdb_release(the_database);
     }
+    free((void*)sources);
+    lmconfig_dealloc(the_conf);
   } else {
     rc = EINVAL;
   }
@@ -0,0 +1,549 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmstat_collector.c
+ *
+ * Scan one or more lmstat sources concurrently, producing a snapshot
+ * of the feature counts reported by each.
+ *
+ */
+
+#include "lmstat_collector.h"
+#include "fscanln.h"
+#include "lmstat_parser.h"
+#include "mempool.h"
+#include "lmfeature.h"
+#include "lmlog.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+
+//
+
+extern char **environ;
+
+//
+
+typedef struct _lmstat_snapshot_entry {
+  struct _lmstat_snapshot_entry   *link;
+  const char                      *feature_string;
+  const char                      *vendor;
+  const char                      *version;
+  int                             in_use, issued;
+  time_t                          expiration_date;
+} lmstat_snapshot_entry;
+
+typedef struct _lmstat_snapshot_checkout {
+  struct _lmstat_snapshot_checkout  *link;
+  const lmstat_snapshot_entry       *entry;
+  lmdb_checkout_t                   checkout;
+} lmstat_snapshot_checkout;
+
+typedef struct _lmstat_snapshot {
+  struct _lmstat_snapshot         *link;
+  const lmstat_source             *source;
+  lmstat_snapshot_options         options;
+  bool                            is_ok;
+  time_t                          scan_time;
+  unsigned int                    count;
+  lmstat_snapshot_entry           *entries, *entries_tail;
+  unsigned int                    checkout_count;
+  lmstat_snapshot_checkout        *checkouts, *checkouts_tail;
+  mempool_ref                     pool;
+} lmstat_snapshot;
+
+//
+
+lmstat_snapshot*
+__lmstat_snapshot_alloc(
+  const lmstat_source     *the_source,
+  lmstat_snapshot_options options
+)
+{
+  lmstat_snapshot       *new_snapshot = malloc(sizeof(lmstat_snapshot));
+
+  if ( new_snapshot ) {
+    memset(new_snapshot, 0, sizeof(lmstat_snapshot));
+    new_snapshot->source = the_source;
+    new_snapshot->options = options;
+    new_snapshot->pool = mempool_alloc();
+    if ( ! new_snapshot->pool ) {
+      free((void*)new_snapshot);
+      new_snapshot = NULL;
+    }
+  }
+  return new_snapshot;
+}
+
+//
+
+const char*
+__lmstat_snapshot_field_dup(
+  lmstat_snapshot       *the_snapshot,
+  lmstat_field          f
+)
+{
+  char                  *s = mempool_alloc_bytes(the_snapshot->pool, f.len + 1);
+
+  if ( s ) {
+    if ( f.len ) memcpy(s, f.ptr, f.len);
+    s[f.len] = '\0';
+  }
+  return s;
+}
+
+//
+
+bool
+__lmstat_snapshot_add_entry(
+  lmstat_snapshot             *the_snapshot,
+  const lmstat_vendor_record  *record
+)
+{
+  lmstat_snapshot_entry *new_entry = mempool_alloc_bytes(the_snapshot->pool, sizeof(lmstat_snapshot_entry));
+
+  if ( ! new_entry ) return false;
+  new_entry->link = NULL;
+  new_entry->feature_string = __lmstat_snapshot_field_dup(the_snapshot, record->feature);
+  new_entry->vendor = __lmstat_snapshot_field_dup(the_snapshot, record->vendor);
+  new_entry->version = __lmstat_snapshot_field_dup(the_snapshot, record->version);
+  if ( ! new_entry->feature_string || ! new_entry->vendor || ! new_entry->version ) return false;
+  new_entry->in_use = record->in_use;
+  new_entry->issued = record->issued;
+  new_entry->expiration_date = record->expiration_date;
+  if ( the_snapshot->entries_tail ) {
+    the_snapshot->entries_tail->link = new_entry;
+  } else {
+    the_snapshot->entries = new_entry;
+  }
+  the_snapshot->entries_tail = new_entry;
+  the_snapshot->count++;
+  return true;
+}
+
+//
+
+bool
+__lmstat_snapshot_usage_callback(
+  void                        *context,
+  const lmstat_usage_record   *record
+)
+{
+  (void)context;
+  lmlogf(lmlog_level_debug, "Found Users of line: %.*s %d of %d", (int)record->feature.len, record->feature.ptr, record->in_use, record->issued);
+  return true;
+}
+
+//
+
+bool
+__lmstat_snapshot_vendor_callback(
+  void                        *context,
+  const lmstat_vendor_record  *record
+)
+{
+  lmstat_snapshot             *the_snapshot = (lmstat_snapshot*)context;
+
+  LMDEBUG("from lmstat => %.*s (%.*s %.*s) expires %lld = %d",
+      (int)record->feature.len, record->feature.ptr,
+      (int)record->vendor.len, record->vendor.ptr,
+      (int)record->version.len, record->version.ptr,
+      (long long int)record->expiration_date, record->in_use
+    );
+  if ( ! __lmstat_snapshot_add_entry(the_snapshot, record) ) {
+    lmlog(lmlog_level_error, "unable to allocate space for lmstat snapshot entry");
+    the_snapshot->is_ok = false;
+    return false;
+  }
+  return true;
+}
+
+//
+
+bool
+__lmstat_snapshot_user_callback(
+  void                        *context,
+  const lmstat_user_record    *record
+)
+{
+  lmstat_snapshot             *the_snapshot = (lmstat_snapshot*)context;
+  const lmstat_snapshot_entry *entry = the_snapshot->entries_tail;
+  lmstat_snapshot_checkout    *new_checkout;
+  time_t                      start_ts;
+
+  //
+  // The checkout belongs to the feature from the last vendor line:
+  //
+  if ( ! entry || ! lmstat_field_is_equal(record->feature, entry->feature_string) ) return true;
+
+  start_ts = lmstat_parse_start_time(record->start.ptr, record->start.len, the_snapshot->scan_time);
+  if ( start_ts == -1 ) {
+    LMDEBUG("ignoring checkout by %.*s with unparseable start time '%.*s'", (int)record->user.len, record->user.ptr, (int)record->start.len, record->start.ptr);
+    return true;
+  }
+  if ( ! (new_checkout = mempool_alloc_bytes(the_snapshot->pool, sizeof(lmstat_snapshot_checkout))) ) goto exit_on_error;
+  new_checkout->link = NULL;
+  new_checkout->entry = entry;
+  if ( ! (new_checkout->checkout.user = __lmstat_snapshot_field_dup(the_snapshot, record->user)) ) goto exit_on_error;
+  if ( ! (new_checkout->checkout.host = __lmstat_snapshot_field_dup(the_snapshot, record->host)) ) goto exit_on_error;
+  if ( ! (new_checkout->checkout.display = __lmstat_snapshot_field_dup(the_snapshot, record->display)) ) goto exit_on_error;
+  if ( ! (new_checkout->checkout.version = __lmstat_snapshot_field_dup(the_snapshot, record->checkout_version)) ) goto exit_on_error;
+  if ( ! (new_checkout->checkout.server_host = __lmstat_snapshot_field_dup(the_snapshot, record->server_host)) ) goto exit_on_error;
+  if ( ! (new_checkout->checkout.server_port = __lmstat_snapshot_field_dup(the_snapshot, record->server_port)) ) goto exit_on_error;
+  if ( ! (new_checkout->checkout.handle = __lmstat_snapshot_field_dup(the_snapshot, record->handle)) ) goto exit_on_error;
+  new_checkout->checkout.start_timestamp = start_ts;
+  new_checkout->checkout.license_count = record->license_count;
+  if ( the_snapshot->checkouts_tail ) {
+    the_snapshot->checkouts_tail->link = new_checkout;
+  } else {
+    the_snapshot->checkouts = new_checkout;
+  }
+  the_snapshot->checkouts_tail = new_checkout;
+  the_snapshot->checkout_count++;
+  return true;
+
+exit_on_error:
+  lmlog(lmlog_level_error, "unable to allocate space for lmstat snapshot checkout");
+  the_snapshot->is_ok = false;
+  return false;
+}
+
+//
+
+void
+__lmstat_snapshot_scan(
+  lmstat_snapshot       *the_snapshot
+)
+{
+  const lmstat_source   *the_source = the_snapshot->source;
+  fscanln_ref           lmstat_scanner = NULL;
+
+  switch ( the_source->kind ) {
+
+    default:
+    case lmstat_interface_kind_unset:
+      break;
+
+    case lmstat_interface_kind_static_output:
+      LMDEBUG("attempting to open %s lmstat output", the_source->interface.static_output);
+      lmstat_scanner = fscanln_create_with_file(the_source->interface.static_output);
+      break;
+
+    case lmstat_interface_kind_command:
+      LMDEBUG("attempting to execute \"%s\" lmstat command in shell", the_source->interface.command);
+      lmstat_scanner = fscanln_create_with_command(the_source->interface.command);
+      break;
+
+    case lmstat_interface_kind_exec:
+      LMDEBUG("attempting to execute \"%s\"", the_source->interface.exec[0]);
+      lmstat_scanner = fscanln_create_with_execve(the_source->interface.exec[0], the_source->interface.exec, environ, true);
+      break;
+
+  }
+  if ( lmstat_scanner ) {
+    LMDEBUG("lmstat source opened and ready to scan");
+    lmstat_parser_callbacks callbacks = {
+                              .usage = __lmstat_snapshot_usage_callback,
+                              .vendor = __lmstat_snapshot_vendor_callback,
+                              .user = ( the_snapshot->options & lmstat_snapshot_option_capture_checkouts ) ? __lmstat_snapshot_user_callback : NULL
+                            };
+    lmstat_parser_ref       parser = lmstat_parser_create(&callbacks, the_snapshot);
+
+    if ( parser ) {
+      const char            *next_line;
+      size_t                next_line_len;
+
+      the_snapshot->is_ok = true;
+      the_snapshot->scan_time = time(NULL);
+      while ( fscanln_get_line_span(lmstat_scanner, &next_line, &next_line_len) ) {
+        if ( ! lmstat_parser_push_line(parser, next_line, next_line_len) ) break;
+      }
+      lmstat_parser_release(parser);
+    } else {
+      lmlog(lmlog_level_error, "unable to allocate lmstat parser");
+    }
+    fscanln_release(lmstat_scanner);
+  }
+}
+
+//
+
+lmstat_snapshot_ref
+lmstat_snapshot_create_with_source(
+  const lmstat_source     *the_source,
+  lmstat_snapshot_options options
+)
+{
+  lmstat_snapshot       *new_snapshot = __lmstat_snapshot_alloc(the_source, options);
+
+  if ( new_snapshot ) __lmstat_snapshot_scan(new_snapshot);
+  return (lmstat_snapshot_ref)new_snapshot;
+}
+
+//
+
+void
+lmstat_snapshot_release(
+  lmstat_snapshot_ref   the_snapshot
+)
+{
+  mempool_dealloc(the_snapshot->pool);
+  free((void*)the_snapshot);
+}
+
+//
+
+const lmstat_source*
+lmstat_snapshot_get_source(
+  lmstat_snapshot_ref   the_snapshot
+)
+{
+  return the_snapshot->source;
+}
+
+//
+
+bool
+lmstat_snapshot_is_ok(
+  lmstat_snapshot_ref   the_snapshot
+)
+{
+  return the_snapshot->is_ok;
+}
+
+//
+
+unsigned int
+lmstat_snapshot_get_count(
+  lmstat_snapshot_ref   the_snapshot
+)
+{
+  return the_snapshot->count;
+}
+
+//
+
+void
+lmstat_snapshot_iterate(
+  lmstat_snapshot_ref       the_snapshot,
+  lmstat_snapshot_iterator  iterator,
+  const void                *context
+)
+{
+  lmstat_snapshot_entry     *entry = the_snapshot->entries;
+
+  while ( entry ) {
+    if ( ! iterator(context, entry->feature_string, entry->vendor, entry->version, entry->in_use, entry->issued, entry->expiration_date) ) break;
+    entry = entry->link;
+  }
+}
+
+//
+
+unsigned int
+lmstat_snapshot_get_checkout_count(
+  lmstat_snapshot_ref   the_snapshot
+)
+{
+  return the_snapshot->checkout_count;
+}
+
+//
+
+void
+lmstat_snapshot_iterate_checkouts(
+  lmstat_snapshot_ref               the_snapshot,
+  lmstat_snapshot_checkout_iterator iterator,
+  const void                        *context
+)
+{
+  lmstat_snapshot_checkout          *checkout = the_snapshot->checkouts;
+
+  while ( checkout ) {
+    if ( ! iterator(context, checkout->entry->feature_string, checkout->entry->vendor, checkout->entry->version, &checkout->checkout) ) break;
+    checkout = checkout->link;
+  }
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+typedef struct _lmstat_collector_worker {
+  struct _lmstat_collector  *collector;
+  lmstat_snapshot           *snapshot;
+  pthread_t                 thread;
+  bool                      is_running;
+} lmstat_collector_worker;
+
+typedef struct _lmstat_collector {
+  unsigned int              source_count;
+  unsigned int              delivered_count;
+  //
+  // Workers push completed snapshots onto a lock-free stack (the head is
+  // only ever modified by compare-and-swap) and post the semaphore; the
+  // consumer takes the entire stack in one atomic exchange:
+  //
+  lmstat_snapshot           *completed;
+  sem_t                     completed_sem;
+  //
+  // Snapshots taken from the stack but not yet handed out, oldest first:
+  //
+  lmstat_snapshot           *pending;
+  lmstat_collector_worker   workers[];
+} lmstat_collector;
+
+//
+
+void
+__lmstat_collector_push(
+  lmstat_collector  *the_collector,
+  lmstat_snapshot   *the_snapshot
+)
+{
+  lmstat_snapshot   *head = __atomic_load_n(&the_collector->completed, __ATOMIC_RELAXED);
+
+  do {
+    the_snapshot->link = head;
+  } while ( ! __atomic_compare_exchange_n(&the_collector->completed, &head, the_snapshot, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+  sem_post(&the_collector->completed_sem);
+}
+
+//
+
+void*
+__lmstat_collector_worker_main(
+  void      *context
+)
+{
+  lmstat_collector_worker *the_worker = (lmstat_collector_worker*)context;
+  lmstat_snapshot         *the_snapshot = the_worker->snapshot;
+
+  //
+  // Once pushed, the snapshot belongs to the consumer:
+  //
+  the_worker->snapshot = NULL;
+  __lmstat_snapshot_scan(the_snapshot);
+  __lmstat_collector_push(the_worker->collector, the_snapshot);
+  return NULL;
+}
+
+//
+
+lmstat_collector_ref
+lmstat_collector_create(
+  const lmstat_source     *sources,
+  unsigned int            source_count,
+  lmstat_snapshot_options options
+)
+{
+  lmstat_collector      *new_collector = malloc(sizeof(lmstat_collector) + source_count * sizeof(lmstat_collector_worker));
+
+  if ( new_collector ) {
+    unsigned int        i = 0;
+
+    new_collector->source_count = source_count;
+    new_collector->delivered_count = 0;
+    new_collector->completed = NULL;
+    new_collector->pending = NULL;
+    if ( sem_init(&new_collector->completed_sem, 0, 0) != 0 ) {
+      lmlogf(lmlog_level_error, "unable to initialize lmstat collector semaphore: %s", strerror(errno));
+      free((void*)new_collector);
+      return NULL;
+    }
+    //
+    // Allocate all snapshots up-front so that every worker is guaranteed
+    // to deliver one:
+    //
+    while ( i < source_count ) {
+      lmstat_collector_worker *the_worker = &new_collector->workers[i];
+
+      the_worker->collector = new_collector;
+      the_worker->is_running = false;
+      if ( ! (the_worker->snapshot = __lmstat_snapshot_alloc(&sources[i], options)) ) {
+        lmlog(lmlog_level_error, "unable to allocate lmstat snapshot");
+        while ( i-- > 0 ) lmstat_snapshot_release((lmstat_snapshot_ref)new_collector->workers[i].snapshot);
+        sem_destroy(&new_collector->completed_sem);
+        free((void*)new_collector);
+        return NULL;
+      }
+      i++;
+    }
+    i = 0;
+    while ( i < source_count ) {
+      lmstat_collector_worker *the_worker = &new_collector->workers[i];
+
+      the_worker->is_running = ( pthread_create(&the_worker->thread, NULL, __lmstat_collector_worker_main, the_worker) == 0 );
+      if ( ! the_worker->is_running ) {
+        //
+        // No thread, so do the work right here:
+        //
+        lmlogf(lmlog_level_warn, "unable to start lmstat worker thread, scanning source %u serially", i);
+        __lmstat_collector_worker_main(the_worker);
+      }
+      i++;
+    }
+  }
+  return (lmstat_collector_ref)new_collector;
+}
+
+//
+
+lmstat_snapshot_ref
+lmstat_collector_next_snapshot(
+  lmstat_collector_ref  the_collector
+)
+{
+  lmstat_collector      *THE_COLLECTOR = (lmstat_collector*)the_collector;
+  lmstat_snapshot       *the_snapshot;
+
+  if ( THE_COLLECTOR->delivered_count >= THE_COLLECTOR->source_count ) return NULL;
+
+  while ( ! THE_COLLECTOR->pending ) {
+    lmstat_snapshot     *stack;
+
+    if ( sem_wait(&THE_COLLECTOR->completed_sem) != 0 ) {
+      if ( errno == EINTR ) continue;
+      lmlogf(lmlog_level_error, "failure while waiting for lmstat snapshot: %s", strerror(errno));
+      return NULL;
+    }
+    //
+    // Take everything that's been pushed so far; the stack is LIFO so
+    // reverse it to hand snapshots out in order of completion:
+    //
+    stack = __atomic_exchange_n(&THE_COLLECTOR->completed, NULL, __ATOMIC_ACQUIRE);
+    while ( stack ) {
+      lmstat_snapshot   *next = stack->link;
+
+      stack->link = THE_COLLECTOR->pending;
+      THE_COLLECTOR->pending = stack;
+      stack = next;
+    }
+  }
+  the_snapshot = THE_COLLECTOR->pending;
+  THE_COLLECTOR->pending = the_snapshot->link;
+  the_snapshot->link = NULL;
+  THE_COLLECTOR->delivered_count++;
+  return (lmstat_snapshot_ref)the_snapshot;
+}
+
+//
+
+void
+lmstat_collector_release(
+  lmstat_collector_ref  the_collector
+)
+{
+  lmstat_collector      *THE_COLLECTOR = (lmstat_collector*)the_collector;
+  lmstat_snapshot_ref   the_snapshot;
+  unsigned int          i = 0;
+
+  while ( i < THE_COLLECTOR->source_count ) {
+    if ( THE_COLLECTOR->workers[i].is_running ) pthread_join(THE_COLLECTOR->workers[i].thread, NULL);
+    i++;
+  }
+  while ( (the_snapshot = lmstat_collector_next_snapshot(the_collector)) ) lmstat_snapshot_release(the_snapshot);
+  sem_destroy(&THE_COLLECTOR->completed_sem);
+  free((void*)THE_COLLECTOR);
+}
@@ -0,0 +1,145 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmstat_collector.h
+ *
+ * Scan one or more lmstat sources concurrently, producing a snapshot
+ * of the feature counts reported by each.
+ *
+ */
+
+#ifndef __LMSTAT_COLLECTOR_H__
+#define __LMSTAT_COLLECTOR_H__
+
+#include "lmconfig.h"
+#include "lmdb.h"
+
+/*!
+  @typedef lmstat_snapshot_options
+  Bit vector of options that control what is captured in a snapshot:
+
+    lmstat_snapshot_option_capture_checkouts
+      the per-user checkout lines are parsed and kept in the snapshot
+*/
+enum {
+  lmstat_snapshot_option_capture_checkouts = 1 << 0
+};
+typedef unsigned int lmstat_snapshot_options;
+
+/*!
+  @typedef lmstat_snapshot_ref
+  Opaque reference to the feature counts parsed from a single lmstat
+  source.
+*/
+typedef const struct _lmstat_snapshot * lmstat_snapshot_ref;
+
+/*!
+  @typedef lmstat_snapshot_iterator
+  Type of a function called on each feature count in an lmstat snapshot.
+  The function should return false to terminate the iteration.
+*/
+typedef bool (*lmstat_snapshot_iterator)(const void *context, const char *feature_string, const char *vendor, const char *version, int in_use, int issued, time_t expiration_date);
+
+/*!
+  @typedef lmstat_snapshot_checkout_iterator
+  Type of a function called on each checkout in an lmstat snapshot.  The
+  function should return false to terminate the iteration.
+*/
+typedef bool (*lmstat_snapshot_checkout_iterator)(const void *context, const char *feature_string, const char *vendor, const char *version, const lmdb_checkout_t *checkout);
+
+/*!
+  @function lmstat_snapshot_create_with_source
+  Open the_source, scan its output and return a snapshot of the feature
+  counts it reported.  Returns NULL only if memory could not be allocated;
+  a source that could not be opened yields an empty snapshot for which
+  lmstat_snapshot_is_ok() returns false.
+*/
+lmstat_snapshot_ref lmstat_snapshot_create_with_source(const lmstat_source *the_source, lmstat_snapshot_options options);
+
+/*!
+  @function lmstat_snapshot_release
+  Dispose of the_snapshot.
+*/
+void lmstat_snapshot_release(lmstat_snapshot_ref the_snapshot);
+
+/*!
+  @function lmstat_snapshot_get_source
+  Returns the lmstat source that was scanned to produce the_snapshot.
+*/
+const lmstat_source* lmstat_snapshot_get_source(lmstat_snapshot_ref the_snapshot);
+
+/*!
+  @function lmstat_snapshot_is_ok
+  Returns true if the source of the_snapshot was opened and scanned.
+*/
+bool lmstat_snapshot_is_ok(lmstat_snapshot_ref the_snapshot);
+
+/*!
+  @function lmstat_snapshot_get_count
+  Returns the number of feature counts present in the_snapshot.
+*/
+unsigned int lmstat_snapshot_get_count(lmstat_snapshot_ref the_snapshot);
+
+/*!
+  @function lmstat_snapshot_iterate
+  Call the iterator function on each feature count in the_snapshot, in the
+  order they were reported by the source.
+*/
+void lmstat_snapshot_iterate(lmstat_snapshot_ref the_snapshot, lmstat_snapshot_iterator iterator, const void *context);
+
+/*!
+  @function lmstat_snapshot_get_checkout_count
+  Returns the number of checkouts present in the_snapshot; always zero
+  unless the snapshot was created with
+  lmstat_snapshot_option_capture_checkouts.
+*/
+unsigned int lmstat_snapshot_get_checkout_count(lmstat_snapshot_ref the_snapshot);
+
+/*!
+  @function lmstat_snapshot_iterate_checkouts
+  Call the iterator function on each checkout in the_snapshot, in the order
+  they were reported by the source.
+*/
+void lmstat_snapshot_iterate_checkouts(lmstat_snapshot_ref the_snapshot, lmstat_snapshot_checkout_iterator iterator, const void *context);
+
+#if 0
+#pragma mark -
+#endif
+
+/*!
+  @typedef lmstat_collector_ref
+  Opaque reference to a set of lmstat sources being scanned concurrently.
+  Each source is scanned by its own worker thread; completed snapshots are
+  handed to the (single) consumer through a lock-free queue, so the caller
+  can apply each one as soon as it is ready.
+*/
+typedef const struct _lmstat_collector * lmstat_collector_ref;
+
+/*!
+  @function lmstat_collector_create
+  Start scanning each of the source_count lmstat sources at sources.  The
+  sources array must remain valid until the collector is released.  The
+  options apply to every snapshot produced.
+
+  Returns NULL on error.
+*/
+lmstat_collector_ref lmstat_collector_create(const lmstat_source *sources, unsigned int source_count, lmstat_snapshot_options options);
+
+/*!
+  @function lmstat_collector_next_snapshot
+  Wait for the next completed snapshot and return it; the caller is
+  responsible for calling lmstat_snapshot_release() on it.  Snapshots are
+  returned in order of completion, not in the order of the sources.
+
+  Returns NULL once a snapshot has been returned for every source.  Only a
+  single thread may consume snapshots from a collector.
+*/
+lmstat_snapshot_ref lmstat_collector_next_snapshot(lmstat_collector_ref the_collector);
+
+/*!
+  @function lmstat_collector_release
+  Wait for all worker threads to finish and dispose of the_collector.  Any
+  snapshots that were not consumed are released.
+*/
+void lmstat_collector_release(lmstat_collector_ref the_collector);
+
+#endif /* __LMSTAT_COLLECTOR_H__ */
@@ -0,0 +1,431 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * debuglog_parser.c
+ *
+ * Parser for the debug log written by lmgrd and the vendor daemons.
+ *
+ */
+
+#include "debuglog_parser.h"
+#include "lmlog.h"
+
+//
+
+typedef struct _debuglog_parser {
+  //
+  // The date lines are currently being logged on:
+  //
+  int             year, month, mday;
+  //
+  // Time of day (in seconds) of the last timestamped line, or -1 if none
+  // has been parsed; while is_bounded, the first line is dated no later
+  // than bound_tod on the reference date:
+  //
+  int             last_tod;
+  bool            is_bounded;
+  int             bound_tod;
+  //
+  // mktime() is only consulted once per hour of log:
+  //
+  int             cached_hour;
+  time_t          cached_hour_start;
+  //
+  time_t          last_timestamp;
+} debuglog_parser;
+
+//
+
+static inline bool
+__debuglog_is_space(
+  char          c
+)
+{
+  return ( c == ' ' || c == '\t' );
+}
+
+//
+
+static inline const char*
+__debuglog_skip_space(
+  const char    *p,
+  const char    *e
+)
+{
+  while ( (p < e) && __debuglog_is_space(*p) ) p++;
+  return p;
+}
+
+//
+
+static inline const char*
+__debuglog_parse_int(
+  const char    *p,
+  const char    *e,
+  int           *value
+)
+{
+  const char    *s = p;
+  int           v = 0;
+
+  while ( (p < e) && (*p >= '0') && (*p <= '9') ) {
+    v = 10 * v + (*p - '0');
+    p++;
+  }
+  if ( p == s ) return NULL;
+  *value = v;
+  return p;
+}
+
+//
+
+/*
+ * If [p, e) starts with token, return the pointer to the first character
+ * following it, otherwise NULL.
+ */
+static inline const char*
+__debuglog_match(
+  const char    *p,
+  const char    *e,
+  const char    *token
+)
+{
+  size_t        token_len = strlen(token);
+
+  if ( ((size_t)(e - p) >= token_len) && (memcmp(p, token, token_len) == 0) ) return p + token_len;
+  return NULL;
+}
+
+//
+
+/*
+ * Parse "<m>/<d>/<yyyy>" at p; returns the pointer to the character that
+ * follows it, or NULL.
+ */
+static const char*
+__debuglog_parse_date(
+  const char    *p,
+  const char    *e,
+  int           *year,
+  int           *month,
+  int           *mday
+)
+{
+  if ( ! (p = __debuglog_parse_int(p, e, month)) || (p >= e) || (*p != '/') ) return NULL;
+  if ( ! (p = __debuglog_parse_int(p + 1, e, mday)) || (p >= e) || (*p != '/') ) return NULL;
+  if ( ! (p = __debuglog_parse_int(p + 1, e, year)) ) return NULL;
+  if ( (*month < 1) || (*month > 12) || (*mday < 1) || (*mday > 31) || (*year < 1970) ) return NULL;
+  return p;
+}
+
+//
+
+void
+__debuglog_parser_set_date(
+  debuglog_parser *the_parser,
+  int             year,
+  int             month,
+  int             mday
+)
+{
+  struct tm       date_conv;
+  time_t          noon;
+
+  //
+  // Normalize via mktime() so that callers can step past the end of a
+  // month:
+  //
+  memset(&date_conv, 0, sizeof(date_conv));
+  date_conv.tm_year = year - 1900;
+  date_conv.tm_mon = month - 1;
+  date_conv.tm_mday = mday;
+  date_conv.tm_hour = 12;
+  date_conv.tm_isdst = -1;
+  noon = mktime(&date_conv);
+  localtime_r(&noon, &date_conv);
+  the_parser->year = date_conv.tm_year + 1900;
+  the_parser->month = date_conv.tm_mon + 1;
+  the_parser->mday = date_conv.tm_mday;
+  the_parser->cached_hour = -1;
+}
+
+//
+
+time_t
+__debuglog_parser_timestamp(
+  debuglog_parser *the_parser,
+  int             tod
+)
+{
+  int             hour = tod / 3600;
+
+  if ( hour != the_parser->cached_hour ) {
+    struct tm     hour_conv;
+
+    memset(&hour_conv, 0, sizeof(hour_conv));
+    hour_conv.tm_year = the_parser->year - 1900;
+    hour_conv.tm_mon = the_parser->month - 1;
+    hour_conv.tm_mday = the_parser->mday;
+    hour_conv.tm_hour = hour;
+    hour_conv.tm_isdst = -1;
+    the_parser->cached_hour_start = mktime(&hour_conv);
+    the_parser->cached_hour = hour;
+  }
+  return the_parser->cached_hour_start + (tod % 3600);
+}
+
+//
+
+/*
+ * The remainder of an OUT/IN/DENIED/UNSUPPORTED line, starting with the
+ * feature name.
+ */
+bool
+__debuglog_parser_license_event(
+  const char      *p,
+  const char      *e,
+  debuglog_event  *the_event
+)
+{
+  const char      *q;
+
+  // Feature name, usually quoted:
+  if ( (p < e) && (*p == '"') ) {
+    p++;
+    if ( ! (q = memchr(p, '"', e - p)) ) return false;
+    the_event->feature.ptr = p;
+    the_event->feature.len = q - p;
+    p = q + 1;
+  } else {
+    q = p;
+    while ( (q < e) && ! __debuglog_is_space(*q) ) q++;
+    the_event->feature.ptr = p;
+    the_event->feature.len = q - p;
+    p = q;
+  }
+  if ( the_event->feature.len == 0 ) return false;
+  p = __debuglog_skip_space(p, e);
+
+  // UNSUPPORTED lines may qualify the request before the user:
+  if ( (p < e) && (*p == '(') ) {
+    if ( ! (q = memchr(p, ')', e - p)) ) return false;
+    p = __debuglog_skip_space(q + 1, e);
+  }
+
+  // <user>@<host>:
+  q = p;
+  while ( (q < e) && ! __debuglog_is_space(*q) ) q++;
+  if ( q == p ) return false;
+  the_event->user.ptr = p;
+  the_event->user.len = q - p;
+  {
+    const char    *at = memchr(p, '@', q - p);
+
+    if ( at ) {
+      the_event->user.len = at - p;
+      the_event->host.ptr = at + 1;
+      the_event->host.len = q - (at + 1);
+    }
+  }
+  p = __debuglog_skip_space(q, e);
+
+  // Anything that follows is parenthesized:
+  if ( (p < e) && (*p == '(') ) {
+    p++;
+    switch ( the_event->kind ) {
+
+      case debuglog_event_kind_out:
+      case debuglog_event_kind_in: {
+        int       count;
+
+        // "(<n> licenses)"; other notes like "(INACTIVE)" are ignored:
+        if ( (q = __debuglog_parse_int(p, e, &count)) && (count > 0) && __debuglog_match(__debuglog_skip_space(q, e), e, "license") ) {
+          the_event->license_count = count;
+        }
+        break;
+      }
+
+      default: {
+        // The reason may itself contain parentheses:
+        q = e;
+        while ( (q > p) && (q[-1] != ')') ) q--;
+        if ( q > p ) q--;
+        else q = e;
+        the_event->reason.ptr = p;
+        the_event->reason.len = q - p;
+        break;
+      }
+
+    }
+  }
+  return true;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+debuglog_parser_ref
+debuglog_parser_create(
+  time_t          reference,
+  bool            is_continuation
+)
+{
+  debuglog_parser *new_parser = malloc(sizeof(debuglog_parser));
+
+  if ( new_parser ) {
+    struct tm     ref_conv;
+    int           ref_tod;
+
+    memset(new_parser, 0, sizeof(debuglog_parser));
+    localtime_r(&reference, &ref_conv);
+    __debuglog_parser_set_date(new_parser, ref_conv.tm_year + 1900, ref_conv.tm_mon + 1, ref_conv.tm_mday);
+    ref_tod = 3600 * ref_conv.tm_hour + 60 * ref_conv.tm_min + ref_conv.tm_sec;
+    if ( is_continuation ) {
+      new_parser->last_tod = ref_tod;
+    } else {
+      new_parser->last_tod = -1;
+      new_parser->is_bounded = true;
+      new_parser->bound_tod = ref_tod;
+    }
+    new_parser->last_timestamp = reference;
+  } else {
+    lmlog(lmlog_level_warn, "debuglog_parser:  unable to allocate a new parser");
+  }
+  return (debuglog_parser_ref)new_parser;
+}
+
+//
+
+void
+debuglog_parser_release(
+  debuglog_parser_ref the_parser
+)
+{
+  free((void*)the_parser);
+}
+
+//
+
+bool
+debuglog_parser_parse_line(
+  debuglog_parser_ref the_parser,
+  const char          *line,
+  size_t              line_len,
+  debuglog_event      *the_event
+)
+{
+  debuglog_parser     *THE_PARSER = (debuglog_parser*)the_parser;
+  const char          *e = line + line_len;
+  const char          *p, *q;
+  int                 hour, minute, second, tod;
+  int                 year, month, mday;
+  lmstat_field        vendor;
+
+  while ( (e > line) && ((e[-1] == '\n') || (e[-1] == '\r')) ) e--;
+  p = __debuglog_skip_space(line, e);
+
+  //
+  // Every line of interest starts "<H>:<MM>:<SS> (<daemon>) ":
+  //
+  if ( ! (p = __debuglog_parse_int(p, e, &hour)) || (p >= e) || (*p != ':') ) return false;
+  if ( ! (p = __debuglog_parse_int(p + 1, e, &minute)) || (p >= e) || (*p != ':') ) return false;
+  if ( ! (p = __debuglog_parse_int(p + 1, e, &second)) ) return false;
+  if ( (hour > 23) || (minute > 59) || (second > 60) ) return false;
+  p = __debuglog_skip_space(p, e);
+  if ( (p >= e) || (*p != '(') || ! (q = memchr(p, ')', e - p)) ) return false;
+  vendor.ptr = p + 1;
+  vendor.len = q - vendor.ptr;
+  p = __debuglog_skip_space(q + 1, e);
+
+  //
+  // Track the date:  a time of day well before the last one means the log
+  // has crossed midnight.  (Allow for the hour repeated when daylight
+  // saving time ends.)
+  //
+  tod = 3600 * hour + 60 * minute + second;
+  if ( THE_PARSER->is_bounded ) {
+    if ( tod > THE_PARSER->bound_tod ) __debuglog_parser_set_date(THE_PARSER, THE_PARSER->year, THE_PARSER->month, THE_PARSER->mday - 1);
+    THE_PARSER->is_bounded = false;
+  } else if ( (THE_PARSER->last_tod >= 0) && (tod + 2 * 3600 < THE_PARSER->last_tod) ) {
+    __debuglog_parser_set_date(THE_PARSER, THE_PARSER->year, THE_PARSER->month, THE_PARSER->mday + 1);
+  }
+  THE_PARSER->last_tod = tod;
+
+  memset(the_event, 0, sizeof(debuglog_event));
+  the_event->license_count = 1;
+  switch ( *p ) {
+
+    case 'O':
+      if ( (q = __debuglog_match(p, e, "OUT:")) ) the_event->kind = debuglog_event_kind_out;
+      break;
+
+    case 'I':
+      if ( (q = __debuglog_match(p, e, "IN:")) ) the_event->kind = debuglog_event_kind_in;
+      break;
+
+    case 'D':
+      if ( (q = __debuglog_match(p, e, "DENIED:")) ) the_event->kind = debuglog_event_kind_denied;
+      break;
+
+    case 'U':
+      if ( (q = __debuglog_match(p, e, "UNSUPPORTED:")) ) the_event->kind = debuglog_event_kind_unsupported;
+      break;
+
+    case 'E':
+      if ( __debuglog_match(p, e, "EXITING") ) the_event->kind = debuglog_event_kind_vendor_exit;
+      break;
+
+    case 'T':
+      if ( (q = __debuglog_match(p, e, "TIMESTAMP ")) && __debuglog_parse_date(__debuglog_skip_space(q, e), e, &year, &month, &mday) ) {
+        __debuglog_parser_set_date(THE_PARSER, year, month, mday);
+      }
+      break;
+
+    default: {
+      //
+      // lmgrd's startup line ends with the date:
+      //
+      //   (lmgrd) FLEXnet Licensing (v11.16.2.0 build 242433 x64_lsb) started on host (linux) (10/16/2026)
+      //
+      if ( (e > p) && (e[-1] == ')') && memmem(p, e - p, "started on", 10) ) {
+        q = e - 1;
+        while ( (q > p) && (q[-1] != '(') ) q--;
+        if ( (q > p) && (__debuglog_parse_date(q, e - 1, &year, &month, &mday) == e - 1) ) {
+          __debuglog_parser_set_date(THE_PARSER, year, month, mday);
+        }
+      }
+      break;
+    }
+
+  }
+  THE_PARSER->last_timestamp = __debuglog_parser_timestamp(THE_PARSER, tod);
+
+  switch ( the_event->kind ) {
+
+    case debuglog_event_kind_none:
+      return false;
+
+    case debuglog_event_kind_vendor_exit:
+      break;
+
+    default:
+      if ( ! __debuglog_parser_license_event(__debuglog_skip_space(q, e), e, the_event) ) return false;
+      break;
+
+  }
+  the_event->timestamp = THE_PARSER->last_timestamp;
+  the_event->vendor = vendor;
+  return true;
+}
+
+//
+
+time_t
+debuglog_parser_get_timestamp(
+  debuglog_parser_ref the_parser
+)
+{
+  return the_parser->last_timestamp;
+}
@@ -0,0 +1,111 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * debuglog_parser.h
+ *
+ * Parser for the debug log written by lmgrd and the vendor daemons.  Each
+ * line is parsed on its own; the date (most lines carry only a time of day)
+ * is tracked across lines by the parser.
+ *
+ */
+
+#ifndef __DEBUGLOG_PARSER_H__
+#define __DEBUGLOG_PARSER_H__
+
+#include "config.h"
+#include "lmstat_parser.h"
+
+/*!
+  @typedef debuglog_event_kind
+  The license events recognized in a debug log:
+
+    debuglog_event_kind_out
+      "<time> (<vendor>) OUT: "<feature>" <user>@<host>  {(<n> licenses)}"
+
+    debuglog_event_kind_in
+      "<time> (<vendor>) IN: "<feature>" <user>@<host>  {(<n> licenses)}"
+
+    debuglog_event_kind_denied
+      "<time> (<vendor>) DENIED: "<feature>" <user>@<host>  (<reason>)"
+
+    debuglog_event_kind_unsupported
+      "<time> (<vendor>) UNSUPPORTED: "<feature>" {(<qualifier>)} <user>@<host>  (<reason>)"
+
+    debuglog_event_kind_vendor_exit
+      "<time> (<vendor>) EXITING ..." -- all of the vendor's licenses have
+      been returned
+*/
+typedef enum {
+  debuglog_event_kind_none = 0,
+  debuglog_event_kind_out,
+  debuglog_event_kind_in,
+  debuglog_event_kind_denied,
+  debuglog_event_kind_unsupported,
+  debuglog_event_kind_vendor_exit
+} debuglog_event_kind;
+
+/*!
+  @typedef debuglog_event
+  An event parsed from a debug log line.  The fields point into the line
+  that was parsed (see lmstat_field) and are absent when not applicable to
+  the kind of event.  The license_count is 1 unless the line said otherwise.
+*/
+typedef struct {
+  debuglog_event_kind   kind;
+  time_t                timestamp;
+  lmstat_field          vendor;
+  lmstat_field          feature;
+  lmstat_field          user;
+  lmstat_field          host;
+  lmstat_field          reason;
+  int                   license_count;
+} debuglog_event;
+
+/*!
+  @typedef debuglog_parser_ref
+  Type of an opaque reference to a debug log parser.
+*/
+typedef const struct _debuglog_parser * debuglog_parser_ref;
+
+/*!
+  @function debuglog_parser_create
+  Create a new parser.  Log lines are dated by the "TIMESTAMP <m>/<d>/<yyyy>"
+  lines the daemons write periodically and by the date on lmgrd's startup
+  line; between those the date is advanced when the time of day wraps past
+  midnight.  Until a date has been seen, reference provides it:
+
+    - if is_continuation is true, the first line parsed follows a line logged
+      at reference (e.g. the last line ingested from the same log)
+    - otherwise reference is an upper bound on the time of the first line
+      (e.g. the modification time of the log) and the first line is dated no
+      later than it
+
+  Returns NULL in case of any error.
+*/
+debuglog_parser_ref debuglog_parser_create(time_t reference, bool is_continuation);
+
+/*!
+  @function debuglog_parser_release
+  Dispose of the_parser.
+*/
+void debuglog_parser_release(debuglog_parser_ref the_parser);
+
+/*!
+  @function debuglog_parser_parse_line
+  Parse the line of line_len characters at line.  The line need not be
+  NUL-terminated; trailing CR/NL characters are ignored.
+
+  Returns true and fills-in the_event if the line contained a license
+  event; returns false for every other line.
+*/
+bool debuglog_parser_parse_line(debuglog_parser_ref the_parser, const char *line, size_t line_len, debuglog_event *the_event);
+
+/*!
+  @function debuglog_parser_get_timestamp
+  Returns the time at which the last timestamped line parsed by the_parser
+  was logged (the reference time if no such line has been parsed).  Passing
+  this to debuglog_parser_create() with is_continuation true resumes dating
+  lines where the_parser left off.
+*/
+time_t debuglog_parser_get_timestamp(debuglog_parser_ref the_parser);
+
+#endif /* __DEBUGLOG_PARSER_H__ */
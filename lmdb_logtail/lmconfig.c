@@ -0,0 +1 @@
+../common/lmconfig.c
\ No newline at end of file
@@ -0,0 +1,510 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmdb_logtail.c
+ *
+ * Ingest license events from a license server debug log.  The position
+ * reached in the log is saved in the database with the counts it
+ * produced, so each run resumes exactly where the last one stopped.
+ *
+ */
+
+#include "lmconfig.h"
+#include "lmdb.h"
+#include "lmlog.h"
+#include "fscanln.h"
+#include "util_fns.h"
+#include "debuglog_parser.h"
+
+#include <signal.h>
+#include <poll.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+//
+
+/*
+ * Lines are ingested in batches, each committed in one transaction with
+ * the checkpoint that covers it:
+ */
+#ifndef LMDB_LOGTAIL_BATCH_LINES
+#define LMDB_LOGTAIL_BATCH_LINES        10000
+#endif
+
+/*
+ * When following, the log is checked this often even if no inotify event
+ * arrives (e.g. on filesystems that don't generate them):
+ */
+#ifndef LMDB_LOGTAIL_RECHECK_INTERVAL
+#define LMDB_LOGTAIL_RECHECK_INTERVAL   60
+#endif
+
+//
+
+typedef struct {
+  lmdb_ref              the_db;
+  const char            *log_path;
+  //
+  FILE                  *fptr;
+  fscanln_ref           scanner;
+  dev_t                 device;
+  ino_t                 inode;
+  debuglog_parser_ref   parser;
+  //
+  // Features with changed in-use counts are committed once all of the
+  // events logged at the same second have been applied:
+  //
+  bool                  has_pending_counts;
+  time_t                pending_timestamp;
+  //
+  unsigned long         line_count, out_count, in_count, denial_count;
+} logtail;
+
+//
+
+bool
+logtail_open(
+  logtail       *the_tail,
+  off_t         offset
+)
+{
+  struct stat   finfo;
+
+  if ( ! (the_tail->fptr = fopen(the_tail->log_path, "r")) ) {
+    lmlogf(lmlog_level_error, "unable to open debug log %s: %s", the_tail->log_path, strerror(errno));
+    return false;
+  }
+  if ( fstat(fileno(the_tail->fptr), &finfo) != 0 ) {
+    lmlogf(lmlog_level_error, "unable to stat debug log %s: %s", the_tail->log_path, strerror(errno));
+    goto exit_on_error;
+  }
+  the_tail->device = finfo.st_dev;
+  the_tail->inode = finfo.st_ino;
+  if ( (offset > 0) && (lseek(fileno(the_tail->fptr), offset, SEEK_SET) != offset) ) {
+    lmlogf(lmlog_level_error, "unable to seek to offset %lld in debug log %s: %s", (long long)offset, the_tail->log_path, strerror(errno));
+    goto exit_on_error;
+  }
+  //
+  // Always following, so that a line still being written when we reach the
+  // end of the log is left for next time:
+  //
+  if ( ! (the_tail->scanner = fscanln_create(the_tail->fptr, true)) ) goto exit_on_error;
+  fscanln_set_is_following(the_tail->scanner, true);
+  LMDEBUG("opened debug log %s (inode %llu) at offset %lld", the_tail->log_path, (unsigned long long)the_tail->inode, (long long)offset);
+  return true;
+
+exit_on_error:
+  fclose(the_tail->fptr);
+  the_tail->fptr = NULL;
+  return false;
+}
+
+//
+
+void
+logtail_close(
+  logtail       *the_tail
+)
+{
+  if ( the_tail->scanner ) {
+    fscanln_release(the_tail->scanner);
+  } else if ( the_tail->fptr ) {
+    fclose(the_tail->fptr);
+  }
+  the_tail->scanner = NULL;
+  the_tail->fptr = NULL;
+}
+
+//
+
+/*
+ * Open the log at the checkpoint saved in the database (or the start of the
+ * log if it has been rotated or truncated since) and create the parser.
+ */
+bool
+logtail_resume(
+  logtail                 *the_tail
+)
+{
+  lmdb_log_checkpoint_t   checkpoint;
+  struct stat             finfo;
+
+  if ( ! lmdb_get_log_checkpoint(the_tail->the_db, the_tail->log_path, &checkpoint) ) return false;
+  if ( stat(the_tail->log_path, &finfo) != 0 ) {
+    lmlogf(lmlog_level_error, "unable to stat debug log %s: %s", the_tail->log_path, strerror(errno));
+    return false;
+  }
+  if ( checkpoint.inode && (checkpoint.device == finfo.st_dev) && (checkpoint.inode == finfo.st_ino) && (checkpoint.offset <= finfo.st_size) ) {
+    lmlogf(lmlog_level_info, "resuming debug log %s at offset %lld", the_tail->log_path, (long long)checkpoint.offset);
+    the_tail->parser = debuglog_parser_create(checkpoint.event_timestamp, true);
+  } else {
+    if ( checkpoint.inode ) {
+      lmlogf(lmlog_level_info, "debug log %s was rotated or truncated, starting from its beginning", the_tail->log_path);
+    } else {
+      lmlogf(lmlog_level_info, "starting debug log %s from its beginning", the_tail->log_path);
+    }
+    checkpoint.offset = 0;
+    the_tail->parser = debuglog_parser_create(finfo.st_mtime, false);
+  }
+  if ( ! the_tail->parser ) return false;
+  return logtail_open(the_tail, checkpoint.offset);
+}
+
+//
+
+bool
+logtail_commit_pending_counts(
+  logtail       *the_tail
+)
+{
+  if ( the_tail->has_pending_counts ) {
+    the_tail->has_pending_counts = false;
+    return lmdb_commit_counts(the_tail->the_db, the_tail->pending_timestamp);
+  }
+  return true;
+}
+
+//
+
+struct logtail_vendor_exit_context {
+  const char    *vendor;
+  bool          was_changed;
+};
+
+bool
+logtail_vendor_exit_iterator(
+  const void    *context,
+  lmfeature_ref a_feature
+)
+{
+  struct logtail_vendor_exit_context  *CONTEXT = (struct logtail_vendor_exit_context*)context;
+
+  if ( (lmfeature_get_in_use(a_feature) != 0) && (strcmp(lmfeature_get_vendor(a_feature), CONTEXT->vendor) == 0) ) {
+    lmfeature_set_in_use(a_feature, 0);
+    CONTEXT->was_changed = true;
+  }
+  return true;
+}
+
+//
+
+bool
+logtail_apply_event(
+  logtail               *the_tail,
+  const debuglog_event  *the_event
+)
+{
+  char                  *vendor = lmstat_field_strdup(the_event->vendor);
+  char                  *feature_string = NULL, *user = NULL, *host = NULL, *reason = NULL;
+  lmfeature_ref         the_feature = NULL;
+  bool                  ok = false;
+
+  if ( ! vendor ) goto exit_on_error;
+
+  //
+  // Counts changed by earlier events are recorded at their own timestamp:
+  //
+  if ( the_tail->has_pending_counts && (the_event->timestamp != the_tail->pending_timestamp) ) {
+    if ( ! logtail_commit_pending_counts(the_tail) ) goto exit_on_error;
+  }
+
+  if ( the_event->kind == debuglog_event_kind_vendor_exit ) {
+    struct logtail_vendor_exit_context  context = { .vendor = vendor, .was_changed = false };
+
+    //
+    // The vendor daemon going away returns all of its licenses:
+    //
+    lmfeatureset_iterate(lmdb_get_features(the_tail->the_db), logtail_vendor_exit_iterator, &context);
+    if ( context.was_changed ) {
+      the_tail->has_pending_counts = true;
+      the_tail->pending_timestamp = the_event->timestamp;
+    }
+    ok = true;
+    goto exit_on_error;
+  }
+
+  if ( ! (feature_string = lmstat_field_strdup(the_event->feature)) ) goto exit_on_error;
+  if ( ! (the_feature = lmdb_get_feature_by_vendor(the_tail->the_db, feature_string, vendor)) ) {
+    lmlogf(lmlog_level_error, "unable to find or add feature %s for vendor %s", feature_string, vendor);
+    goto exit_on_error;
+  }
+
+  switch ( the_event->kind ) {
+
+    case debuglog_event_kind_out:
+      lmfeature_add_in_use(the_feature, the_event->license_count);
+      the_tail->has_pending_counts = true;
+      the_tail->pending_timestamp = the_event->timestamp;
+      the_tail->out_count++;
+      ok = true;
+      break;
+
+    case debuglog_event_kind_in: {
+      int         in_use = lmfeature_get_in_use(the_feature) - the_event->license_count;
+
+      //
+      // Checkouts made before the log began are not known:
+      //
+      lmfeature_set_in_use(the_feature, (in_use > 0) ? in_use : 0);
+      the_tail->has_pending_counts = true;
+      the_tail->pending_timestamp = the_event->timestamp;
+      the_tail->in_count++;
+      ok = true;
+      break;
+    }
+
+    case debuglog_event_kind_denied:
+    case debuglog_event_kind_unsupported:
+      if ( the_event->user.ptr && ! (user = lmstat_field_strdup(the_event->user)) ) goto exit_on_error;
+      if ( the_event->host.ptr && ! (host = lmstat_field_strdup(the_event->host)) ) goto exit_on_error;
+      if ( the_event->reason.ptr && ! (reason = lmstat_field_strdup(the_event->reason)) ) goto exit_on_error;
+      ok = lmdb_add_denial(the_tail->the_db, the_feature, user, host, reason, (the_event->kind == debuglog_event_kind_unsupported), the_event->timestamp);
+      if ( ok ) the_tail->denial_count++;
+      break;
+
+    default:
+      ok = true;
+      break;
+
+  }
+
+exit_on_error:
+  if ( vendor ) free((void*)vendor);
+  if ( feature_string ) free((void*)feature_string);
+  if ( user ) free((void*)user);
+  if ( host ) free((void*)host);
+  if ( reason ) free((void*)reason);
+  return ok;
+}
+
+//
+
+/*
+ * Ingest complete lines until the end of the log is reached.  Each batch of
+ * lines is written in a single transaction along with the checkpoint that
+ * follows it, so a line's effects are recorded exactly once.
+ */
+bool
+logtail_ingest(
+  logtail       *the_tail
+)
+{
+  bool          is_more = true;
+
+  while ( is_more ) {
+    unsigned long         batch_lines = 0;
+    const char            *line;
+    size_t                line_len;
+    debuglog_event        event;
+    lmdb_log_checkpoint_t checkpoint;
+    bool                  ok = true;
+
+    if ( ! lmdb_begin_batch(the_tail->the_db) ) return false;
+    while ( (is_more = fscanln_get_line_span(the_tail->scanner, &line, &line_len)) ) {
+      batch_lines++;
+      if ( debuglog_parser_parse_line(the_tail->parser, line, line_len, &event) ) {
+        if ( ! (ok = logtail_apply_event(the_tail, &event)) ) break;
+      }
+      if ( batch_lines >= LMDB_LOGTAIL_BATCH_LINES ) break;
+    }
+    if ( ok ) ok = logtail_commit_pending_counts(the_tail);
+    if ( ok ) {
+      checkpoint.device = the_tail->device;
+      checkpoint.inode = the_tail->inode;
+      checkpoint.offset = fscanln_get_offset(the_tail->scanner);
+      checkpoint.event_timestamp = debuglog_parser_get_timestamp(the_tail->parser);
+      ok = lmdb_set_log_checkpoint(the_tail->the_db, the_tail->log_path, &checkpoint);
+    }
+    if ( ! lmdb_end_batch(the_tail->the_db, ok) ) {
+      //
+      // The in-memory counts no longer match the database, so give up;
+      // the next run resumes from the last checkpoint that was committed:
+      //
+      lmlog(lmlog_level_error, "failed to commit debug log batch");
+      return false;
+    }
+    the_tail->line_count += batch_lines;
+    if ( batch_lines ) LMDEBUG("committed %lu line(s) of debug log through offset %lld", batch_lines, (long long)checkpoint.offset);
+  }
+  return true;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+static volatile sig_atomic_t  logtail_should_exit = 0;
+
+void
+logtail_signal_handler(
+  int     signum
+)
+{
+  (void)signum;
+  logtail_should_exit = 1;
+}
+
+//
+
+/*
+ * Returns true if the log at the_tail's path is no longer the file being
+ * read (it was rotated) or has become shorter than what has been read (it
+ * was truncated in place).
+ */
+bool
+logtail_was_replaced(
+  logtail       *the_tail
+)
+{
+  struct stat   finfo;
+
+  if ( stat(the_tail->log_path, &finfo) != 0 ) return false;
+  if ( (finfo.st_dev != the_tail->device) || (finfo.st_ino != the_tail->inode) ) {
+    lmlogf(lmlog_level_info, "debug log %s was rotated", the_tail->log_path);
+    return true;
+  }
+  if ( finfo.st_size < fscanln_get_offset(the_tail->scanner) ) {
+    lmlogf(lmlog_level_info, "debug log %s was truncated", the_tail->log_path);
+    return true;
+  }
+  return false;
+}
+
+//
+
+int
+logtail_follow(
+  logtail       *the_tail
+)
+{
+  struct sigaction    sa;
+  char                dir_path[strlen(the_tail->log_path) + 1];
+  int                 inotify_fd, file_wd = -1, rc = 0;
+
+  //
+  // No SA_RESTART, so a signal interrupts the wait for log activity:
+  //
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = logtail_signal_handler;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+
+  if ( (inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) < 0 ) {
+    lmlogf(lmlog_level_error, "unable to initialize inotify: %s", strerror(errno));
+    return errno;
+  }
+  //
+  // Watch the directory, too, so the replacement for a rotated log is
+  // noticed as soon as it is created:
+  //
+  strcpy(dir_path, the_tail->log_path);
+  if ( inotify_add_watch(inotify_fd, dirname(dir_path), IN_CREATE | IN_MOVED_TO) < 0 ) {
+    lmlogf(lmlog_level_warn, "unable to watch directory containing %s: %s", the_tail->log_path, strerror(errno));
+  }
+
+  lmlogf(lmlog_level_info, "following debug log %s", the_tail->log_path);
+  while ( ! logtail_should_exit ) {
+    struct pollfd     pfd = { .fd = inotify_fd, .events = POLLIN };
+    char              events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    if ( file_wd < 0 ) {
+      file_wd = inotify_add_watch(inotify_fd, the_tail->log_path, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    }
+    if ( ! logtail_ingest(the_tail) ) {
+      rc = EIO;
+      break;
+    }
+    if ( logtail_was_replaced(the_tail) ) {
+      //
+      // Pick up anything written to the old file since it was last read
+      // (the daemon may not have switched files yet when we noticed) and
+      // carry on at the start of the new file:
+      //
+      if ( ! logtail_ingest(the_tail) ) {
+        rc = EIO;
+        break;
+      }
+      logtail_close(the_tail);
+      if ( file_wd >= 0 ) inotify_rm_watch(inotify_fd, file_wd);
+      file_wd = -1;
+      if ( ! logtail_open(the_tail, 0) ) {
+        rc = ENOENT;
+        break;
+      }
+      continue;
+    }
+    if ( poll(&pfd, 1, LMDB_LOGTAIL_RECHECK_INTERVAL * 1000) > 0 ) {
+      // Only the wakeup matters, not what the events were:
+      while ( read(inotify_fd, events, sizeof(events)) > 0 );
+    }
+  }
+  close(inotify_fd);
+  lmlog(lmlog_level_info, "no longer following debug log");
+  return rc;
+}
+
+//
+
+int
+main(
+  int           argc,
+  char * const  argv[]
+)
+{
+  lmconfig      *the_conf = lmconfig_update_with_options(NULL, argc, argv);
+  int           rc = 0;
+
+  //
+  // Now update from whatever configuration file we're supposed to be
+  // using:
+  //
+  if ( file_exists(the_conf->base_config_path) ) the_conf = lmconfig_update_with_file(the_conf, the_conf->base_config_path);
+
+  //
+  // Command line arguments also override whatever may have been in a
+  // configure file:
+  //
+  the_conf = lmconfig_update_with_options(the_conf, argc, argv);
+
+  if ( ! the_conf ) return EINVAL;
+  if ( ! the_conf->license_db_path ) {
+    lmlog(lmlog_level_error, "No license database configured");
+    rc = EINVAL;
+  } else if ( ! the_conf->debug_log_path ) {
+    lmlog(lmlog_level_error, "No debug log configured");
+    rc = EINVAL;
+  } else {
+    logtail       the_tail;
+
+    memset(&the_tail, 0, sizeof(the_tail));
+    the_tail.log_path = the_conf->debug_log_path;
+    the_tail.the_db = lmdb_create_with_options(the_conf->license_db_path, &the_conf->db_options);
+    if ( the_tail.the_db ) {
+      //
+      // Events adjust the counts most recently recorded for each feature:
+      //
+      if ( lmdb_enable_log_ingest(the_tail.the_db) && lmdb_load_last_counts(the_tail.the_db) && logtail_resume(&the_tail) ) {
+        if ( ! logtail_ingest(&the_tail) ) {
+          rc = EIO;
+        } else if ( the_conf->should_follow ) {
+          rc = logtail_follow(&the_tail);
+        }
+        lmlogf(lmlog_level_info, "ingested %lu line(s) of debug log: %lu checkout(s), %lu checkin(s), %lu denial(s)",
+            the_tail.line_count, the_tail.out_count, the_tail.in_count, the_tail.denial_count
+          );
+        logtail_close(&the_tail);
+      } else {
+        rc = EIO;
+      }
+      if ( the_tail.parser ) debuglog_parser_release(the_tail.parser);
+      lmdb_release(the_tail.the_db);
+    } else {
+      rc = EIO;
+    }
+  }
+  lmconfig_dealloc(the_conf);
+  return rc;
+}
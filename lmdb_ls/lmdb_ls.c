@@ -22,7 +22,24 @@ bool feature_iterator(
 {
   lmconfig        *the_conf = (lmconfig*)context;
   
-  if ( the_conf->name_only ) {
+  if ( the_conf->as_json ) {
+    //
+    // One object per line, with the keys lmdb_report uses:
+    //
+    if ( the_conf->name_only ) {
+      fputs("{\"feature\":", stdout);
+    } else {
+      printf("{\"id\":%d,\"feature\":", lmfeature_get_feature_id(a_feature));
+    }
+    fputs_json_string(lmfeature_get_feature_string(a_feature), stdout);
+    if ( ! the_conf->name_only ) {
+      fputs(",\"vendor\":", stdout);
+      fputs_json_string(lmfeature_get_vendor(a_feature), stdout);
+      fputs(",\"version\":", stdout);
+      fputs_json_string(lmfeature_get_version(a_feature), stdout);
+    }
+    fputs("}\n", stdout);
+  } else if ( the_conf->name_only ) {
     printf("%s\n",
         lmfeature_get_feature_string(a_feature)
       );
@@ -89,7 +106,7 @@ main(
     // If a database file was present, get it opened.  If there was
     // no file, at least open an in-memory database:
     //
-    the_database = lmdb_create_read_only(the_conf->license_db_path);
+    the_database = lmdb_create_read_only_with_options(the_conf->license_db_path, &the_conf->db_options);
     if ( the_database ) {
       lmdb_predicate_ref  predicate = NULL;
       lmfeatureset_ref    the_features;
@@ -212,7 +212,7 @@ main(
     // If a database file was present, get it opened.  If there was
     // no file, at least open an in-memory database:
     //
-    the_database = lmdb_create_read_only(the_conf->license_db_path);
+    the_database = lmdb_create_read_only_with_options(the_conf->license_db_path, &the_conf->db_options);
     if ( the_database ) {
       lmdb_usage_report_ref		the_report;
       
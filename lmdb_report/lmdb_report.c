@@ -10,6 +10,7 @@
 #include "fscanln.h"
 #include "lmdb.h"
 #include "lmlog.h"
+#include "mempool.h"
 #include "util_fns.h"
 
 #include <math.h>
@@ -258,56 +259,1050 @@ column_calc_range_iterator(
 
 //
 
+void
+csv_print_headers(
+	display_field_control		*ctl,
+	bool										is_ranged
+)
+{
+	int						i;
+	const char		*comma = "";
+	
+	if ( is_ranged ) {
+		for ( i = display_field_feature_id; i < display_field_max; i++ ) {
+			if ( ! ctl->disable[i] ) {
+				switch ( i ) {
+					case display_field_in_use:
+					case display_field_issued:
+					case display_field_percentage:
+						printf("%1$s\"%2$s min\",\"%2$s max\",\"%2$s avg\"", comma, display_field_header[i]);
+						break;
+					case display_field_check_timestamp:
+						printf("%1$s\"%2$s start\",\"%2$s end\"", comma, display_field_header[i]);
+						break;
+					default:
+						printf("%s\"%s\"", comma, display_field_header[i]);
+						break;
+				}
+				comma = ",";
+			}
+		}
+	} else {
+		for ( i = display_field_feature_id; i < display_field_max; i++ ) {
+			if ( ! ctl->disable[i] ) {
+				printf("%s\"%s\"", comma, display_field_header[i]);
+				comma = ",";
+			}
+		}
+	}
+	fputc('\n', stdout);
+}
+
+//
+
+/*
+ * Report rows are printed by a plan compiled once from the display field
+ * control:  one step per displayed field, each a small emitter specialised
+ * for the output format, whether the report is ranged, and the field's
+ * width.  Emitters append to a large output buffer with hand-rolled integer,
+ * fixed-point, and timestamp formatting that produces exactly what the
+ * printf() formats they replace would; the few values whose rounding could
+ * differ (ties, division by zero) are handed to snprintf().
+ *
+ * Output is flushed in chunks that start small, so the first rows reach
+ * the reader at once, and double up to the size of the buffer.
+ */
+#ifndef REPORT_OUTPUT_BUFFER_SIZE
+#define REPORT_OUTPUT_BUFFER_SIZE (1024 * 1024)
+#endif
+
+#ifndef REPORT_OUTPUT_FIRST_FLUSH
+#define REPORT_OUTPUT_FIRST_FLUSH 4096
+#endif
+
+#ifndef REPORT_DAY_CACHE_SIZE
+#define REPORT_DAY_CACHE_SIZE     64
+#endif
+
+/*
+ * Local-time conversions are memoised per day:  a day whose UTC offset is
+ * constant from midnight through 23:59:59 remembers its midnight and its
+ * "YYYY-mm-dd " prefix, and any timestamp that falls in it is formatted
+ * from those.  Days with an offset change fall back to localtime_r().
+ */
+typedef struct {
+  time_t          start, end;
+  int             prefix_len;
+  char            prefix[32];
+} report_day;
+
+typedef struct _report_plan report_plan;
+typedef struct _report_plan_step report_plan_step;
+
+typedef struct {
+  int               feature_id;
+  const char        *strings[display_field_max];
+  lmdb_int_range_t  ranges[display_field_max];
+  time_t            expiration_timestamp;
+  lmdb_time_range_t check_timestamp;
+} report_plan_row;
+
+typedef void (*report_emitter_fn)(report_plan *plan, const report_plan_step *step, const report_plan_row *row);
+
+struct _report_plan_step {
+  report_emitter_fn emit;
+  display_field     field;
+  const char        *leading;           /* field separator and/or key */
+  size_t            leading_len;
+  int               width;
+  int               sub_width, extra;     /* min/max/avg triples */
+};
+
+struct _report_plan {
+  char              *buffer;
+  size_t            used, capacity, flush_at;
+  bool              is_okay;
+  const char        *row_start, *row_end;
+  report_day        days[REPORT_DAY_CACHE_SIZE];
+  unsigned int      step_count;
+  report_plan_step  steps[display_field_max];
+};
+
+//
+
+bool
+report_plan_flush(
+  report_plan       *plan
+)
+{
+  if ( plan->used ) {
+    if ( (fwrite(plan->buffer, 1, plan->used, stdout) != plan->used) || fflush(stdout) ) plan->is_okay = false;
+    plan->used = 0;
+  }
+  return plan->is_okay;
+}
+
+//
+
+/*
+ * Ensure there is room for another n bytes in the output buffer.
+ */
+static inline bool
+report_plan_reserve(
+  report_plan       *plan,
+  size_t            n
+)
+{
+  if ( plan->used + n > plan->capacity ) {
+    report_plan_flush(plan);
+    if ( n > plan->capacity ) {
+      char          *new_buffer = realloc(plan->buffer, n);
+      
+      if ( ! new_buffer ) return false;
+      plan->buffer = new_buffer;
+      plan->capacity = n;
+    }
+  }
+  return true;
+}
+
+//
+
+static inline void
+report_plan_put_char(
+  report_plan       *plan,
+  char              c
+)
+{
+  if ( report_plan_reserve(plan, 1) ) plan->buffer[plan->used++] = c;
+}
+
+//
+
+static inline void
+report_plan_put_bytes(
+  report_plan       *plan,
+  const char        *s,
+  size_t            n
+)
+{
+  if ( report_plan_reserve(plan, n) ) {
+    memcpy(plan->buffer + plan->used, s, n);
+    plan->used += n;
+  }
+}
+
+//
+
+static inline void
+report_plan_put_leading(
+  report_plan             *plan,
+  const report_plan_step  *step
+)
+{
+  report_plan_put_bytes(plan, step->leading, step->leading_len);
+}
+
+//
+
+static inline void
+report_plan_put_padded(
+  report_plan       *plan,
+  const char        *s,
+  size_t            n,
+  int               width
+)
+{
+  size_t            pad = ( width > 0 && (size_t)width > n ) ? (size_t)width - n : 0;
+  
+  if ( report_plan_reserve(plan, pad + n) ) {
+    memset(plan->buffer + plan->used, ' ', pad);
+    memcpy(plan->buffer + plan->used + pad, s, n);
+    plan->used += pad + n;
+  }
+}
+
+//
+
+/*
+ * Write value in decimal at the end of the 24-byte buffer s; returns the
+ * offset of the first digit.
+ */
+static inline int
+report_plan_format_int(
+  char              *s,
+  long long int     value
+)
+{
+  unsigned long long int  v = ( value < 0 ) ? -(unsigned long long int)value : (unsigned long long int)value;
+  int               i = 24;
+  
+  do {
+    s[--i] = '0' + (v % 10);
+    v /= 10;
+  } while ( v );
+  if ( value < 0 ) s[--i] = '-';
+  return i;
+}
+
+//
+
+static inline void
+report_plan_put_int(
+  report_plan       *plan,
+  long long int     value,
+  int               width
+)
+{
+  char              s[24];
+  int               i = report_plan_format_int(s, value);
+  
+  report_plan_put_padded(plan, s + i, 24 - i, width);
+}
+
+//
+
+/*
+ * Equivalent to (int)ceil(100.0 * (double)in_use / (double)issued).
+ */
+static inline int
+report_plan_percent_ceil(
+  int               in_use,
+  int               issued
+)
+{
+  if ( (in_use >= 0) && (issued > 0) ) {
+    long long int   pct = (100LL * in_use + issued - 1) / issued;
+    
+    if ( pct <= INT_MAX ) return (int)pct;
+  }
+  return (int)ceil(100.0 * (double)in_use / (double)issued);
+}
+
+//
+
+/*
+ * Equivalent to printf("%.3f", scale * (double)in_use / (double)issued) with
+ * a scale of 1 or 100.  The rational value is rounded to three places
+ * directly; only an exact tie -- where the double's representation error
+ * decides the rounding -- is left to snprintf().  If non_finite is not NULL
+ * it is written in place of an infinite or NaN value.
+ */
+static inline void
+report_plan_put_fixed3(
+  report_plan       *plan,
+  int               in_use,
+  int               issued,
+  int               scale,
+  const char        *non_finite
+)
+{
+  double            value;
+  char              s[64];
+  int               n;
+  
+  if ( (in_use >= 0) && (issued > 0) ) {
+    long long int   num = 1000LL * scale * in_use;
+    long long int   q = num / issued, r = num % issued;
+    
+    if ( 2 * r != issued ) {
+      int           i;
+      
+      if ( 2 * r > issued ) q++;
+      i = report_plan_format_int(s, q / 1000);
+      n = 24 - i;
+      memmove(s, s + i, n);
+      s[n++] = '.';
+      s[n++] = '0' + (q / 100) % 10;
+      s[n++] = '0' + (q / 10) % 10;
+      s[n++] = '0' + q % 10;
+      report_plan_put_bytes(plan, s, n);
+      return;
+    }
+  }
+  if ( scale == 1 ) {
+    value = (double)in_use / (double)issued;
+  } else {
+    value = (double)scale * (double)in_use / (double)issued;
+  }
+  if ( non_finite && ! isfinite(value) ) {
+    report_plan_put_bytes(plan, non_finite, strlen(non_finite));
+  } else {
+    n = snprintf(s, sizeof(s), "%.3f", value);
+    report_plan_put_bytes(plan, s, n);
+  }
+}
+
+//
+
+/*
+ * Fill in the_day for the day containing t (whose local time is when);
+ * returns false if the day's UTC offset is not constant.
+ */
+bool
+report_day_init(
+  report_day        *the_day,
+  time_t            t,
+  const struct tm   *when
+)
+{
+  struct tm         edge;
+  time_t            start = t - (3600 * when->tm_hour + 60 * when->tm_min + when->tm_sec), end = start + 86399;
+  
+  the_day->start = the_day->end = 0;
+  localtime_r(&start, &edge);
+  if ( edge.tm_hour || edge.tm_min || edge.tm_sec || (edge.tm_mday != when->tm_mday) || (edge.tm_gmtoff != when->tm_gmtoff) ) return false;
+  localtime_r(&end, &edge);
+  if ( (edge.tm_hour != 23) || (edge.tm_min != 59) || (edge.tm_sec != 59) || (edge.tm_mday != when->tm_mday) || (edge.tm_gmtoff != when->tm_gmtoff) ) return false;
+  the_day->prefix_len = strftime(the_day->prefix, sizeof(the_day->prefix), "%Y-%m-%d ", when);
+  if ( ! the_day->prefix_len ) return false;
+  the_day->start = start;
+  the_day->end = start + 86400;
+  return true;
+}
+
+//
+
+/*
+ * Equivalent to strftime(s, ..., "%Y-%m-%d %H:%M:%S") on the local time of
+ * t; s must have room for 48 characters.  Returns the length written.
+ */
+int
+report_plan_format_timestamp(
+  report_plan       *plan,
+  time_t            t,
+  char              *s
+)
+{
+  long long int     day = ( t >= 0 ) ? (t / 86400) : ((t + 1) / 86400 - 1);
+  report_day        *the_day = &plan->days[day & (REPORT_DAY_CACHE_SIZE - 1)];
+  int               secs, n;
+  
+  if ( (t < the_day->start) || (t >= the_day->end) ) {
+    struct tm       when;
+    
+    localtime_r(&t, &when);
+    if ( ! report_day_init(the_day, t, &when) ) return strftime(s, 48, "%Y-%m-%d %H:%M:%S", &when);
+  }
+  secs = t - the_day->start;
+  memcpy(s, the_day->prefix, n = the_day->prefix_len);
+  s[n++] = '0' + secs / 36000;
+  s[n++] = '0' + (secs / 3600) % 10;
+  s[n++] = ':';
+  s[n++] = '0' + (secs % 3600) / 600;
+  s[n++] = '0' + (secs / 60) % 10;
+  s[n++] = ':';
+  s[n++] = '0' + (secs % 60) / 10;
+  s[n++] = '0' + secs % 10;
+  return n;
+}
+
+//
+
+int
+report_plan_format_expiration(
+  report_plan       *plan,
+  time_t            t,
+  char              *s
+)
+{
+  if ( t == lmfeature_no_expiration ) {
+    memcpy(s, "permanent", 9);
+    return 9;
+  }
+  return report_plan_format_timestamp(plan, t, s);
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+void
+column_emit_feature_id(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  report_plan_put_int(plan, row->feature_id, step->width);
+  report_plan_put_char(plan, ' ');
+}
+
+//
+
+void
+column_emit_string(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  const char              *s = row->strings[step->field];
+  
+  report_plan_put_padded(plan, s, strlen(s), step->width);
+  report_plan_put_char(plan, ' ');
+}
+
+//
+
+void
+column_emit_count(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  report_plan_put_int(plan, row->ranges[step->field].avg, step->width);
+  report_plan_put_char(plan, ' ');
+}
+
+//
+
+void
+column_emit_count_range(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  const lmdb_int_range_t  *r = &row->ranges[step->field];
+  
+  if ( (r->min == r->max) && (r->min == r->avg) ) {
+    report_plan_put_int(plan, r->min, step->width);
+  } else {
+    report_plan_put_padded(plan, "", 0, step->extra);
+    report_plan_put_int(plan, r->min, step->sub_width);
+    report_plan_put_char(plan, '/');
+    report_plan_put_int(plan, r->max, step->sub_width);
+    report_plan_put_char(plan, '/');
+    report_plan_put_int(plan, r->avg, step->sub_width);
+  }
+  report_plan_put_char(plan, ' ');
+}
+
+//
+
+void
+column_emit_percent(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  report_plan_put_int(plan, report_plan_percent_ceil(row->ranges[display_field_in_use].avg, row->ranges[display_field_issued].avg), step->width - 1);
+  report_plan_put_bytes(plan, "% ", 2);
+}
+
+//
+
+void
+column_emit_percent_range(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  const lmdb_int_range_t  *in_use = &row->ranges[display_field_in_use];
+  const lmdb_int_range_t  *issued = &row->ranges[display_field_issued];
+  int                     pct_min = report_plan_percent_ceil(in_use->min, issued->min);
+  int                     pct_max = report_plan_percent_ceil(in_use->max, issued->max);
+  int                     pct_avg = report_plan_percent_ceil(in_use->avg, issued->avg);
+  
+  if ( (pct_min == pct_max) && (pct_min == pct_avg) ) {
+    report_plan_put_int(plan, pct_min, step->width - 1);
+    report_plan_put_bytes(plan, "% ", 2);
+  } else {
+    report_plan_put_padded(plan, "", 0, step->extra);
+    report_plan_put_int(plan, pct_min, step->sub_width);
+    report_plan_put_bytes(plan, "%/", 2);
+    report_plan_put_int(plan, pct_max, step->sub_width);
+    report_plan_put_bytes(plan, "%/", 2);
+    report_plan_put_int(plan, pct_avg, step->sub_width);
+    report_plan_put_bytes(plan, "% ", 2);
+  }
+}
+
+//
+
+void
+column_emit_expiration(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  char                    s[48];
+  
+  report_plan_put_padded(plan, s, report_plan_format_expiration(plan, row->expiration_timestamp, s), step->width);
+  report_plan_put_char(plan, ' ');
+}
+
+//
+
+void
+column_emit_check(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  char                    s[48];
+  
+  report_plan_put_padded(plan, s, report_plan_format_timestamp(plan, row->check_timestamp.start, s), step->width);
+  report_plan_put_char(plan, ' ');
+}
+
+//
+
+void
+column_emit_check_range(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  char                    s[100];
+  int                     n = report_plan_format_timestamp(plan, row->check_timestamp.start, s);
+  
+  memcpy(s + n, " - ", 3); n += 3;
+  n += report_plan_format_timestamp(plan, row->check_timestamp.end, s + n);
+  report_plan_put_padded(plan, s, n, step->width);
+  report_plan_put_char(plan, ' ');
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+void
+csv_emit_feature_id(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  report_plan_put_leading(plan, step);
+  report_plan_put_int(plan, row->feature_id, 0);
+}
+
+//
+
+void
+csv_emit_feature_id_quoted(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  report_plan_put_leading(plan, step);
+  report_plan_put_char(plan, '"');
+  report_plan_put_int(plan, row->feature_id, 0);
+  report_plan_put_char(plan, '"');
+}
+
+//
+
+void
+csv_emit_string(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  const char              *s = row->strings[step->field];
+  
+  report_plan_put_leading(plan, step);
+  report_plan_put_char(plan, '"');
+  report_plan_put_bytes(plan, s, strlen(s));
+  report_plan_put_char(plan, '"');
+}
+
+//
+
+void
+csv_emit_count(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  report_plan_put_leading(plan, step);
+  report_plan_put_int(plan, row->ranges[step->field].avg, 0);
+}
+
+//
+
+void
+csv_emit_count_range(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  const lmdb_int_range_t  *r = &row->ranges[step->field];
+  
+  report_plan_put_leading(plan, step);
+  report_plan_put_int(plan, r->min, 0);
+  report_plan_put_char(plan, ',');
+  report_plan_put_int(plan, r->max, 0);
+  report_plan_put_char(plan, ',');
+  report_plan_put_int(plan, r->avg, 0);
+}
+
+//
+
+void
+csv_emit_percent(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  // Not scaled to 100:
+  report_plan_put_leading(plan, step);
+  report_plan_put_fixed3(plan, row->ranges[display_field_in_use].avg, row->ranges[display_field_issued].avg, 1, NULL);
+}
+
+//
+
+void
+csv_emit_percent_range(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  const lmdb_int_range_t  *in_use = &row->ranges[display_field_in_use];
+  const lmdb_int_range_t  *issued = &row->ranges[display_field_issued];
+  
+  report_plan_put_leading(plan, step);
+  report_plan_put_fixed3(plan, in_use->min, issued->min, 100, NULL);
+  report_plan_put_char(plan, ',');
+  report_plan_put_fixed3(plan, in_use->max, issued->max, 100, NULL);
+  report_plan_put_char(plan, ',');
+  report_plan_put_fixed3(plan, in_use->avg, issued->avg, 100, NULL);
+}
+
+//
+
+void
+csv_emit_expiration(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  char                    s[48];
+  
+  report_plan_put_leading(plan, step);
+  report_plan_put_char(plan, '"');
+  report_plan_put_bytes(plan, s, report_plan_format_expiration(plan, row->expiration_timestamp, s));
+  report_plan_put_char(plan, '"');
+}
+
+//
+
+void
+csv_emit_check(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  char                    s[48];
+  
+  report_plan_put_leading(plan, step);
+  report_plan_put_char(plan, '"');
+  report_plan_put_bytes(plan, s, report_plan_format_timestamp(plan, row->check_timestamp.start, s));
+  report_plan_put_char(plan, '"');
+}
+
+//
+
+void
+csv_emit_check_range(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  char                    s[48];
+  
+  report_plan_put_leading(plan, step);
+  report_plan_put_char(plan, '"');
+  report_plan_put_bytes(plan, s, report_plan_format_timestamp(plan, row->check_timestamp.start, s));
+  report_plan_put_bytes(plan, "\",\"", 3);
+  report_plan_put_bytes(plan, s, report_plan_format_timestamp(plan, row->check_timestamp.end, s));
+  report_plan_put_char(plan, '"');
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+/*
+ * JSON rows carry the same fields as the other formats, under fixed keys
+ * in a fixed order.  Percentages are true percentages in both layouts and
+ * are null where nothing was issued; a permanent license has a null
+ * expiration time.
+ */
+void
+json_emit_string(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  const char              *s = row->strings[step->field];
+  size_t                  len = strlen(s);
+  
+  report_plan_put_leading(plan, step);
+  if ( report_plan_reserve(plan, 6 * len + 2) ) {
+    plan->buffer[plan->used++] = '"';
+    plan->used += json_escape(plan->buffer + plan->used, s, len);
+    plan->buffer[plan->used++] = '"';
+  }
+}
+
+//
+
+void
+json_emit_count_range(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  const lmdb_int_range_t  *r = &row->ranges[step->field];
+  
+  report_plan_put_leading(plan, step);
+  report_plan_put_bytes(plan, "{\"min\":", 7);
+  report_plan_put_int(plan, r->min, 0);
+  report_plan_put_bytes(plan, ",\"max\":", 7);
+  report_plan_put_int(plan, r->max, 0);
+  report_plan_put_bytes(plan, ",\"avg\":", 7);
+  report_plan_put_int(plan, r->avg, 0);
+  report_plan_put_char(plan, '}');
+}
+
+//
+
+void
+json_emit_percent(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  report_plan_put_leading(plan, step);
+  report_plan_put_fixed3(plan, row->ranges[display_field_in_use].avg, row->ranges[display_field_issued].avg, 100, "null");
+}
+
+//
+
+void
+json_emit_percent_range(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  const lmdb_int_range_t  *in_use = &row->ranges[display_field_in_use];
+  const lmdb_int_range_t  *issued = &row->ranges[display_field_issued];
+  
+  report_plan_put_leading(plan, step);
+  report_plan_put_bytes(plan, "{\"min\":", 7);
+  report_plan_put_fixed3(plan, in_use->min, issued->min, 100, "null");
+  report_plan_put_bytes(plan, ",\"max\":", 7);
+  report_plan_put_fixed3(plan, in_use->max, issued->max, 100, "null");
+  report_plan_put_bytes(plan, ",\"avg\":", 7);
+  report_plan_put_fixed3(plan, in_use->avg, issued->avg, 100, "null");
+  report_plan_put_char(plan, '}');
+}
+
+//
+
+void
+json_emit_expiration(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  report_plan_put_leading(plan, step);
+  if ( row->expiration_timestamp == lmfeature_no_expiration ) {
+    report_plan_put_bytes(plan, "null", 4);
+  } else {
+    char                  s[48];
+    
+    report_plan_put_char(plan, '"');
+    report_plan_put_bytes(plan, s, report_plan_format_timestamp(plan, row->expiration_timestamp, s));
+    report_plan_put_char(plan, '"');
+  }
+}
+
+//
+
+void
+json_emit_check_range(
+  report_plan             *plan,
+  const report_plan_step  *step,
+  const report_plan_row   *row
+)
+{
+  char                    s[48];
+  
+  report_plan_put_leading(plan, step);
+  report_plan_put_bytes(plan, "{\"start\":\"", 10);
+  report_plan_put_bytes(plan, s, report_plan_format_timestamp(plan, row->check_timestamp.start, s));
+  report_plan_put_bytes(plan, "\",\"end\":\"", 9);
+  report_plan_put_bytes(plan, s, report_plan_format_timestamp(plan, row->check_timestamp.end, s));
+  report_plan_put_bytes(plan, "\"}", 2);
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+/*
+ * Emitters for each displayed field, by output format and by whether the
+ * report is ranged:
+ */
+static const report_emitter_fn report_plan_column_emitters[2][display_field_max] = {
+      {
+        column_emit_feature_id,
+        column_emit_string,
+        column_emit_string,
+        column_emit_string,
+        column_emit_count,
+        column_emit_count,
+        column_emit_percent,
+        column_emit_expiration,
+        column_emit_check
+      },
+      {
+        column_emit_feature_id,
+        column_emit_string,
+        column_emit_string,
+        column_emit_string,
+        column_emit_count_range,
+        column_emit_count_range,
+        column_emit_percent_range,
+        column_emit_expiration,
+        column_emit_check_range
+      }
+    };
+
+static const report_emitter_fn report_plan_csv_emitters[2][display_field_max] = {
+      {
+        csv_emit_feature_id_quoted,
+        csv_emit_string,
+        csv_emit_string,
+        csv_emit_string,
+        csv_emit_count,
+        csv_emit_count,
+        csv_emit_percent,
+        csv_emit_expiration,
+        csv_emit_check
+      },
+      {
+        csv_emit_feature_id,
+        csv_emit_string,
+        csv_emit_string,
+        csv_emit_string,
+        csv_emit_count_range,
+        csv_emit_count_range,
+        csv_emit_percent_range,
+        csv_emit_expiration,
+        csv_emit_check_range
+      }
+    };
+
+//
+// The feature id, single counts, and check timestamp are written just as
+// for CSV (the id unquoted); the plan supplies the keys:
+//
+static const report_emitter_fn report_plan_json_emitters[2][display_field_max] = {
+      {
+        csv_emit_feature_id,
+        json_emit_string,
+        json_emit_string,
+        json_emit_string,
+        csv_emit_count,
+        csv_emit_count,
+        json_emit_percent,
+        json_emit_expiration,
+        csv_emit_check
+      },
+      {
+        csv_emit_feature_id,
+        json_emit_string,
+        json_emit_string,
+        json_emit_string,
+        json_emit_count_range,
+        json_emit_count_range,
+        json_emit_percent_range,
+        json_emit_expiration,
+        json_emit_check_range
+      }
+    };
+
+static const char* report_plan_json_keys[2][display_field_max] = {
+      {
+        "\"id\":",
+        "\"feature\":",
+        "\"vendor\":",
+        "\"version\":",
+        "\"in_use\":",
+        "\"issued\":",
+        "\"percent\":",
+        "\"expire_time\":",
+        "\"check_time\":"
+      },
+      {
+        ",\"id\":",
+        ",\"feature\":",
+        ",\"vendor\":",
+        ",\"version\":",
+        ",\"in_use\":",
+        ",\"issued\":",
+        ",\"percent\":",
+        ",\"expire_time\":",
+        ",\"check_time\":"
+      }
+    };
+
+//
+
+/*
+ * Compile the plan for printing rows in the given format; for column output
+ * the widths in ctl must already be final.
+ */
 bool
-column_display_no_range_iterator(
-  const void        *context,
-  int               feature_id,
-  const char        *vendor,
-  const char        *version,
-  const char        *feature_string,
-  lmdb_int_range_t  in_use,
-  lmdb_int_range_t  issued,
-  time_t            expiration_timestamp,
-  lmdb_time_range_t check_timestamp
+report_plan_init(
+  report_plan             *plan,
+  display_field_control   *ctl,
+  report_format           format,
+  bool                    is_ranged
 )
 {
-	display_field_control			*ctl = (display_field_control*)context;
-	char											check_ts[20], expiration_ts[20];
-	double										pct = 100.0 *  (double)in_use.avg / (double)issued.avg;
-	
-	if ( ! ctl->disable[display_field_check_timestamp] ) {
-		struct tm								when;
-		
-		localtime_r(&check_timestamp.start, &when); strftime(check_ts, sizeof(check_ts), "%Y-%m-%d %H:%M:%S", &when);
-	}
-	if ( ! ctl->disable[display_field_expiration_timestamp] ) {
-		if ( expiration_timestamp == lmfeature_no_expiration ) {
-			strncpy(expiration_ts, "permanent", sizeof(expiration_ts));
-		} else {
-			struct tm							when;
-			
-			localtime_r(&expiration_timestamp, &when); strftime(expiration_ts, sizeof(expiration_ts), "%Y-%m-%d %H:%M:%S", &when);
-		}
-	}
-	if ( ! ctl->disable[display_field_feature_id] ) printf("%*d ", ctl->width[display_field_feature_id], feature_id);
-	if ( ! ctl->disable[display_field_feature_string] ) printf("%*s ", ctl->width[display_field_feature_string], feature_string);
-	if ( ! ctl->disable[display_field_vendor] ) printf("%*s ", ctl->width[display_field_vendor], vendor);
-	if ( ! ctl->disable[display_field_version] ) printf("%*s ", ctl->width[display_field_version], version);
-	if ( ! ctl->disable[display_field_in_use] ) printf("%*d ", ctl->width[display_field_in_use], in_use.avg);
-	if ( ! ctl->disable[display_field_issued] ) printf("%*d ", ctl->width[display_field_issued], issued.avg);
-	if ( ! ctl->disable[display_field_percentage] ) printf("%*d%% ", ctl->width[display_field_percentage] - 1, (int)ceil(pct));
-	if ( ! ctl->disable[display_field_expiration_timestamp] ) printf("%*s ", ctl->width[display_field_expiration_timestamp], expiration_ts);
-	if ( ! ctl->disable[display_field_check_timestamp] ) printf("%*s ", ctl->width[display_field_check_timestamp], check_ts);
-	
-	fputc('\n', stdout);
-	
+  const report_emitter_fn *emitters;
+  int                     i;
+  
+  memset(plan, 0, sizeof(*plan));
+  switch ( format ) {
+    case report_format_csv:
+      emitters = report_plan_csv_emitters[is_ranged ? 1 : 0];
+      break;
+    case report_format_json:
+      emitters = report_plan_json_emitters[is_ranged ? 1 : 0];
+      break;
+    default:
+      emitters = report_plan_column_emitters[is_ranged ? 1 : 0];
+      break;
+  }
+  if ( ! (plan->buffer = malloc(REPORT_OUTPUT_BUFFER_SIZE)) ) return false;
+  plan->capacity = REPORT_OUTPUT_BUFFER_SIZE;
+  plan->flush_at = REPORT_OUTPUT_FIRST_FLUSH;
+  plan->is_okay = true;
+  plan->row_start = ( format == report_format_json ) ? "{" : "";
+  plan->row_end = ( format == report_format_json ) ? "}\n" : "\n";
+  for ( i = display_field_feature_id; i < display_field_max; i++ ) {
+    if ( ! ctl->disable[i] ) {
+      report_plan_step    *step = &plan->steps[plan->step_count];
+      
+      step->emit = emitters[i];
+      step->field = i;
+      if ( format == report_format_json ) {
+        step->leading = report_plan_json_keys[plan->step_count ? 1 : 0][i];
+      } else {
+        step->leading = plan->step_count ? "," : "";
+      }
+      step->leading_len = strlen(step->leading);
+      step->width = ctl->width[i];
+      if ( i == display_field_percentage ) {
+        step->sub_width = ((step->width - 2) / 3) - 1;
+        step->extra = step->width - (3 * (step->sub_width + 1) + 2);
+      } else {
+        step->sub_width = (step->width - 2) / 3;
+        step->extra = step->width - (3 * step->sub_width + 2);
+      }
+      plan->step_count++;
+    }
+  }
   return true;
 }
 
 //
 
+/*
+ * Flush any buffered output and dispose of the plan's resources.  Returns
+ * false if any output could not be written.
+ */
+bool
+report_plan_destroy(
+  report_plan       *plan
+)
+{
+  bool              is_okay = report_plan_flush(plan);
+  
+  if ( plan->buffer ) free((void*)plan->buffer);
+  plan->buffer = NULL;
+  return is_okay;
+}
+
+//
+
 bool
-column_display_range_iterator(
+report_plan_iterator(
   const void        *context,
   int               feature_id,
   const char        *vendor,
@@ -319,115 +1314,162 @@ column_display_range_iterator(
   lmdb_time_range_t check_timestamp
 )
 {
-	display_field_control			*ctl = (display_field_control*)context;
-	char											check_ts[42], expiration_ts[20];
-	int                       pct_avg = (int)ceil(100.0 *  (double)in_use.avg / (double)issued.avg);
-	int                       pct_min = (int)ceil(100.0 *  (double)in_use.min / (double)issued.min);
-	int                       pct_max = (int)ceil(100.0 *  (double)in_use.max / (double)issued.max);
-	
-	if ( ! ctl->disable[display_field_check_timestamp] ) {
-		struct tm								when;
-		
-		localtime_r(&check_timestamp.start, &when); strftime(check_ts, sizeof(check_ts), "%Y-%m-%d %H:%M:%S", &when);
-		strncpy(check_ts + strlen(check_ts), " - ", sizeof(check_ts) - strlen(check_ts));
-		localtime_r(&check_timestamp.end, &when); strftime(check_ts + strlen(check_ts), sizeof(check_ts) - strlen(check_ts), "%Y-%m-%d %H:%M:%S", &when);
-	}
-	if ( ! ctl->disable[display_field_expiration_timestamp] ) {
-		if ( expiration_timestamp == lmfeature_no_expiration ) {
-			strncpy(expiration_ts, "permanent", sizeof(expiration_ts));
-		} else {
-			struct tm							when;
-			
-			localtime_r(&expiration_timestamp, &when); strftime(expiration_ts, sizeof(expiration_ts), "%Y-%m-%d %H:%M:%S", &when);
-		}
-	}
-	if ( ! ctl->disable[display_field_feature_id] ) printf("%*d ", ctl->width[display_field_feature_id], feature_id);
-	if ( ! ctl->disable[display_field_feature_string] ) printf("%*s ", ctl->width[display_field_feature_string], feature_string);
-	if ( ! ctl->disable[display_field_vendor] ) printf("%*s ", ctl->width[display_field_vendor], vendor);
-	if ( ! ctl->disable[display_field_version] ) printf("%*s ", ctl->width[display_field_version], version);
-	if ( ! ctl->disable[display_field_in_use] ) {
-    if ( in_use.min == in_use.max && in_use.min == in_use.avg ) {
-      printf("%*d ", ctl->width[display_field_in_use], in_use.min);
-    } else {
-      int				w = (ctl->width[display_field_in_use] - 2) / 3;
-      int       extra = ctl->width[display_field_in_use] - (3 * w + 2);
-      while ( extra-- ) fputc(' ', stdout);
-      printf("%*d/%*d/%*d ", w, in_use.min, w, in_use.max, w, in_use.avg);
-    }
-	}
-	if ( ! ctl->disable[display_field_issued] ) {
-    if ( issued.min == issued.max && issued.min == issued.avg ) {
-      printf("%*d ", ctl->width[display_field_issued], issued.min);
-    } else {
-      int				w = (ctl->width[display_field_issued] - 2) / 3;
-      int       extra = ctl->width[display_field_issued] - (3 * w + 2);
-      while ( extra-- ) fputc(' ', stdout);
-      printf("%*d/%*d/%*d ", w, issued.min, w, issued.max, w, issued.avg);
-    }
-	}
-	if ( ! ctl->disable[display_field_percentage] ) {
-    if ( pct_min == pct_max && pct_min == pct_avg ) {
-      printf("%*d%% ", ctl->width[display_field_percentage] - 1, pct_min);
-    } else {
-      int				w = ((ctl->width[display_field_percentage] - 2) / 3) - 1;
-      int       extra = ctl->width[display_field_percentage] - (3 * (w + 1) + 2);
-      while ( extra-- ) fputc(' ', stdout);
-      printf("%*d%%/%*d%%/%*d%% ", w, (int)ceil(pct_min), w, (int)ceil(pct_max), w, (int)ceil(pct_avg));
-    }
-	}
-	if ( ! ctl->disable[display_field_expiration_timestamp] ) printf("%*s ", ctl->width[display_field_expiration_timestamp], expiration_ts);
-	if ( ! ctl->disable[display_field_check_timestamp] ) printf("%*s ", ctl->width[display_field_check_timestamp], check_ts);
-	
-	fputc('\n', stdout);
-	
-  return true;
+  report_plan       *plan = (report_plan*)context;
+  report_plan_row   row;
+  unsigned int      i;
+  
+  row.feature_id = feature_id;
+  row.strings[display_field_feature_string] = feature_string;
+  row.strings[display_field_vendor] = vendor;
+  row.strings[display_field_version] = version;
+  row.ranges[display_field_in_use] = in_use;
+  row.ranges[display_field_issued] = issued;
+  row.expiration_timestamp = expiration_timestamp;
+  row.check_timestamp = check_timestamp;
+  report_plan_put_bytes(plan, plan->row_start, strlen(plan->row_start));
+  for ( i = 0; i < plan->step_count; i++ ) plan->steps[i].emit(plan, &plan->steps[i], &row);
+  report_plan_put_bytes(plan, plan->row_end, strlen(plan->row_end));
+  if ( plan->used >= plan->flush_at ) {
+    report_plan_flush(plan);
+    if ( plan->flush_at < plan->capacity ) plan->flush_at *= 2;
+  }
+  return plan->is_okay;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+/*
+ * Column output needs every row twice:  once to size the columns and once
+ * to print them.  Rather than run the report's query a second time, its
+ * rows are fetched once into a columnar buffer -- one array per integer
+ * field, one per timestamp, and string fields as indices into a table of
+ * interned strings -- and both passes replay the buffer.
+ */
+typedef enum {
+  report_buffer_int_feature_id = 0,
+  report_buffer_int_vendor,
+  report_buffer_int_version,
+  report_buffer_int_feature_string,
+  report_buffer_int_in_use_min,
+  report_buffer_int_in_use_max,
+  report_buffer_int_in_use_avg,
+  report_buffer_int_issued_min,
+  report_buffer_int_issued_max,
+  report_buffer_int_issued_avg,
+  //
+  report_buffer_int_max
+} report_buffer_int;
+
+typedef enum {
+  report_buffer_time_expiration = 0,
+  report_buffer_time_check_start,
+  report_buffer_time_check_end,
+  //
+  report_buffer_time_max
+} report_buffer_time;
+
+typedef struct {
+  mempool_ref     strings;
+  unsigned int    string_count, string_capacity, string_mask;
+  const char      **string_list;
+  unsigned int    *string_slots;      /* index + 1 into string_list; 0 is empty */
+  
+  unsigned int    row_count, row_capacity;
+  int             *ints[report_buffer_int_max];
+  time_t          *times[report_buffer_time_max];
+} report_buffer;
+
+//
+
+bool
+report_buffer_init(
+  report_buffer   *buffer
+)
+{
+  memset(buffer, 0, sizeof(*buffer));
+  return ( (buffer->strings = mempool_alloc()) != NULL );
 }
 
 //
 
 void
-csv_print_headers(
-	display_field_control		*ctl,
-	bool										is_ranged
+report_buffer_destroy(
+  report_buffer   *buffer
 )
 {
-	int						i;
-	const char		*comma = "";
-	
-	if ( is_ranged ) {
-		for ( i = display_field_feature_id; i < display_field_max; i++ ) {
-			if ( ! ctl->disable[i] ) {
-				switch ( i ) {
-					case display_field_in_use:
-					case display_field_issued:
-					case display_field_percentage:
-						printf("%1$s\"%2$s min\",\"%2$s max\",\"%2$s avg\"", comma, display_field_header[i]);
-						break;
-					case display_field_check_timestamp:
-						printf("%1$s\"%2$s start\",\"%2$s end\"", comma, display_field_header[i]);
-						break;
-					default:
-						printf("%s\"%s\"", comma, display_field_header[i]);
-						break;
-				}
-				comma = ",";
-			}
-		}
-	} else {
-		for ( i = display_field_feature_id; i < display_field_max; i++ ) {
-			if ( ! ctl->disable[i] ) {
-				printf("%s\"%s\"", comma, display_field_header[i]);
-				comma = ",";
-			}
-		}
-	}
-	fputc('\n', stdout);
+  int             i;
+  
+  for ( i = 0; i < report_buffer_int_max; i++ ) if ( buffer->ints[i] ) free((void*)buffer->ints[i]);
+  for ( i = 0; i < report_buffer_time_max; i++ ) if ( buffer->times[i] ) free((void*)buffer->times[i]);
+  if ( buffer->string_slots ) free((void*)buffer->string_slots);
+  if ( buffer->string_list ) free((void*)buffer->string_list);
+  if ( buffer->strings ) mempool_dealloc(buffer->strings);
+  memset(buffer, 0, sizeof(*buffer));
+}
+
+//
+
+/*
+ * Returns the index of the buffer's copy of s (adding one if necessary),
+ * or -1 if it could not be added.
+ */
+int
+report_buffer_intern(
+  report_buffer   *buffer,
+  const char      *s
+)
+{
+  unsigned int    hash = 2166136261U, i;
+  const char      *p = s;
+  
+  // Keep the table at most half full:
+  if ( 2 * (buffer->string_count + 1) > (buffer->string_slots ? buffer->string_mask + 1 : 0) ) {
+    unsigned int  new_capacity = buffer->string_slots ? 2 * (buffer->string_mask + 1) : 64;
+    unsigned int  *new_slots = calloc(new_capacity, sizeof(unsigned int));
+    
+    if ( ! new_slots ) return -1;
+    for ( i = 0; i < buffer->string_count; i++ ) {
+      unsigned int  h = 2166136261U, j;
+      
+      p = buffer->string_list[i];
+      while ( *p ) h = (h ^ (unsigned char)*p++) * 16777619U;
+      j = h & (new_capacity - 1);
+      while ( new_slots[j] ) j = (j + 1) & (new_capacity - 1);
+      new_slots[j] = i + 1;
+    }
+    if ( buffer->string_slots ) free((void*)buffer->string_slots);
+    buffer->string_slots = new_slots;
+    buffer->string_mask = new_capacity - 1;
+  }
+  
+  p = s;
+  while ( *p ) hash = (hash ^ (unsigned char)*p++) * 16777619U;
+  i = hash & buffer->string_mask;
+  while ( buffer->string_slots[i] ) {
+    if ( strcmp(buffer->string_list[buffer->string_slots[i] - 1], s) == 0 ) return buffer->string_slots[i] - 1;
+    i = (i + 1) & buffer->string_mask;
+  }
+  if ( buffer->string_count == buffer->string_capacity ) {
+    unsigned int  new_capacity = buffer->string_capacity ? 2 * buffer->string_capacity : 32;
+    const char    **new_list = realloc(buffer->string_list, new_capacity * sizeof(const char*));
+    
+    if ( ! new_list ) return -1;
+    buffer->string_list = new_list;
+    buffer->string_capacity = new_capacity;
+  }
+  if ( ! (buffer->string_list[buffer->string_count] = mempool_strdup(buffer->strings, s)) ) return -1;
+  buffer->string_slots[i] = ++buffer->string_count;
+  return buffer->string_count - 1;
 }
 
 //
 
 bool
-csv_display_no_range_iterator(
+report_buffer_fill_iterator(
   const void        *context,
   int               feature_id,
   const char        *vendor,
@@ -439,126 +1481,113 @@ csv_display_no_range_iterator(
   lmdb_time_range_t check_timestamp
 )
 {
-	display_field_control			*ctl = (display_field_control*)context;
-	char											check_ts[20], expiration_ts[20];
-	double										pct = (double)in_use.avg / (double)issued.avg;
-	const char								*comma = "";
-	
-	if ( ! ctl->disable[display_field_check_timestamp] ) {
-		struct tm								when;
-		
-		localtime_r(&check_timestamp.start, &when); strftime(check_ts, sizeof(check_ts), "%Y-%m-%d %H:%M:%S", &when);
-	}
-	if ( ! ctl->disable[display_field_expiration_timestamp] ) {
-		if ( expiration_timestamp == lmfeature_no_expiration ) {
-			strncpy(expiration_ts, "permanent", sizeof(expiration_ts));
-		} else {
-			struct tm							when;
-			
-			localtime_r(&expiration_timestamp, &when); strftime(expiration_ts, sizeof(expiration_ts), "%Y-%m-%d %H:%M:%S", &when);
-		}
-	}
-	if ( ! ctl->disable[display_field_feature_id] ) {
-		printf("\"%d\"", feature_id); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_feature_string] ) {
-		printf("%s\"%s\"", comma, feature_string); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_vendor] ) {
-		printf("%s\"%s\"", comma, vendor); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_version] ) {
-		printf("%s\"%s\"", comma, version); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_in_use] ) {
-		printf("%s%d", comma, in_use.avg); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_issued] ) {
-		printf("%s%d", comma, issued.avg); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_percentage] ) {
-		printf("%s%.3f", comma, pct); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_expiration_timestamp] ) {
-		printf("%s\"%s\"", comma, expiration_ts); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_check_timestamp] ) {
-		printf("%s\"%s\"", comma, check_ts);
-	}
-	fputc('\n', stdout);
-	
+  report_buffer     *buffer = (report_buffer*)context;
+  unsigned int      row = buffer->row_count;
+  int               vendor_index, version_index, feature_string_index;
+  
+  if ( row == buffer->row_capacity ) {
+    unsigned int    new_capacity = buffer->row_capacity ? 2 * buffer->row_capacity : 256;
+    int             i;
+    
+    for ( i = 0; i < report_buffer_int_max; i++ ) {
+      int           *new_column = realloc(buffer->ints[i], new_capacity * sizeof(int));
+      
+      if ( ! new_column ) return false;
+      buffer->ints[i] = new_column;
+    }
+    for ( i = 0; i < report_buffer_time_max; i++ ) {
+      time_t        *new_column = realloc(buffer->times[i], new_capacity * sizeof(time_t));
+      
+      if ( ! new_column ) return false;
+      buffer->times[i] = new_column;
+    }
+    buffer->row_capacity = new_capacity;
+  }
+  if ( ((vendor_index = report_buffer_intern(buffer, vendor)) < 0) ||
+       ((version_index = report_buffer_intern(buffer, version)) < 0) ||
+       ((feature_string_index = report_buffer_intern(buffer, feature_string)) < 0)
+  ) return false;
+  
+  buffer->ints[report_buffer_int_feature_id][row] = feature_id;
+  buffer->ints[report_buffer_int_vendor][row] = vendor_index;
+  buffer->ints[report_buffer_int_version][row] = version_index;
+  buffer->ints[report_buffer_int_feature_string][row] = feature_string_index;
+  buffer->ints[report_buffer_int_in_use_min][row] = in_use.min;
+  buffer->ints[report_buffer_int_in_use_max][row] = in_use.max;
+  buffer->ints[report_buffer_int_in_use_avg][row] = in_use.avg;
+  buffer->ints[report_buffer_int_issued_min][row] = issued.min;
+  buffer->ints[report_buffer_int_issued_max][row] = issued.max;
+  buffer->ints[report_buffer_int_issued_avg][row] = issued.avg;
+  buffer->times[report_buffer_time_expiration][row] = expiration_timestamp;
+  buffer->times[report_buffer_time_check_start][row] = check_timestamp.start;
+  buffer->times[report_buffer_time_check_end][row] = check_timestamp.end;
+  buffer->row_count++;
   return true;
 }
 
 //
 
 bool
-csv_display_range_iterator(
-  const void        *context,
-  int               feature_id,
-  const char        *vendor,
-  const char        *version,
-  const char        *feature_string,
-  lmdb_int_range_t  in_use,
-  lmdb_int_range_t  issued,
-  time_t            expiration_timestamp,
-  lmdb_time_range_t check_timestamp
+report_buffer_fill(
+  report_buffer         *buffer,
+  lmdb_usage_report_ref the_report
 )
 {
-	display_field_control			*ctl = (display_field_control*)context;
-	char											check_start_ts[20], check_end_ts[20], expiration_ts[20];
-	double										pct_avg = 100.0 *  (double)in_use.avg / (double)issued.avg;
-	double										pct_min = 100.0 *  (double)in_use.min / (double)issued.min;
-	double										pct_max = 100.0 *  (double)in_use.max / (double)issued.max;
-	const char								*comma = "";
-	
-	if ( ! ctl->disable[display_field_check_timestamp] ) {
-		struct tm								when;
-		
-		localtime_r(&check_timestamp.start, &when); strftime(check_start_ts, sizeof(check_start_ts), "%Y-%m-%d %H:%M:%S", &when);
-		localtime_r(&check_timestamp.end, &when); strftime(check_end_ts, sizeof(check_end_ts), "%Y-%m-%d %H:%M:%S", &when);
-	}
-	if ( ! ctl->disable[display_field_expiration_timestamp] ) {
-		if ( expiration_timestamp == lmfeature_no_expiration ) {
-			strncpy(expiration_ts, "permanent", sizeof(expiration_ts));
-		} else {
-			struct tm							when;
-			
-			localtime_r(&expiration_timestamp, &when); strftime(expiration_ts, sizeof(expiration_ts), "%Y-%m-%d %H:%M:%S", &when);
-		}
-	}
-	if ( ! ctl->disable[display_field_feature_id] ) {
-		printf("%d", feature_id); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_feature_string] ) {
-		printf("%s\"%s\"", comma, feature_string); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_vendor] ) {
-		printf("%s\"%s\"", comma, vendor); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_version] ) {
-		printf("%s\"%s\"", comma, version); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_in_use] ) {
-		printf("%s%d,%d,%d", comma, in_use.min, in_use.max, in_use.avg); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_issued] ) {
-		printf("%s%d,%d,%d", comma, issued.min, issued.max, issued.avg); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_percentage] ) {
-		printf("%s%.3f,%.3f,%.3f", comma, pct_min, pct_max, pct_avg); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_expiration_timestamp] ) {
-		printf("%s\"%s\"", comma, expiration_ts); comma = ",";
-	}
-	if ( ! ctl->disable[display_field_check_timestamp] ) {
-		printf("%s\"%s\",\"%s\"", comma, check_start_ts, check_end_ts);
-	}
-	fputc('\n', stdout);
-	
+  return lmdb_usage_report_iterate(the_report, report_buffer_fill_iterator, (const void*)buffer);
+}
+
+//
+
+/*
+ * Call iterator_fn for each buffered row, in the order the report produced
+ * them.
+ */
+bool
+report_buffer_iterate(
+  report_buffer     *buffer,
+  lmdb_iterator_fn  iterator_fn,
+  const void        *context
+)
+{
+  unsigned int      row = 0;
+  
+  while ( row < buffer->row_count ) {
+    lmdb_int_range_t  in_use = {
+                          .min = buffer->ints[report_buffer_int_in_use_min][row],
+                          .max = buffer->ints[report_buffer_int_in_use_max][row],
+                          .avg = buffer->ints[report_buffer_int_in_use_avg][row]
+                        };
+    lmdb_int_range_t  issued = {
+                          .min = buffer->ints[report_buffer_int_issued_min][row],
+                          .max = buffer->ints[report_buffer_int_issued_max][row],
+                          .avg = buffer->ints[report_buffer_int_issued_avg][row]
+                        };
+    lmdb_time_range_t check_timestamp = {
+                          .start = buffer->times[report_buffer_time_check_start][row],
+                          .end = buffer->times[report_buffer_time_check_end][row]
+                        };
+    
+    if ( ! iterator_fn(
+                context,
+                buffer->ints[report_buffer_int_feature_id][row],
+                buffer->string_list[buffer->ints[report_buffer_int_vendor][row]],
+                buffer->string_list[buffer->ints[report_buffer_int_version][row]],
+                buffer->string_list[buffer->ints[report_buffer_int_feature_string][row]],
+                in_use,
+                issued,
+                buffer->times[report_buffer_time_expiration][row],
+                check_timestamp
+              )
+    ) return false;
+    row++;
+  }
   return true;
 }
 
+//
+#if 0
+#pragma mark -
+#endif
 //
 
 lmdb_predicate_operator
@@ -611,7 +1640,7 @@ main(
     // If a database file was present, get it opened.  If there was
     // no file, at least open an in-memory database:
     //
-    the_database = lmdb_create_read_only(the_conf->license_db_path);
+    the_database = lmdb_create_read_only_with_options(the_conf->license_db_path, &the_conf->db_options);
     if ( the_database ) {
       lmdb_usage_report_ref         the_report;
       display_field_control         column_ctl = display_field_control_make(the_conf->should_show_headers);
@@ -740,7 +1769,7 @@ main(
       // Vendor string matching?
       //
       if ( the_conf->match_vendor ) {
-        const char                *pattern = the_conf->match_feature;
+        const char                *pattern = the_conf->match_vendor;
         lmdb_predicate_operator   operator = finish_parsing_matching_option(&pattern);
         
         if ( predicate ) {
@@ -765,28 +1794,62 @@ main(
       }
       
       //
-      // Generate report results:
+      // Generate report results, from the time-series store if one was
+      // selected:
       //
-      the_report = lmdb_usage_report_create(
-															the_database,
-															aggregate,
-															range,
-															predicate
-														);
+      if ( the_conf->tsdb_path && ! lmdb_set_tsdb_path(the_database, the_conf->tsdb_path) ) {
+        rc = EIO;
+        the_report = NULL;
+      } else {
+        the_report = lmdb_usage_report_create(
+                                the_database,
+                                aggregate,
+                                range,
+                                predicate
+                              );
+      }
       if ( the_report ) {
       	bool			is_ranged = (the_conf->report_aggregate == lmdb_usage_report_aggregate_none) ? false : true;
       	
       	switch ( the_conf->report_format ) {
       	
-      		case report_format_column:
-		        lmdb_usage_report_iterate(the_report, is_ranged ? column_calc_range_iterator : column_calc_no_range_iterator, (const void*)&column_ctl);
-						if ( the_conf->should_show_headers ) column_print_headers(&column_ctl, is_ranged);
-						lmdb_usage_report_iterate(the_report, is_ranged ? column_display_range_iterator : column_display_no_range_iterator, (const void*)&column_ctl);
+      		case report_format_column: {
+      		  report_buffer   rows;
+      		  
+      		  //
+      		  // Fetch the rows once, then size and print the columns
+      		  // from the buffer:
+      		  //
+      		  if ( report_buffer_init(&rows) && report_buffer_fill(&rows, the_report) ) {
+  		        report_plan   plan;
+  		        
+  		        report_buffer_iterate(&rows, is_ranged ? column_calc_range_iterator : column_calc_no_range_iterator, (const void*)&column_ctl);
+  						if ( the_conf->should_show_headers ) column_print_headers(&column_ctl, is_ranged);
+  						if ( report_plan_init(&plan, &column_ctl, report_format_column, is_ranged) ) {
+  						  report_buffer_iterate(&rows, report_plan_iterator, (const void*)&plan);
+  						  if ( ! report_plan_destroy(&plan) ) rc = EIO;
+  						} else {
+  						  rc = ENOMEM;
+  						}
+  					} else {
+  					  lmlog(lmlog_level_error, "Unable to buffer report rows");
+  					  rc = ENOMEM;
+  					}
+  					report_buffer_destroy(&rows);
 						break;
+					}
 					
-					case report_format_csv: {
-		        if ( the_conf->should_show_headers ) csv_print_headers(&column_ctl, is_ranged);
-    		    lmdb_usage_report_iterate(the_report, is_ranged ? csv_display_range_iterator : csv_display_no_range_iterator, (const void*)&column_ctl);
+					case report_format_csv:
+					case report_format_json: {
+					  report_plan     plan;
+					  
+		        if ( the_conf->should_show_headers && (the_conf->report_format == report_format_csv) ) csv_print_headers(&column_ctl, is_ranged);
+		        if ( report_plan_init(&plan, &column_ctl, the_conf->report_format, is_ranged) ) {
+      		    lmdb_usage_report_iterate(the_report, report_plan_iterator, (const void*)&plan);
+      		    if ( ! report_plan_destroy(&plan) ) rc = EIO;
+      		  } else {
+      		    rc = ENOMEM;
+      		  }
     		    break;
     		  }
           
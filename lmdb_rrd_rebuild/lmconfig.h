@@ -0,0 +1 @@
+../common/lmconfig.h
\ No newline at end of file
@@ -0,0 +1,57 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmdb_rrd_rebuild.c
+ *
+ * Rebuild the RRD files for the features in a database from its counts.
+ *
+ */
+
+#include "lmconfig.h"
+#include "lmdb.h"
+#include "lmlog.h"
+#include "util_fns.h"
+
+//
+
+int
+main(
+  int           argc,
+  char * const  argv[]
+)
+{
+  lmconfig      *the_conf = lmconfig_update_with_options(NULL, argc, argv);
+  int           rc = 0;
+  
+  //
+  // Now update from whatever configuration file we're supposed to be
+  // using:
+  //
+  if ( file_exists(the_conf->base_config_path) ) the_conf = lmconfig_update_with_file(the_conf, the_conf->base_config_path);
+  
+  //
+  // Command line arguments also override whatever may have been in a
+  // configure file:
+  //
+  the_conf = lmconfig_update_with_options(the_conf, argc, argv);
+  
+  if ( the_conf && the_conf->license_db_path ) {
+    lmdb_ref          the_database = NULL;
+    
+    //
+    // Only read from the database; each rebuild thread opens its own
+    // read-only connection to it, too:
+    //
+    the_database = lmdb_create_read_only_with_options(the_conf->license_db_path, &the_conf->db_options);
+    if ( the_database ) {
+      if ( ! lmdb_rrd_rebuild(the_database, the_conf->rrd_repodir, the_conf->rebuild_feature_id, the_conf->rebuild_thread_count) ) rc = EIO;
+      lmdb_release(the_database);
+    } else {
+      rc = ENOENT;
+    }
+  } else {
+    lmlog(lmlog_level_error, "No license database configured");
+    rc = EINVAL;
+  }
+  if ( the_conf ) lmconfig_dealloc(the_conf);
+  return rc;
+}
@@ -0,0 +1,318 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmdb_tsdb.c
+ *
+ * List, fill, and export the contents of a time-series store.
+ *
+ */
+
+#include "lmconfig.h"
+#include "lmdb.h"
+#include "lmtsdb.h"
+#include "lmlog.h"
+#include "util_fns.h"
+
+#include <math.h>
+
+//
+
+bool
+list_features_iterator(
+  const void    *context,
+  int           feature_id,
+  time_t        last_update
+)
+{
+  struct tm     local;
+  char          last_update_str[32];
+
+  (void)context;
+  localtime_r(&last_update, &local);
+  strftime(last_update_str, sizeof(last_update_str), "%Y-%m-%d %H:%M:%S", &local);
+  printf("%d %s\n", feature_id, last_update_str);
+  return true;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+typedef struct {
+  int64_t       first_bucket;
+  unsigned int  width, row_count;
+  double        *in_use, *issued;
+} export_rows;
+
+bool
+export_rows_iterator(
+  const void    *context,
+  time_t        timestamp,
+  double        in_use,
+  double        issued
+)
+{
+  export_rows   *ROWS = (export_rows*)context;
+  int64_t       i = (int64_t)timestamp / ROWS->width - ROWS->first_bucket;
+
+  if ( (i >= 0) && (i < ROWS->row_count) ) {
+    ROWS->in_use[i] = in_use;
+    ROWS->issued[i] = issued;
+  }
+  return true;
+}
+
+//
+
+void
+export_print_value(
+  double        value
+)
+{
+  if ( isnan(value) ) {
+    printf("<v>NaN</v>");
+  } else {
+    printf("<v>%0.10e</v>", value);
+  }
+}
+
+//
+
+/*
+ * Each level becomes an AVERAGE archive whose newest row is the last
+ * interval completed before the feature's last update, just as rrdtool
+ * would have consolidated it; 'rrdtool restore' turns the dump into an
+ * RRD file that the graphing tool can draw from.
+ */
+bool
+export_rrd_xml(
+  lmtsdb_ref    the_tsdb,
+  int           feature_id
+)
+{
+  time_t        last_update;
+  unsigned int  level = 0, ds;
+  const char    *ds_names[2] = { "in_use", "issued" };
+
+  if ( ! lmtsdb_get_last_update(the_tsdb, feature_id, &last_update) ) {
+    lmlogf(lmlog_level_error, "no feature with id %d in the time-series store", feature_id);
+    return false;
+  }
+  printf(
+      "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+      "<!DOCTYPE rrd SYSTEM \"http://oss.oetiker.ch/rrdtool/rrdtool.dtd\">\n"
+      "<rrd>\n"
+      "\t<version>0003</version>\n"
+      "\t<step>%u</step>\n"
+      "\t<lastupdate>%lld</lastupdate>\n",
+      lmtsdb_level_get_step(lmtsdb_level_5min),
+      (long long int)last_update
+    );
+  for ( ds = 0; ds < 2; ds++ ) {
+    printf(
+        "\t<ds>\n"
+        "\t\t<name> %s </name>\n"
+        "\t\t<type> GAUGE </type>\n"
+        "\t\t<minimal_heartbeat>%u</minimal_heartbeat>\n"
+        "\t\t<min>0.0000000000e+00</min>\n"
+        "\t\t<max>NaN</max>\n"
+        "\t\t<last_ds>U</last_ds>\n"
+        "\t\t<value>0.0000000000e+00</value>\n"
+        "\t\t<unknown_sec> %u </unknown_sec>\n"
+        "\t</ds>\n",
+        ds_names[ds],
+        2 * lmtsdb_level_get_step(lmtsdb_level_5min),
+        (unsigned int)(last_update % lmtsdb_level_get_step(lmtsdb_level_5min))
+      );
+  }
+  while ( level < lmtsdb_level_max ) {
+    export_rows rows;
+    int64_t     last_bucket;
+    unsigned int i;
+
+    rows.width = lmtsdb_level_get_step(level);
+    rows.row_count = lmtsdb_level_get_row_count(level);
+    last_bucket = (int64_t)last_update / rows.width;
+    rows.first_bucket = last_bucket - rows.row_count;
+    rows.in_use = malloc(2 * rows.row_count * sizeof(double));
+    if ( ! rows.in_use ) return false;
+    rows.issued = rows.in_use + rows.row_count;
+    for ( i = 0; i < 2 * rows.row_count; i++ ) rows.in_use[i] = NAN;
+    lmtsdb_fetch(the_tsdb, feature_id, level, (time_t)(rows.first_bucket * rows.width), (time_t)(last_bucket * rows.width - 1), export_rows_iterator, &rows);
+
+    printf(
+        "\t<rra>\n"
+        "\t\t<cf>AVERAGE</cf>\n"
+        "\t\t<pdp_per_row>%u</pdp_per_row>\n"
+        "\t\t<params>\n"
+        "\t\t<xff>5.0000000000e-01</xff>\n"
+        "\t\t</params>\n"
+        "\t\t<cdp_prep>\n",
+        rows.width / lmtsdb_level_get_step(lmtsdb_level_5min)
+      );
+    for ( ds = 0; ds < 2; ds++ ) {
+      printf(
+          "\t\t\t<ds>\n"
+          "\t\t\t<primary_value>NaN</primary_value>\n"
+          "\t\t\t<secondary_value>NaN</secondary_value>\n"
+          "\t\t\t<value>NaN</value>\n"
+          "\t\t\t<unknown_datapoints>%u</unknown_datapoints>\n"
+          "\t\t\t</ds>\n",
+          (unsigned int)((last_update % rows.width) / lmtsdb_level_get_step(lmtsdb_level_5min))
+        );
+    }
+    printf(
+        "\t\t</cdp_prep>\n"
+        "\t\t<database>\n"
+      );
+    for ( i = 0; i < rows.row_count; i++ ) {
+      printf("\t\t\t<!-- %lld --> <row>", (long long int)((rows.first_bucket + i + 1) * rows.width));
+      export_print_value(rows.in_use[i]);
+      export_print_value(rows.issued[i]);
+      printf("</row>\n");
+    }
+    printf(
+        "\t\t</database>\n"
+        "\t</rra>\n"
+      );
+    free((void*)rows.in_use);
+    level++;
+  }
+  printf("</rrd>\n");
+  return true;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+typedef struct {
+  lmtsdb_ref    the_tsdb;
+  unsigned long count;
+  bool          is_okay;
+} import_context;
+
+bool
+import_counts_iterator(
+  const void          *context,
+  int                 feature_id,
+  const char          *vendor,
+  const char          *version,
+  const char          *feature_string,
+  lmdb_int_range_t    in_use,
+  lmdb_int_range_t    issued,
+  time_t              expiration_timestamp,
+  lmdb_time_range_t   check_timestamp
+)
+{
+  import_context      *CONTEXT = (import_context*)context;
+
+  (void)vendor; (void)version; (void)feature_string; (void)expiration_timestamp;
+  if ( ! lmtsdb_update(CONTEXT->the_tsdb, feature_id, check_timestamp.start, in_use.avg, issued.avg) ) {
+    CONTEXT->is_okay = false;
+    return false;
+  }
+  CONTEXT->count++;
+  return true;
+}
+
+//
+
+/*
+ * The database's counts come back in check timestamp order, so each
+ * feature's samples are folded into the store in order; the store skips
+ * those it already holds.
+ */
+bool
+import_counts(
+  lmdb_ref            the_db,
+  lmtsdb_ref          the_tsdb
+)
+{
+  lmdb_usage_report_ref the_report = lmdb_usage_report_create(the_db, lmdb_usage_report_aggregate_none, lmdb_usage_report_range_none, NULL);
+  import_context      context = { .the_tsdb = the_tsdb, .count = 0, .is_okay = true };
+
+  if ( ! the_report ) return false;
+  lmdb_usage_report_iterate(the_report, import_counts_iterator, &context);
+  lmdb_usage_report_release(the_report);
+  if ( context.is_okay ) {
+    context.is_okay = lmtsdb_sync(the_tsdb);
+  } else {
+    lmtsdb_discard(the_tsdb);
+  }
+  if ( context.is_okay ) lmlogf(lmlog_level_info, "imported %lu count(s) into %s", context.count, lmtsdb_get_path(the_tsdb));
+  return context.is_okay;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+int
+main(
+  int           argc,
+  char * const  argv[]
+)
+{
+  lmconfig      *the_conf = lmconfig_update_with_options(NULL, argc, argv);
+  int           rc = 0;
+
+  //
+  // Now update from whatever configuration file we're supposed to be
+  // using:
+  //
+  if ( file_exists(the_conf->base_config_path) ) the_conf = lmconfig_update_with_file(the_conf, the_conf->base_config_path);
+
+  //
+  // Command line arguments also override whatever may have been in a
+  // configure file:
+  //
+  the_conf = lmconfig_update_with_options(the_conf, argc, argv);
+
+  if ( the_conf && the_conf->tsdb_path ) {
+    lmtsdb_ref        the_tsdb = NULL;
+
+    if ( the_conf->should_import_counts ) {
+      //
+      // Only read from the database:
+      //
+      if ( the_conf->license_db_path ) {
+        lmdb_ref      the_database = lmdb_create_read_only_with_options(the_conf->license_db_path, &the_conf->db_options);
+
+        if ( the_database ) {
+          if ( (the_tsdb = lmtsdb_open(the_conf->tsdb_path, false)) ) {
+            if ( ! import_counts(the_database, the_tsdb) ) rc = EIO;
+          } else {
+            rc = EIO;
+          }
+          lmdb_release(the_database);
+        } else {
+          rc = ENOENT;
+        }
+      } else {
+        lmlog(lmlog_level_error, "No license database configured");
+        rc = EINVAL;
+      }
+    } else if ( ! (the_tsdb = lmtsdb_open(the_conf->tsdb_path, true)) ) {
+      rc = ENOENT;
+    }
+    if ( the_tsdb ) {
+      if ( the_conf->export_feature_id != lmfeature_no_id ) {
+        if ( ! export_rrd_xml(the_tsdb, the_conf->export_feature_id) ) rc = ENOENT;
+      } else if ( the_conf->should_list_features || ! the_conf->should_import_counts ) {
+        lmtsdb_iterate_features(the_tsdb, list_features_iterator, NULL);
+      }
+      lmtsdb_close(the_tsdb);
+    }
+  } else {
+    lmlog(lmlog_level_error, "No time-series store configured");
+    rc = EINVAL;
+  }
+  if ( the_conf ) lmconfig_dealloc(the_conf);
+  return rc;
+}
@@ -0,0 +1,243 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmdb_batch_test.c
+ *
+ * Regression tests for batches of commits.
+ *
+ */
+
+#include "lmdb.h"
+
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//
+
+#define TEST_LOG_PATH     "/var/log/test.dlog"
+#define TEST_START        ((time_t)1700000000)
+
+typedef struct {
+  const char    *dir;
+  char          path[1024];
+  lmdb_ref      the_db;
+  sqlite3       *db_handle;
+  lmfeature_ref alpha, beta;
+  unsigned int  failures;
+} batch_test;
+
+//
+
+void
+batch_test_fail(
+  batch_test    *the_test,
+  const char    *what
+)
+{
+  fprintf(stderr, "FAIL: %s\n", what);
+  the_test->failures++;
+}
+
+//
+
+/*
+ * The single integer produced by sql, or -1 on error.
+ */
+long long int
+batch_test_query(
+  batch_test    *the_test,
+  const char    *sql
+)
+{
+  sqlite3_stmt  *stmt = NULL;
+  long long int value = -1;
+
+  if ( sqlite3_prepare_v2(the_test->db_handle, sql, -1, &stmt, NULL) == SQLITE_OK ) {
+    if ( sqlite3_step(stmt) == SQLITE_ROW ) value = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+  if ( value < 0 ) fprintf(stderr, "query failed: %s: %s\n", sql, sqlite3_errmsg(the_test->db_handle));
+  return value;
+}
+
+//
+
+/*
+ * The in_use count of the open run of the_feature.
+ */
+long long int
+batch_test_open_run_in_use(
+  batch_test    *the_test,
+  lmfeature_ref the_feature
+)
+{
+  char          sql[256];
+
+  snprintf(sql, sizeof(sql), "SELECT in_use FROM count_runs WHERE feature_id = %d AND last_check_id IS NULL", lmfeature_get_feature_id(the_feature));
+  return batch_test_query(the_test, sql);
+}
+
+//
+
+bool
+batch_test_set_checkpoint(
+  batch_test    *the_test,
+  off_t         offset
+)
+{
+  lmdb_log_checkpoint_t checkpoint = { .device = 1, .inode = 2, .offset = offset, .event_timestamp = TEST_START };
+
+  return lmdb_set_log_checkpoint(the_test->the_db, TEST_LOG_PATH, &checkpoint);
+}
+
+//
+
+off_t
+batch_test_get_checkpoint(
+  batch_test    *the_test
+)
+{
+  lmdb_log_checkpoint_t checkpoint;
+
+  if ( ! lmdb_get_log_checkpoint(the_test->the_db, TEST_LOG_PATH, &checkpoint) ) return -1;
+  return checkpoint.offset;
+}
+
+//
+
+bool
+batch_test_setup(
+  batch_test    *the_test
+)
+{
+  snprintf(the_test->path, sizeof(the_test->path), "%s/test.sqlite3db", the_test->dir);
+  if ( ! (the_test->the_db = lmdb_create(the_test->path)) || ! lmdb_enable_log_ingest(the_test->the_db) ) {
+    batch_test_fail(the_test, "unable to create database");
+    return false;
+  }
+  if ( sqlite3_open(the_test->path, &the_test->db_handle) != SQLITE_OK ) {
+    batch_test_fail(the_test, "unable to open database");
+    return false;
+  }
+  the_test->alpha = lmdb_get_feature_by_vendor(the_test->the_db, "alpha", "vendor");
+  the_test->beta = lmdb_get_feature_by_vendor(the_test->the_db, "beta", "vendor");
+  if ( ! the_test->alpha || ! the_test->beta ) {
+    batch_test_fail(the_test, "unable to add features");
+    return false;
+  }
+  lmfeature_set_in_use(the_test->alpha, 1);
+  lmfeature_set_in_use(the_test->beta, 1);
+  if ( ! lmdb_commit_counts(the_test->the_db, TEST_START) || ! batch_test_set_checkpoint(the_test, 100) ) {
+    batch_test_fail(the_test, "unable to commit initial counts");
+    return false;
+  }
+  return true;
+}
+
+//
+
+/*
+ * A commit that fails part-way through a batch must take the whole batch
+ * with it:  neither the counts committed earlier in the batch nor the log
+ * checkpoint written after it may reach the database, and the features
+ * whose counts were lost must be written by the next commit.
+ */
+void
+batch_test_failed_write(
+  batch_test    *the_test
+)
+{
+  if ( sqlite3_exec(the_test->db_handle, "CREATE TRIGGER test_fail_run BEFORE INSERT ON count_runs WHEN NEW.in_use = 99 BEGIN SELECT RAISE(ABORT, 'forced failure'); END", NULL, NULL, NULL) != SQLITE_OK ) {
+    batch_test_fail(the_test, "unable to create trigger");
+    return;
+  }
+  if ( ! lmdb_begin_batch(the_test->the_db) ) {
+    batch_test_fail(the_test, "unable to begin batch");
+    return;
+  }
+  lmfeature_set_in_use(the_test->alpha, 2);
+  lmfeature_set_in_use(the_test->beta, 2);
+  if ( ! lmdb_commit_counts(the_test->the_db, TEST_START + 60) ) batch_test_fail(the_test, "first commit in batch failed");
+  if ( ! batch_test_set_checkpoint(the_test, 200) ) batch_test_fail(the_test, "first checkpoint in batch failed");
+  lmfeature_set_in_use(the_test->alpha, 99);
+  if ( lmdb_commit_counts(the_test->the_db, TEST_START + 120) ) batch_test_fail(the_test, "failing commit in batch succeeded");
+  batch_test_set_checkpoint(the_test, 300);
+  if ( lmdb_end_batch(the_test->the_db, true) ) batch_test_fail(the_test, "batch with a failed commit was committed");
+
+  if ( batch_test_query(the_test, "SELECT COUNT(*) FROM checks") != 1 ) batch_test_fail(the_test, "checks from the failed batch were committed");
+  if ( batch_test_query(the_test, "SELECT COUNT(*) FROM count_runs WHERE in_use <> 1") != 0 ) batch_test_fail(the_test, "counts from the failed batch were committed");
+  if ( batch_test_get_checkpoint(the_test) != 100 ) batch_test_fail(the_test, "checkpoint from the failed batch was committed");
+
+  if ( sqlite3_exec(the_test->db_handle, "DROP TRIGGER test_fail_run", NULL, NULL, NULL) != SQLITE_OK ) {
+    batch_test_fail(the_test, "unable to drop trigger");
+    return;
+  }
+  lmfeature_set_in_use(the_test->alpha, 3);
+  if ( ! lmdb_commit_counts(the_test->the_db, TEST_START + 180) ) {
+    batch_test_fail(the_test, "commit after the failed batch failed");
+    return;
+  }
+  if ( batch_test_open_run_in_use(the_test, the_test->alpha) != 3 ) batch_test_fail(the_test, "count after the failed batch was not committed");
+  if ( batch_test_open_run_in_use(the_test, the_test->beta) != 2 ) batch_test_fail(the_test, "count lost with the failed batch was not written again");
+}
+
+//
+
+/*
+ * A batch whose commits all succeed is committed with its checkpoint.
+ */
+void
+batch_test_successful_batch(
+  batch_test    *the_test
+)
+{
+  if ( ! lmdb_begin_batch(the_test->the_db) ) {
+    batch_test_fail(the_test, "unable to begin batch");
+    return;
+  }
+  lmfeature_set_in_use(the_test->alpha, 4);
+  lmfeature_set_in_use(the_test->beta, 2);
+  if ( ! lmdb_commit_counts(the_test->the_db, TEST_START + 240) ) batch_test_fail(the_test, "first commit in batch failed");
+  lmfeature_set_in_use(the_test->alpha, 4);
+  lmfeature_set_in_use(the_test->beta, 4);
+  if ( ! lmdb_commit_counts(the_test->the_db, TEST_START + 300) ) batch_test_fail(the_test, "second commit in batch failed");
+  if ( ! batch_test_set_checkpoint(the_test, 400) ) batch_test_fail(the_test, "checkpoint in batch failed");
+  if ( ! lmdb_end_batch(the_test->the_db, true) ) batch_test_fail(the_test, "batch was not committed");
+
+  if ( batch_test_query(the_test, "SELECT COUNT(*) FROM checks") != 4 ) batch_test_fail(the_test, "checks from the batch were not committed");
+  if ( batch_test_open_run_in_use(the_test, the_test->alpha) != 4 ) batch_test_fail(the_test, "first count in batch was not committed");
+  if ( batch_test_open_run_in_use(the_test, the_test->beta) != 4 ) batch_test_fail(the_test, "second count in batch was not committed");
+  if ( batch_test_get_checkpoint(the_test) != 400 ) batch_test_fail(the_test, "checkpoint from the batch was not committed");
+}
+
+//
+
+int
+main()
+{
+  char          dir[] = "/tmp/lmdb_batch_test.XXXXXX";
+  batch_test    the_test;
+
+  memset(&the_test, 0, sizeof(the_test));
+  if ( ! mkdtemp(dir) ) {
+    perror("mkdtemp");
+    return 1;
+  }
+  the_test.dir = dir;
+  if ( batch_test_setup(&the_test) ) {
+    batch_test_failed_write(&the_test);
+    batch_test_successful_batch(&the_test);
+  }
+  if ( the_test.db_handle ) sqlite3_close(the_test.db_handle);
+  if ( the_test.the_db ) lmdb_release(the_test.the_db);
+  unlink(the_test.path);
+  rmdir(dir);
+  if ( the_test.failures ) {
+    fprintf(stderr, "%u failure(s)\n", the_test.failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
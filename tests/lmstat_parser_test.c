@@ -0,0 +1,152 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmstat_parser_test.c
+ *
+ * Regression tests for the lmstat output parser.
+ *
+ */
+
+#include "lmstat_parser.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//
+
+typedef struct {
+  unsigned int  vendor_count, user_count, failures;
+  const char    *feature, *vendor, *version;
+} parser_test;
+
+//
+
+bool
+parser_test_check_field(
+  parser_test   *the_test,
+  const char    *what,
+  lmstat_field  f,
+  const char    *expected
+)
+{
+  if ( ! lmstat_field_is_equal(f, expected) ) {
+    fprintf(stderr, "FAIL: %s is \"%.*s\", expected \"%s\"\n", what, (int)f.len, (f.ptr ? f.ptr : ""), expected);
+    the_test->failures++;
+    return false;
+  }
+  return true;
+}
+
+//
+
+bool
+parser_test_vendor(
+  void                        *context,
+  const lmstat_vendor_record  *record
+)
+{
+  parser_test                 *the_test = (parser_test*)context;
+
+  the_test->vendor_count++;
+  parser_test_check_field(the_test, "vendor record feature", record->feature, the_test->feature);
+  parser_test_check_field(the_test, "vendor record vendor", record->vendor, the_test->vendor);
+  parser_test_check_field(the_test, "vendor record version", record->version, the_test->version);
+  return true;
+}
+
+//
+
+bool
+parser_test_user(
+  void                        *context,
+  const lmstat_user_record    *record
+)
+{
+  parser_test                 *the_test = (parser_test*)context;
+
+  the_test->user_count++;
+  parser_test_check_field(the_test, "user record feature", record->feature, the_test->feature);
+  parser_test_check_field(the_test, "user record vendor", record->vendor, the_test->vendor);
+  parser_test_check_field(the_test, "user record version", record->version, the_test->version);
+  parser_test_check_field(the_test, "user record user", record->user, "alice");
+  return true;
+}
+
+//
+
+bool
+parser_test_push(
+  lmstat_parser_ref the_parser,
+  const char        *line
+)
+{
+  return lmstat_parser_push_line(the_parser, line, strlen(line));
+}
+
+//
+
+/*
+ * The parser keeps the feature, vendor, and version names of the current
+ * vendor line in one buffer, and the feature is already in that buffer
+ * when the vendor line arrives.  Names long enough to grow the buffer at
+ * that point must still come through intact.
+ */
+unsigned int
+test_long_names(void)
+{
+  lmstat_parser_callbacks callbacks = { .usage = NULL, .vendor = parser_test_vendor, .user = parser_test_user };
+  parser_test             the_test = {
+                              .vendor_count = 0, .user_count = 0, .failures = 0,
+                              .feature = "Distrib_Computing_Toolbox_Long_Feature_Name_0123456789",
+                              .vendor = "a_vendor_daemon_with_a_rather_long_name",
+                              .version = "2024.0123456789.0123456789.0123456789"
+                            };
+  lmstat_parser_ref       the_parser = lmstat_parser_create(&callbacks, &the_test);
+  char                    line[256];
+  int                     pass;
+
+  if ( ! the_parser ) {
+    fprintf(stderr, "FAIL: unable to create parser\n");
+    return 1;
+  }
+  //
+  // A second pass starts from the grown buffer:
+  //
+  for ( pass = 0; pass < 2; pass++ ) {
+    snprintf(line, sizeof(line), "Users of %s:  (Total of 10 licenses issued;  Total of 1 license in use)", the_test.feature);
+    parser_test_push(the_parser, line);
+    parser_test_push(the_parser, "");
+    snprintf(line, sizeof(line), "  \"%s\" v%s, vendor: %s, expiry: 01-jan-2030", the_test.feature, the_test.version, the_test.vendor);
+    parser_test_push(the_parser, line);
+    parser_test_push(the_parser, "  floating license");
+    parser_test_push(the_parser, "");
+    snprintf(line, sizeof(line), "    alice host1 /dev/tty (v%s) (host1/27000 101), start Mon 1/2 9:00", the_test.version);
+    parser_test_push(the_parser, line);
+    parser_test_push(the_parser, "");
+  }
+  lmstat_parser_release(the_parser);
+  if ( the_test.vendor_count != 2 ) {
+    fprintf(stderr, "FAIL: saw %u vendor record(s), expected 2\n", the_test.vendor_count);
+    the_test.failures++;
+  }
+  if ( the_test.user_count != 2 ) {
+    fprintf(stderr, "FAIL: saw %u user record(s), expected 2\n", the_test.user_count);
+    the_test.failures++;
+  }
+  return the_test.failures;
+}
+
+//
+
+int
+main()
+{
+  unsigned int  failures = 0;
+
+  failures += test_long_names();
+  if ( failures ) {
+    fprintf(stderr, "%u failure(s)\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
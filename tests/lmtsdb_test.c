@@ -0,0 +1,314 @@
+/*
+ * lmdb - Simple database to count FLEXlm licenses/features
+ * lmtsdb_test.c
+ *
+ * Regression tests for the time-series store.
+ *
+ */
+
+#include "lmtsdb.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+//
+
+#define TEST_FEATURE_ID   7
+#define TEST_STEP         300
+#define TEST_START        ((time_t)1700000100)
+
+typedef struct {
+  time_t        timestamp;
+  double        in_use, issued;
+} test_point;
+
+typedef struct {
+  unsigned int  count, capacity;
+  test_point    *points;
+} test_dump;
+
+//
+
+bool
+test_dump_iterator(
+  const void    *context,
+  time_t        timestamp,
+  double        in_use,
+  double        issued
+)
+{
+  test_dump     *the_dump = (test_dump*)context;
+
+  if ( the_dump->count == the_dump->capacity ) {
+    unsigned int  new_capacity = the_dump->capacity ? 2 * the_dump->capacity : 1024;
+    test_point    *new_points = realloc(the_dump->points, new_capacity * sizeof(test_point));
+
+    if ( ! new_points ) return false;
+    the_dump->points = new_points;
+    the_dump->capacity = new_capacity;
+  }
+  the_dump->points[the_dump->count].timestamp = timestamp;
+  the_dump->points[the_dump->count].in_use = in_use;
+  the_dump->points[the_dump->count].issued = issued;
+  the_dump->count++;
+  return true;
+}
+
+//
+
+/*
+ * Every retained point of the test feature, all levels in turn.
+ */
+bool
+test_dump_fill(
+  lmtsdb_ref    the_tsdb,
+  test_dump     *the_dump
+)
+{
+  unsigned int  level = 0;
+
+  the_dump->count = 0;
+  while ( level < lmtsdb_level_max ) {
+    if ( ! lmtsdb_fetch(the_tsdb, TEST_FEATURE_ID, level, -1, TEST_START + (time_t)100 * 365 * 24 * 3600, test_dump_iterator, the_dump) ) return false;
+    level++;
+  }
+  return true;
+}
+
+//
+
+static inline bool
+test_value_is_equal(
+  double        v1,
+  double        v2
+)
+{
+  return ( isnan(v1) ? isnan(v2) : (v1 == v2) );
+}
+
+//
+
+unsigned int
+test_dump_compare(
+  const char    *what,
+  lmtsdb_ref    the_tsdb,
+  test_dump     *expected
+)
+{
+  test_dump     actual = { .count = 0, .capacity = 0, .points = NULL };
+  unsigned int  i = 0, failures = 0;
+
+  if ( ! test_dump_fill(the_tsdb, &actual) ) {
+    fprintf(stderr, "FAIL: %s: unable to fetch points\n", what);
+    failures++;
+  } else if ( actual.count != expected->count ) {
+    fprintf(stderr, "FAIL: %s: %u point(s), expected %u\n", what, actual.count, expected->count);
+    failures++;
+  } else {
+    while ( i < actual.count ) {
+      if ( (actual.points[i].timestamp != expected->points[i].timestamp) || ! test_value_is_equal(actual.points[i].in_use, expected->points[i].in_use) || ! test_value_is_equal(actual.points[i].issued, expected->points[i].issued) ) {
+        fprintf(stderr, "FAIL: %s: point %u is (%lld, %g, %g), expected (%lld, %g, %g)\n",
+            what, i,
+            (long long int)actual.points[i].timestamp, actual.points[i].in_use, actual.points[i].issued,
+            (long long int)expected->points[i].timestamp, expected->points[i].in_use, expected->points[i].issued
+          );
+        failures++;
+        break;
+      }
+      i++;
+    }
+  }
+  if ( actual.points ) free((void*)actual.points);
+  return failures;
+}
+
+//
+
+unsigned int
+test_reader_compare(
+  const char    *what,
+  const char    *path,
+  test_dump     *expected
+)
+{
+  lmtsdb_ref    reader = lmtsdb_open(path, true);
+  unsigned int  failures;
+
+  if ( ! reader ) {
+    fprintf(stderr, "FAIL: %s: unable to open %s read-only\n", what, path);
+    return 1;
+  }
+  failures = test_dump_compare(what, reader, expected);
+  lmtsdb_close(reader);
+  return failures;
+}
+
+//
+
+/*
+ * Samples that are never synchronized:  one more in the interval in
+ * progress, one in the next interval, and one after a gap.  Each writes
+ * cells that the synchronized points are read from.
+ */
+bool
+test_stage_samples(
+  lmtsdb_ref    the_tsdb,
+  time_t        last_update
+)
+{
+  return lmtsdb_update(the_tsdb, TEST_FEATURE_ID, last_update + 60, 1000.0, 2000.0) &&
+         lmtsdb_update(the_tsdb, TEST_FEATURE_ID, last_update + TEST_STEP, 1001.0, 2001.0) &&
+         lmtsdb_update(the_tsdb, TEST_FEATURE_ID, last_update + 40 * TEST_STEP, 1002.0, 2002.0);
+}
+
+//
+
+bool
+test_add_samples(
+  lmtsdb_ref    the_tsdb,
+  time_t        from,
+  unsigned int  count
+)
+{
+  unsigned int  i = 0;
+
+  while ( i < count ) {
+    if ( ! lmtsdb_update(the_tsdb, TEST_FEATURE_ID, from + i * TEST_STEP, (double)(i % 17), (double)(20 + i % 5)) ) return false;
+    i++;
+  }
+  return true;
+}
+
+//
+
+/*
+ * Staged updates must not show through the synchronized points:  not to
+ * a reader while they are pending, not after they are discarded, and not
+ * after the writer dies without synchronizing them.  The reference store
+ * only ever sees the synchronized samples.
+ */
+unsigned int
+test_staged_updates(
+  const char    *dir
+)
+{
+  char          path[1024], ref_path[1024];
+  lmtsdb_ref    the_tsdb = NULL, ref_tsdb = NULL;
+  test_dump     expected = { .count = 0, .capacity = 0, .points = NULL };
+  unsigned int  history = lmtsdb_level_get_row_count(lmtsdb_level_5min) + 20;
+  time_t        last_update = TEST_START + (history - 1) * TEST_STEP;
+  unsigned int  failures = 0;
+  pid_t         child;
+  int           child_status;
+
+  snprintf(path, sizeof(path), "%s/test.tsdb", dir);
+  snprintf(ref_path, sizeof(ref_path), "%s/reference.tsdb", dir);
+  if ( ! (the_tsdb = lmtsdb_open(path, false)) || ! (ref_tsdb = lmtsdb_open(ref_path, false)) ) {
+    fprintf(stderr, "FAIL: unable to create stores in %s\n", dir);
+    failures++;
+    goto exit_on_error;
+  }
+
+  //
+  // More history than the finest level holds, so that every row of its
+  // ring is in use:
+  //
+  if ( ! test_add_samples(the_tsdb, TEST_START, history) || ! lmtsdb_sync(the_tsdb) || ! test_add_samples(ref_tsdb, TEST_START, history) || ! lmtsdb_sync(ref_tsdb) ) {
+    fprintf(stderr, "FAIL: unable to fill stores\n");
+    failures++;
+    goto exit_on_error;
+  }
+  if ( ! test_dump_fill(ref_tsdb, &expected) ) {
+    fprintf(stderr, "FAIL: unable to fetch reference points\n");
+    failures++;
+    goto exit_on_error;
+  }
+  failures += test_dump_compare("after sync", the_tsdb, &expected);
+
+  // Pending, then discarded:
+  if ( ! test_stage_samples(the_tsdb, last_update) ) {
+    fprintf(stderr, "FAIL: unable to stage samples\n");
+    failures++;
+    goto exit_on_error;
+  }
+  failures += test_reader_compare("reader with updates pending", path, &expected);
+  lmtsdb_discard(the_tsdb);
+  failures += test_dump_compare("writer after discard", the_tsdb, &expected);
+  failures += test_reader_compare("reader after discard", path, &expected);
+
+  //
+  // Pending when the writer dies:  a child process stages the samples
+  // and exits without closing the store.
+  //
+  lmtsdb_close(the_tsdb);
+  the_tsdb = NULL;
+  if ( (child = fork()) == 0 ) {
+    lmtsdb_ref  crashing_tsdb = lmtsdb_open(path, false);
+
+    _exit( (crashing_tsdb && test_stage_samples(crashing_tsdb, last_update)) ? 0 : 1 );
+  }
+  if ( (child < 0) || (waitpid(child, &child_status, 0) != child) || ! WIFEXITED(child_status) || WEXITSTATUS(child_status) ) {
+    fprintf(stderr, "FAIL: unable to stage samples in a child process\n");
+    failures++;
+    goto exit_on_error;
+  }
+  failures += test_reader_compare("reader after writer died", path, &expected);
+  if ( ! (the_tsdb = lmtsdb_open(path, false)) ) {
+    fprintf(stderr, "FAIL: unable to reopen %s\n", path);
+    failures++;
+    goto exit_on_error;
+  }
+  failures += test_dump_compare("writer after reopen", the_tsdb, &expected);
+  failures += test_reader_compare("reader after reopen", path, &expected);
+
+  //
+  // Both stores take the same samples from here on, and should agree
+  // once they are synchronized:
+  //
+  if ( ! test_add_samples(the_tsdb, last_update + 3 * TEST_STEP, 30) || ! lmtsdb_sync(the_tsdb) || ! test_add_samples(ref_tsdb, last_update + 3 * TEST_STEP, 30) || ! lmtsdb_sync(ref_tsdb) ) {
+    fprintf(stderr, "FAIL: unable to extend stores\n");
+    failures++;
+    goto exit_on_error;
+  }
+  if ( ! test_dump_fill(ref_tsdb, &expected) ) {
+    fprintf(stderr, "FAIL: unable to fetch reference points\n");
+    failures++;
+    goto exit_on_error;
+  }
+  failures += test_dump_compare("writer after further updates", the_tsdb, &expected);
+  failures += test_reader_compare("reader after further updates", path, &expected);
+
+exit_on_error:
+  if ( the_tsdb ) lmtsdb_close(the_tsdb);
+  if ( ref_tsdb ) lmtsdb_close(ref_tsdb);
+  if ( expected.points ) free((void*)expected.points);
+  unlink(path);
+  unlink(ref_path);
+  return failures;
+}
+
+//
+
+int
+main()
+{
+  char          dir[] = "/tmp/lmtsdb_test.XXXXXX";
+  unsigned int  failures = 0;
+
+  if ( ! mkdtemp(dir) ) {
+    perror("mkdtemp");
+    return 1;
+  }
+  failures += test_staged_updates(dir);
+  rmdir(dir);
+  if ( failures ) {
+    fprintf(stderr, "%u failure(s)\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}